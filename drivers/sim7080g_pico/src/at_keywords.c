@@ -0,0 +1,102 @@
+#include <string.h>
+
+#include "at_keywords.h"
+
+#define AT_KEY_SLOTS 32
+
+struct _keyword_s {
+	const char *string;
+	uint8_t length;
+	bool urc;
+};
+
+#define KEYWORD(s, is_urc) { s, sizeof s - 1, is_urc }
+
+static const struct _keyword_s _keywords[AT_KEYS_NUM] = {
+	[AT_KEY_NONE]       = KEYWORD("", false),
+	[AT_KEY_OK]         = KEYWORD("OK", false),
+	[AT_KEY_ERROR]      = KEYWORD("ERROR", false),
+	[AT_KEY_PROMPT]     = KEYWORD("> ", false),
+	[AT_KEY_CME_ERROR]  = KEYWORD("+CME ERROR", false),
+	[AT_KEY_POWER_DOWN] = KEYWORD("NORMAL POWER DOWN", false),
+	[AT_KEY_RDY]        = KEYWORD("RDY", true),
+	[AT_KEY_SMS_READY]  = KEYWORD("SMS Ready", true),
+	[AT_KEY_APP_PDP]    = KEYWORD("+APP PDP", true),
+	[AT_KEY_CAACK]      = KEYWORD("+CAACK", false),
+	[AT_KEY_CADATAIND]  = KEYWORD("+CADATAIND", true),
+	[AT_KEY_CAOPEN]     = KEYWORD("+CAOPEN", false),
+	[AT_KEY_CARECV]     = KEYWORD("+CARECV", false),
+	[AT_KEY_CASTATE]    = KEYWORD("+CASTATE", true),
+	[AT_KEY_CAURC]      = KEYWORD("+CAURC", true),
+	[AT_KEY_CEDRXS]     = KEYWORD("+CEDRXS", false),
+	[AT_KEY_CFUN]       = KEYWORD("+CFUN", true),
+	[AT_KEY_CNACT]      = KEYWORD("+CNACT", false),
+	[AT_KEY_COPS]       = KEYWORD("+COPS", false),
+	[AT_KEY_CPIN]       = KEYWORD("+CPIN", true),
+	[AT_KEY_CPSMS]      = KEYWORD("+CPSMS", false),
+	[AT_KEY_IPR]        = KEYWORD("+IPR", false),
+};
+
+// Perfect hash, gperf style:
+//   slot = (length + _asso[3rd byte] + _asso[last byte]) % AT_KEY_SLOTS
+// with the 3rd byte taken as 0 for keywords of two bytes. The values
+// were searched for so that no two keywords share a slot. Adding a
+// keyword means searching again: tools/at_keywords_hash prints both
+// tables to paste over these, and sim_bench checks them.
+static const uint8_t _asso[128] = {
+	[' '] = 27, ['A'] = 27, ['C'] = 15, ['E'] = 22, ['F'] = 1,
+	['M'] = 13, ['N'] = 26, ['O'] = 4,  ['P'] = 21, ['R'] = 31,
+	['S'] = 17, ['T'] = 15, ['V'] = 4,  ['Y'] = 8,  ['y'] = 4,
+};
+
+static const uint8_t _slots[AT_KEY_SLOTS] = {
+	[0]  = AT_KEY_CFUN,
+	[1]  = AT_KEY_CAACK,
+	[2]  = AT_KEY_OK,
+	[3]  = AT_KEY_ERROR,
+	[5]  = AT_KEY_CADATAIND,
+	[6]  = AT_KEY_CARECV,
+	[10] = AT_KEY_POWER_DOWN,
+	[12] = AT_KEY_CPSMS,
+	[14] = AT_KEY_CEDRXS,
+	[15] = AT_KEY_CNACT,
+	[16] = AT_KEY_CAURC,
+	[18] = AT_KEY_APP_PDP,
+	[19] = AT_KEY_RDY,
+	[20] = AT_KEY_CPIN,
+	[22] = AT_KEY_CME_ERROR,
+	[24] = AT_KEY_IPR,
+	[25] = AT_KEY_CASTATE,
+	[26] = AT_KEY_COPS,
+	[28] = AT_KEY_CAOPEN,
+	[29] = AT_KEY_PROMPT,
+	[30] = AT_KEY_SMS_READY,
+};
+
+AT_KEY at_key_lookup(const uint8_t *keyword, size_t keyword_len) {
+	if (keyword_len < 2) return AT_KEY_NONE;
+
+	uint8_t third = keyword_len > 2 ? keyword[2] : 0;
+	uint8_t last = keyword[keyword_len - 1];
+	if (third >= 128 || last >= 128) return AT_KEY_NONE;
+
+	// Empty slots hold AT_KEY_NONE, whose length never matches
+	uint32_t slot = (keyword_len + _asso[third] + _asso[last]) % AT_KEY_SLOTS;
+	const struct _keyword_s *candidate = &_keywords[_slots[slot]];
+	if (candidate->length != keyword_len || memcmp(keyword, candidate->string, keyword_len))
+		return AT_KEY_NONE;
+
+	return _slots[slot];
+}
+
+const char *at_key_string(AT_KEY key) {
+	return key < AT_KEYS_NUM ? _keywords[key].string : "";
+}
+
+size_t at_key_length(AT_KEY key) {
+	return key < AT_KEYS_NUM ? _keywords[key].length : 0;
+}
+
+bool at_key_is_urc(AT_KEY key) {
+	return key < AT_KEYS_NUM && _keywords[key].urc;
+}
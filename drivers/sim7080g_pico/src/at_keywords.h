@@ -0,0 +1,57 @@
+#ifndef WISDOM_MODEM_AT_KEYWORDS_H
+#define WISDOM_MODEM_AT_KEYWORDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Keywords the modem starts its lines with
+//
+// A line's keyword is everything before its first ':', or the whole line
+// if it has none: "+CASTATE: 0,1" is AT_KEY_CASTATE, "OK" is AT_KEY_OK.
+// The response parser looks each line's keyword up once as it arrives,
+// everything after that compares AT_KEYs.
+
+typedef enum at_key_e {
+	AT_KEY_NONE,       // Not a keyword, or no line at all
+	AT_KEY_OK,
+	AT_KEY_ERROR,
+	AT_KEY_PROMPT,     // "> ", modem is waiting for CASEND data
+	AT_KEY_CME_ERROR,
+	AT_KEY_POWER_DOWN, // NORMAL POWER DOWN
+	AT_KEY_RDY,
+	AT_KEY_SMS_READY,
+	AT_KEY_APP_PDP,
+	AT_KEY_CAACK,
+	AT_KEY_CADATAIND,
+	AT_KEY_CAOPEN,
+	AT_KEY_CARECV,
+	AT_KEY_CASTATE,
+	AT_KEY_CAURC,
+	AT_KEY_CEDRXS,
+	AT_KEY_CFUN,
+	AT_KEY_CNACT,
+	AT_KEY_COPS,
+	AT_KEY_CPIN,
+	AT_KEY_CPSMS,
+	AT_KEY_IPR,
+	AT_KEYS_NUM
+} AT_KEY;
+
+// Keyword [keyword_len] bytes long at [keyword]
+//
+// return: AT_KEY_NONE if it isn't one
+//
+// O(1): a perfect hash over the keywords and one compare
+AT_KEY at_key_lookup(const uint8_t *keyword, size_t keyword_len);
+
+// return: [key] as the modem sends it, "" for AT_KEY_NONE
+const char *at_key_string(AT_KEY key);
+
+// return: bytes in at_key_string([key])
+size_t at_key_length(AT_KEY key);
+
+// return: true if the modem sends lines with [key] on its own
+bool at_key_is_urc(AT_KEY key);
+
+#endif // WISDOM_MODEM_AT_KEYWORDS_H
@@ -1,6 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
+
 #include "command_buffer.h"
 
+static uint32_t _cb_room(CommandBuffer *cb);
 
 CommandBuffer *cb_create() {
 	CommandBuffer *cb = malloc((sizeof *cb));
@@ -18,12 +21,11 @@ void cb_destroy(CommandBuffer *cb) {
 }
 
 uint32_t cb_write(CommandBuffer *cb, uint8_t *src, uint32_t src_len) {
-	uint32_t written;
-	for (written = 0; written < src_len ; written++) {
-		if (cb_full(cb)) break;
+	uint32_t room = _cb_room(cb);
+	uint32_t written = src_len < room ? src_len : room;
 
-		*cb->index++ = src[written];
-	}
+	memcpy(cb->index, src, written);
+	cb->index += written;
 
 	// Always leave a return character at end
 	// which will be overwritten if the buffer is appended
@@ -38,8 +40,6 @@ uint32_t cb_length(CommandBuffer *cb) {
 }
 
 bool cb_full(CommandBuffer *cb) {
-	uint32_t buf_len = cb_length(cb);
-
 	if (cb->at_prefix) 
 		return cb_length(cb) >= COMMAND_BUFFER_MAX + 2;
 
@@ -65,7 +65,56 @@ CommandBuffer *cb_reset(CommandBuffer *cb) {
 bool cb_at_prefix_set(CommandBuffer *cb) {
 	if (!cb_empty(cb)) return false;
 
-	cb_write(cb, "AT", 2);
+	cb_write_literal(cb, "AT");
 
 	cb->at_prefix = true;
+
+	return true;
+}
+
+CommandBuffer *cb_copy(CommandBuffer *dst, CommandBuffer *src) {
+	uint32_t length = cb_length(src);
+	for (uint32_t i = 0; i < length; i++)
+		dst->buffer[i] = src->buffer[i];
+
+	dst->index = dst->buffer + (src->index - src->buffer);
+	dst->at_prefix = src->at_prefix;
+
+	return dst;
+}
+
+uint32_t cb_write_uint(CommandBuffer *cb, uint32_t value) {
+	uint8_t digits[10];
+	uint32_t first = sizeof digits;
+
+	// Least significant first, from the back
+	do {
+		digits[--first] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	return cb_write(cb, &digits[first], sizeof digits - first);
+}
+
+uint32_t cb_write_str(CommandBuffer *cb, const char *str) {
+	return cb_write(cb, (uint8_t *)str, strlen(str));
+}
+
+uint32_t cb_write_quoted(CommandBuffer *cb, const char *str, uint32_t str_len) {
+	// A quote left open would swallow the rest of the command
+	if (str_len + 2 > _cb_room(cb)) return 0;
+
+	cb_write_literal(cb, "\"");
+	cb_write(cb, (uint8_t *)str, str_len);
+	cb_write_literal(cb, "\"");
+
+	return str_len + 2;
+}
+
+// Bytes that can still be appended
+static uint32_t _cb_room(CommandBuffer *cb) {
+	uint32_t limit = cb->at_prefix ? COMMAND_BUFFER_MAX + 2 : COMMAND_BUFFER_MAX;
+	uint32_t length = cb_length(cb);
+
+	return length < limit ? limit - length : 0;
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #define COMMAND_BUFFER_MAX 559 // per SIM7080_Series_AT_Command_Manual_V1.02.pdf
 							   //
@@ -25,4 +26,47 @@ uint8_t *cb_get_buffer(CommandBuffer *cb);
 CommandBuffer *cb_reset(CommandBuffer *cb);
 bool cb_at_prefix_set(CommandBuffer *cb);
 
+// Copies [src] into [dst], index included
+CommandBuffer *cb_copy(CommandBuffer *dst, CommandBuffer *src);
+
+// Command building without a formatter
+// Appends return bytes written, fewer if the buffer filled up.
+
+// Starts [cb] over as "AT" followed by string literal [literal], e.g.
+// cb_command(cb, "+CAACK=0"). The whole prefix is one constant copied in
+// at once, its length known at compile time.
+#define cb_command(cb, literal) \
+	cb_command_set((cb), (const uint8_t *)("AT" literal), sizeof("AT" literal) - 1)
+
+// Appends string literal [literal]
+#define cb_write_literal(cb, literal) \
+	cb_write((cb), (uint8_t *)("" literal), sizeof(literal) - 1)
+
+// Starts [cb] over as the [command_len] bytes of [command], AT included
+//
+// Inline so a literal's copy is a few stores rather than a memcpy call.
+//
+// return: [cb]
+static inline CommandBuffer *cb_command_set(CommandBuffer *cb, const uint8_t *command, uint32_t command_len) {
+	if (command_len > COMMAND_BUFFER_MAX + 1)
+		command_len = COMMAND_BUFFER_MAX + 1;
+
+	memcpy(cb->buffer, command, command_len);
+	cb->index = cb->buffer + command_len;
+	*cb->index = '\r';
+	cb->at_prefix = true;
+
+	return cb;
+}
+
+// Appends [value] in decimal
+uint32_t cb_write_uint(CommandBuffer *cb, uint32_t value);
+
+// Appends NUL terminated [str]
+uint32_t cb_write_str(CommandBuffer *cb, const char *str);
+
+// Appends [str_len] bytes of [str] in double quotes, or nothing at all
+// if they don't fit
+uint32_t cb_write_quoted(CommandBuffer *cb, const char *str, uint32_t str_len);
+
 #endif // WISDOM_MODEM_COMMAND_BUFFER_H
@@ -1,135 +1,172 @@
-#include <stdlib.h>
-#include <stdbool.h>
-
 #include "response_parser.h"
 
-#define RP_RESPONSE_LEN_MAX 2000
-
-ResponseParser *rp_create() {
-	ResponseParser *rp = malloc((sizeof *rp));
-	if (!rp) return NULL;
-
-	rp->num_messages = 0;
-	rp->index = 0;
-}
-
-void rp_destroy(ResponseParser *rp) {
-	free(rp);
-}
+static void _line_close(ResponseParser *rp);
+static RP_LINE_TYPE _line_classify(ResponseParser *rp, AT_KEY key);
+static AT_KEY _line_key(ResponseParser *rp, uint16_t keyword_len);
+static void _span_add(ResponseParser *rp, uint32_t offset, uint16_t length, RP_LINE_TYPE type, AT_KEY key);
+
+ResponseParser *rp_reset(ResponseParser *rp, uint32_t position, AT_KEY command) {
+	rp->command = command;
+	rp->position = position;
+	rp->line_start = position;
+	rp->line_len = 0;
+	rp->line_keyed = false;
+	rp->data_left = 0;
+	rp->num_spans = 0;
+	rp->final = RP_LINE_INFO;
+	rp->complete = false;
 
-ResponseParser *rp_reset(ResponseParser *rp) {
-	rp->num_messages = 0;
-	rp->index = 0;
 	return rp;
 }
 
-uint32_t rp_num_messages(ResponseParser *rp) {
-	return rp->num_messages;	
-}
+size_t rp_feed(ResponseParser *rp, const uint8_t *src, size_t src_len) {
+	size_t used = 0;
+
+	while (used < src_len && !rp->complete) {
 
-void rp_parse(ResponseParser *rp, uint8_t *src, uint32_t src_len) {
-	bool prefix = false;
-	bool non_standard_response = false;
-	bool close_response = false;
-	uint8_t response_len = 0;
+		// CARECV data, skipped over in one go
+		if (rp->data_left) {
+			size_t skip = src_len - used;
+			if (skip > rp->data_left) skip = rp->data_left;
 
+			rp->data_left -= skip;
+			rp->position += skip;
+			used += skip;
 
-	for (int i = 0; i < src_len; i++) {
-		if (src[i] == '\r') {
+			if (rp->data_left == 0) rp->line_start = rp->position;
 			continue;
 		}
 
-		if (src[i] == '\n') {
-			
-			if (non_standard_response) {
-				non_standard_response = false;
-				rp_close_response(rp, response_len);		
-				response_len = 0;
-			}
-
-			if (!prefix) {
-				prefix = true;
-				continue;
-			}
+		uint8_t c = src[used++];
+		rp->position++;
 
+		if (c == '\r') continue;
 
-			rp_close_response(rp, response_len);
-			prefix = false;
-			response_len = 0;
+		if (c == '\n') {
+			_line_close(rp);
+			rp->line_start = rp->position;
 			continue;
 		}
 
-		if (!prefix) {
-			non_standard_response = true;
-		}
-		rp->buffer[rp->num_messages][response_len] = src[i];
-		response_len++;
-		if (response_len > RP_RESPONSE_LEN_MAX) break;
-	}
-
-	// If we are at the end of the src but have an unclosed
-	// response
-	if (non_standard_response || prefix)
-		rp_close_response(rp, response_len);		
-}
+		if (rp->line_len < RP_LINE_HEAD)
+			rp->line_head[rp->line_len] = c;
+		rp->line_len++;
 
-static void rp_close_response(ResponseParser *rp, uint8_t len) {
-	rp->length_array[rp->num_messages] = len;
-	rp->num_messages++;
-}
+		// Keyword is in, looked up once
+		if (c == ':' && !rp->line_keyed) {
+			rp->line_key = _line_key(rp, rp->line_len - 1);
+			rp->line_keyed = true;
+		}
 
-bool rp_contains(
-		ResponseParser *rp, 
-		uint8_t *needle,
-		uint32_t n,
-		uint8_t *index
-) 
-{
-	bool found = false;
+		// The send prompt never gets a line ending
+		if (rp->line_len == 2 && rp->line_head[0] == '>' && c == ' ') {
+			_line_close(rp);
+			continue;
+		}
 
-	if (index == NULL) index = &(uint8_t) {0};
+		// +CARECV: <length>,<data>
+		if (c == ',' && rp->line_keyed && rp->line_key == AT_KEY_CARECV) {
+			uint16_t length = 0;
+			for (size_t i = 9; i < rp->line_len - 1 && i < RP_LINE_HEAD; i++) {
+				uint8_t d = rp->line_head[i];
+				if (d < '0' || d > '9') break;
+				length = length * 10 + d - '0';
+			}
 
-	for (*index = 0; *index < rp->num_messages; (*index)++) {
-		if (n > rp->length_array[*index]) continue;
+			rp->line_len--; // Header span leaves out the comma
+			_line_close(rp);
 
-		for (int i = 0; i < n; i++) {
-			if (needle[i] != rp->buffer[*index][i]) {
-				found = false;
-				continue;
-			}
-			found = true;
+			_span_add(rp, rp->position, length, RP_LINE_DATA, AT_KEY_NONE);
+			rp->data_left = length;
+			rp->line_start = rp->position;
 		}
-
-		if (found) break;
 	}
 
-	return found;
+	return used;
+}
+
+bool rp_complete(ResponseParser *rp) {
+	return rp->complete;
 }
 
 bool rp_contains_ok(ResponseParser *rp) {
-	return rp_contains(rp, "OK", 2, NULL);
+	return rp->complete && rp->final == RP_LINE_OK;
 }
 
 bool rp_contains_err(ResponseParser *rp) {
-	return rp_contains(rp, "+CME ERROR", 10, NULL);
+	return rp->complete && (rp->final == RP_LINE_ERROR || rp->final == RP_LINE_CME_ERROR);
 }
 
 bool rp_contains_ok_or_err(ResponseParser rp[static 1]) {
 	return rp_contains_ok(rp) || rp_contains_err(rp);
 }
 
-bool rp_get(ResponseParser *rp, uint8_t index, uint8_t **dst, uint32_t *dst_len) {
-	if (index >= rp->num_messages) return false;
+const struct rp_span_s *rp_find(ResponseParser *rp, RP_LINE_TYPE type) {
+	for (uint8_t i = 0; i < rp->num_spans; i++)
+		if (rp->spans[i].type == type) return &rp->spans[i];
+
+	return NULL;
+}
+
+const struct rp_span_s *rp_find_key(ResponseParser *rp, AT_KEY key) {
+	for (uint8_t i = 0; i < rp->num_spans; i++)
+		if (rp->spans[i].key == key && rp->spans[i].type != RP_LINE_DATA) return &rp->spans[i];
 
-	*dst = &rp->buffer[index][0];
-	*dst_len = rp->length_array[index];
+	return NULL;
 }
 
-bool rp_next(ResponseParser *rp, uint8_t **next, uint8_t *next_len) {
-	if (rp->index == rp->num_messages) return false;
+uint32_t rp_num_spans(ResponseParser *rp) {
+	return rp->num_spans;
+}
+
+static void _line_close(ResponseParser *rp) {
+	if (rp->line_len == 0) return;
+
+	// No ':', the whole line is the keyword
+	AT_KEY key = rp->line_keyed ? rp->line_key : _line_key(rp, rp->line_len);
+
+	RP_LINE_TYPE type = _line_classify(rp, key);
+	_span_add(rp, rp->line_start, rp->line_len, type, key);
+
+	rp->line_len = 0;
+	rp->line_keyed = false;
+
+	if (type != RP_LINE_INFO && type != RP_LINE_URC) {
+		rp->final = type;
+		rp->complete = true;
+	}
+}
+
+static RP_LINE_TYPE _line_classify(ResponseParser *rp, AT_KEY key) {
+	switch (key) {
+	case AT_KEY_OK:         return RP_LINE_OK;
+	case AT_KEY_ERROR:      return RP_LINE_ERROR;
+	case AT_KEY_PROMPT:     return RP_LINE_PROMPT;
+	case AT_KEY_CME_ERROR:  return RP_LINE_CME_ERROR;
+	case AT_KEY_POWER_DOWN: return RP_LINE_POWER_DOWN;
+	default:                break;
+	}
+
+	// Same keyword as the command, its answer
+	if (key == rp->command) return RP_LINE_INFO;
+
+	return at_key_is_urc(key) ? RP_LINE_URC : RP_LINE_INFO;
+}
+
+// Keywords all fit in the head, longer ones can't be any of them
+static AT_KEY _line_key(ResponseParser *rp, uint16_t keyword_len) {
+	if (keyword_len > RP_LINE_HEAD) return AT_KEY_NONE;
+
+	return at_key_lookup(rp->line_head, keyword_len);
+}
 
-	*next = &rp->buffer[rp->index][0];
-	*next_len = rp->length_array[rp->index++];
+static void _span_add(ResponseParser *rp, uint32_t offset, uint16_t length, RP_LINE_TYPE type, AT_KEY key) {
+	if (rp->num_spans == RP_SPANS_MAX) return;
 
-	return true;
+	rp->spans[rp->num_spans++] = (struct rp_span_s) {
+		.offset = offset,
+		.length = length,
+		.type = type,
+		.key = key,
+	};
 }
@@ -1,35 +1,78 @@
 #ifndef WISDOM_RESPONSE_PARSER_H
 #define WISDOM_RESPONSE_PARSER_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define RP_RESPONSE_NUM_MAX 20
-#define RP_RESPONSE_LEN_MAX 2000
+#include "at_keywords.h"
 
-typedef struct _response_parser {
-	uint8_t buffer[RP_RESPONSE_NUM_MAX][RP_RESPONSE_LEN_MAX + 1];
-	uint8_t num_messages;
-	uint8_t index;
-	uint32_t length_array[RP_RESPONSE_NUM_MAX];
-} ResponseParser;
+// Streaming AT response parser
+//
+// Bytes are fed in whatever chunks they arrive in and nothing is copied.
+// Each complete line comes out as a span: where it starts in the byte
+// stream, its length without the line ending and what kind of line it
+// is, along with its keyword (see at_keywords.h), looked up once as the
+// line arrives. Stream positions are whatever the caller counts bytes with, the
+// driver uses its receive ring indexes so spans point straight into the
+// ring.
+//
+// A response is complete once its final line has been fed: OK, ERROR,
+// +CME ERROR, NORMAL POWER DOWN or the "> " send prompt. CARECV data is
+// handed out as its own span and never mistaken for lines.
+
+#define RP_SPANS_MAX 12
+#define RP_LINE_HEAD 20 // Bytes of each line kept for classifying it
+
+typedef enum rp_line_types_e {
+	RP_LINE_INFO,       // Part of the command's response
+	RP_LINE_OK,
+	RP_LINE_ERROR,
+	RP_LINE_CME_ERROR,
+	RP_LINE_PROMPT,     // "> ", modem is waiting for CASEND data
+	RP_LINE_POWER_DOWN, // NORMAL POWER DOWN
+	RP_LINE_URC,        // Unsolicited, not from the command
+	RP_LINE_DATA        // CARECV payload
+} RP_LINE_TYPE;
 
-ResponseParser *rp_create();
-void rp_destroy(ResponseParser *rp);
+struct rp_span_s {
+	uint32_t offset; // Stream position of the first byte
+	uint16_t length;
+	uint8_t type;    // RP_LINE_TYPE
+	uint8_t key;     // AT_KEY, AT_KEY_NONE for data
+};
 
-ResponseParser *rp_reset(ResponseParser *rp);
+typedef struct _response_parser {
+	AT_KEY command;    // Keyword of lines answering the command, e.g. AT_KEY_CASTATE
+	uint32_t position; // Stream position of the next byte to feed
+
+	// Line being fed
+	uint32_t line_start;
+	uint16_t line_len;
+	uint8_t line_head[RP_LINE_HEAD];
+	uint8_t line_key;   // AT_KEY, once line_keyed
+	bool line_keyed;    // Keyword has ended, at a ':'
+	uint16_t data_left; // CARECV data bytes still to come
 
-uint32_t rp_num_messages(ResponseParser *rp);
+	struct rp_span_s spans[RP_SPANS_MAX];
+	uint8_t num_spans;
+	uint8_t final; // RP_LINE_TYPE of the final line once complete
+	bool complete;
+} ResponseParser;
 
-void rp_parse(ResponseParser *rp, uint8_t *src, uint32_t src_len);
+// Starts a new response at stream [position]
+// [command] is the keyword of the command's response lines, those are
+// never taken for URCs. AT_KEY_NONE if there isn't one.
+ResponseParser *rp_reset(ResponseParser *rp, uint32_t position, AT_KEY command);
 
-static void rp_close_response(ResponseParser *rp, uint8_t len);
+// Feeds the next [src_len] bytes of the stream
+// Stops after the final line.
+//
+// return: bytes used, less than [src_len] only once complete
+size_t rp_feed(ResponseParser *rp, const uint8_t *src, size_t src_len);
 
-bool rp_contains(
-		ResponseParser *rp, 
-		uint8_t *needle,
-		uint32_t n,
-		uint8_t *index
-); 
+// return: true once the final line has been fed
+bool rp_complete(ResponseParser *rp);
 
 bool rp_contains_ok(ResponseParser *rp);
 
@@ -37,8 +80,18 @@ bool rp_contains_err(ResponseParser *rp);
 
 bool rp_contains_ok_or_err(ResponseParser rp[static 1]);
 
-bool rp_get(ResponseParser *rp, uint8_t index, uint8_t **dst, uint32_t *dst_len);
+// First span of [type]
+//
+// return: NULL if there is none
+const struct rp_span_s *rp_find(ResponseParser *rp, RP_LINE_TYPE type);
+
+// First line starting with [key]
+//
+// return: NULL if there is none
+const struct rp_span_s *rp_find_key(ResponseParser *rp, AT_KEY key);
 
-bool rp_next(ResponseParser *rp, uint8_t **next, uint8_t *next_len);
+// Spans past RP_SPANS_MAX are dropped, the final line is always kept
+// in rp->final.
+uint32_t rp_num_spans(ResponseParser *rp);
 
 #endif // WISDOM_RESPONSE_PARSER_H
@@ -6,16 +6,94 @@
 
 #include "pico/time.h"
 #include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 
 #include "sim7080g_pico.h"
 
 #define MODEM_RETRY_DELAY_MS 100
 #define MODEM_START_RETRIES 100
 #define UART_BAUD 115200
-#define RX_BUFFER_SIZE 1024
+#define PDP_URC_TIMEOUT_US (1000 * 1000 * 5)
+#define MODEM_LINK_TIMEOUT_US (100 * 1000)
 
+// Whole CARECV response, MODEM_TCP_RECV_MAX bytes take 127 ms at 115200
+#define MODEM_TCP_RECV_TIMEOUT_US (1000 * 1000)
+#define MODEM_LINK_SETTLE_MS 20 // After a rate change, before the first command
+#define MODEM_LINK_CHECK_TRIES 3
+
+static_assert((MODEM_RX_RING_SIZE & (MODEM_RX_RING_SIZE - 1)) == 0, "RX ring size must be a power of 2");
+
+// Receive ring per UART for the IRQ handlers
+static sim7080g_context_t *_rx_contexts[2] = {NULL};
+
+// Where sim7080g_tcp_recv has got to in its caller's buffer
+struct _recv_buffer_s {
+	uint8_t *dst;
+	size_t len;
+};
 
 bool sim7080g_config(sim7080g_context_t *context);
+static bool _socket_open(
+		sim7080g_context_t *context, 
+		const char *protocol,
+		uint8_t url_len,  
+		const char url[static url_len],
+		uint16_t port
+);
+static void _rx_irq_enable(sim7080g_context_t *context);
+static void _rx_irq(uint index);
+static void _uart0_irq(void);
+static void _uart1_irq(void);
+static uint32_t _rx_available(sim7080g_context_t *context);
+static uint32_t _rx_head(sim7080g_context_t *context);
+static void _rx_consume(sim7080g_context_t *context, uint32_t position);
+static bool _rx_wait(sim7080g_context_t *context, uint32_t have, absolute_time_t until);
+static uint8_t _rx_peek(sim7080g_context_t *context, uint32_t offset);
+static uint8_t _rx_pop(sim7080g_context_t *context);
+static size_t _rx_line_length(sim7080g_context_t *context);
+static void _rx_release(sim7080g_context_t *context);
+static void _response_begin(sim7080g_context_t *context, ResponseParser *rp, AT_KEY command);
+static bool _response_read(sim7080g_context_t *context, ResponseParser *rp, absolute_time_t until);
+static const struct rp_span_s *_response_find(
+		sim7080g_context_t *context,
+		ResponseParser *rp,
+		AT_KEY key,
+		const char *args
+);
+static bool _span_args_start_with(
+		sim7080g_context_t *context,
+		const struct rp_span_s *span,
+		const char *args
+);
+static size_t _span_copy(
+		sim7080g_context_t *context,
+		const struct rp_span_s *span,
+		size_t skip,
+		uint8_t *dst,
+		size_t dst_len
+);
+static void _urc_dispatch(sim7080g_context_t *context, const struct rp_span_s *span);
+static void _recv_buffer_sink(const uint8_t *data, size_t len, void *arg);
+static bool _line_starts_with(const uint8_t *line, size_t line_len, const char *prefix);
+static void _link_state_forget(sim7080g_context_t *context);
+static void _cn_activate_command(CommandBuffer *cb, bool activate);
+static void _socket_open_command(
+		CommandBuffer *cb,
+		const char *protocol,
+		uint8_t url_len,
+		const char url[static url_len],
+		uint16_t port
+);
+static void _response_feed(sim7080g_context_t *context, ResponseParser *rp);
+static void _at_queue_send(sim7080g_context_t *context);
+static bool _at_chainable(struct sim7080g_at_s *at);
+static struct sim7080g_at_s *_at_queued(sim7080g_context_t *context, uint n);
+static void _at_latency_record(sim7080g_context_t *context);
+static bool _link_command(sim7080g_context_t *context, CommandBuffer *cb);
+static bool _link_check(sim7080g_context_t *context);
+static void _link_uart_set(sim7080g_context_t *context, uint baud, bool flow);
+static void _link_flow_pins(sim7080g_context_t *context, bool flow);
 
 sim7080g_context_t * sim7080g_create(void) {
 	return malloc(sizeof (sim7080g_context_t));
@@ -40,8 +118,30 @@ void sim7080g_init(
 	context->pin_tx = pin_tx;
 	context->pin_rx = pin_rx;
 	context->pin_power = pin_power;
+	context->pin_cts = MODEM_PIN_NONE;
+	context->pin_rts = MODEM_PIN_NONE;
+
+	context->baud = UART_BAUD;
+	context->baud_fast = UART_BAUD;
+	context->flow = false;
+
+	context->command_sent = nil_time;
+	context->at_stats = (struct sim7080g_at_stats_s) {0};
+
+	spsc_buffer_init(&context->rx, context->rx_ring, MODEM_RX_RING_SIZE);
+	context->rx_tail = 0;
+	context->rx_release = 0;
+	context->rx_dropped = 0;
 
-	// Disable hardware flow completely
+	context->urc_handlers_num = 0;
+	_link_state_forget(context);
+
+	context->at_queue_first = 0;
+	context->at_queue_num = 0;
+	context->at_in_flight = 0;
+
+	// Hardware flow control only once sim7080g_link_negotiate has it on
+	// at the modem too
 	uart_set_hw_flow(uart, false, false);
 
 	// gpio stuff
@@ -52,11 +152,12 @@ void sim7080g_init(
 
 	gpio_set_function(context->pin_tx, GPIO_FUNC_UART);
 	gpio_set_function(context->pin_rx, GPIO_FUNC_UART);
+
+	_rx_irq_enable(context);
 }
 
 bool sim7080g_start(sim7080g_context_t *context) {
 	bool success = false;
-	uint8_t read_buffer[RX_BUFFER_SIZE] = {0};
 	for (int tries = 0; tries < MODEM_START_RETRIES; tries++) {
 
 		if (sim7080g_is_ready(context)) {
@@ -70,6 +171,8 @@ bool sim7080g_start(sim7080g_context_t *context) {
 
 	// This is how we fail
 	if (!success) return false;
+
+	sim7080g_link_negotiate(context);
 	if (!sim7080g_config(context)) return false;
 
 	// Wait until network is connected
@@ -78,6 +181,58 @@ bool sim7080g_start(sim7080g_context_t *context) {
 	return success;
 }
 
+void sim7080g_link_set(sim7080g_context_t *context, uint baud, uint pin_cts, uint pin_rts) {
+	context->baud_fast = baud;
+	context->pin_cts = pin_cts;
+	context->pin_rts = pin_rts;
+
+	_link_flow_pins(context, context->flow);
+}
+
+uint sim7080g_link_negotiate(sim7080g_context_t *context) {
+	bool flow = context->pin_cts != MODEM_PIN_NONE && context->pin_rts != MODEM_PIN_NONE;
+	if (context->baud == context->baud_fast && context->flow == flow)
+		return context->baud;
+
+	CommandBuffer cb;
+
+	// Flow control first, the faster rate never runs without it
+	if (flow && !context->flow && _link_command(context, cb_command(&cb, "+IFC=2,2"))) {
+		// CTS is active low. Still pulled up means the modem isn't
+		// driving it, and the UART would never send another byte.
+		if (gpio_get(context->pin_cts))
+			_link_command(context, cb_command(&cb, "+IFC=0,0"));
+		else
+			_link_uart_set(context, context->baud, true);
+	}
+
+	if (context->baud == context->baud_fast) return context->baud;
+
+	cb_command(&cb, "+IPR=");
+	cb_write_uint(&cb, context->baud_fast);
+
+	// OK comes at the old rate, the new one applies from the next
+	// command. No OK is either no change or an OK garbled by it.
+	if (!_link_command(context, &cb) && _link_check(context))
+		return context->baud;
+
+	bool flowing = context->flow;
+	_link_uart_set(context, context->baud_fast, flowing);
+	if (_link_check(context)) return context->baud;
+
+	// Rate doesn't hold on this wiring. Ask for the old one back, some of
+	// it may get through, and check it took.
+	cb_command(&cb, "+IPR=");
+	cb_write_uint(&cb, UART_BAUD);
+	_link_command(context, &cb);
+	_link_uart_set(context, UART_BAUD, false);
+
+	if (_link_check(context) && flowing)
+		_link_command(context, cb_command(&cb, "+IFC=0,0"));
+
+	return context->baud;
+}
+
 bool sim7080g_config(sim7080g_context_t *context) {
 
 	if (!sim7080g_sim_ready(context)) return false;
@@ -90,28 +245,88 @@ bool sim7080g_config(sim7080g_context_t *context) {
 	// +CMNB=1  Preferred network: CAT-M
 	// +CGDCONT Set APN
 	// +CNCFG   Restr_puest proper code from carrier network
-	uint8_t *command = 
-		"+CMEE=2;+CMGF=1;+CMGD=,4;+CNMP=38;+CMNB=1;+CGDCONT=1,\"IP\",\"";
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, command, strlen(command));
-	cb_write(cb, (uint8_t *)context->apn, strlen(context->apn));
-	cb_write(cb, "\"", 1);
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0},
+			"+CMEE=2;+CMGF=1;+CMGD=,4;+CNMP=38;+CMNB=1;+CGDCONT=1,\"IP\",");
+	cb_write_quoted(cb, context->apn, strlen(context->apn));
 
 	sim7080g_cb_write_blocking(context, cb);
 
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	return sim7080g_read_blocking_ok(context);
+}
+
+bool sim7080g_at_enqueue(
+		sim7080g_context_t *context,
+		CommandBuffer *cb,
+		AT_KEY response,
+		uint64_t timeout,
+		sim7080g_at_done_t done,
+		void *arg
+)
+{
+	if (context->at_queue_num == MODEM_AT_QUEUE_MAX) return false;
+
+	struct sim7080g_at_s *at = _at_queued(context, context->at_queue_num++);
+	cb_copy(&at->cb, cb);
+	at->response = response;
+	at->timeout_us = timeout;
+	at->done = done;
+	at->arg = arg;
+
+	return true;
+}
+
+uint sim7080g_at_pump(sim7080g_context_t *context) {
+	if (context->at_in_flight) {
+		ResponseParser *rp = &context->at_rp;
+
+		uint32_t fed = rp->position;
+		_response_feed(context, rp);
+		if (rp->position != fed) _at_latency_record(context);
+
+		bool timed_out = !rp_complete(rp) && time_reached(context->at_deadline);
+		if (!rp_complete(rp) && !timed_out)
+			return context->at_queue_num;
+
+		if (timed_out && !is_nil_time(context->command_sent)) {
+			context->at_stats.timeouts++;
+			context->command_sent = nil_time;
+		}
+
+		// Off the queue before the callbacks, which may queue more
+		uint done_num = context->at_in_flight;
+		sim7080g_at_done_t done[MODEM_AT_QUEUE_MAX];
+		void *done_arg[MODEM_AT_QUEUE_MAX];
+		for (uint i = 0; i < done_num; i++) {
+			done[i] = _at_queued(context, i)->done;
+			done_arg[i] = _at_queued(context, i)->arg;
+		}
+
+		context->at_queue_first = (context->at_queue_first + done_num) % MODEM_AT_QUEUE_MAX;
+		context->at_queue_num -= done_num;
+		context->at_in_flight = 0;
+
+		for (uint i = 0; i < done_num; i++)
+			if (done[i]) done[i](context, rp, timed_out, done_arg[i]);
+	}
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	rp_parse(rp, read_buffer, received);
+	if (context->at_queue_num && !context->at_in_flight)
+		_at_queue_send(context);
 
-	return rp_contains_ok(rp);
+	return context->at_queue_num;
+}
+
+bool sim7080g_at_busy(sim7080g_context_t *context) {
+	return context->at_queue_num != 0;
+}
+
+void sim7080g_at_flush(sim7080g_context_t *context) {
+	while (sim7080g_at_pump(context))
+		_rx_wait(context, context->at_rp.position - context->rx_tail, context->at_deadline);
 }
 
 void sim7080g_write_blocking(
 		sim7080g_context_t *context,
-		const uint8_t src[],
+		const void *src,
 		size_t src_len
 )
 {
@@ -120,7 +335,7 @@ void sim7080g_write_blocking(
 
 bool sim7080g_write_within_us(
 		sim7080g_context_t *context, 
-		const uint8_t *src, 
+		const void *src, 
 		size_t src_len, 
 		uint64_t timeout
 ) 
@@ -144,7 +359,11 @@ bool sim7080g_write_within_us(
 
 
 void sim7080g_cb_write_blocking(sim7080g_context_t *context, CommandBuffer cb[static 1]) {
+	// Queued commands go first, their responses would get in the way
+	sim7080g_at_flush(context);
+
 	sim7080g_write_blocking(context, cb_get_buffer(cb), cb_length(cb));
+	context->command_sent = get_absolute_time();
 }
 
 
@@ -169,106 +388,213 @@ uint32_t sim7080g_read_within_us(
 		uint64_t timeout
 ) 
 {
-	if (!uart_is_readable_within_us(context->uart, timeout)) return 0;
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_NONE);
+	if (!_response_read(context, &rp, make_timeout_time_us(timeout))) return 0;
+
+	uint32_t received = rp.position - context->rx_tail;
+	if (dst == NULL) return received;
 
-	return sim7080g_read_blocking(context, dst, dst_len);
+	struct rp_span_s all = { .offset = context->rx_tail, .length = received };
+	return _span_copy(context, &all, 0, dst, dst_len);
 }
 
 uint32_t sim7080g_read_blocking(sim7080g_context_t *context, uint8_t *dst, size_t dst_len) {
-	if (dst == NULL) {
-		dst = (uint8_t[RX_BUFFER_SIZE]) {0};
-		dst_len = RX_BUFFER_SIZE;
-	}
+	return sim7080g_read_within_us(context, dst, dst_len, UINT64_MAX);
+}
 
-	uint8_t received = 0;
-	for (uint8_t *p = dst; p - dst < dst_len; p++, received++) {
-		uart_read_blocking(context->uart, p, 1);
+size_t sim7080g_read_line_within_us(
+		sim7080g_context_t *context,
+		uint8_t *dst,
+		size_t dst_len,
+		uint64_t timeout
+)
+{
+	absolute_time_t timeout_time = make_timeout_time_us(timeout);
+	_rx_release(context);
 
-		if (!uart_is_readable_within_us(context->uart, READ_STOP_TIMEOUT_US)) 
-			break;
+	for (;;) {
+		// Line endings of the last line, and empty lines
+		while (_rx_available(context)) {
+			uint8_t c = _rx_peek(context, 0);
+			if (c != '\r' && c != '\n') break;
+			_rx_pop(context);
+		}
+
+		size_t line_len = _rx_line_length(context);
+		if (line_len) {
+			_at_latency_record(context);
+
+			size_t copied = 0;
+			for (size_t i = 0; i < line_len; i++) {
+				uint8_t c = _rx_pop(context);
+				if (copied < dst_len) dst[copied++] = c;
+			}
+
+			return copied;
+		}
+
+		if (!_rx_wait(context, _rx_available(context), timeout_time))
+			return 0;
 	}
+}
 
-	return received;
+void sim7080g_at_stats_get(sim7080g_context_t *context, struct sim7080g_at_stats_s *dst) {
+	*dst = context->at_stats;
+	dst->rx_dropped = context->rx_dropped;
 }
 
-bool sim7080g_read_blocking_ok(sim7080g_context_t *context) {
+void sim7080g_at_stats_reset(sim7080g_context_t *context) {
+	context->at_stats = (struct sim7080g_at_stats_s) {0};
+	context->rx_dropped = 0;
+}
+
+bool sim7080g_urc_subscribe(
+		sim7080g_context_t *context,
+		const char *prefix,
+		sim7080g_urc_handler_t handler,
+		void *arg
+)
+{
+	if (context->urc_handlers_num == MODEM_URC_HANDLERS_MAX) return false;
 
-	uint8_t read_buffer[RX_BUFFER_SIZE] = {0};
-	uint32_t received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	context->urc_handlers[context->urc_handlers_num++] = (struct sim7080g_urc_s) {
+		.prefix = prefix,
+		.handler = handler,
+		.arg = arg,
+	};
+
+	return true;
+}
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	rp_parse(rp, read_buffer, received);
+void sim7080g_urc_unsubscribe(sim7080g_context_t *context, sim7080g_urc_handler_t handler) {
+	uint kept = 0;
+	for (uint i = 0; i < context->urc_handlers_num; i++)
+		if (context->urc_handlers[i].handler != handler)
+			context->urc_handlers[kept++] = context->urc_handlers[i];
 
-	return rp_contains_ok(rp);
+	context->urc_handlers_num = kept;
+}
+
+void sim7080g_urc_poll(sim7080g_context_t *context) {
+	// Everything received belongs to the queued command's response
+	if (context->at_in_flight) {
+		sim7080g_at_pump(context);
+		return;
+	}
+
+	_rx_release(context);
+
+	// Every complete line in the ring, stale responses to a timed out
+	// command are let go of too
+	for (;;) {
+		ResponseParser rp;
+		rp_reset(&rp, context->rx_tail, AT_KEY_NONE);
+
+		uint32_t head = _rx_head(context);
+		while (rp.position != head && !rp_complete(&rp)) {
+			uint32_t index = rp.position & (MODEM_RX_RING_SIZE - 1);
+			uint32_t len = head - rp.position;
+			if (len > MODEM_RX_RING_SIZE - index) len = MODEM_RX_RING_SIZE - index;
+
+			rp_feed(&rp, &context->rx_ring[index], len);
+		}
+
+		for (uint i = 0; i < rp_num_spans(&rp); i++)
+			if (rp.spans[i].type != RP_LINE_DATA)
+				_urc_dispatch(context, &rp.spans[i]);
+
+		// Up to the line still arriving
+		_rx_consume(context, rp_complete(&rp) ? rp.position : rp.line_start);
+
+		if (!rp_complete(&rp)) break;
+	}
+}
+
+bool sim7080g_read_blocking_ok(sim7080g_context_t *context) {
+	return sim7080g_read_ok_within_us(context, MODEM_RESPONSE_TIMEOUT_US);
 }
 
 bool sim7080g_read_ok_within_us(sim7080g_context_t *context, uint64_t timeout) {
-	if (!uart_is_readable_within_us(context->uart, timeout)) return false;
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_NONE);
+	_response_read(context, &rp, make_timeout_time_us(timeout));
 
-	return sim7080g_read_blocking_ok(context);
+	return rp_contains_ok(&rp);
 }
 
 bool sim7080g_is_ready(sim7080g_context_t *context) {
-	
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "E0", 2);
+	if (_link_command(context, cb_command(&(CommandBuffer) {0}, "E0"))) return true;
 
-	sim7080g_cb_write_blocking(context, cb);
+	// May have come back up at the rate it was left at
+	if (context->baud_fast != UART_BAUD)
+		_link_uart_set(context,
+				context->baud == UART_BAUD ? context->baud_fast : UART_BAUD, false);
 
-    return sim7080g_read_ok_within_us(context, 100 * 1000);
+	return false;
 }
 
 
 bool sim7080g_sim_ready(sim7080g_context_t *context) {
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CPIN?", 6);
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+CPIN?");
 
 	sim7080g_cb_write_blocking(context, cb);
 
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_CPIN);
+	_response_read(context, &rp, make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US));
 
-	rp_parse(rp, read_buffer, received);
-	return rp_contains(rp, "+CPIN: READY", 12, NULL);
+	return _response_find(context, &rp, AT_KEY_CPIN, "READY") != NULL;
 }
 
 
 bool sim7080g_cn_available(sim7080g_context_t *context) {
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+COPS?", 6);
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+COPS?");
 
 	sim7080g_cb_write_blocking(context, cb);
 
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_COPS);
+	_response_read(context, &rp, make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US));
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	rp_parse(rp, read_buffer, received);
+	return sim7080g_cn_available_response(context, &rp);
+}
 
-	return rp_contains(rp, "+COPS: 0,", 9, NULL);
+bool sim7080g_cn_available_enqueue(
+		sim7080g_context_t *context,
+		sim7080g_at_done_t done,
+		void *arg
+)
+{
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+COPS?");
+
+	return sim7080g_at_enqueue(context, cb, AT_KEY_COPS, MODEM_RESPONSE_TIMEOUT_US, done, arg);
+}
+
+bool sim7080g_cn_available_response(sim7080g_context_t *context, ResponseParser *rp) {
+	return _response_find(context, rp, AT_KEY_COPS, "0,") != NULL;
 }
 
 bool sim7080g_cn_is_active(sim7080g_context_t *context) {
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CNACT?", 7); 
+	sim7080g_urc_poll(context);
+	if (context->pdp_state != MODEM_LINK_UNKNOWN)
+		return context->pdp_state == MODEM_LINK_UP;
+
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+CNACT?");
 
 	sim7080g_cb_write_blocking(context, cb);
 
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_CNACT);
+	_response_read(context, &rp, make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US));
+
+	if (!rp_contains_ok(&rp)) return false;
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	rp_parse(rp, read_buffer, received);
+	bool active = _response_find(context, &rp, AT_KEY_CNACT, "0,1") != NULL;
+	context->pdp_state = active ? MODEM_LINK_UP : MODEM_LINK_DOWN;
 
-	return rp_contains(rp, "+CNACT: 0,1", 11, NULL);
+	return active;
 }
 
 bool sim7080g_cn_activate(sim7080g_context_t *context, bool activate) {
@@ -278,38 +604,108 @@ bool sim7080g_cn_activate(sim7080g_context_t *context, bool activate) {
 	if (activate && sim7080g_cn_is_active(context)) return true;
 	if (!activate && !sim7080g_cn_is_active(context)) return true;
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CNACT=0,", 9); 
-	cb_write(cb, activate ? "1" : "0", 1);
+	CommandBuffer cb;
+	_cn_activate_command(&cb, activate);
 
-	sim7080g_cb_write_blocking(context, cb);
+	sim7080g_cb_write_blocking(context, &cb);
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	uint32_t received = 0;
-	uint8_t read_buffer[RX_BUFFER_SIZE];
+	// Set again by the +APP PDP URC
+	context->pdp_state = MODEM_LINK_UNKNOWN;
+
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_CNACT);
+
+	absolute_time_t response_time = make_timeout_time_us(MODEM_NETWORK_TIMEOUT_US);
+	while (!rp_complete(&rp) && _response_read(context, &rp, response_time));
+
+	if (!rp_contains_ok(&rp)) return false;
+
+	// The PDP URC usually trails the OK
+	absolute_time_t timeout_time = make_timeout_time_us(PDP_URC_TIMEOUT_US);
 	for (;;) {
+		sim7080g_urc_poll(context);
+		if (context->pdp_state != MODEM_LINK_UNKNOWN) break;
 
-		received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
-		rp_parse(rp, read_buffer, received);
-		if (rp_contains_ok_or_err(rp)) break;
+		if (!_rx_wait(context, _rx_available(context), timeout_time)) break;
+	}
 
-		sleep_ms(1000);
+	return context->pdp_state == (activate ? MODEM_LINK_UP : MODEM_LINK_DOWN);
+}
+
+bool sim7080g_cn_activate_enqueue(
+		sim7080g_context_t *context,
+		bool activate,
+		sim7080g_at_done_t done,
+		void *arg
+)
+{
+	CommandBuffer cb;
+	_cn_activate_command(&cb, activate);
+
+	if (!sim7080g_at_enqueue(context, &cb, AT_KEY_CNACT, MODEM_NETWORK_TIMEOUT_US, done, arg))
+		return false;
+
+	// Set again by the +APP PDP URC
+	context->pdp_state = MODEM_LINK_UNKNOWN;
+	return true;
+}
+
+enum sim7080g_link_state_e sim7080g_cn_state(sim7080g_context_t *context) {
+	sim7080g_urc_poll(context);
+	return context->pdp_state;
+}
+
+bool sim7080g_psm_set(
+		sim7080g_context_t *context,
+		bool enable,
+		const char *tau,
+		const char *active
+)
+{
+	CommandBuffer cb;
+	sim7080g_psm_command(&cb, enable, tau, active);
+
+	sim7080g_cb_write_blocking(context, &cb);
+
+	return sim7080g_read_blocking_ok(context);
+}
+
+void sim7080g_psm_command(CommandBuffer *cb, bool enable, const char *tau, const char *active) {
+	if (!enable) {
+		cb_command(cb, "+CPSMS=0");
+	} else {
+		cb_command(cb, "+CPSMS=1,,,");
+		cb_write_quoted(cb, tau, strlen(tau));
+		cb_write_literal(cb, ",");
+		cb_write_quoted(cb, active, strlen(active));
 	}
+}
 
-	if (activate)
-		return rp_contains(rp, "+APP PDP: 0,ACTIVE", 18, NULL);
+bool sim7080g_edrx_set(sim7080g_context_t *context, bool enable, const char *value) {
+	CommandBuffer cb;
+	sim7080g_edrx_command(&cb, enable, value);
+
+	sim7080g_cb_write_blocking(context, &cb);
 
-	return rp_contains(rp, "+APP PDP: 0,DEACTIVE", 20, NULL);
+	return sim7080g_read_blocking_ok(context);
+}
+
+void sim7080g_edrx_command(CommandBuffer *cb, bool enable, const char *value) {
+	// Access technology 4: E-UTRAN (CAT-M)
+	if (!enable) {
+		cb_command(cb, "+CEDRXS=0");
+	} else {
+		cb_command(cb, "+CEDRXS=1,4,");
+		cb_write_quoted(cb, value, strlen(value));
+	}
 }
 
 bool sim7080g_ssl_enable(sim7080g_context_t *context, bool enable) {
 	if (!sim7080g_cn_is_active(context)) return false;
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CASSLCFG=0,\"SSL\",", 18); 
-	cb_write(cb, enable ? "1" : "0", 1);
+	CommandBuffer *cb = enable
+		? cb_command(&(CommandBuffer) {0}, "+CASSLCFG=0,\"SSL\",1")
+		: cb_command(&(CommandBuffer) {0}, "+CASSLCFG=0,\"SSL\",0");
 
 	sim7080g_cb_write_blocking(context, cb);
 
@@ -323,49 +719,108 @@ void sim7080g_wait_for_cn(sim7080g_context_t *context) {
 bool sim7080g_tcp_open(
 		sim7080g_context_t *context, 
 		uint8_t url_len,  
-		uint8_t url[static url_len],
+		const char url[static url_len],
+		uint16_t port
+)
+{
+	return _socket_open(context, "TCP", url_len, url, port);
+}
+
+bool sim7080g_udp_open(
+		sim7080g_context_t *context, 
+		uint8_t url_len,  
+		const char url[static url_len],
+		uint16_t port
+)
+{
+	return _socket_open(context, "UDP", url_len, url, port);
+}
+
+// Opens socket 0 as [protocol], "TCP" or "UDP"
+static bool _socket_open(
+		sim7080g_context_t *context, 
+		const char *protocol,
+		uint8_t url_len,  
+		const char url[static url_len],
 		uint16_t port
 )
 {
 	if (!sim7080g_cn_is_active(context)) return false;
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CAOPEN=0,0,\"TCP\",\"", 19); 
-	cb_write(cb, url, url_len);
-	cb_write(cb, "\",", 2);
+	CommandBuffer cb;
+	_socket_open_command(&cb, protocol, url_len, url, port);
 
-	uint8_t port_str[6];
-	size_t str_len = sprintf(port_str, "%u", port);
-	cb_write(cb, port_str, str_len);
+	sim7080g_cb_write_blocking(context, &cb);
 
-	sim7080g_cb_write_blocking(context, cb);
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_CAOPEN);
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = 0;
-	for (;;) {
+	absolute_time_t response_time = make_timeout_time_us(MODEM_NETWORK_TIMEOUT_US);
+	while (!rp_complete(&rp) && _response_read(context, &rp, response_time));
+
+	return sim7080g_socket_open_response(context, &rp);
+}
+
+bool sim7080g_socket_open_enqueue(
+		sim7080g_context_t *context,
+		bool udp,
+		uint8_t url_len,
+		const char url[static url_len],
+		uint16_t port,
+		sim7080g_at_done_t done,
+		void *arg
+)
+{
+	CommandBuffer cb;
+	_socket_open_command(&cb, udp ? "UDP" : "TCP", url_len, url, port);
+
+	return sim7080g_at_enqueue(context, &cb, AT_KEY_CAOPEN, MODEM_NETWORK_TIMEOUT_US, done, arg);
+}
 
-		received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
-		rp_parse(rp, read_buffer, received);
+bool sim7080g_socket_open_response(sim7080g_context_t *context, ResponseParser *rp) {
+	bool opened = _response_find(context, rp, AT_KEY_CAOPEN, "0,0") != NULL;
+	context->socket_state = opened ? MODEM_LINK_UP : MODEM_LINK_DOWN;
+	context->data_pending = false;
 
-		if (rp_contains_ok_or_err(rp)) break;
+	return opened;
+}
 
-		sleep_ms(1000);
-	}
+// +CNACT for PDP context 0
+static void _cn_activate_command(CommandBuffer *cb, bool activate) {
+	if (activate)
+		cb_command(cb, "+CNACT=0,1");
+	else
+		cb_command(cb, "+CNACT=0,0");
+}
 
-	return rp_contains(rp, "+CAOPEN: 0,0", 12, NULL);
+// +CAOPEN for socket 0, [protocol] "TCP" or "UDP"
+static void _socket_open_command(
+		CommandBuffer *cb,
+		const char *protocol,
+		uint8_t url_len,
+		const char url[static url_len],
+		uint16_t port
+)
+{
+	cb_command(cb, "+CAOPEN=0,0,");
+	cb_write_quoted(cb, protocol, 3);
+	cb_write_literal(cb, ",");
+	cb_write_quoted(cb, url, url_len);
+	cb_write_literal(cb, ",");
+	cb_write_uint(cb, port);
 }
 
 bool sim7080g_tcp_close(sim7080g_context_t *context) {
 	if (!sim7080g_cn_is_active(context)) return false;
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CACLOSE=0", 10); 
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+CACLOSE=0");
 	
 	sim7080g_cb_write_blocking(context, cb);
 
+	// Closed either way, an error means it already was
+	context->socket_state = MODEM_LINK_DOWN;
+	context->data_pending = false;
+
 	return sim7080g_read_blocking_ok(context);
 }
 
@@ -377,15 +832,8 @@ bool sim7080g_tcp_send(
 {
 	//if (!sim7080g_cn_is_active(context)) return false;
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-
 	size_t send_len;
-	uint8_t command[100];
-	uint8_t command_len;
 	uint8_t *p = data;
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received;
 
 	while(data_len) {
 		if (data_len > MODEM_TCP_SEND_MAX)
@@ -395,67 +843,81 @@ bool sim7080g_tcp_send(
 
 		data_len -= send_len;
 
-		command_len = sprintf(command, "+CASEND=0,%u", send_len);
-
-		cb_reset(cb);
-		cb_at_prefix_set(cb);
-		cb_write(cb, command, command_len);
+		if (!sim7080g_tcp_send_split(context, send_len, p, 0, NULL))
+			return false;
 
-		sim7080g_cb_write_blocking(context, cb);
+		p += send_len;
+	}
 
-		received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	return true;
+}
 
-		rp_reset(rp);
-		rp_parse(rp, read_buffer, received);
-		
-		if (!rp_contains(rp, ">", 1, NULL)) return false;
+bool sim7080g_tcp_send_split(
+		sim7080g_context_t *context,
+		size_t first_len,
+		uint8_t *first,
+		size_t second_len,
+		uint8_t *second
+)
+{
+	struct sim7080g_chunk_s chunks[] = {
+		{ first, first_len },
+		{ second, second_len },
+	};
 
-		sim7080g_write_blocking(context, p, send_len);
+	return sim7080g_tcp_sendv(context, chunks, 2);
+}
 
-		p += send_len;
+bool sim7080g_tcp_sendv(
+		sim7080g_context_t *context,
+		const struct sim7080g_chunk_s *chunks,
+		uint count
+)
+{
+	size_t send_len = 0;
+	for (uint i = 0; i < count; i++)
+		send_len += chunks[i].len;
 
-		received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	if (send_len == 0 || send_len > MODEM_TCP_SEND_MAX) return false;
 
-		rp_reset(rp);
-		rp_parse(rp, read_buffer, received);
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+CASEND=0,");
+	cb_write_uint(cb, send_len);
 
-		if (!rp_contains_ok(rp)) return false;
-	}
+	sim7080g_cb_write_blocking(context, cb);
 
-	return true;
-}
+	ResponseParser rp;
 
-bool sim7080g_tcp_ack(sim7080g_context_t *context, uint *sent, uint *unack) {
-	uint8_t buffer[100];
-	uint8_t buffer_len;
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received;
+	_response_begin(context, &rp, AT_KEY_NONE);
+	_response_read(context, &rp, make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US));
+	
+	if (!rp_complete(&rp) || rp.final != RP_LINE_PROMPT) return false;
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
+	// The modem counts bytes, not writes, so the chunks land as one send
+	for (uint i = 0; i < count; i++)
+		if (chunks[i].len)
+			sim7080g_write_blocking(context, chunks[i].data, chunks[i].len);
 
-	buffer_len = sprintf(buffer, "+CAACK=0");
+	return sim7080g_read_blocking_ok(context);
+}
 
-	cb_reset(cb);
-	cb_at_prefix_set(cb);
-	cb_write(cb, buffer, buffer_len);
+bool sim7080g_tcp_ack(sim7080g_context_t *context, uint *sent, uint *unack) {
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+CAACK=0");
 	sim7080g_cb_write_blocking(context, cb);
 
-	received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+	ResponseParser rp;
 
-	rp_reset(rp);
-	rp_parse(rp, read_buffer, received);
+	_response_begin(context, &rp, AT_KEY_CAACK);
+	_response_read(context, &rp, make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US));
 
-	uint8_t index;
-	if (!rp_contains(rp, "+CAACK:", 7, &index)) return false;
+	const struct rp_span_s *span = _response_find(context, &rp, AT_KEY_CAACK, NULL);
+	if (span == NULL) return false;
 
-	uint8_t *return_message;
-	uint32_t message_len;
-	rp_get(rp, index, &return_message, &message_len);
+	uint8_t return_message[32];
+	size_t message_len = _span_copy(context, span, 0, return_message, sizeof return_message - 1);
 	return_message[message_len] = '\0';
 
 	// Find and return values
-	char *cp = return_message;
+	char *cp = (char *)return_message;
 	while (!isdigit(*cp)) cp++;
 	int digits = 0;
 
@@ -475,6 +937,8 @@ bool sim7080g_tcp_ack(sim7080g_context_t *context, uint *sent, uint *unack) {
 	num_str[digits] = '\0';
 
 	*unack = atoi(num_str);
+
+	return true;
 }
 
 size_t sim7080g_tcp_recv(
@@ -482,65 +946,80 @@ size_t sim7080g_tcp_recv(
 		size_t dst_len,
 		uint8_t dst[dst_len]
 )
+{
+	struct _recv_buffer_s buffer = { dst, 0 };
+
+	// Whatever made it in before a failed read is still good
+	sim7080g_tcp_recv_to(context, dst_len, _recv_buffer_sink, &buffer);
+
+	return buffer.len;
+}
+
+int sim7080g_tcp_recv_to(
+		sim7080g_context_t *context,
+		size_t max,
+		sim7080g_recv_sink_t sink,
+		void *arg
+)
 {
 	if (!sim7080g_cn_is_active(context)) return 0;
 
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
+	CommandBuffer cb;
+	ResponseParser rp;
 
 	size_t recv_len;
-	uint8_t command[100] = {0};
-	size_t command_len = 0;
-	uint8_t *dst_p = dst;
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received;
 	size_t total_received = 0;
-	uint8_t len_str[6];
-	uint8_t *str_p = NULL;
-	uint16_t data_len = 0;
-	uint8_t *r = NULL;
-	while (dst_len - total_received) {
-		if (dst_len - total_received > MODEM_TCP_SEND_MAX)
-			recv_len = MODEM_TCP_SEND_MAX;
+	while (max - total_received) {
+		if (max - total_received > MODEM_TCP_RECV_MAX)
+			recv_len = MODEM_TCP_RECV_MAX;
 		else
-			recv_len = dst_len - total_received;
+			recv_len = max - total_received;
 
-		command_len = sprintf(command, "+CARECV=0,%u", recv_len);
+		cb_command(&cb, "+CARECV=0,");
+		cb_write_uint(&cb, recv_len);
 
-		cb_reset(cb);
-		cb_at_prefix_set(cb);
-		cb_write(cb, command, command_len);
+		sim7080g_cb_write_blocking(context, &cb);
 
-		sim7080g_cb_write_blocking(context, cb);
-		
-		received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
+		_response_begin(context, &rp, AT_KEY_CARECV);
+		_response_read(context, &rp, make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US));
 
-		rp_reset(rp);
-		rp_parse(rp, read_buffer, received);
+		// A pause in the middle of the payload ends a read early, the
+		// rest is still on its way
+		absolute_time_t timeout_time = make_timeout_time_us(MODEM_TCP_RECV_TIMEOUT_US);
+		while (!rp_complete(&rp) && _response_read(context, &rp, timeout_time));
 
-		uint8_t index;
-		if (!rp_contains(rp, "+CARECV: ", 9, &index)) return 0; 
-	
-		uint8_t *response; 
-		uint32_t response_len;
-		if (!rp_get(rp, index, &response, &response_len)) return 0;
+		// Data of a response that never finished may not all be in the
+		// ring, none of it is handed over
+		if (!rp_complete(&rp)) {
+			context->at_stats.timeouts++;
+			return -1;
+		}
+
+		if (!rp_contains_ok(&rp) || !_response_find(context, &rp, AT_KEY_CARECV, NULL)) return -1;
 
 		// No data
-		if (response[9] == '0') break;
-		
-		str_p = len_str;	
-		for (r = &response[9]; *r != ','; r++) {
-			*str_p++ = *r;	
+		const struct rp_span_s *data = rp_find(&rp, RP_LINE_DATA);
+		if (data == NULL || data->length == 0) {
+			context->data_pending = false;
+			break;
 		}
-		*str_p = '\0';
-		// set r to first byte of data
-		r++;
-		data_len = atoi(len_str);
-
-		for (int i = 0; i < data_len; i++) {
-			if (total_received == dst_len) break;
-			*dst_p++ = *r++;
-			total_received++;
+
+		// Handed over where it lies in the ring, which holds it until
+		// the next command
+		uint32_t index = data->offset & (MODEM_RX_RING_SIZE - 1);
+		size_t first = MODEM_RX_RING_SIZE - index;
+		if (first > data->length) first = data->length;
+
+		sink(&context->rx_ring[index], first, arg);
+		if (first < data->length)
+			sink(context->rx_ring, data->length - first, arg);
+
+		total_received += data->length;
+
+		// Less than asked for, nothing left until the next +CADATAIND
+		if (data->length < recv_len) {
+			context->data_pending = false;
+			break;
 		}
 	}
 
@@ -568,48 +1047,42 @@ size_t sim7080g_tcp_recv_within_us(
 }
 
 bool sim7080g_tcp_recv_ready_within_us(sim7080g_context_t *context, uint64_t timeout) {
-
-	ResponseParser *rp = &(ResponseParser) {0};
-
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = 0;
-	bool success = false;
 	absolute_time_t timeout_time = make_timeout_time_us(timeout);
-	while (get_absolute_time() < timeout_time) {
 
-		received = sim7080g_read_within_us(context, read_buffer, RX_BUFFER_SIZE, timeout);
-		rp_reset(rp);
-		rp_parse(rp, read_buffer, received);
+	for (;;) {
+		sim7080g_urc_poll(context);
+		if (context->data_pending) return true;
 
-		if (rp_contains(rp, "+CADATAIND: 0", 13, NULL)) {
-			success = true;
-			break;
-		}
+		if (!_rx_wait(context, _rx_available(context), timeout_time)) return false;
 	}
+}
 
-	return success;
+bool sim7080g_tcp_data_pending(sim7080g_context_t *context) {
+	sim7080g_urc_poll(context);
+	return context->data_pending;
 }
 
 bool sim7080g_tcp_is_open(sim7080g_context_t *context) {
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CASTATE?", 9);
+	sim7080g_urc_poll(context);
+	if (context->socket_state != MODEM_LINK_UNKNOWN)
+		return context->socket_state == MODEM_LINK_UP;
+
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+CASTATE?");
 
 	sim7080g_cb_write_blocking(context, cb);
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = 0;
-	for (;;) {
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_CASTATE);
 
-		received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
-		rp_parse(rp, read_buffer, received);
+	absolute_time_t response_time = make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US);
+	while (!rp_complete(&rp) && _response_read(context, &rp, response_time));
 
-		if (rp_contains_ok_or_err(rp)) break;
-		sleep_ms(50);
-	}
+	if (!rp_contains_ok(&rp)) return false;
+
+	bool open = _response_find(context, &rp, AT_KEY_CASTATE, "0,1") != NULL;
+	context->socket_state = open ? MODEM_LINK_UP : MODEM_LINK_DOWN;
 
-	return rp_contains(rp, "+CASTATE: 0,1", 13, NULL);
+	return open;
 }
 
 void sim7080g_read_to_null(sim7080g_context_t *context) {
@@ -617,23 +1090,440 @@ void sim7080g_read_to_null(sim7080g_context_t *context) {
 }
 
 bool sim7080g_toggle_power(sim7080g_context_t *context) {
-	gpio_put(context->pin_power, 0);
+	sim7080g_power_key_set(context, true);
 	sleep_ms(2500);
-	gpio_put(context->pin_power, 1);
+	sim7080g_power_key_set(context, false);
+
+	return true;
+}
+
+void sim7080g_power_key_set(sim7080g_context_t *context, bool pressed) {
+	// PWRKEY is active low
+	gpio_put(context->pin_power, !pressed);
+
+	// Whatever comes back up may not be what went down
+	_link_state_forget(context);
 }
 
 bool sim7080g_power_down(sim7080g_context_t *context) {
-	CommandBuffer *cb = cb_reset(&(CommandBuffer) {0});
-	cb_at_prefix_set(cb);
-	cb_write(cb, "+CPOWD=1", 8);
+	CommandBuffer *cb = cb_command(&(CommandBuffer) {0}, "+CPOWD=1");
 
 	sim7080g_cb_write_blocking(context, cb);
 
-	ResponseParser *rp = rp_reset(&(ResponseParser) {0});
-	uint8_t read_buffer[RX_BUFFER_SIZE];
-	uint32_t received = sim7080g_read_blocking(context, read_buffer, RX_BUFFER_SIZE);
-	rp_parse(rp, read_buffer, received);
+	ResponseParser rp;
+	_response_begin(context, &rp, AT_KEY_NONE);
+	_response_read(context, &rp, make_timeout_time_us(MODEM_RESPONSE_TIMEOUT_US));
 
-	bool success = rp_contains(rp, "NORMAL POWER DOWN", 17, NULL);
-	return success;
+	if (!rp_complete(&rp) || rp.final != RP_LINE_POWER_DOWN) return false;
+
+	_link_state_forget(context);
+	return true;
+}
+
+// Receives into the ring from the UART IRQ
+// Interrupts on the RX FIFO filling up or going quiet, so a short
+// response is in the ring within a few character times of its last byte
+static void _rx_irq_enable(sim7080g_context_t *context) {
+	uint index = uart_get_index(context->uart);
+	_rx_contexts[index] = context;
+
+	irq_set_exclusive_handler(index ? UART1_IRQ : UART0_IRQ, index ? _uart1_irq : _uart0_irq);
+	irq_set_enabled(index ? UART1_IRQ : UART0_IRQ, true);
+	uart_set_irq_enables(context->uart, true, false);
+}
+
+static void _rx_irq(uint index) {
+	sim7080g_context_t *context = _rx_contexts[index];
+
+	// A FIFO's worth at a time, published in one go
+	uint8_t bytes[32];
+	while (uart_is_readable(context->uart)) {
+		uint count = 0;
+		while (count < sizeof bytes && uart_is_readable(context->uart))
+			bytes[count++] = uart_getc(context->uart);
+
+		// Newest bytes give way, readers own everything they haven't
+		// consumed
+		context->rx_dropped += count - spsc_buffer_push(&context->rx, bytes, count);
+	}
+
+	// Wakes a reader waiting on the other core
+	__sev();
+}
+
+static void _uart0_irq(void) {
+	_rx_irq(0);
+}
+
+static void _uart1_irq(void) {
+	_rx_irq(1);
+}
+
+static uint32_t _rx_available(sim7080g_context_t *context) {
+	return spsc_buffer_length(&context->rx);
+}
+
+// Position just past the newest byte received
+static uint32_t _rx_head(sim7080g_context_t *context) {
+	return context->rx_tail + _rx_available(context);
+}
+
+// Hands everything before [position] back to the IRQ
+static void _rx_consume(sim7080g_context_t *context, uint32_t position) {
+	spsc_buffer_commit(&context->rx, position - context->rx_tail);
+	context->rx_tail = position;
+}
+
+// Sleeps until the ring holds more than [have] bytes
+//
+// return: false if [until] came first
+static bool _rx_wait(sim7080g_context_t *context, uint32_t have, absolute_time_t until) {
+	while (_rx_available(context) <= have) {
+		if (time_reached(until)) return false;
+
+		// Woken by the RX IRQ or the timeout, whichever comes first
+		best_effort_wfe_or_timeout(until);
+	}
+
+	return true;
+}
+
+static uint8_t _rx_peek(sim7080g_context_t *context, uint32_t offset) {
+	return context->rx_ring[(context->rx_tail + offset) & (MODEM_RX_RING_SIZE - 1)];
+}
+
+static uint8_t _rx_pop(sim7080g_context_t *context) {
+	uint8_t c = _rx_peek(context, 0);
+	_rx_consume(context, context->rx_tail + 1);
+	return c;
+}
+
+// Length of the complete line at the front of the ring
+//
+// return: 0 if the line hasn't been fully received
+static size_t _rx_line_length(sim7080g_context_t *context) {
+	uint32_t available = _rx_available(context);
+
+	for (uint32_t i = 0; i < available; i++) {
+		uint8_t c = _rx_peek(context, i);
+		if (c == '\r' || c == '\n') return i;
+
+		// The send prompt never gets a line ending
+		if (i == 1 && c == ' ' && _rx_peek(context, 0) == '>') return 2;
+	}
+
+	// A line longer than the ring is handed out in pieces
+	return available == MODEM_RX_RING_SIZE ? available : 0;
+}
+
+// Readers other than the span based ones consume as they go. Spans of
+// the last response stay valid until the next read, then it is let go.
+static void _rx_release(sim7080g_context_t *context) {
+	if ((int32_t)(context->rx_release - context->rx_tail) > 0)
+		_rx_consume(context, context->rx_release);
+}
+
+// Starts parsing the response to a command just sent
+// [command] is its response prefix, see rp_reset
+static void _response_begin(sim7080g_context_t *context, ResponseParser *rp, AT_KEY command) {
+	_rx_release(context);
+	rp_reset(rp, context->rx_tail, command);
+}
+
+// Feeds [rp] from the ring as bytes arrive, in place
+// Stops at the final line, or once nothing new has arrived for
+// READ_STOP_TIMEOUT_US. Can be called again to carry on with a response
+// that isn't complete.
+//
+// return: false if nothing arrived before [until]
+static bool _response_read(sim7080g_context_t *context, ResponseParser *rp, absolute_time_t until) {
+	if (!_rx_wait(context, rp->position - context->rx_tail, until)) {
+		if (!is_nil_time(context->command_sent)) {
+			context->at_stats.timeouts++;
+			context->command_sent = nil_time;
+		}
+		return false;
+	}
+
+	_at_latency_record(context);
+
+	for (;;) {
+		_response_feed(context, rp);
+		if (rp_complete(rp)) break;
+
+		if (!_rx_wait(context, rp->position - context->rx_tail, make_timeout_time_us(READ_STOP_TIMEOUT_US)))
+			break;
+	}
+
+	return true;
+}
+
+// Feeds [rp] what has been received so far, without waiting
+static void _response_feed(sim7080g_context_t *context, ResponseParser *rp) {
+	uint dispatched = rp_num_spans(rp);
+	uint32_t head = _rx_head(context);
+
+	// Up to the newest byte, in at most two pieces around the wrap
+	while (rp->position != head && !rp_complete(rp)) {
+		uint32_t index = rp->position & (MODEM_RX_RING_SIZE - 1);
+		uint32_t len = head - rp->position;
+		if (len > MODEM_RX_RING_SIZE - index) len = MODEM_RX_RING_SIZE - index;
+
+		rp_feed(rp, &context->rx_ring[index], len);
+	}
+
+	context->rx_release = rp->position;
+
+	for (; dispatched < rp_num_spans(rp); dispatched++)
+		if (rp->spans[dispatched].type == RP_LINE_URC)
+			_urc_dispatch(context, &rp->spans[dispatched]);
+}
+
+// Line of [rp] with [key], its arguments starting with [args], NULL for
+// any: "+CASTATE: 0,1" is AT_KEY_CASTATE with "0,1"
+//
+// return: NULL if there is none
+static const struct rp_span_s *_response_find(
+		sim7080g_context_t *context,
+		ResponseParser *rp,
+		AT_KEY key,
+		const char *args
+)
+{
+	for (uint i = 0; i < rp_num_spans(rp); i++) {
+		const struct rp_span_s *span = &rp->spans[i];
+		if (span->key != key || span->type == RP_LINE_DATA) continue;
+
+		if (args == NULL || _span_args_start_with(context, span, args))
+			return span;
+	}
+
+	return NULL;
+}
+
+// Arguments of keyword line [span], past its ": ", start with [args]
+static bool _span_args_start_with(
+		sim7080g_context_t *context,
+		const struct rp_span_s *span,
+		const char *args
+)
+{
+	size_t skip = at_key_length(span->key) + 2;
+	size_t n = strlen(args);
+	if (skip + n > span->length) return false;
+
+	for (size_t i = 0; i < n; i++)
+		if (context->rx_ring[(span->offset + skip + i) & (MODEM_RX_RING_SIZE - 1)] != (uint8_t)args[i])
+			return false;
+
+	return true;
+}
+
+// Copies [span] out of the ring, starting [skip] bytes in
+//
+// return: bytes copied
+static size_t _span_copy(
+		sim7080g_context_t *context,
+		const struct rp_span_s *span,
+		size_t skip,
+		uint8_t *dst,
+		size_t dst_len
+)
+{
+	if (skip >= span->length) return 0;
+
+	size_t len = span->length - skip;
+	if (len > dst_len) len = dst_len;
+
+	uint32_t index = (span->offset + skip) & (MODEM_RX_RING_SIZE - 1);
+	size_t first = MODEM_RX_RING_SIZE - index;
+	if (first > len) first = len;
+
+	memcpy(dst, &context->rx_ring[index], first);
+	memcpy(&dst[first], context->rx_ring, len - first);
+
+	return len;
+}
+
+// sim7080g_tcp_recv's sink
+static void _recv_buffer_sink(const uint8_t *data, size_t len, void *arg) {
+	struct _recv_buffer_s *buffer = arg;
+
+	memcpy(&buffer->dst[buffer->len], data, len);
+	buffer->len += len;
+}
+
+// First byte back since the last command
+static void _at_latency_record(sim7080g_context_t *context) {
+	if (is_nil_time(context->command_sent)) return;
+
+	uint32_t latency = absolute_time_diff_us(context->command_sent, get_absolute_time());
+	context->at_stats.commands++;
+	context->at_stats.total_us += latency;
+	if (latency > context->at_stats.max_us)
+		context->at_stats.max_us = latency;
+	context->command_sent = nil_time;
+}
+
+// Runs the driver's own state tracking, then the subscribed handlers
+static void _urc_dispatch(sim7080g_context_t *context, const struct rp_span_s *span) {
+	switch (span->key) {
+	case AT_KEY_APP_PDP:
+		if (_span_args_start_with(context, span, "0,ACTIVE")) {
+			context->pdp_state = MODEM_LINK_UP;
+		} else if (_span_args_start_with(context, span, "0,DEACTIVE")) {
+			// Takes the socket with it
+			context->pdp_state = MODEM_LINK_DOWN;
+			context->socket_state = MODEM_LINK_DOWN;
+			context->data_pending = false;
+		}
+		break;
+
+	case AT_KEY_CASTATE:
+		if (_span_args_start_with(context, span, "0,0"))
+			context->socket_state = MODEM_LINK_DOWN;
+		else if (_span_args_start_with(context, span, "0,1"))
+			context->socket_state = MODEM_LINK_UP;
+		break;
+
+	case AT_KEY_CADATAIND:
+		if (_span_args_start_with(context, span, "0"))
+			context->data_pending = true;
+		break;
+
+	case AT_KEY_RDY:
+		// Modem has restarted on its own
+		_link_state_forget(context);
+		break;
+
+	default:
+		break;
+	}
+
+	if (context->urc_handlers_num == 0) return;
+
+	uint8_t line[MODEM_URC_LINE_MAX];
+	size_t line_len = _span_copy(context, span, 0, line, sizeof line);
+
+	for (uint i = 0; i < context->urc_handlers_num; i++) {
+		struct sim7080g_urc_s *urc = &context->urc_handlers[i];
+		if (_line_starts_with(line, line_len, urc->prefix))
+			urc->handler(context, line, line_len, urc->arg);
+	}
+}
+
+static bool _line_starts_with(const uint8_t *line, size_t line_len, const char *prefix) {
+	size_t n = strlen(prefix);
+	return line_len >= n && memcmp(line, prefix, n) == 0;
+}
+
+static void _link_state_forget(sim7080g_context_t *context) {
+	context->pdp_state = MODEM_LINK_UNKNOWN;
+	context->socket_state = MODEM_LINK_UNKNOWN;
+	context->data_pending = false;
+}
+
+// Writes out the front of the queue, chaining what can be
+static void _at_queue_send(sim7080g_context_t *context) {
+	struct sim7080g_at_s *first = _at_queued(context, 0);
+	uint8_t *buffer = cb_get_buffer(&first->cb);
+	uint32_t length = cb_length(&first->cb) - 1; // Without \r
+
+	uint64_t timeout = first->timeout_us;
+	uint count = 1;
+
+	sim7080g_write_blocking(context, buffer, length);
+
+	// AT+A;+B answers with one OK for the lot
+	while (count < context->at_queue_num
+			&& _at_chainable(first)
+			&& _at_chainable(_at_queued(context, count))) {
+		struct sim7080g_at_s *next = _at_queued(context, count);
+		uint32_t next_len = cb_length(&next->cb) - 3; // Without AT and \r
+
+		if (length + 1 + next_len > COMMAND_BUFFER_MAX + 2) break;
+
+		sim7080g_write_blocking(context, ";", 1);
+		sim7080g_write_blocking(context, cb_get_buffer(&next->cb) + 2, next_len);
+		length += 1 + next_len;
+
+		if (next->timeout_us > timeout) timeout = next->timeout_us;
+		count++;
+	}
+
+	sim7080g_write_blocking(context, "\r", 1);
+	context->command_sent = get_absolute_time();
+
+	_response_begin(context, &context->at_rp, first->response);
+	context->at_in_flight = count;
+	context->at_deadline = make_timeout_time_us(timeout);
+}
+
+// Set commands answering only OK, in extended AT+ syntax
+static bool _at_chainable(struct sim7080g_at_s *at) {
+	uint8_t *buffer = cb_get_buffer(&at->cb);
+	return at->response == AT_KEY_NONE && cb_length(&at->cb) > 3 && buffer[2] == '+';
+}
+
+// [n]th command in the queue, oldest first
+static struct sim7080g_at_s *_at_queued(sim7080g_context_t *context, uint n) {
+	return &context->at_queue[(context->at_queue_first + n) % MODEM_AT_QUEUE_MAX];
+}
+
+// Sends AT[command] and waits a short while for its OK
+static bool _link_command(sim7080g_context_t *context, CommandBuffer *cb) {
+	sim7080g_cb_write_blocking(context, cb);
+
+	return sim7080g_read_ok_within_us(context, MODEM_LINK_TIMEOUT_US);
+}
+
+// Modem answers at the current rate
+static bool _link_check(sim7080g_context_t *context) {
+	sleep_ms(MODEM_LINK_SETTLE_MS);
+
+	// What arrived mid change is noise
+	sim7080g_read_to_null(context);
+
+	for (uint tries = 0; tries < MODEM_LINK_CHECK_TRIES; tries++)
+		if (_link_command(context, cb_command(&(CommandBuffer) {0}, "E0"))) return true;
+
+	return false;
+}
+
+static void _link_uart_set(sim7080g_context_t *context, uint baud, bool flow) {
+	// Whatever is still going out goes at the old rate
+	uart_tx_wait_blocking(context->uart);
+
+	if (baud != context->baud) {
+		uart_set_baudrate(context->uart, baud);
+		context->baud = baud;
+	}
+
+	if (flow != context->flow) {
+		_link_flow_pins(context, flow);
+		uart_set_hw_flow(context->uart, flow, flow);
+		context->flow = flow;
+	}
+}
+
+// Flow control pins to the UART, or left as GPIOs with RTS held
+// asserted, so a modem that still has flow control on keeps sending
+static void _link_flow_pins(sim7080g_context_t *context, bool flow) {
+	if (context->pin_cts == MODEM_PIN_NONE || context->pin_rts == MODEM_PIN_NONE)
+		return;
+
+	if (flow) {
+		gpio_set_function(context->pin_cts, GPIO_FUNC_UART);
+		gpio_set_function(context->pin_rts, GPIO_FUNC_UART);
+		return;
+	}
+
+	gpio_init(context->pin_cts);
+	gpio_set_dir(context->pin_cts, GPIO_IN);
+	gpio_pull_up(context->pin_cts);
+
+	// Active low
+	gpio_init(context->pin_rts);
+	gpio_set_dir(context->pin_rts, GPIO_OUT);
+	gpio_put(context->pin_rts, 0);
 }
@@ -3,15 +3,22 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "pico/time.h"
 #include "hardware/uart.h"
 
+#include "spsc_buffer.h"
+
 #include "command_buffer.h"
 #include "response_parser.h"
 
 #define MODEM_READ_BUFFER_SIZE 1024
+#define MODEM_RX_RING_SIZE 2048 // Power of 2, holds a full CARECV
 #define WRITE_TIMEOUT_RESOLUTION_US 100
 #define READ_STOP_TIMEOUT_US (1000 * 10)
+#define MODEM_RESPONSE_TIMEOUT_US (1000 * 1000 * 5) // Most a command waits for its response
+#define MODEM_NETWORK_TIMEOUT_US (1000 * 1000 * 30) // Same for +CNACT and +CAOPEN, which wait on the network
 #define MODEM_TCP_SEND_MAX 1459
+#define MODEM_TCP_RECV_MAX 1460 // Most one CARECV hands back
 
 #define UART_PORT uart0
 #define UART_BAUD 115200
@@ -19,19 +26,109 @@
 #define UART_PIN_RX 1
 
 #define MODEM_PIN_PWR 14
+#define MODEM_PIN_NONE 0xFF // Flow control pins not wired
 #define MODEM_APN "iot.1nce.net"
-#define SERVER_URL "34.27.138.203"
-#define SERVER_PORT 8086
+
+// AT command latency, from a command being written to the first byte
+// of its response
+struct sim7080g_at_stats_s {
+	uint32_t commands;  // Commands that got a response
+	uint32_t timeouts;  // Responses given up on by a _within_us read
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t rx_dropped; // Received bytes lost to a full RX ring
+};
+
+#define MODEM_URC_HANDLERS_MAX 8
+#define MODEM_URC_LINE_MAX 64 // Longer URCs are cut short for handlers
 
 // Modem state object
 typedef struct _sim7080g_context sim7080g_context_t;
 
+// Called with a URC line, without its line ending
+typedef void (*sim7080g_urc_handler_t)(
+		sim7080g_context_t *context,
+		const uint8_t *line,
+		size_t line_len,
+		void *arg
+);
+
+struct sim7080g_urc_s {
+	const char *prefix;
+	sim7080g_urc_handler_t handler;
+	void *arg;
+};
+
+#define MODEM_AT_QUEUE_MAX 4
+
+// Called once a queued command has its response
+// [rp] spans point into the receive ring and stay valid until the next
+// read. Commands that went out chained share one response, and an ERROR
+// in it can't be pinned on one of them. [timed_out] is true if the
+// response never completed.
+typedef void (*sim7080g_at_done_t)(
+		sim7080g_context_t *context,
+		ResponseParser *rp,
+		bool timed_out,
+		void *arg
+);
+
+struct sim7080g_at_s {
+	CommandBuffer cb;
+	AT_KEY response; // Response keyword, AT_KEY_NONE if it only answers OK
+	uint64_t timeout_us;
+	sim7080g_at_done_t done;
+	void *arg;
+};
+
+// Link state as last reported by the modem
+enum sim7080g_link_state_e {
+	MODEM_LINK_UNKNOWN, // Has to be asked
+	MODEM_LINK_DOWN,
+	MODEM_LINK_UP
+};
+
 struct _sim7080g_context {
 	const char *apn;
 	uart_inst_t *uart;
 	uint pin_tx;
 	uint pin_rx;
 	uint pin_power;
+	uint pin_cts; // MODEM_PIN_NONE unless given to sim7080g_link_set
+	uint pin_rts;
+
+	uint baud;      // UART rate as set now
+	uint baud_fast; // Rate sim7080g_link_negotiate asks for
+	bool flow;      // RTS/CTS on at both ends
+
+	absolute_time_t command_sent; // nil_time once the response has started
+	struct sim7080g_at_stats_s at_stats;
+
+	// UART receive ring, filled by the UART IRQ on the core that called
+	// sim7080g_init. The IRQ is the producer of [rx], readers are its
+	// consumer. Positions run free and are masked on use.
+	uint8_t rx_ring[MODEM_RX_RING_SIZE];
+	spsc_buffer_t rx;          // Over rx_ring
+	uint32_t rx_tail;          // Position of rx's tail, as spans count it
+	uint32_t rx_release;       // End of the last parsed response, see response_parser.h
+	volatile uint32_t rx_dropped;
+
+	struct sim7080g_urc_s urc_handlers[MODEM_URC_HANDLERS_MAX];
+	uint urc_handlers_num;
+
+	// Kept from URCs and command responses, see sim7080g_urc_poll
+	uint8_t pdp_state;    // sim7080g_link_state_e
+	uint8_t socket_state; // sim7080g_link_state_e
+	bool data_pending;    // +CADATAIND seen since the last drained CARECV
+
+	// Queued commands, a ring from [at_queue_first]. The first
+	// [at_in_flight] of them have been written out and share [at_rp].
+	struct sim7080g_at_s at_queue[MODEM_AT_QUEUE_MAX];
+	uint at_queue_first;
+	uint at_queue_num;
+	uint at_in_flight;
+	absolute_time_t at_deadline;
+	ResponseParser at_rp;
 };
 
 sim7080g_context_t * sim7080g_create(void);
@@ -57,8 +154,98 @@ void sim7080g_init(
 );
 
 bool sim7080g_start(sim7080g_context_t *context);
+
+// Sets what sim7080g_link_negotiate asks the modem for
+// With both flow control pins wired RTS/CTS goes on before the rate goes
+// up, so neither end can overrun the other. The modem keeps the rate
+// over a power cycle, so one the wiring can't carry leaves it out of
+// reach.
+//
+// baud    - UART rate to move to, one AT+IPR takes (230400, 921600,
+//           2000000, 3000000, ...)
+// pin_cts - UART CTS gpio pin, MODEM_PIN_NONE if not wired
+// pin_rts - UART RTS gpio pin, MODEM_PIN_NONE if not wired
+void sim7080g_link_set(sim7080g_context_t *context, uint baud, uint pin_cts, uint pin_rts);
+
+// Moves a responsive modem to the rate and flow control given to
+// sim7080g_link_set and checks the link at the new rate. If it doesn't
+// hold both ends go back to UART_BAUD without flow control. Does nothing
+// once there.
+//
+// return: the UART rate in use
+//
+// BLOCKING: for a second or so at worst, each command it sends gets
+// 100 ms to answer
+uint sim7080g_link_negotiate(sim7080g_context_t *context);
+
+void sim7080g_at_stats_get(sim7080g_context_t *context, struct sim7080g_at_stats_s *dst);
+void sim7080g_at_stats_reset(sim7080g_context_t *context);
 bool sim7080g_config(sim7080g_context_t *context);
 
+// Calls [handler] for every URC starting with [prefix]
+// [prefix] has to outlive the subscription. URCs that arrive in the
+// middle of a command's response are only recognised if their keyword
+// is a URC one in at_keywords.c, any prefix is recognised between
+// commands.
+//
+// return: false if all MODEM_URC_HANDLERS_MAX are taken
+bool sim7080g_urc_subscribe(
+		sim7080g_context_t *context,
+		const char *prefix,
+		sim7080g_urc_handler_t handler,
+		void *arg
+);
+
+void sim7080g_urc_unsubscribe(sim7080g_context_t *context, sim7080g_urc_handler_t handler);
+
+// Handles every complete line received since the last command
+// Lines between commands can only be URCs. The driver tracks PDP
+// context, socket and data-ready state from +APP PDP, +CASTATE and
+// +CADATAIND, so sim7080g_cn_is_active, sim7080g_tcp_is_open and
+// sim7080g_tcp_data_pending mostly don't have to ask the modem. URCs
+// that arrive along with a command's response are handled with it, so
+// this only needs calling while the modem is otherwise left alone.
+//
+// NON-BLOCKING
+void sim7080g_urc_poll(sim7080g_context_t *context);
+
+// Queues a command to be sent by sim7080g_at_pump
+// [cb] is copied. Commands with no [response] keyword are set commands
+// answering just OK, neighbouring ones of those go out chained on one
+// line with ';' like sim7080g_config does, saving a round trip each.
+// Every blocking call waits for the queue to empty before writing its
+// own command, so the two can be mixed.
+//
+// response - keyword of the command's response lines, e.g. AT_KEY_CASTATE
+// timeout  - how long to wait for the response once written out
+// done     - called with the response, may be NULL
+//
+// return: false if the queue is full
+bool sim7080g_at_enqueue(
+		sim7080g_context_t *context,
+		CommandBuffer *cb,
+		AT_KEY response,
+		uint64_t timeout,
+		sim7080g_at_done_t done,
+		void *arg
+);
+
+// Moves the queue along: completes the command in flight once its
+// response is in or it has timed out, then writes out the next
+//
+// return: commands queued or in flight
+//
+// NON-BLOCKING
+uint sim7080g_at_pump(sim7080g_context_t *context);
+
+// return: true while commands are queued or in flight
+bool sim7080g_at_busy(sim7080g_context_t *context);
+
+// Pumps until the queue is empty
+//
+// BLOCKING
+void sim7080g_at_flush(sim7080g_context_t *context);
+
 // Writes to modem over UART
 //
 // modem   - Modem state object pointer 
@@ -68,7 +255,7 @@ bool sim7080g_config(sim7080g_context_t *context);
 // BLOCKING: will block until entire source buffer is written to UART
 void sim7080g_write_blocking(
 		sim7080g_context_t *context,
-		const uint8_t src[],
+		const void *src,
 		size_t src_len
 );
 
@@ -85,7 +272,7 @@ void sim7080g_write_blocking(
 // NON-BLOCKING: Will not block for > (timeout + WRITE_TIMEOUT_RESOLUTION_US)
 bool sim7080g_write_within_us (
 		sim7080g_context_t *context, 
-		const uint8_t *src, 
+		const void *src, 
 		size_t src_len, 
 		uint64_t timeout
 ); 
@@ -100,17 +287,42 @@ bool sim7080g_write_within_us (
 //
 // BLOCKING: will block until data is received from modem
 //
-// Under the hood this function works by blocking on a UART read until
-// data is available. Once data has been received, data will continue
-// to be read into the buffer until the buffer is full, or until new
-// data has not been received in > READ_STOP_TIMEOUT_US
+// Under the hood this function sleeps until the UART IRQ has put data
+// in the receive ring. Data is then read into the buffer until a final
+// result line (OK, ERROR, +CME ERROR, NORMAL POWER DOWN or the "> " send
+// prompt) has been parsed, or, for responses without one, no new data
+// has arrived in > READ_STOP_TIMEOUT_US. CARECV data is passed over when
+// looking for the final line. What doesn't fit in the buffer is dropped.
 uint32_t sim7080g_read_blocking(sim7080g_context_t *context, uint8_t *dst, size_t dst_len);
 
+// Reads the next complete line from modem, without its line ending
+// Empty lines are skipped. The "> " send prompt counts as a line. Bytes
+// of a line that is still arriving are left in the receive ring.
+//
+// modem   - Modem state object pointer
+// dst     - Destination buffer to read into
+// dst_len - Length of destination buffer, the rest of a longer line is
+//           dropped
+// timeout - Timout time in micro-seconds
+//
+// return: # of bytes read to buffer
+//         0 if no complete line arrived in time
+//
+// NON-BLOCKING: Will not block for > timeout
+size_t sim7080g_read_line_within_us(
+		sim7080g_context_t *context,
+		uint8_t *dst,
+		size_t dst_len,
+		uint64_t timeout
+);
+
 // Reads from moding and checks if data contains OK message
 //
 // modem - Modem state object pointer
 //
 // return: true if read data contains OK message
+//
+// BLOCKING: for at most MODEM_RESPONSE_TIMEOUT_US
 bool sim7080g_read_blocking_ok(sim7080g_context_t *context);
 
 bool sim7080g_read_ok_within_us(sim7080g_context_t *context, uint64_t timeout);
@@ -157,6 +369,9 @@ bool sim7080g_cb_write_within_us(
 
 
 // Tests if modem is ready to accept commands
+// The modem keeps an AT+IPR rate over a power cycle. One that doesn't
+// answer is tried at the other of UART_BAUD and the sim7080g_link_set
+// rate next time, without flow control.
 //
 // modem - pointer to Modem state object
 //
@@ -180,7 +395,23 @@ bool sim7080g_sim_ready(sim7080g_context_t *context);
 // 		   false otherwise
 bool sim7080g_cn_available(sim7080g_context_t *context);
 
+// Queues the command sim7080g_cn_available sends
+// [done] can hand its response to sim7080g_cn_available_response.
+//
+// return: false if the queue is full
+bool sim7080g_cn_available_enqueue(
+		sim7080g_context_t *context,
+		sim7080g_at_done_t done,
+		void *arg
+);
+
+// return: true if [rp], the response to a queued
+//         sim7080g_cn_available_enqueue, says a network is detected
+bool sim7080g_cn_available_response(sim7080g_context_t *context, ResponseParser *rp);
+
 // Tests if a network connection is currently active
+// Only asks the modem when no +APP PDP or CNACT response has been seen
+// since the last power change.
 //
 // modem - pointer to Modem state object
 //
@@ -197,6 +428,61 @@ bool sim7080g_cn_is_active(sim7080g_context_t *context);
 //         false if there was an error
 bool sim7080g_cn_activate(sim7080g_context_t *context, bool activate);
 
+// Queues the command sim7080g_cn_activate sends, without its checks
+// [done] only gets the OK. The +APP PDP URC that says whether it took
+// trails it, see sim7080g_cn_state.
+//
+// return: false if the queue is full
+bool sim7080g_cn_activate_enqueue(
+		sim7080g_context_t *context,
+		bool activate,
+		sim7080g_at_done_t done,
+		void *arg
+);
+
+// PDP context state as last reported, without asking the modem
+// MODEM_LINK_UNKNOWN from sim7080g_cn_activate_enqueue until +APP PDP
+// says how it went.
+//
+// NON-BLOCKING
+enum sim7080g_link_state_e sim7080g_cn_state(sim7080g_context_t *context);
+
+// Enable/disable power saving mode
+// The modem sleeps between periodic tracking area updates while staying
+// registered, so the next wake skips network attach.
+//
+// modem  - pointer to Modem state object
+// enable - true to request PSM
+// 			false to turn it off
+// tau    - requested T3412 periodic TAU, 8 bit string e.g. "00100010"
+// active - requested T3324 active time, 8 bit string e.g. "00000101"
+//
+// return: true if command was successful
+//         false if there was an error
+bool sim7080g_psm_set(
+		sim7080g_context_t *context,
+		bool enable,
+		const char *tau,
+		const char *active
+);
+
+// Builds the command sim7080g_psm_set sends, for sim7080g_at_enqueue
+void sim7080g_psm_command(CommandBuffer *cb, bool enable, const char *tau, const char *active);
+
+// Enable/disable extended discontinuous reception on CAT-M
+//
+// modem  - pointer to Modem state object
+// enable - true to enable
+// 			false to disable
+// value  - requested eDRX cycle, 4 bit string e.g. "0101"
+//
+// return: true if command was successful
+//         false if there was an error
+bool sim7080g_edrx_set(sim7080g_context_t *context, bool enable, const char *value);
+
+// Builds the command sim7080g_edrx_set sends, for sim7080g_at_enqueue
+void sim7080g_edrx_command(CommandBuffer *cb, bool enable, const char *value);
+
 // Enable/disable SSL
 //
 // modem  - pointer to Modem state object
@@ -221,10 +507,41 @@ void sim7080g_wait_for_cn(sim7080g_context_t *context);
 bool sim7080g_tcp_open(
 		sim7080g_context_t *context, 
 		uint8_t url_len,  
-		uint8_t url[static url_len],
+		const char url[static url_len],
 		uint16_t port
 ); 
 
+// Opens a UDP socket to a remote server
+// Takes the same arguments as sim7080g_tcp_open. Nothing goes over the
+// air until the first send. The socket is used and closed through the
+// same sim7080g_tcp_* calls, each send going out as one datagram.
+bool sim7080g_udp_open(
+		sim7080g_context_t *context, 
+		uint8_t url_len,  
+		const char url[static url_len],
+		uint16_t port
+);
+
+// Queues the command sim7080g_tcp_open, or with [udp] sim7080g_udp_open,
+// sends, without its checks
+// [done] hands its response to sim7080g_socket_open_response.
+//
+// return: false if the queue is full
+bool sim7080g_socket_open_enqueue(
+		sim7080g_context_t *context,
+		bool udp,
+		uint8_t url_len,
+		const char url[static url_len],
+		uint16_t port,
+		sim7080g_at_done_t done,
+		void *arg
+);
+
+// Takes in [rp], the response to a queued sim7080g_socket_open_enqueue
+//
+// return: true if the socket is open
+bool sim7080g_socket_open_response(sim7080g_context_t *context, ResponseParser *rp);
+
 // Close a TCP connection with a remote server
 //
 // modem   - pointer to Modem state object
@@ -240,14 +557,70 @@ bool sim7080g_tcp_send(
 		uint8_t data[static data_len]
 );
 
+// Sends [first] followed by [second] in a single CASEND
+// For data that wraps around the end of a ring buffer. [second] may be
+// NULL when [second_len] is 0.
+// Returns false if the total is 0 or more than MODEM_TCP_SEND_MAX, or
+// if the modem refuses the send
+bool sim7080g_tcp_send_split(
+		sim7080g_context_t *context,
+		size_t first_len,
+		uint8_t *first,
+		size_t second_len,
+		uint8_t *second
+);
+
+// One piece of a gathered send
+struct sim7080g_chunk_s {
+	const uint8_t *data;
+	size_t len;
+};
+
+// Sends [count] chunks back to back in a single CASEND
+// Lets a frame header and ring buffer spans go out without first being
+// copied together. Empty chunks are skipped.
+// Returns false if the total is 0 or more than MODEM_TCP_SEND_MAX, or
+// if the modem refuses the send
+bool sim7080g_tcp_sendv(
+		sim7080g_context_t *context,
+		const struct sim7080g_chunk_s *chunks,
+		uint count
+);
+
 bool sim7080g_tcp_ack(sim7080g_context_t *context, uint *sent, uint *unack);
 
+// Copies up to [dst_len] bytes of what the modem holds for the socket
+// into [dst]
+//
+// return: bytes received
 size_t sim7080g_tcp_recv(
 		sim7080g_context_t *context,
 		size_t dst_len,
 		uint8_t dst[dst_len]
 );
 
+// Gets received data where it lies in the receive ring. [data] is only
+// valid during the call.
+typedef void (*sim7080g_recv_sink_t)(const uint8_t *data, size_t len, void *arg);
+
+// Hands up to [max] bytes of what the modem holds for the socket to
+// [sink], MODEM_TCP_RECV_MAX per CARECV, without copying them out of
+// the receive ring first. Data that wraps around the ring comes in two
+// calls. Where one piece ends says nothing about framing, the caller
+// carries partial frames over to the next call.
+// Stops early once the modem has nothing more, clearing
+// sim7080g_tcp_data_pending.
+// Only data of a CARECV answered in full and with OK is handed over.
+//
+// return: bytes handed to [sink], -1 if a CARECV failed or timed out,
+//         pieces handed over before it stay handed over
+int sim7080g_tcp_recv_to(
+		sim7080g_context_t *context,
+		size_t max,
+		sim7080g_recv_sink_t sink,
+		void *arg
+);
+
 size_t sim7080g_tcp_recv_within_us(
 		sim7080g_context_t *context,
 		size_t dst_len,
@@ -255,14 +628,29 @@ size_t sim7080g_tcp_recv_within_us(
 		uint64_t timeout
 );
 
+// Waits for a +CADATAIND
+// return: true if data is waiting to be received
 bool sim7080g_tcp_recv_ready_within_us(sim7080g_context_t *context, uint64_t timeout);
 
+// return: true if the modem has said data is waiting to be received
+//
+// NON-BLOCKING
+bool sim7080g_tcp_data_pending(sim7080g_context_t *context);
+
+// Only asks the modem when the socket state isn't known from a CAOPEN,
+// CACLOSE or +CASTATE since
 bool sim7080g_tcp_is_open(sim7080g_context_t *context);
 
 void sim7080g_read_to_null(sim7080g_context_t *context);
 
 bool sim7080g_toggle_power(sim7080g_context_t *context);
 
+// Holds ([pressed] = true) or releases the power key
+// Non-blocking alternative to sim7080g_toggle_power. The modem toggles
+// power when the key is held for ~2.5s, the caller does the timing.
+// Forgets the link state tracked from URCs.
+void sim7080g_power_key_set(sim7080g_context_t *context, bool pressed);
+
 bool sim7080g_power_down(sim7080g_context_t *context);
 
 #endif // WISDOM_MODEM_H
@@ -51,14 +51,14 @@ void send_data(struct date_time_s *dt) {
 	send_message("farting...");
 	sensor_read((sensor_t *)&sht30);
 	buf[1] = sensor_pack((sensor_t *)&sht30, (uint8_t *)&buf[2], 100);
-	gateway_queue_push(&buf, buf[1] + 4);
-	int8_t now[5] = {0};
+	// Timestamp goes in the same record as the reading
+	uint8_t *now = ((uint8_t *)buf) + buf[1] + 4;
 	scheduler_date_time_get_packed(now);
-	gateway_queue_push(now, 5);
+	gateway_queue_push(&buf, buf[1] + 4 + 5);
 
 	int rval = gateway_pump();
 	
-	while (rval != MODEM_POWERED_DOWN) {
+	while (rval != MODEM_POWERED_DOWN && rval != MODEM_IDLE) {
 		switch (rval) {
 		case MODEM_POWERED_DOWN:
 			send_message("State: MODEM_POWERED_DOWN");
@@ -75,9 +75,12 @@ void send_data(struct date_time_s *dt) {
 		case MODEM_SERVER_CONNECTED:
 			send_message("State: MODEM_SERVER_CONNECTED");
 			break;
+		case MODEM_IDLE:
+			send_message("State: MODEM_IDLE");
+			break;
 		}
 
-		sleep_ms(1000);
+		sleep_until(gateway_next_service());
 		rval = gateway_pump();
 	}
 
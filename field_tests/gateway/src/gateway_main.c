@@ -75,10 +75,12 @@ RETRY:;
 	gateway_queue_push(data, received);
 
 PUMP:;
+#ifndef GATEWAY_DUAL_CORE
 	int rval = gateway_pump();
+	int last_state = -1;
 	
-	while (rval != MODEM_POWERED_DOWN) {
-		switch (rval) {
+	while (rval != MODEM_POWERED_DOWN && rval != MODEM_IDLE) {
+		if (rval != last_state) switch (rval) {
 		case MODEM_POWERED_DOWN:
 			send_message("State: MODEM_POWERED_DOWN");
 			break;
@@ -94,11 +96,16 @@ PUMP:;
 		case MODEM_SERVER_CONNECTED:
 			send_message("State: MODEM_SERVER_CONNECTED");
 			break;
+		case MODEM_IDLE:
+			send_message("State: MODEM_IDLE");
+			break;
 		}
+		last_state = rval;
 
-		sleep_ms(500);
+		sleep_until(gateway_next_service());
 		rval = gateway_pump();
 	}
+#endif // Core1 uploads on its own, straight back to the radio
 
 	send_message("farted!");
 	date_time_add(dt, &add);
@@ -1,7 +1,10 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "cbuffer.h"
 
+static uint8_t *_cbuffer_advance(cbuffer_t *buffer, uint8_t *p, size_t num);
+
 cbuffer_t * cbuffer_create(size_t size) {
 	cbuffer_t *buffer = malloc(sizeof (cbuffer_t));
 	if (buffer == NULL) return NULL;
@@ -52,42 +55,120 @@ size_t cbuffer_length(cbuffer_t *buffer) {
 int cbuffer_push(cbuffer_t *buffer, void *src, size_t size) {
 	if (buffer == NULL || src == NULL) return -1;
 
-	uint8_t *src_bytes = (uint8_t *)src;
-	uint pushed = 0;
-	for (int i = 0; i < size && cbuffer_remaining(buffer) > 0; i++) {
-		*buffer->write_p = src_bytes[i];
+	size_t remaining = cbuffer_remaining(buffer);
+	if (size > remaining) size = remaining;
 
-		buffer->write_p++;
-		buffer->write_index++;
-		pushed++;
+	// Copy in at most two chunks. Everything up to the end
+	// of the array, then whatever wraps around to the beginning.
+	size_t first = buffer->end_p - buffer->write_p;
+	if (first > size) first = size;
 
-		// If we are at end of buffer, cycle to beginning
-		if (buffer->write_p == buffer->end_p)
-			buffer->write_p = buffer->buff;
-	}
+	memcpy(buffer->write_p, src, first);
+	if (size > first)
+		memcpy(buffer->buff, (uint8_t *)src + first, size - first);
 
+	buffer->write_p = _cbuffer_advance(buffer, buffer->write_p, size);
+	buffer->write_index += size;
 
-	return pushed;
+	return size;
 }
 
 int cbuffer_pop(cbuffer_t *buffer, void *dest, size_t num) {
 	if (buffer == NULL || dest == NULL) return -1;
 
-	uint8_t *dest_bytes = (uint8_t *)dest;
-	int popped = 0;
-	for (int i = 0; i < num && !cbuffer_empty(buffer); i++) {
-		if (dest != NULL)
-			dest_bytes[i] = *buffer->base_p;
+	size_t length = cbuffer_length(buffer);
+	if (num > length) num = length;
 
-		buffer->base_p++;
-		popped++;
-		buffer->write_index--;
+	// Same as push, at most two chunks split at the wrap point
+	size_t first = buffer->end_p - buffer->base_p;
+	if (first > num) first = num;
 
-		// If we are at end of buffer, cycle to beginning
-		if (buffer->base_p == buffer->end_p)
-			buffer->base_p = buffer->buff;
-	}
+	memcpy(dest, buffer->base_p, first);
+	if (num > first)
+		memcpy((uint8_t *)dest + first, buffer->buff, num - first);
+
+	buffer->base_p = _cbuffer_advance(buffer, buffer->base_p, num);
+	buffer->write_index -= num;
+
+	return num;
+}
+
+int cbuffer_peek(cbuffer_t *buffer, size_t offset, void *dest, size_t num) {
+	if (buffer == NULL || dest == NULL) return -1;
+
+	size_t length = cbuffer_length(buffer);
+	if (offset >= length) return 0;
+	if (num > length - offset) num = length - offset;
+
+	uint8_t *start = _cbuffer_advance(buffer, buffer->base_p, offset);
+	size_t first = buffer->end_p - start;
+	if (first > num) first = num;
+
+	memcpy(dest, start, first);
+	if (num > first)
+		memcpy((uint8_t *)dest + first, buffer->buff, num - first);
+
+	return num;
+}
+
+size_t cbuffer_peek_span(cbuffer_t *buffer, uint8_t **span) {
+	return cbuffer_peek_span_at(buffer, 0, span);
+}
+
+size_t cbuffer_peek_span_at(cbuffer_t *buffer, size_t offset, uint8_t **span) {
+	if (buffer == NULL || span == NULL) return 0;
+
+	size_t length = cbuffer_length(buffer);
+	if (offset > length) offset = length;
+	length -= offset;
+
+	*span = _cbuffer_advance(buffer, buffer->base_p, offset);
+	size_t contiguous = buffer->end_p - *span;
 
-	return popped;
+	return length < contiguous ? length : contiguous;
 }
 
+int cbuffer_commit(cbuffer_t *buffer, size_t num) {
+	if (buffer == NULL) return -1;
+
+	size_t length = cbuffer_length(buffer);
+	if (num > length) num = length;
+
+	buffer->base_p = _cbuffer_advance(buffer, buffer->base_p, num);
+	buffer->write_index -= num;
+
+	return num;
+}
+
+size_t cbuffer_write_span(cbuffer_t *buffer, uint8_t **span) {
+	if (buffer == NULL || span == NULL) return 0;
+
+	*span = buffer->write_p;
+
+	size_t remaining = cbuffer_remaining(buffer);
+	size_t contiguous = buffer->end_p - buffer->write_p;
+
+	return remaining < contiguous ? remaining : contiguous;
+}
+
+int cbuffer_write_commit(cbuffer_t *buffer, size_t num) {
+	if (buffer == NULL) return -1;
+
+	size_t remaining = cbuffer_remaining(buffer);
+	if (num > remaining) num = remaining;
+
+	buffer->write_p = _cbuffer_advance(buffer, buffer->write_p, num);
+	buffer->write_index += num;
+
+	return num;
+}
+
+static uint8_t *_cbuffer_advance(cbuffer_t *buffer, uint8_t *p, size_t num) {
+	size_t offset = (p - buffer->buff) + num;
+
+	// num is never larger than the buffer, so one wrap is enough
+	if (offset >= cbuffer_size(buffer))
+		offset -= cbuffer_size(buffer);
+
+	return &buffer->buff[offset];
+}
@@ -43,4 +43,42 @@ int cbuffer_push(cbuffer_t *buffer, void *src, size_t size);
 // -1 if [buffer] or [dest] is NULL
 int cbuffer_pop(cbuffer_t *buffer, void *dest, size_t num);
 
+// Copies up to [num] bytes starting [offset] bytes past the front of
+// [buffer] into [dest] without consuming anything
+// Returns number of bytes copied
+// -1 if [buffer] or [dest] is NULL
+int cbuffer_peek(cbuffer_t *buffer, size_t offset, void *dest, size_t num);
+
+// Zero-copy access
+//
+// The span functions hand out pointers straight into the buffer array.
+// A span is the largest contiguous region available before the wrap
+// point, so a full read or write can take two span/commit rounds.
+// Spans stay valid until the matching commit call.
+
+// Points [span] at the oldest unread byte in [buffer]
+// Returns length of readable span in bytes
+// 0 if [buffer] is empty or NULL
+size_t cbuffer_peek_span(cbuffer_t *buffer, uint8_t **span);
+
+// Points [span] at the byte [offset] bytes past the front of [buffer]
+// Returns length of readable span in bytes
+// 0 if [offset] is at or past the end of [buffer] or [buffer] is NULL
+size_t cbuffer_peek_span_at(cbuffer_t *buffer, size_t offset, uint8_t **span);
+
+// Consumes [num] bytes from the front of [buffer] without copying
+// Returns number of bytes consumed
+// -1 if [buffer] is NULL
+int cbuffer_commit(cbuffer_t *buffer, size_t num);
+
+// Points [span] at the next free byte in [buffer]
+// Returns length of writable span in bytes
+// 0 if [buffer] is full or NULL
+size_t cbuffer_write_span(cbuffer_t *buffer, uint8_t **span);
+
+// Marks [num] bytes written through cbuffer_write_span as pushed
+// Returns number of bytes committed
+// -1 if [buffer] is NULL
+int cbuffer_write_commit(cbuffer_t *buffer, size_t num);
+
 #endif // CIRCLE_BUFFER_BROG_H
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+
+#include "record_buffer.h"
+
+static bool _header_read(rbuffer_t *buffer, size_t offset, size_t *size);
+static void _header_build(uint8_t header[RBUFFER_HEADER_SIZE], size_t size);
+
+rbuffer_t * rbuffer_create(size_t size) {
+	rbuffer_t *buffer = malloc(sizeof (rbuffer_t));
+	if (buffer == NULL) return NULL;
+
+	buffer->bytes = cbuffer_create(size);
+	if (buffer->bytes == NULL) {
+		rbuffer_destroy(buffer);
+		return NULL;
+	}
+
+	buffer->count = 0;
+	buffer->span_len = 0;
+
+	return buffer;
+}
+
+void rbuffer_destroy(rbuffer_t *buffer) {
+	if (buffer == NULL) return;
+
+	cbuffer_destroy(buffer->bytes);
+	free(buffer);
+}
+
+size_t rbuffer_count(rbuffer_t *buffer) {
+	if (buffer == NULL) return 0;
+	return buffer->count;
+}
+
+size_t rbuffer_length(rbuffer_t *buffer) {
+	if (buffer == NULL) return 0;
+	return cbuffer_length(buffer->bytes);
+}
+
+size_t rbuffer_remaining(rbuffer_t *buffer) {
+	if (buffer == NULL) return 0;
+
+	size_t remaining = cbuffer_remaining(buffer->bytes);
+	if (remaining <= RBUFFER_HEADER_SIZE) return 0;
+
+	remaining -= RBUFFER_HEADER_SIZE;
+	return remaining < RBUFFER_RECORD_MAX ? remaining : RBUFFER_RECORD_MAX;
+}
+
+bool rbuffer_empty(rbuffer_t *buffer) {
+	return rbuffer_count(buffer) == 0;
+}
+
+int rbuffer_push(rbuffer_t *buffer, const void *src, size_t size) {
+	if (buffer == NULL || src == NULL) return -1;
+	if (size > RBUFFER_RECORD_MAX) return -1;
+
+	// All or nothing
+	if (cbuffer_remaining(buffer->bytes) < size + RBUFFER_HEADER_SIZE)
+		return 0;
+
+	uint8_t header[RBUFFER_HEADER_SIZE];
+	_header_build(header, size);
+
+	cbuffer_push(buffer->bytes, header, RBUFFER_HEADER_SIZE);
+	cbuffer_push(buffer->bytes, (void *)src, size);
+	buffer->count++;
+
+	return size;
+}
+
+int rbuffer_peek(rbuffer_t *buffer, void *dest, size_t dest_len) {
+	size_t size;
+	if (buffer == NULL || !_header_read(buffer, 0, &size)) return -1;
+
+	if (dest != NULL)
+		cbuffer_peek(buffer->bytes, RBUFFER_HEADER_SIZE, dest, dest_len < size ? dest_len : size);
+
+	return size;
+}
+
+int rbuffer_pop(rbuffer_t *buffer, void *dest, size_t dest_len) {
+	size_t size;
+	if (buffer == NULL || !_header_read(buffer, 0, &size)) return -1;
+	if (dest == NULL || size > dest_len) return -2;
+
+	cbuffer_commit(buffer->bytes, RBUFFER_HEADER_SIZE);
+	cbuffer_pop(buffer->bytes, dest, size);
+	buffer->count--;
+
+	return size;
+}
+
+int rbuffer_drop(rbuffer_t *buffer) {
+	size_t size;
+	if (buffer == NULL || !_header_read(buffer, 0, &size)) return -1;
+
+	cbuffer_commit(buffer->bytes, RBUFFER_HEADER_SIZE + size);
+	buffer->count--;
+
+	return size;
+}
+
+size_t rbuffer_batch_length(rbuffer_t *buffer, size_t budget, uint *count) {
+	return rbuffer_batch_length_at(buffer, 0, budget, count);
+}
+
+size_t rbuffer_batch_length_at(rbuffer_t *buffer, size_t offset, size_t budget, uint *count) {
+	size_t length = 0;
+	uint records = 0;
+	size_t size;
+
+	// Header reads past the end fail, which ends the batch
+	if (buffer != NULL) {
+		size_t stored = cbuffer_length(buffer->bytes);
+		while (_header_read(buffer, offset + length, &size)) {
+			if (length + RBUFFER_HEADER_SIZE + size > budget) break;
+			if (offset + length + RBUFFER_HEADER_SIZE + size > stored) break;
+
+			length += RBUFFER_HEADER_SIZE + size;
+			records++;
+		}
+	}
+
+	if (count != NULL) *count = records;
+	return length;
+}
+
+int rbuffer_pop_batch(rbuffer_t *buffer, void *dest, size_t budget, uint *count) {
+	if (buffer == NULL || dest == NULL) return -1;
+
+	uint records;
+	size_t length = rbuffer_batch_length(buffer, budget, &records);
+
+	cbuffer_pop(buffer->bytes, dest, length);
+	buffer->count -= records;
+
+	if (count != NULL) *count = records;
+	return length;
+}
+
+bool rbuffer_commit(rbuffer_t *buffer, size_t length, uint count) {
+	if (buffer == NULL) return false;
+
+	// Only ever consume whole records
+	uint records;
+	if (rbuffer_batch_length(buffer, length, &records) != length || records != count)
+		return false;
+
+	cbuffer_commit(buffer->bytes, length);
+	buffer->count -= count;
+
+	return true;
+}
+
+size_t rbuffer_write_span(rbuffer_t *buffer, uint8_t **span) {
+	if (buffer == NULL || span == NULL) return 0;
+
+	buffer->span_len = 0;
+
+	size_t remaining = cbuffer_remaining(buffer->bytes);
+	if (remaining <= RBUFFER_HEADER_SIZE) return 0;
+
+	uint8_t *write_p;
+	size_t contiguous = cbuffer_write_span(buffer->bytes, &write_p);
+
+	// Payload goes right after the header. If the header itself runs
+	// into the wrap point, the payload starts just past it at the
+	// beginning of the array and everything up to base is usable.
+	if (contiguous > RBUFFER_HEADER_SIZE) {
+		*span = write_p + RBUFFER_HEADER_SIZE;
+		buffer->span_len = contiguous - RBUFFER_HEADER_SIZE;
+	} else {
+		*span = buffer->bytes->buff + (RBUFFER_HEADER_SIZE - contiguous);
+		buffer->span_len = remaining - RBUFFER_HEADER_SIZE;
+	}
+
+	if (buffer->span_len > RBUFFER_RECORD_MAX)
+		buffer->span_len = RBUFFER_RECORD_MAX;
+
+	return buffer->span_len;
+}
+
+int rbuffer_write_commit(rbuffer_t *buffer, size_t size) {
+	if (buffer == NULL || size > buffer->span_len) return -1;
+
+	uint8_t header[RBUFFER_HEADER_SIZE];
+	_header_build(header, size);
+
+	// Header lands in front of the payload already sitting in the array
+	cbuffer_push(buffer->bytes, header, RBUFFER_HEADER_SIZE);
+	cbuffer_write_commit(buffer->bytes, size);
+	buffer->count++;
+	buffer->span_len = 0;
+
+	return size;
+}
+
+static bool _header_read(rbuffer_t *buffer, size_t offset, size_t *size) {
+	uint8_t header[RBUFFER_HEADER_SIZE];
+	if (cbuffer_peek(buffer->bytes, offset, header, RBUFFER_HEADER_SIZE) != RBUFFER_HEADER_SIZE)
+		return false;
+
+	*size = header[0] | (header[1] << 8);
+	return true;
+}
+
+static void _header_build(uint8_t header[RBUFFER_HEADER_SIZE], size_t size) {
+	header[0] = size & 0xFF;
+	header[1] = (size >> 8) & 0xFF;
+}
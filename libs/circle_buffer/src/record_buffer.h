@@ -0,0 +1,99 @@
+#ifndef RECORD_BUFFER_BROG_H
+#define RECORD_BUFFER_BROG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cbuffer.h"
+
+// Length framed record queue built on cbuffer
+//
+// Every record is stored as a 2 byte little endian payload length
+// followed by the payload. Records go in whole or not at all and come
+// out whole, so packet boundaries survive a full buffer.
+//
+// The framed bytes are left as-is in the underlying cbuffer so a batch
+// of records can be read (or sent) straight from ring memory.
+
+#define RBUFFER_HEADER_SIZE (2)
+#define RBUFFER_RECORD_MAX UINT16_MAX
+
+typedef struct _record_buffer {
+	cbuffer_t *bytes; // Framed record storage
+	size_t count;     // Number of whole records in storage
+	size_t span_len;  // Payload space handed out by rbuffer_write_span
+} rbuffer_t;
+
+rbuffer_t * rbuffer_create(size_t size);
+void rbuffer_destroy(rbuffer_t *buffer);
+
+// Returns number of whole records in [buffer]
+size_t rbuffer_count(rbuffer_t *buffer);
+// Returns framed length of [buffer] in bytes (headers included)
+size_t rbuffer_length(rbuffer_t *buffer);
+// Returns largest payload that can currently be pushed
+size_t rbuffer_remaining(rbuffer_t *buffer);
+bool rbuffer_empty(rbuffer_t *buffer);
+
+// Pushes one [size] byte record from [src] into [buffer]
+// Returns [size] if the record was queued
+// 0 if there was not room for all of it (nothing is queued)
+// -1 if [buffer] or [src] is NULL or [size] > RBUFFER_RECORD_MAX
+int rbuffer_push(rbuffer_t *buffer, const void *src, size_t size);
+
+// Copies up to [dest_len] bytes of the next record into [dest]
+// without consuming it. [dest] may be NULL to only query the size.
+// Returns payload size of the next record
+// -1 if [buffer] is NULL or empty
+int rbuffer_peek(rbuffer_t *buffer, void *dest, size_t dest_len);
+
+// Pops the next record into [dest]
+// Returns payload size of the popped record
+// -1 if [buffer] is NULL or empty
+// -2 if the record does not fit in [dest_len] (nothing is popped)
+int rbuffer_pop(rbuffer_t *buffer, void *dest, size_t dest_len);
+
+// Discards the oldest record
+// Returns payload size of the dropped record
+// -1 if [buffer] is NULL or empty
+int rbuffer_drop(rbuffer_t *buffer);
+
+// BATCHES
+//
+// A batch is a run of whole framed records, headers included, taken
+// from the front of the buffer.
+
+// Measures the largest batch of whole records that fits in [budget]
+// bytes. [count] (optional) is set to number of records in the batch.
+// Returns framed length of the batch in bytes
+size_t rbuffer_batch_length(rbuffer_t *buffer, size_t budget, uint *count);
+
+// Same as rbuffer_batch_length for the batch starting [offset] bytes
+// in. [offset] must be on a record boundary, e.g. the end of batches
+// that have been read but not yet committed.
+size_t rbuffer_batch_length_at(rbuffer_t *buffer, size_t offset, size_t budget, uint *count);
+
+// Pops the largest batch that fits in [budget] bytes into [dest]
+// [count] (optional) is set to number of records popped.
+// Returns framed length of the batch in bytes
+// -1 if [buffer] or [dest] is NULL
+int rbuffer_pop_batch(rbuffer_t *buffer, void *dest, size_t budget, uint *count);
+
+// Consumes a batch previously measured with rbuffer_batch_length
+// after its bytes have been read in place
+// Returns false if [length]/[count] do not describe the front batch
+bool rbuffer_commit(rbuffer_t *buffer, size_t length, uint count);
+
+// IN PLACE WRITES
+
+// Points [span] at space for the payload of the next record
+// Returns largest payload that can be written contiguously at [span]
+size_t rbuffer_write_span(rbuffer_t *buffer, uint8_t **span);
+
+// Queues a [size] byte record written through rbuffer_write_span
+// Returns [size] on success
+// -1 if [size] is larger than the span that was handed out
+int rbuffer_write_commit(rbuffer_t *buffer, size_t size);
+
+#endif // RECORD_BUFFER_BROG_H
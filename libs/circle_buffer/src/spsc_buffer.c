@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_buffer.h"
+
+// Each side owns one counter. It reads its own with relaxed ordering and
+// the other side's with acquire, and publishes its own with release so
+// the data copy is always visible before the counter that covers it.
+#define _own_load(p) atomic_load_explicit(p, memory_order_relaxed)
+#define _other_load(p) atomic_load_explicit(p, memory_order_acquire)
+#define _publish(p, v) atomic_store_explicit(p, v, memory_order_release)
+
+bool spsc_buffer_init(spsc_buffer_t *buffer, void *array, size_t array_size) {
+	if (buffer == NULL || array == NULL) return false;
+
+	// Power of two only, so indices can be masked instead of divided
+	if (array_size == 0 || (array_size & (array_size - 1))) return false;
+
+	buffer->buff = array;
+	buffer->mask = array_size - 1;
+	atomic_init(&buffer->head, 0);
+	atomic_init(&buffer->tail, 0);
+
+	return true;
+}
+
+spsc_buffer_t * spsc_buffer_create(size_t size) {
+	spsc_buffer_t *buffer = malloc(sizeof (spsc_buffer_t));
+	if (buffer == NULL) return NULL;
+
+	void *array = malloc(size);
+	if (!spsc_buffer_init(buffer, array, size)) {
+		free(array);
+		free(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+void spsc_buffer_destroy(spsc_buffer_t *buffer) {
+	if (buffer == NULL) return;
+
+	free(buffer->buff);
+	free(buffer);
+}
+
+size_t spsc_buffer_size(spsc_buffer_t *buffer) {
+	if (buffer == NULL) return 0;
+	return buffer->mask + 1;
+}
+
+size_t spsc_buffer_length(spsc_buffer_t *buffer) {
+	if (buffer == NULL) return 0;
+	return _other_load(&buffer->head) - _other_load(&buffer->tail);
+}
+
+size_t spsc_buffer_remaining(spsc_buffer_t *buffer) {
+	return spsc_buffer_size(buffer) - spsc_buffer_length(buffer);
+}
+
+bool spsc_buffer_empty(spsc_buffer_t *buffer) {
+	return spsc_buffer_length(buffer) == 0;
+}
+
+int spsc_buffer_push(spsc_buffer_t *buffer, const void *src, size_t size) {
+	if (buffer == NULL || src == NULL) return -1;
+
+	size_t head = _own_load(&buffer->head);
+	size_t free_space = spsc_buffer_size(buffer) - (head - _other_load(&buffer->tail));
+	if (size > free_space) size = free_space;
+
+	// At most two copies, split at the wrap point
+	size_t index = head & buffer->mask;
+	size_t first = spsc_buffer_size(buffer) - index;
+	if (first > size) first = size;
+
+	memcpy(&buffer->buff[index], src, first);
+	if (size > first)
+		memcpy(buffer->buff, (const uint8_t *)src + first, size - first);
+
+	_publish(&buffer->head, head + size);
+
+	return size;
+}
+
+size_t spsc_buffer_write_span(spsc_buffer_t *buffer, uint8_t **span) {
+	if (buffer == NULL || span == NULL) return 0;
+
+	size_t head = _own_load(&buffer->head);
+	size_t free_space = spsc_buffer_size(buffer) - (head - _other_load(&buffer->tail));
+
+	size_t index = head & buffer->mask;
+	size_t contiguous = spsc_buffer_size(buffer) - index;
+
+	*span = &buffer->buff[index];
+	return free_space < contiguous ? free_space : contiguous;
+}
+
+int spsc_buffer_write_commit(spsc_buffer_t *buffer, size_t num) {
+	if (buffer == NULL) return -1;
+
+	size_t head = _own_load(&buffer->head);
+	size_t free_space = spsc_buffer_size(buffer) - (head - _other_load(&buffer->tail));
+	if (num > free_space) num = free_space;
+
+	_publish(&buffer->head, head + num);
+
+	return num;
+}
+
+int spsc_buffer_pop(spsc_buffer_t *buffer, void *dest, size_t num) {
+	if (buffer == NULL || dest == NULL) return -1;
+
+	size_t tail = _own_load(&buffer->tail);
+	size_t length = _other_load(&buffer->head) - tail;
+	if (num > length) num = length;
+
+	size_t index = tail & buffer->mask;
+	size_t first = spsc_buffer_size(buffer) - index;
+	if (first > num) first = num;
+
+	memcpy(dest, &buffer->buff[index], first);
+	if (num > first)
+		memcpy((uint8_t *)dest + first, buffer->buff, num - first);
+
+	_publish(&buffer->tail, tail + num);
+
+	return num;
+}
+
+size_t spsc_buffer_peek_span(spsc_buffer_t *buffer, uint8_t **span) {
+	if (buffer == NULL || span == NULL) return 0;
+
+	size_t tail = _own_load(&buffer->tail);
+	size_t length = _other_load(&buffer->head) - tail;
+
+	size_t index = tail & buffer->mask;
+	size_t contiguous = spsc_buffer_size(buffer) - index;
+
+	*span = &buffer->buff[index];
+	return length < contiguous ? length : contiguous;
+}
+
+int spsc_buffer_commit(spsc_buffer_t *buffer, size_t num) {
+	if (buffer == NULL) return -1;
+
+	size_t tail = _own_load(&buffer->tail);
+	size_t length = _other_load(&buffer->head) - tail;
+	if (num > length) num = length;
+
+	_publish(&buffer->tail, tail + num);
+
+	return num;
+}
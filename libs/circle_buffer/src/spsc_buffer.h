@@ -0,0 +1,76 @@
+#ifndef SPSC_BUFFER_BROG_H
+#define SPSC_BUFFER_BROG_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-producer/single-consumer byte ring
+//
+// Safe to share between core0 and core1, or between an IRQ handler and
+// the main loop, without locks. Exactly one context may call the
+// producer functions and exactly one (other) context may call the
+// consumer functions. Either side may call the query functions, but
+// the answer is only exact for the side asking:
+// the producer never sees less free space than there is, and the
+// consumer never sees more data than has been fully written.
+//
+// head and tail are free running byte counters. They are only masked
+// down to an array index when touching memory, so unsigned wrap of the
+// counters themselves is harmless.
+
+typedef struct _spsc_buffer {
+	uint8_t *buff; // Pointer to beginning of buffer array
+	size_t mask;   // Array size - 1, array size is a power of two
+
+	_Atomic size_t head; // Total bytes written, only the producer stores
+	_Atomic size_t tail; // Total bytes read, only the consumer stores
+} spsc_buffer_t;
+
+// Initializes [buffer] over caller owned [array]
+// Returns false if [array_size] is not a power of two
+bool spsc_buffer_init(spsc_buffer_t *buffer, void *array, size_t array_size);
+
+spsc_buffer_t * spsc_buffer_create(size_t size);
+void spsc_buffer_destroy(spsc_buffer_t *buffer);
+
+// Returns fixed size of buffer in bytes
+size_t spsc_buffer_size(spsc_buffer_t *buffer);
+// Returns current length of buffer in bytes
+size_t spsc_buffer_length(spsc_buffer_t *buffer);
+// Returns remaining buffer space in bytes
+size_t spsc_buffer_remaining(spsc_buffer_t *buffer);
+bool spsc_buffer_empty(spsc_buffer_t *buffer);
+
+// PRODUCER
+
+// Pushes up to [size] bytes from [src] into [buffer]
+// Returns number of bytes pushed
+// -1 if [buffer] or [src] is NULL
+int spsc_buffer_push(spsc_buffer_t *buffer, const void *src, size_t size);
+
+// Points [span] at the next free byte in [buffer]
+// Returns length of contiguous writable span in bytes
+size_t spsc_buffer_write_span(spsc_buffer_t *buffer, uint8_t **span);
+
+// Publishes [num] bytes written through spsc_buffer_write_span
+// Returns number of bytes published
+int spsc_buffer_write_commit(spsc_buffer_t *buffer, size_t num);
+
+// CONSUMER
+
+// Pop up to [num] bytes from [buffer] into [dest]
+// Returns number of bytes popped
+// -1 if [buffer] or [dest] is NULL
+int spsc_buffer_pop(spsc_buffer_t *buffer, void *dest, size_t num);
+
+// Points [span] at the oldest unread byte in [buffer]
+// Returns length of contiguous readable span in bytes
+size_t spsc_buffer_peek_span(spsc_buffer_t *buffer, uint8_t **span);
+
+// Releases [num] bytes read through spsc_buffer_peek_span
+// Returns number of bytes released
+int spsc_buffer_commit(spsc_buffer_t *buffer, size_t num);
+
+#endif // SPSC_BUFFER_BROG_H
@@ -11,9 +11,15 @@ set(target "gateway_module")
 list(APPEND sources
 	src/gateway_sim7080g.c
 	src/gateway_error.c
-	#src/gw_core.c
-	#src/gw_core_error.c
-	#src/gateway_queue.c
+	src/gw_core.c
+	src/gw_core_error.c
+	src/gateway_queue.c
+	src/gateway_uplink.c
+	src/gateway_uplink_pack.c
+	src/gateway_endpoint.c
+
+	# Uncomment for SD card spill storage (see gateway_spool.h)
+	#src/gateway_spool.c
 )
 
 list(APPEND includes
@@ -22,9 +28,13 @@ list(APPEND includes
 
 list(APPEND libraries
 	pico_stdlib
-	#pico_multicore
+	pico_multicore
+	pico_rand
 	sim7080g_pico
 	circle_buffer
+
+	# Needed by src/gateway_spool.c
+	#FatFs_SPI
 )
 
 list(APPEND definitions
@@ -33,4 +43,32 @@ list(APPEND definitions
 	GATEWAY_PIN_TX=0
 	GATEWAY_PIN_RX=1
 	GATEWAY_PIN_PWR=14
+
+	# Modem UART rate to negotiate up to from 115200 (see sim7080g_link_set)
+	#GATEWAY_UART_BAUD=921600
+
+	# RTS/CTS to the modem, only with both wired (uart0: CTS 2, RTS 3)
+	#GATEWAY_PIN_CTS=2
+	#GATEWAY_PIN_RTS=3
+
+	# Upload servers, host:port[/priority[/weight]] (see gateway_interface.h)
+	GATEWAY_ENDPOINTS="73.149.88.183:8086"
+
+	# DROP_NEWEST, DROP_OLDEST or SPILL (see gateway_interface.h)
+	GATEWAY_OVERFLOW_POLICY=GATEWAY_OVERFLOW_DROP_OLDEST
+
+	# TCP or UDP uploads (see gateway_interface.h)
+	GATEWAY_TRANSPORT=GATEWAY_TRANSPORT_TCP
+
+	# Run the modem state machine on core1
+	#GATEWAY_DUAL_CORE
+
+	# Park the modem in PSM between uploads instead of powering down
+	#GATEWAY_SESSION_KEEP
+
+	# Delta/varint pack upload batches (see gateway_uplink_pack.h)
+	#GATEWAY_UPLINK_PACK
+
+	# Queue a link metrics snapshot with uploads at most this often
+	#GATEWAY_METRICS_INTERVAL_MS=3600000
 )
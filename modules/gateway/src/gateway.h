@@ -13,7 +13,8 @@ enum _modem_state_e {
 	MODEM_STOPPED,
 	MODEM_STARTED,
 	MODEM_CN_ACTIVE,
-	MODEM_SERVER_CONNECTED
+	MODEM_SERVER_CONNECTED,
+	MODEM_IDLE // Session parked in PSM (GATEWAY_SESSION_KEEP)
 };
 
 extern int MODEM_CORE_STATE;
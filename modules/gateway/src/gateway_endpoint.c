@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/sync.h"
+
+#include "gateway_endpoint.h"
+
+#ifndef GATEWAY_ENDPOINTS
+#define GATEWAY_ENDPOINTS "73.149.88.183:8086"
+#endif
+
+// Failure backoff, doubles for every failure in a row
+#define ENDPOINT_BACKOFF_MS (30 * 1000)
+#define ENDPOINT_BACKOFF_MAX_MS (30 * 60 * 1000)
+
+struct _endpoint_s {
+	struct gateway_endpoint_stats_s stats;
+	absolute_time_t backoff_until;
+};
+
+static struct _endpoint_s _endpoints[GATEWAY_ENDPOINTS_MAX];
+static uint _endpoint_count = 0;
+
+// Bumped on every list change so a result for an endpoint picked from
+// the old list isn't charged to whatever took its place
+static uint32_t _generation = 0;
+static uint32_t _picked_generation = 0;
+
+static critical_section_t _lock;
+
+static int _parse(const char *list, struct _endpoint_s *dst);
+static const struct _endpoint_s *_find(const struct _endpoint_s *endpoint);
+static bool _better(const struct _endpoint_s *a, const struct _endpoint_s *b, absolute_time_t now);
+
+bool gateway_endpoints_set(const char *list) {
+	struct _endpoint_s parsed[GATEWAY_ENDPOINTS_MAX];
+
+	int count = _parse(list, parsed);
+	if (count <= 0) return false;
+
+	critical_section_enter_blocking(&_lock);
+
+	// Endpoints that stay keep what we learned about them
+	for (int i = 0; i < count; i++) {
+		const struct _endpoint_s *old = _find(&parsed[i]);
+		if (old == NULL) continue;
+
+		uint8_t priority = parsed[i].stats.priority;
+		uint8_t weight = parsed[i].stats.weight;
+		parsed[i] = *old;
+		parsed[i].stats.priority = priority;
+		parsed[i].stats.weight = weight;
+	}
+
+	memcpy(_endpoints, parsed, count * sizeof (struct _endpoint_s));
+	_endpoint_count = count;
+	_generation++;
+
+	critical_section_exit(&_lock);
+
+	return true;
+}
+
+uint gateway_endpoint_stats_get(struct gateway_endpoint_stats_s *dst, uint max) {
+	critical_section_enter_blocking(&_lock);
+
+	absolute_time_t now = get_absolute_time();
+	uint count = _endpoint_count;
+	for (uint i = 0; i < count && i < max; i++) {
+		dst[i] = _endpoints[i].stats;
+		dst[i].backed_off = absolute_time_diff_us(now, _endpoints[i].backoff_until) > 0;
+	}
+
+	critical_section_exit(&_lock);
+
+	return count;
+}
+
+bool endpoint_init(void) {
+	critical_section_init(&_lock);
+
+	return gateway_endpoints_set(GATEWAY_ENDPOINTS);
+}
+
+int endpoint_pick(char host[GATEWAY_ENDPOINT_HOST_MAX], uint16_t *port) {
+	critical_section_enter_blocking(&_lock);
+
+	absolute_time_t now = get_absolute_time();
+	int best = -1;
+	for (uint i = 0; i < _endpoint_count; i++) {
+		if (best < 0 || _better(&_endpoints[i], &_endpoints[best], now))
+			best = i;
+	}
+
+	if (best >= 0) {
+		memcpy(host, _endpoints[best].stats.host, GATEWAY_ENDPOINT_HOST_MAX);
+		*port = _endpoints[best].stats.port;
+		_picked_generation = _generation;
+	}
+
+	critical_section_exit(&_lock);
+
+	return best;
+}
+
+void endpoint_connected(int index, uint32_t latency_us) {
+	critical_section_enter_blocking(&_lock);
+
+	if (index >= 0 && _picked_generation == _generation) {
+		struct gateway_endpoint_stats_s *stats = &_endpoints[index].stats;
+
+		// Smoothed so one slow attach doesn't write an endpoint off
+		stats->latency_us = stats->latency_us
+			? (stats->latency_us * 3 + latency_us) / 4
+			: latency_us;
+
+		stats->connects++;
+		stats->failures_in_row = 0;
+		_endpoints[index].backoff_until = nil_time;
+	}
+
+	critical_section_exit(&_lock);
+}
+
+void endpoint_failed(int index) {
+	critical_section_enter_blocking(&_lock);
+
+	if (index >= 0 && _picked_generation == _generation) {
+		struct _endpoint_s *endpoint = &_endpoints[index];
+
+		endpoint->stats.failures++;
+		endpoint->stats.failures_in_row++;
+
+		uint32_t backoff = ENDPOINT_BACKOFF_MS;
+		for (uint i = 1; i < endpoint->stats.failures_in_row && backoff < ENDPOINT_BACKOFF_MAX_MS; i++)
+			backoff *= 2;
+		if (backoff > ENDPOINT_BACKOFF_MAX_MS) backoff = ENDPOINT_BACKOFF_MAX_MS;
+
+		endpoint->backoff_until = make_timeout_time_ms(backoff);
+	}
+
+	critical_section_exit(&_lock);
+}
+
+// Comma separated host:port[/priority[/weight]]
+//
+// return: endpoints parsed into [dst]
+//         -1 if any entry is malformed
+static int _parse(const char *list, struct _endpoint_s *dst) {
+	int count = 0;
+	const char *p = list;
+
+	if (list == NULL) return -1;
+
+	while (*p) {
+		if (*p == ',' || *p == ' ') {
+			p++;
+			continue;
+		}
+
+		if (count == GATEWAY_ENDPOINTS_MAX) return -1;
+
+		const char *colon = strchr(p, ':');
+		const char *end = strchr(p, ',');
+		if (end == NULL) end = p + strlen(p);
+		if (colon == NULL || colon > end || colon == p) return -1;
+
+		size_t host_len = colon - p;
+		if (host_len >= GATEWAY_ENDPOINT_HOST_MAX) return -1;
+
+		struct _endpoint_s *endpoint = &dst[count];
+		memset(endpoint, 0, sizeof *endpoint);
+		memcpy(endpoint->stats.host, p, host_len);
+
+		char *next;
+		unsigned long port = strtoul(colon + 1, &next, 10);
+		unsigned long priority = 0;
+		unsigned long weight = 1;
+
+		if (*next == '/') priority = strtoul(next + 1, &next, 10);
+		if (*next == '/') weight = strtoul(next + 1, &next, 10);
+
+		if (next != end || port == 0 || port > UINT16_MAX
+				|| priority > UINT8_MAX || weight == 0 || weight > UINT8_MAX)
+			return -1;
+
+		endpoint->stats.port = port;
+		endpoint->stats.priority = priority;
+		endpoint->stats.weight = weight;
+		endpoint->backoff_until = nil_time;
+
+		count++;
+		p = end;
+	}
+
+	return count;
+}
+
+static const struct _endpoint_s *_find(const struct _endpoint_s *endpoint) {
+	for (uint i = 0; i < _endpoint_count; i++) {
+		if (_endpoints[i].stats.port == endpoint->stats.port
+				&& strcmp(_endpoints[i].stats.host, endpoint->stats.host) == 0)
+			return &_endpoints[i];
+	}
+
+	return NULL;
+}
+
+// True if [a] should be tried before [b]
+static bool _better(const struct _endpoint_s *a, const struct _endpoint_s *b, absolute_time_t now) {
+	bool a_ready = absolute_time_diff_us(now, a->backoff_until) <= 0;
+	bool b_ready = absolute_time_diff_us(now, b->backoff_until) <= 0;
+
+	// Nothing ready, whoever comes back first
+	if (!a_ready && !b_ready)
+		return absolute_time_diff_us(a->backoff_until, b->backoff_until) > 0;
+	if (a_ready != b_ready) return a_ready;
+
+	if (a->stats.priority != b->stats.priority)
+		return a->stats.priority < b->stats.priority;
+
+	// Compared as latency_a / weight_a < latency_b / weight_b
+	return (uint64_t)a->stats.latency_us * b->stats.weight
+		< (uint64_t)b->stats.latency_us * a->stats.weight;
+}
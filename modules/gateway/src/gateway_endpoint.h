@@ -0,0 +1,41 @@
+#ifndef WISDOM_GATEWAY_ENDPOINT_H
+#define WISDOM_GATEWAY_ENDPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gateway_interface.h"
+
+// Server endpoint list and failover
+//
+// Endpoints with the lowest priority value are tried first. Among those,
+// the one with the lowest smoothed connect time divided by its weight
+// wins, and one never connected to counts as fastest so every endpoint
+// gets measured. An endpoint that fails is backed off for a while,
+// doubling with every failure in a row, and the next best one is used
+// instead. When all are backed off the one due back first is tried.
+//
+// The list is set at build time from GATEWAY_ENDPOINTS, by
+// gateway_endpoints_set and by an UPLINK_ENDPOINTS downlink frame. Safe
+// to change from core0 while core1 runs the modem.
+
+// Loads the GATEWAY_ENDPOINTS list
+// Called by gateway_init, before core1 is running.
+//
+// return: false if GATEWAY_ENDPOINTS is malformed
+bool endpoint_init(void);
+
+// Picks the endpoint to connect to and copies out its address
+//
+// return: endpoint index for endpoint_connected/endpoint_failed
+//         -1 if the list is empty
+int endpoint_pick(char host[GATEWAY_ENDPOINT_HOST_MAX], uint16_t *port);
+
+// TCP to endpoint [index] opened in [latency_us]
+void endpoint_connected(int index, uint32_t latency_us);
+
+// Endpoint [index] refused the connection or stopped acking
+void endpoint_failed(int index);
+
+#endif // WISDOM_GATEWAY_ENDPOINT_H
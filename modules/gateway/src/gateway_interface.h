@@ -2,23 +2,311 @@
 #define WISDOM_GATEWAY_MODULE_H
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/time.h"
+#include "pico/types.h"
 
 // Note: Any commands can fail if modem is busy
-// TODO: add way to read return messages from gw_core
-// ABANDON SHIP GO ONE CORE! I'll fix this later.
+//
+// Building with GATEWAY_DUAL_CORE defined hands the modem to core1 (see
+// gw_core.c). gateway_init launches core1, gateway_pump just reports
+// state, and pushed records reach core1 through a pool of buffers
+// (see gateway_queue.h) so core0 never waits on modem I/O.
 
 bool gateway_init(void);
 
-// Issues modem startup command
+// Runs the modem state machine
+// Never sleeps. Returns straight away if nothing is due before
+// gateway_next_service(), so it is cheap to call early.
+//
+// return: current modem state (see gateway.h)
 int gateway_pump(void);
 
+// Absolute time gateway_pump next needs to run
+// at_the_end_of_time while the modem is powered down with nothing to
+// send. Pushing data makes the pump due immediately.
+absolute_time_t gateway_next_service(void);
+
 int gateway_state_get(void);
 
+// Largest single record that can be queued. Every record has to fit
+// in one TCP send (MODEM_TCP_SEND_MAX) along with its 2 byte length
+// header.
+#define GATEWAY_RECORD_MAX (1459 - 2)
+
 // For sending packed data buffers
+// Each push is one record. When the buffer is full the overflow policy
+// decides what gives (see GATEWAY_OVERFLOW_POLICY_T). Records are uploaded whole, prefixed with
+// their length as a 2 byte little endian header.
+//
+// return: [size] if the record was queued or spilled
+//         0 if the record was dropped (nothing is queued)
+//         -1 if [size] is 0 or > GATEWAY_RECORD_MAX
 int gateway_queue_push(void *data, uint32_t size);
 
-// For receiving data from gateway
-bool gateway_recv(void *data, uint size);
+// For building packed data in place
+// gateway_queue_span points [span] at free space in the output buffer
+// and returns how many contiguous bytes can be written there.
+// gateway_queue_commit then queues the [size] bytes written to the span
+// as one record.
+uint32_t gateway_queue_span(void **span);
+int gateway_queue_commit(uint32_t size);
+
+// Overflow handling
+//
+// Decides what happens when a pushed record doesn't fit in the output
+// buffer. Default is set at build time with GATEWAY_OVERFLOW_POLICY.
+typedef enum _gateway_overflow_policy {
+	// Refuse the new record
+	GATEWAY_OVERFLOW_DROP_NEWEST,
+	// Drop whole records from the front until the new one fits
+	GATEWAY_OVERFLOW_DROP_OLDEST,
+	// Append to secondary storage (see gateway_spill_set) and read back
+	// as the buffer drains. Falls back to DROP_OLDEST when no storage
+	// is set or it fails.
+	GATEWAY_OVERFLOW_SPILL,
+	GATEWAY_OVERFLOW_POLICY_MAX
+} GATEWAY_OVERFLOW_POLICY_T;
+
+// Secondary storage hooks for GATEWAY_OVERFLOW_SPILL
+struct gateway_spill_s {
+	// Append one record
+	// return: false if storage is full or failed
+	bool (*write)(const void *record, uint32_t size);
+
+	// Read the next unread record into [dst]
+	// return: record size, 0 when storage has been fully read, < 0 on error
+	int (*read)(void *dst, uint32_t dst_len);
+
+	// Let go of the record read keeps failing on, so reading carries on
+	// past it. If storage can't tell where the next record starts,
+	// everything from there on goes.
+	// return: records let go of, < 0 if storage can't get past it
+	int (*skip)(void);
+
+	// Everything read so far has been uploaded and can be let go of
+	void (*release)(void);
+};
+
+// Counters for data that didn't make it into the output buffer
+struct gateway_drop_stats_s {
+	uint32_t records_dropped;
+	uint32_t bytes_dropped;
+	// ... of which already sent, the server may have stored them
+	uint32_t records_dropped_sent;
+	uint32_t records_spilled;
+	uint32_t bytes_spilled;
+	// Writes storage refused, plus records given up on after repeated
+	// read errors. What was given up on counts as dropped too.
+	uint32_t spill_failures;
+	// GATEWAY_DUAL_CORE only: pushes refused because core1 still held
+	// every pool block
+	uint32_t handoff_dropped;
+};
+
+bool gateway_overflow_policy_set(GATEWAY_OVERFLOW_POLICY_T policy);
+GATEWAY_OVERFLOW_POLICY_T gateway_overflow_policy_get(void);
+
+// [spill] must stay valid for as long as it is set
+void gateway_spill_set(const struct gateway_spill_s *spill);
+
+void gateway_drop_stats_get(struct gateway_drop_stats_s *dst);
+void gateway_drop_stats_reset(void);
+
+// Upload throughput counters
+struct gateway_upload_stats_s {
+	uint32_t sends;         // Successful CASENDs (one DATA frame each)
+	uint32_t send_failures; // CASENDs the modem refused
+	uint32_t resends;       // Batches sent again after a lost connection or datagram
+	uint32_t ack_timeouts;  // Connections dropped for want of an ack
+	uint32_t records_acked; // Records the server confirmed storing
+	uint32_t payload_bytes; // Acked record bytes, framing excluded
+	uint32_t wire_bytes;    // Bytes handed to the modem, framing included
+	uint64_t send_us;       // Time spent inside CASEND
+	uint64_t connected_us;  // Time the TCP connection was held open
+	uint32_t goodput_bps;   // payload_bytes per second of connected_us
+	uint32_t pushes;        // UPLINK_PUSH frames handed over whole
+	uint32_t push_drops;    // ... dropped, see gateway_recv
+};
+
+void gateway_upload_stats_get(struct gateway_upload_stats_s *dst);
+void gateway_upload_stats_reset(void);
+
+// Session keeping
+// When enabled the modem is parked in PSM with its registration and PDP
+// context kept after an upload, instead of being powered down. The next
+// upload wakes it and reuses the session, falling back to a full
+// bring-up if that fails. Defaults on when GATEWAY_SESSION_KEEP is
+// defined. Turning it off takes effect at the end of the next upload.
+void gateway_session_keep_set(bool keep);
+bool gateway_session_keep_get(void);
+
+// Upload cycle counters and the phase timings of the most recent cycle
+struct gateway_session_stats_s {
+	uint32_t cycles;         // Upload cycles started
+	uint32_t cold_starts;    // ... by powering the modem up
+	uint32_t session_reuses; // ... by waking a parked session
+	uint32_t pdp_reuses;     // Parked sessions whose PDP context survived
+	uint32_t fallbacks;      // Parked sessions that needed a full bring-up
+
+	// Most recent cycle, in microseconds
+	uint64_t boot_us;       // Power up or PSM wake until the modem answers
+	uint64_t attach_us;     // Network registration and PDP activation
+	uint64_t connect_us;    // TCP open
+	uint64_t first_byte_us; // Cycle start until the first send is accepted
+	uint64_t upload_us;     // TCP connection held open
+};
+
+void gateway_session_stats_get(struct gateway_session_stats_s *dst);
+void gateway_session_stats_reset(void);
+
+// Modem link metrics
+// Where the time goes between uploads, state by state, for finding
+// sites that burn their energy budget stuck in attach.
+//
+// One entry per modem state (see gateway.h)
+#define GATEWAY_METRICS_STATES 7
+// Dwell time buckets, each 4 times the last:
+// < 1 s, < 4 s, < 16 s, < 64 s, < 256 s, < 1024 s, < 4096 s, longer
+#define GATEWAY_METRICS_BUCKETS 8
+
+struct gateway_state_metrics_s {
+	uint32_t entries;      // Times the state was entered
+	uint32_t retries;      // Pump runs that stayed in the state
+	uint64_t dwell_us;     // Total time spent in the state, left or not
+	uint32_t dwell_max_us; // Longest single stay
+	uint32_t dwell_hist[GATEWAY_METRICS_BUCKETS];
+};
+
+struct gateway_metrics_s {
+	uint64_t uptime_us;
+	struct gateway_state_metrics_s states[GATEWAY_METRICS_STATES];
+	// [from][to]
+	uint32_t transitions[GATEWAY_METRICS_STATES][GATEWAY_METRICS_STATES];
+
+	uint32_t power_ups;   // Cold boots from MODEM_POWERED_DOWN
+	uint32_t power_downs; // Returns to MODEM_POWERED_DOWN
+	uint32_t psm_wakes;   // Parked sessions woken (GATEWAY_SESSION_KEEP)
+
+	// AT commands, write to first response byte
+	uint32_t at_commands;
+	uint32_t at_timeouts;
+	uint32_t at_mean_us;
+	uint32_t at_max_us;
+
+	uint32_t bytes_sent;  // Handed to the modem, framing included
+	uint32_t bytes_acked; // Record bytes the server confirmed storing
+};
+
+void gateway_metrics_get(struct gateway_metrics_s *dst);
+void gateway_metrics_reset(void);
+
+// Metrics snapshots in the upload stream
+// At the start of an upload cycle, if at least [interval_ms] has passed
+// since the last one, a snapshot record is queued along with the data so
+// metrics reach the server without costing an upload of their own.
+// 0 turns it off. Defaults to GATEWAY_METRICS_INTERVAL_MS, or off if
+// that isn't defined.
+//
+// Record layout, all little endian:
+//	u16 GATEWAY_METRICS_NODE, u16 bytes that follow
+//	u16 GATEWAY_METRICS_TYPE, u8 version 1
+//	u32 uptime in seconds
+//	per state: u32 entries, u32 retries, u32 dwell in seconds,
+//	           u32 longest stay in ms, u16 dwell_hist (each capped)
+//	u32 power_ups, power_downs, psm_wakes
+//	u32 at_commands, at_timeouts, at_mean_us, at_max_us
+//	u32 bytes_sent, bytes_acked
+#define GATEWAY_METRICS_NODE 0xFFFF
+#define GATEWAY_METRICS_TYPE 0x4D47 // "GM"
+void gateway_metrics_interval_set(uint32_t interval_ms);
+
+// Upload transport
+// UDP skips the TCP handshake and teardown, which for a few hundred
+// bytes per upload costs more airtime than the data. Every send is one
+// datagram with the same uplink frames as over TCP, and batches the
+// server hasn't acked within GATEWAY_UDP_ACK_TIMEOUT_MS are sent again
+// (see gateway_uplink.h). Default is set at build time with
+// GATEWAY_TRANSPORT. A change takes effect on the next connection.
+typedef enum _gateway_transport {
+	GATEWAY_TRANSPORT_TCP,
+	GATEWAY_TRANSPORT_UDP,
+	GATEWAY_TRANSPORT_MAX
+} GATEWAY_TRANSPORT_T;
+
+bool gateway_transport_set(GATEWAY_TRANSPORT_T transport);
+GATEWAY_TRANSPORT_T gateway_transport_get(void);
+
+// Server endpoints
+// Uploads go to one of up to GATEWAY_ENDPOINTS_MAX servers, picked by
+// priority, then connect time and weight, failing over when one stops
+// answering (see gateway_endpoint.h). Starts out as GATEWAY_ENDPOINTS
+// and can be replaced by the server with an UPLINK_ENDPOINTS frame.
+#define GATEWAY_ENDPOINTS_MAX 4
+#define GATEWAY_ENDPOINT_HOST_MAX 64
+
+// Replaces the endpoint list with [list]: comma separated
+// host:port[/priority[/weight]] entries, e.g.
+// "10.0.0.1:8086,ingest.example.com:8086/1". Lower priorities are tried
+// first, default 0. Weight 1 to 255 (default 1) scales how much slower
+// an endpoint may be and still be preferred. What was learned about an
+// endpoint that stays on the list is kept.
+//
+// return: false if [list] is empty or malformed, the old list stays
+bool gateway_endpoints_set(const char *list);
+
+struct gateway_endpoint_stats_s {
+	char host[GATEWAY_ENDPOINT_HOST_MAX];
+	uint16_t port;
+	uint8_t priority;
+	uint8_t weight;
+	uint32_t connects;        // TCP connections opened
+	uint32_t failures;        // Refused connections and ack timeouts
+	uint32_t failures_in_row;
+	uint32_t latency_us;      // Smoothed TCP open time, 0 until connected
+	bool backed_off;          // Skipped until it is due for another try
+};
+
+// return: number of endpoints, up to [max] of them copied to [dst]
+uint gateway_endpoint_stats_get(struct gateway_endpoint_stats_s *dst, uint max);
+
+// Downlink
+// While connected to upload, the server can push data down to the
+// gateway (UPLINK_PUSH, see gateway_uplink.h). Pushes are read from the
+// modem in the largest pieces it hands out and go straight from its
+// receive buffer to a sink, or into a buffer lent with gateway_recv. A
+// connection with nothing left to upload is held open until a push that
+// has started arriving is in.
+
+// One piece of a push
+struct gateway_recv_piece_s {
+	uint32_t seq;        // As the server sent it
+	uint16_t length;     // Of the whole push
+	uint16_t offset;     // Of [data] within the push
+	const uint8_t *data; // Only valid during the call
+	uint16_t len;
+	bool last;           // offset + len == length
+	bool valid;          // Last piece only: the CRC over the push matched
+};
+
+// Gets every piece of every push in order, on the core running the modem
+// A push cut off by a lost connection never gets its last piece.
+typedef void (*gateway_recv_sink_t)(const struct gateway_recv_piece_s *piece, void *arg);
+
+// NULL hands pushes back to gateway_recv
+void gateway_recv_sink_set(gateway_recv_sink_t sink, void *arg);
+
+// Polls for a push received into [data]
+// Lends [data] to the gateway, which writes the next push of up to
+// [size] bytes straight into it as it arrives. Keep calling with the
+// same buffer until one is in. Pushes that are empty, don't fit, fail
+// their CRC or come while one is waiting to be picked up are dropped.
+// Not used while a sink is set.
+//
+// return: bytes of the push now in [data], which is the caller's again
+//         0 while none is in
+int gateway_recv(void *data, uint size);
 
 
 #endif // WISDOM_GATEWAY_MODULE_H
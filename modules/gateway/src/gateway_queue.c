@@ -1,85 +1,90 @@
+#include <stddef.h>
+
+#include "spsc_buffer.h"
+
 #include "gateway_queue.h"
 
-static queue_t _queue_gw;
-static queue_t _queue_main;
+struct gw_queue_desc {
+	uint8_t *block;
+	uint16_t size;
+};
+
+#define DESC_SIZE (sizeof (struct gw_queue_desc))
+
+// Ring sizes have to be a power of two. 256 bytes holds well over
+// GW_POOL_COUNT descriptors with room to spare.
+#define GW_QUEUE_SIZE 256
+
+static uint8_t _pool[GW_POOL_COUNT][GW_POOL_BLOCK_SIZE];
+
+static spsc_buffer_t _queue_submit; // core0 -> core1
+static spsc_buffer_t _queue_free;   // core1 -> core0
+static uint8_t _queue_submit_array[GW_QUEUE_SIZE];
+static uint8_t _queue_free_array[GW_QUEUE_SIZE];
 
 static bool _is_init = false;
 
+static bool _desc_push(spsc_buffer_t *queue, struct gw_queue_desc *desc);
+static bool _desc_pop(spsc_buffer_t *queue, struct gw_queue_desc *desc);
+
 void gw_queue_init(void) {
-	queue_init(&_queue_gw, GW_QUEUE_WIDTH, GW_QUEUE_SIZE);
-	queue_init(&_queue_main, GW_QUEUE_WIDTH, GW_QUEUE_SIZE);
+	spsc_buffer_init(&_queue_submit, _queue_submit_array, GW_QUEUE_SIZE);
+	spsc_buffer_init(&_queue_free, _queue_free_array, GW_QUEUE_SIZE);
+
+	// Every block starts out free. Core1 isn't running yet so it's fine
+	// for core0 to act as producer here.
+	for (int i = 0; i < GW_POOL_COUNT; i++)
+		_desc_push(&_queue_free, &(struct gw_queue_desc) { .block = _pool[i] });
 
 	_is_init = true;
 }
 
-int gw_queue_gw_peek(uint32_t *buffer) {
-	if (_is_init == false) return -4;
-	if (buffer == NULL) return -1;
+uint8_t *gw_queue_acquire(void) {
+	if (_is_init == false) return NULL;
+
+	struct gw_queue_desc desc;
+	if (!_desc_pop(&_queue_free, &desc)) return NULL;
 
-	return queue_try_peek(&_queue_gw, buffer);
+	return desc.block;
 }
 
-int gw_queue_gw_send(uint8_t *buffer, uint16_t size) {
-	if (_is_init == false) return -4;
-	if (buffer == NULL) return -1;
+bool gw_queue_submit(uint8_t *block, uint16_t size) {
+	if (_is_init == false) return false;
+	if (size > GW_POOL_BLOCK_SIZE) return false;
 
-	uint sent = 0;
-	while (queue_try_add(&_queue_main, buffer)) {
-		sent += GW_QUEUE_WIDTH;
-		if (sent >= size) break;
-		buffer += GW_QUEUE_WIDTH;
-	}
+	// Only pool blocks are allowed across
+	ptrdiff_t offset = block - &_pool[0][0];
+	if (offset < 0 || offset >= sizeof _pool || offset % GW_POOL_BLOCK_SIZE)
+		return false;
 
-	if (sent > size) sent = size;
-	return sent;
+	return _desc_push(&_queue_submit, &(struct gw_queue_desc) { block, size });
 }
 
-int gw_queue_gw_recv(uint8_t *buffer, uint16_t size) {
-	if (_is_init == false) return -4;
-	if (buffer == NULL) return -1; 
-	if (size < GW_QUEUE_WIDTH) return -2; // Buffer too small
-
-	uint received = 0;
-	while (queue_try_remove(&_queue_gw, buffer)) {
-		received += GW_QUEUE_WIDTH;
-		size -= received;
-		// If there is not enough in the buffer to receive
-		// without overflowing;
-		if (size < sizeof (uint32_t)) break;
-		buffer += GW_QUEUE_WIDTH;
-	}
-
-	return received;
+bool gw_queue_receive(uint8_t **block, uint16_t *size) {
+	if (_is_init == false) return false;
+
+	struct gw_queue_desc desc;
+	if (!_desc_pop(&_queue_submit, &desc)) return false;
+
+	*block = desc.block;
+	*size = desc.size;
+	return true;
 }
 
-int gw_queue_main_send(uint8_t *buffer, uint16_t size) {
-	if (_is_init == false) return -4;
-	if (buffer == NULL) return -1;
+void gw_queue_release(uint8_t *block) {
+	_desc_push(&_queue_free, &(struct gw_queue_desc) { .block = block });
+}
 
-	uint sent = 0;
-	while (queue_try_add(&_queue_gw, buffer)) {
-		sent += GW_QUEUE_WIDTH;
-		if (sent >= size) break;
-		buffer += GW_QUEUE_WIDTH;
-	}
+// Descriptors only ever move whole. There are never more descriptors in
+// flight than pool blocks, so a push can't actually fail.
+static bool _desc_push(spsc_buffer_t *queue, struct gw_queue_desc *desc) {
+	if (spsc_buffer_remaining(queue) < DESC_SIZE) return false;
 
-	if (sent > size) sent = size;
-	return sent;
+	return spsc_buffer_push(queue, desc, DESC_SIZE) == DESC_SIZE;
 }
 
-int gw_queue_main_recv(uint8_t *buffer, uint16_t size) {
-	if (_is_init == false) return -4;
-	if (buffer == NULL) return -1; 
-	if (size < GW_QUEUE_WIDTH) return -2; // Buffer too small
-
-	uint received = 0;
-	while (queue_try_remove(&_queue_main, buffer)) {
-		received += GW_QUEUE_WIDTH;
-		// If there is not enough in the buffer to receive
-		// without overflowing;
-		if (size < sizeof (uint32_t)) break;
-		buffer += GW_QUEUE_WIDTH;
-	}
-
-	return received;
+static bool _desc_pop(spsc_buffer_t *queue, struct gw_queue_desc *desc) {
+	if (spsc_buffer_length(queue) < DESC_SIZE) return false;
+
+	return spsc_buffer_pop(queue, desc, DESC_SIZE) == DESC_SIZE;
 }
@@ -1,19 +1,43 @@
 #ifndef WISDOM_GATEWAY_QUEUE_H
 #define WISDOM_GATEWAY_QUEUE_H
 
-#include "pico/util/queue.h"
+#include <stdbool.h>
+#include <stdint.h>
 
-#define GW_QUEUE_SIZE 100
-#define GW_QUEUE_TYPE uint32_t
-#define GW_QUEUE_WIDTH (sizeof (GW_QUEUE_TYPE))
+#include "gateway_interface.h"
+
+// Buffer handoff between core0 (radio/main) and core1 (modem)
+//
+// Core0 takes a block from a fixed pool, fills it in place and submits a
+// descriptor (pointer + size) to core1. Core1 copies the record into the
+// upload buffer and hands the block back. Data is never streamed through
+// the queues themselves, only descriptors.
+//
+// Both directions are SPSC rings (see spsc_buffer.h) so neither side ever
+// takes a lock.
+
+#define GW_POOL_COUNT 8
+#define GW_POOL_BLOCK_SIZE GATEWAY_RECORD_MAX
 
 void gw_queue_init(void);
 
-int gw_queue_gw_peek(uint32_t *buffer);
-int gw_queue_gw_send(uint8_t *buffer, uint16_t size);
-int gw_queue_gw_recv(uint8_t *buffer, uint16_t size);
+// CORE0
+
+// Returns a free block of GW_POOL_BLOCK_SIZE bytes
+// NULL if every block is still waiting on core1
+uint8_t *gw_queue_acquire(void);
+
+// Hands [size] bytes of [block] over to core1
+// Returns false if [block] is not from the pool or [size] is too large
+bool gw_queue_submit(uint8_t *block, uint16_t size);
+
+// CORE1
+
+// Takes the next submitted block
+// Returns false if nothing is waiting
+bool gw_queue_receive(uint8_t **block, uint16_t *size);
 
-int gw_queue_main_send(uint8_t *buffer, uint16_t size);
-int gw_queue_main_recv(uint8_t *buffer, uint16_t size);
+// Returns [block] to the pool
+void gw_queue_release(uint8_t *block);
 
 #endif // WISDOM_GATEWAY_QUEUE_H
@@ -1,19 +1,28 @@
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/rand.h"
+#include "hardware/sync.h"
 
 #include "sim7080g_pico.h"
-#include "cbuffer.h"
+#include "record_buffer.h"
 
 #include "gateway_interface.h"
 #include "gateway_error.h"
 
+#include "gateway_queue.h"
+#include "gateway_uplink.h"
+#include "gateway_uplink_pack.h"
+#include "gateway_endpoint.h"
+#include "gw_core.h"
+
 #include "gateway_codes.h" // Communication codes
 						   
 #define UART_BAUD 115200
 
-#define SERVER_IP "73.149.88.183"
 						   
 enum _modem_state_e {
 	MODEM_UNINITIALIZED,
@@ -21,8 +30,12 @@ enum _modem_state_e {
 	MODEM_STOPPED,
 	MODEM_STARTED,
 	MODEM_CN_ACTIVE,
-	MODEM_SERVER_CONNECTED
+	MODEM_SERVER_CONNECTED,
+	MODEM_IDLE,
+	MODEM_STATE_MAX // Keep at end
 };
+static_assert(MODEM_STATE_MAX == GATEWAY_METRICS_STATES, "metrics need one entry per state");
+
 static sim7080g_context_t *_gateway = NULL;
 
 // Yup, a global for exposing state. Don't yell at me.
@@ -36,15 +49,232 @@ static bool _modem_send_incomplete = false;
 // Command flags
 //static bool _start_command_issued = false;
 
+// Pump scheduling
+// gw_modem_pump never sleeps. Anything it has to wait on is turned into
+// a wake time which the caller can sleep (or do radio work) until.
+#define MODEM_POWER_KEY_MS 2500
+#define MODEM_BOOT_TIMEOUT_MS (60 * 1000)
+#define MODEM_POLL_MS 500
+#define MODEM_CN_POLL_MS 1000
+#define MODEM_ACK_POLL_MS 100
+#define MODEM_ACK_TIMEOUT_MS (30 * 1000)
+#define MODEM_AT_POLL_MS 10 // While queued AT commands are waiting on the modem
+#define MODEM_AT_TIMEOUT_US (5 * 1000 * 1000)
+
+static absolute_time_t _wake_time = 0;
+static absolute_time_t _modem_boot_deadline = 0;
+static bool _modem_power_key_held = false;
+static absolute_time_t _modem_state_entered = 0;
+
+// Attach and connect
+// MODEM_STARTED and MODEM_CN_ACTIVE queue the commands that wait on the
+// network and come back for their answers, which the callbacks below
+// take in. Any state change starts the steps over.
+#define MODEM_PDP_TIMEOUT_MS (5 * 1000) // +APP PDP after the +CNACT OK
+
+enum modem_step_e {
+	MODEM_STEP_NONE,       // Next command still to be queued
+	MODEM_STEP_WAITING,    // Queued, answer still to come
+	MODEM_STEP_SEARCHING,  // +COPS? found none, asked again after MODEM_CN_POLL_MS
+	MODEM_STEP_REGISTERED, // +COPS? found a network
+	MODEM_STEP_PDP_WAIT,   // +CNACT OK, +APP PDP still to come
+	MODEM_STEP_OPENED,     // +CAOPEN opened the socket
+	MODEM_STEP_FAILED      // +CNACT or +CAOPEN didn't take
+};
+
+static uint8_t _modem_step = MODEM_STEP_NONE; // modem_step_e
+static absolute_time_t _modem_step_started = 0; // Last command queued
+static absolute_time_t _modem_pdp_deadline = 0;
+
+// Uplink batches (see gateway_uplink.h)
+// Every CASEND is one DATA frame holding as many whole records as fit.
+// Sent batches stay at the front of the output buffer until the server
+// acks them, and go out again with the same seq after a reconnect. Up to
+// MODEM_BATCH_MAX are kept in flight, so a backlog goes out as back to
+// back full-size sends instead of one send per ack round trip.
+#define MODEM_BATCH_MAX 4
+#define MODEM_BATCH_PAYLOAD_MAX (MODEM_TCP_SEND_MAX - UPLINK_HEADER_SIZE)
+
+struct _batch_s {
+	uint32_t seq;
+	uint16_t length; // Framed bytes at the front of the output buffer
+	uint16_t count;  // Records
+	uint16_t packed; // Payload bytes when sent packed, 0 if sent as is
+	uint8_t sends;   // Times sent, over any connection
+};
+
+static struct _batch_s _batches[MODEM_BATCH_MAX]; // Oldest first
+static uint _batch_count = 0;    // Batches waiting on an ack
+static uint _batch_sent = 0;     // ... of which sent on this connection
+static uint32_t _batch_bytes = 0; // Output buffer bytes they cover
+
+static uint32_t _uplink_epoch = 0;
+static uint32_t _uplink_seq = 0; // Last seq handed out
+static struct uplink_reader_s _uplink_reader = {0};
+static absolute_time_t _ack_deadline = 0;
+
+// Server endpoint of the current connection (see gateway_endpoint.h)
+static int _endpoint = -1;
+
+// Transport, see GATEWAY_TRANSPORT_T
+// Over UDP an ack timeout is a lost datagram, not a dead connection, so
+// it is much shorter and is followed by a resend on the same socket.
+// Only after MODEM_UDP_RETRIES of those without progress is the
+// endpoint given up on. A gap the server reports is resent from right
+// away instead, once per gap.
+#ifndef GATEWAY_TRANSPORT
+#define GATEWAY_TRANSPORT GATEWAY_TRANSPORT_TCP
+#endif
+#ifndef GATEWAY_UDP_ACK_TIMEOUT_MS
+#define GATEWAY_UDP_ACK_TIMEOUT_MS (3 * 1000)
+#endif
+#define MODEM_UDP_RETRIES 4
+
+static GATEWAY_TRANSPORT_T _transport = GATEWAY_TRANSPORT;
+static GATEWAY_TRANSPORT_T _link_transport = GATEWAY_TRANSPORT; // Of the open socket
+static uint _udp_retries = 0;
+static bool _udp_gap_resent = false; // Since the last ack
+
+// Frames from the server. Payloads past MODEM_DOWNLINK_MAX are read
+// through and dropped, pushes are passed on as they come instead.
+// Each pump reads up to MODEM_DOWNLINK_READ_MAX of what is waiting.
+#define MODEM_DOWNLINK_MAX 256
+#define MODEM_DOWNLINK_READ_MAX (4 * MODEM_TCP_RECV_MAX)
+static struct uplink_header_s _downlink_header = {0};
+static bool _downlink_in_payload = false;
+static uint16_t _downlink_len = 0;
+static uint16_t _downlink_crc = UPLINK_CRC_INIT; // So far
+static uint8_t _downlink_payload[MODEM_DOWNLINK_MAX + 1]; // + terminator
+static absolute_time_t _downlink_deadline; // Rest of a frame given up on
+
+// Where server pushes go (see gateway_recv). The buffer is lent from
+// core0 and filled on whichever core runs the modem.
+static gateway_recv_sink_t _recv_sink = NULL;
+static void *_recv_sink_arg = NULL;
+static uint8_t *volatile _recv_buffer = NULL;
+static volatile uint _recv_size = 0;
+static volatile bool _recv_ready = false; // Whole push in _recv_buffer
+static volatile uint16_t _recv_len = 0;
+static uint8_t *_recv_into = NULL;        // Push coming in goes here
+
+#ifdef GATEWAY_UPLINK_PACK
+// Packed batches (see gateway_uplink_pack.h)
+// Records are copied out of the ring and packed into as many as fit in
+// one send. A batch only goes out packed if that is smaller than sending
+// the same records as is. A resend packs the same records again, which
+// gives the same frame, so nothing but the last frame is kept.
+#define MODEM_PACK_STAGE_SIZE (1024 * 8)
+
+static uint8_t _pack_stage[MODEM_PACK_STAGE_SIZE];
+static uint8_t _pack_frame[MODEM_BATCH_PAYLOAD_MAX];
+static uint32_t _pack_frame_seq = 0; // Batch held in _pack_frame
+#endif
+
+static struct gateway_upload_stats_s _upload_stats = {0};
+static absolute_time_t _connected_at = 0;
+
+// Modem UART rate to move up to once it answers, and RTS/CTS if both
+// are wired (see sim7080g_link_set)
+#ifndef GATEWAY_PIN_CTS
+#define GATEWAY_PIN_CTS MODEM_PIN_NONE
+#endif
+#ifndef GATEWAY_PIN_RTS
+#define GATEWAY_PIN_RTS MODEM_PIN_NONE
+#endif
+
+// Session keeping
+// Instead of tearing down to MODEM_POWERED_DOWN after an upload, the
+// modem is left registered with its PDP context up and asked to go into
+// PSM (eDRX while it is still in its active time). The next cycle wakes
+// it and goes straight to TCP, skipping power up, config and attach.
+// If the parked session doesn't answer we fall back to a full bring-up.
+//
+// Timers are 3GPP 8 bit strings (see AT+CPSMS / AT+CEDRXS)
+#ifndef GATEWAY_PSM_TAU
+#define GATEWAY_PSM_TAU "00100010" // T3412 periodic TAU: 2 hours
+#endif
+#ifndef GATEWAY_PSM_ACTIVE
+#define GATEWAY_PSM_ACTIVE "00000101" // T3324 active time: 10 seconds
+#endif
+#ifndef GATEWAY_EDRX_VALUE
+#define GATEWAY_EDRX_VALUE "0101" // CAT-M eDRX cycle: 81.92 seconds
+#endif
+
+// Shorter than the press that switches a running modem off
+#define MODEM_PSM_WAKE_MS 500
+#define MODEM_PSM_WAKE_TIMEOUT_MS (5 * 1000)
+
+#ifdef GATEWAY_SESSION_KEEP
+static bool _session_keep = true;
+#else
+static bool _session_keep = false;
+#endif
+static bool _modem_psm_configured = false; // Or queued, see _modem_psm_done
+static bool _modem_wake_pulsed = false;
+
+static struct gateway_session_stats_s _session_stats = {0};
+static bool _cycle_active = false;
+static absolute_time_t _cycle_started = 0;
+
+// Link metrics
+// Unlike the session stats these cover all time, parked time included
+#define MODEM_METRICS_RECORD_SIZE (4 + 7 + GATEWAY_METRICS_STATES * 32 + 36)
+
+static struct gateway_metrics_s _metrics = {0};
+static absolute_time_t _metrics_since = 0;
+static absolute_time_t _metrics_state_entered = 0;
+#ifdef GATEWAY_METRICS_INTERVAL_MS
+static uint32_t _metrics_interval_ms = GATEWAY_METRICS_INTERVAL_MS;
+#else
+static uint32_t _metrics_interval_ms = 0;
+#endif
+static bool _metrics_queued = false;
+static absolute_time_t _metrics_queued_at = 0;
+
 // Data output buffer
+// Holds length framed records (see record_buffer.h) so a node packet
+// is either queued whole or refused, and every TCP send carries only
+// complete records.
 #define MODEM_BUFFER_OUT_SIZE (1024 * 10) // 10 KB
-static cbuffer_t *_modem_buffer_out = NULL;
+static rbuffer_t *_modem_buffer_out = NULL;
+
+// What to do when a record doesn't fit in the output buffer
+#ifndef GATEWAY_OVERFLOW_POLICY
+#define GATEWAY_OVERFLOW_POLICY GATEWAY_OVERFLOW_DROP_OLDEST
+#endif
+static GATEWAY_OVERFLOW_POLICY_T _overflow_policy = GATEWAY_OVERFLOW_POLICY;
+static struct gateway_drop_stats_s _drop_stats = {0};
+
+// Secondary storage for GATEWAY_OVERFLOW_SPILL
+// While anything is sitting in spill storage new records are spilled
+// too, so the upload order stays oldest first: ring, then storage.
+static const struct gateway_spill_s *_spill = NULL;
+static bool _spill_active = false;   // Unread records in spill storage
+static bool _spill_unreleased = false; // Read back but not yet acked
+static uint32_t _spill_unreleased_bytes = 0;
+static uint8_t _spill_read_failures = 0; // In a row
+static bool _spill_failed = false; // Couldn't get past a bad record
+
+// Reading back pauses after this much until the server has acked it, so
+// a long drain checkpoints its progress along the way
+#define MODEM_SPILL_RELEASE_BYTES (32 * 1024)
+
+// Failed reads in a row before the record they fail on is given up on
+// and skipped. Otherwise the modem would never run out of data to wait
+// for. Storage that can't skip it isn't used again until the next
+// gateway_spill_set, overflow falls back to DROP_OLDEST.
+#define MODEM_SPILL_READ_RETRIES 8
+
+// Core0 side of GATEWAY_DUAL_CORE
+#ifdef GATEWAY_DUAL_CORE
+static uint8_t *_span_block = NULL; // Pool block handed out by gateway_queue_span
+#endif
+static uint32_t _handoff_dropped = 0; // Pushes refused because the pool was empty
 
 // Command buffer
 // Should only need to hold several commands at a time
 #define MODEM_BUFFER_COMMAND_SIZE (sizeof (uint32_t) * 100)
 //static cbuffer_t *_modem_buffer_command = NULL; // Internal func prototypes
-static bool _modem_cn_available(void);
 //static int _message_queue_process(void);
 //static void _dispatch_message_buffer(uint32_t buffer);
 //static int _build_command(uint32_t buffer);
@@ -53,16 +283,51 @@ static bool _modem_cn_available(void);
 static bool _modem_buffer_push(void *buffer, uint size);
 //static void _command_buffer_execute(void);
 static bool _modem_buffer_send(void);
+static bool _modem_buffer_empty(void);
+static void _modem_buffer_refill(void);
+static void _modem_power_key_press(uint32_t ms);
+static void _modem_state_set(int state);
+static void _metrics_dwell_add(int state, uint64_t dwell_us);
+static void _metrics_queue(void);
+static void _modem_cycle_start(bool cold);
+static void _modem_session_park(void);
+static void _modem_psm_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg);
+static void _modem_step_queued(bool queued);
+static void _modem_open_failed(void);
+static void _modem_cn_available_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg);
+static void _modem_cn_activate_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg);
+static void _modem_socket_open_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg);
+static void _wake_in_ms(uint32_t ms);
+static void _modem_tcp_close(void);
+static uint32_t _modem_ack_timeout_ms(void);
+static bool _modem_uplink_hello(void);
+static bool _modem_batch_make(struct _batch_s *batch);
+static bool _modem_batch_send(uint index, uint32_t offset);
+#ifdef GATEWAY_UPLINK_PACK
+static int _modem_batch_pack(uint32_t offset, size_t length, size_t *used, uint *count);
+#endif
+static void _modem_downlink_read(void);
+static void _modem_downlink_feed(const uint8_t *data, size_t len, void *arg);
+static void _modem_downlink_take(const uint8_t *data, size_t len);
+static void _modem_downlink_handle(void);
+static void _modem_push_begin(void);
+static void _modem_push_piece(const uint8_t *data, size_t len, bool last);
+static void _modem_ack(uint32_t seq);
+static void _modem_gap(uint32_t seq);
+static bool _modem_buffer_drop_oldest(void);
 
 bool gateway_init(void) {
 	bool success = false;
 
-	_modem_buffer_out = cbuffer_create(MODEM_BUFFER_OUT_SIZE);
+	_modem_buffer_out = rbuffer_create(MODEM_BUFFER_OUT_SIZE);
 	//_modem_buffer_command = cbuffer_create(MODEM_BUFFER_COMMAND_SIZE);
 
 	if (!_modem_buffer_out) // || !_modem_buffer_command)
 		goto RETURN_SUCCESS;
 
+	if (!endpoint_init())
+		goto RETURN_SUCCESS;
+
 	_gateway = sim7080g_create();
 	if (_gateway == NULL)
 		goto RETURN_SUCCESS;
@@ -77,157 +342,1186 @@ bool gateway_init(void) {
 			GATEWAY_PIN_PWR
 	);
 
+#ifdef GATEWAY_UART_BAUD
+	sim7080g_link_set(_gateway, GATEWAY_UART_BAUD, GATEWAY_PIN_CTS, GATEWAY_PIN_RTS);
+#endif
+
 	MODEM_CORE_STATE = MODEM_POWERED_DOWN;
 
+	_metrics_since = _metrics_state_entered = get_absolute_time();
+	_metrics.states[MODEM_POWERED_DOWN].entries++;
+
+	// Lets the server tell this boot's batch numbers from the last one's
+	_uplink_epoch = get_rand_32();
+
+#ifdef GATEWAY_DUAL_CORE
+	// Modem belongs to core1 from here on
+	gw_queue_init();
+	multicore_launch_core1(gw_core_entry);
+#endif
+
 	success = true;
 RETURN_SUCCESS:
 	return success;
-
-// OLD
-	//gw_queue_init();
-
-	//multicore_launch_core1(gw_core_entry);
 }
 
 int gateway_pump(void) {
+#ifdef GATEWAY_DUAL_CORE
+	// Core1 does the pumping
+	return MODEM_CORE_STATE;
+#else
+	return gw_modem_pump();
+#endif
+}
+
+int gw_modem_pump(void) {
+
+	// Nothing is due yet
+	if (!time_reached(_wake_time))
+		return MODEM_CORE_STATE;
+
+	// Default to coming straight back. States that are waiting on
+	// something push this out.
+	_wake_time = get_absolute_time();
+
+	// Finish a power key press before anything else
+	if (_modem_power_key_held) {
+		sim7080g_power_key_set(_gateway, false);
+		_modem_power_key_held = false;
 
-	//_message_queue_process();
-	//_command_buffer_execute();
+		// A PSM wake gets less time to answer than a cold boot
+		if (MODEM_CORE_STATE == MODEM_IDLE)
+			_modem_boot_deadline = make_timeout_time_ms(MODEM_PSM_WAKE_TIMEOUT_MS);
+		else
+			_modem_boot_deadline = make_timeout_time_ms(MODEM_BOOT_TIMEOUT_MS);
+
+		_wake_in_ms(MODEM_POLL_MS);
+		return MODEM_CORE_STATE;
+	}
+
+	// Pull spilled records back in as the ring makes room
+	_modem_buffer_refill();
+
+	// Queued commands finish in the background of the states below
+	sim7080g_at_pump(_gateway);
+
+	int state = MODEM_CORE_STATE;
 
-	static int count = 0;
 	switch (MODEM_CORE_STATE) {
 	case MODEM_POWERED_DOWN:
-		if (cbuffer_empty(_modem_buffer_out))
+		// Sleep until a push wakes us
+		if (_modem_buffer_empty()) {
+			_wake_time = at_the_end_of_time;
 			break;
+		}
 
-		sim7080g_toggle_power(_gateway);
-		MODEM_CORE_STATE = MODEM_STOPPED;
+		_modem_cycle_start(true);
+		_modem_power_key_press(MODEM_POWER_KEY_MS);
+		_modem_state_set(MODEM_STOPPED);
 		break;
 
 	case MODEM_STOPPED:
 			
 		// If we are stopped and have nothing to do
-		if (cbuffer_empty(_modem_buffer_out)) {
+		if (_modem_buffer_empty()) {
 			if (sim7080g_power_down(_gateway))
-				MODEM_CORE_STATE = MODEM_POWERED_DOWN;
+				_modem_state_set(MODEM_POWERED_DOWN);
+			else
+				_wake_in_ms(MODEM_POLL_MS);
 			break;
 		}
 
-		if (count == 100) {
-			sim7080g_toggle_power(_gateway);
-			count = 0;
+		// Modem never came up, give it another kick
+		if (time_reached(_modem_boot_deadline)) {
+			_modem_power_key_press(MODEM_POWER_KEY_MS);
 			break;
 		}
-		count++;
 
-		
 		// Try to start
-		if (!sim7080g_is_ready(_gateway))
+		if (!sim7080g_is_ready(_gateway)) {
+			_wake_in_ms(MODEM_POLL_MS);
 			break;
+		}
+
+		// Falls back to the boot rate on its own
+		sim7080g_link_negotiate(_gateway);
 
 		sim7080g_config(_gateway);
+		_modem_psm_configured = false;
 
-		count = 0;
-		MODEM_CORE_STATE = MODEM_STARTED;
+		_modem_state_set(MODEM_STARTED);
 		break;
 
 	case MODEM_STARTED:
-		if (!sim7080g_is_ready(_gateway) || cbuffer_empty(_modem_buffer_out)) {
-			MODEM_CORE_STATE = MODEM_STOPPED;
+		// +COPS? or +CNACT is on the queue
+		if (_modem_step == MODEM_STEP_WAITING) {
+			_wake_in_ms(MODEM_AT_POLL_MS);
+			break;
+		}
+
+		if (_modem_step == MODEM_STEP_SEARCHING) {
+			_modem_step = MODEM_STEP_NONE;
+			_wake_in_ms(MODEM_CN_POLL_MS);
 			break;
 		}
 
-		if (!_modem_cn_available())
+		if (_modem_step == MODEM_STEP_REGISTERED) {
+			_modem_step_queued(sim7080g_cn_activate_enqueue(_gateway, true, _modem_cn_activate_done, NULL));
 			break;
+		}
+
+		if (_modem_step == MODEM_STEP_PDP_WAIT) {
+			enum sim7080g_link_state_e pdp = sim7080g_cn_state(_gateway);
+			if (pdp == MODEM_LINK_UP) {
+				_modem_state_set(MODEM_CN_ACTIVE);
+				break;
+			}
+
+			if (pdp == MODEM_LINK_UNKNOWN && !time_reached(_modem_pdp_deadline)) {
+				_wake_in_ms(MODEM_AT_POLL_MS);
+				break;
+			}
 
-		if (!sim7080g_cn_activate(_gateway, true)) {
+			_modem_step = MODEM_STEP_FAILED;
+		}
+
+		if (_modem_step == MODEM_STEP_FAILED) {
 			sim7080g_cn_activate(_gateway, false);
+			_modem_step = MODEM_STEP_NONE;
+			_wake_in_ms(MODEM_CN_POLL_MS);
+			break;
+		}
+
+		if (_modem_buffer_empty() && _session_keep) {
+			_modem_session_park();
+			break;
+		}
+
+		if (!sim7080g_is_ready(_gateway) || _modem_buffer_empty()) {
+			_modem_boot_deadline = make_timeout_time_ms(MODEM_BOOT_TIMEOUT_MS);
+			_modem_state_set(MODEM_STOPPED);
 			break;
 		}
 
-		MODEM_CORE_STATE = MODEM_CN_ACTIVE;
+		_modem_step_queued(sim7080g_cn_available_enqueue(_gateway, _modem_cn_available_done, NULL));
 		break;
 
 	case MODEM_CN_ACTIVE:
-		if (!sim7080g_cn_is_active(_gateway) || cbuffer_empty(_modem_buffer_out)) {
-			sim7080g_cn_activate(_gateway, false);
-			MODEM_CORE_STATE = MODEM_STARTED;
+		// +CAOPEN is on the queue
+		if (_modem_step == MODEM_STEP_WAITING) {
+			_wake_in_ms(MODEM_AT_POLL_MS);
 			break;
 		}
 
-		if (!sim7080g_tcp_open(_gateway, strlen(SERVER_IP), SERVER_IP, 8086)) {
-			sim7080g_tcp_close(_gateway);
+		if (_modem_step == MODEM_STEP_FAILED) {
+			_modem_open_failed();
 			break;
 		}
 
-		//sim7080g_ssl_enable(_gateway,false);
+		if (_modem_step == MODEM_STEP_OPENED) {
+			endpoint_connected(_endpoint, absolute_time_diff_us(_modem_step_started, get_absolute_time()));
 
-		MODEM_CORE_STATE = MODEM_SERVER_CONNECTED;
+			//sim7080g_ssl_enable(_gateway,false);
+
+			_connected_at = get_absolute_time();
+			_modem_state_set(MODEM_SERVER_CONNECTED);
+
+			// New connection, new stream. Not on a UDP hello again, what
+			// the server is sending carries on.
+			uplink_reader_reset(&_uplink_reader);
+			_downlink_in_payload = false;
+
+			if (!_modem_uplink_hello())
+				_modem_tcp_close();
+			break;
+		}
+
+		// Leave the PDP context up for the next cycle
+		if (_modem_buffer_empty() && _session_keep) {
+			_modem_session_park();
+			break;
+		}
+
+		if (!sim7080g_cn_is_active(_gateway) || _modem_buffer_empty()) {
+			sim7080g_cn_activate(_gateway, false);
+			_modem_state_set(MODEM_STARTED);
+			break;
+		}
+
+		char host[GATEWAY_ENDPOINT_HOST_MAX];
+		uint16_t port;
+		_endpoint = endpoint_pick(host, &port);
+
+		_link_transport = _transport;
+		_udp_retries = 0;
+		_udp_gap_resent = false;
+
+		if (_endpoint < 0) {
+			_modem_open_failed();
+			break;
+		}
+
+		_modem_step_queued(sim7080g_socket_open_enqueue(_gateway, _link_transport == GATEWAY_TRANSPORT_UDP,
+				strlen(host), host, port, _modem_socket_open_done, NULL));
 		break;
 
 	case MODEM_SERVER_CONNECTED:
-		if (!sim7080g_tcp_is_open(_gateway) || ((cbuffer_empty(_modem_buffer_out) && !_modem_send_incomplete))) {
-			MODEM_CORE_STATE = MODEM_CN_ACTIVE;
-			sim7080g_tcp_close(_gateway);
+		if (!sim7080g_tcp_is_open(_gateway)) {
+			_modem_tcp_close();
+			break;
+		}
+
+		// Let go of whatever the server says it has stored, take in
+		// whatever it pushed. Only asks for data once the modem has said
+		// some came in, or one last time before giving up on an ack in
+		// case that URC was lost.
+		if (sim7080g_tcp_data_pending(_gateway) || (_batch_count && time_reached(_ack_deadline)))
+			_modem_downlink_read();
+
+		// Records read back from spill storage are only let go of once
+		// the server has acked them
+		if (_spill_unreleased && rbuffer_empty(_modem_buffer_out)) {
+			_spill->release();
+			_spill_unreleased = false;
+			_spill_unreleased_bytes = 0;
+		}
+
+		// Everything is stored, and no push is halfway in
+		if (_modem_buffer_empty() && !(_downlink_in_payload && !time_reached(_downlink_deadline))) {
+			_modem_tcp_close();
 			break;
 		}
 
+		// Server has gone quiet, reconnect and send again
+		if (_batch_sent && time_reached(_ack_deadline)) {
+			_upload_stats.ack_timeouts++;
+
+			// Over UDP, say hello again and resend on the same socket
+			if (_link_transport == GATEWAY_TRANSPORT_UDP && _udp_retries < MODEM_UDP_RETRIES) {
+				_udp_retries++;
+				_udp_gap_resent = false;
+				_batch_sent = 0;
+				if (_modem_uplink_hello()) {
+					_ack_deadline = make_timeout_time_ms(_modem_ack_timeout_ms());
+				} else {
+					_modem_tcp_close();
+					break;
+				}
+			} else {
+				endpoint_failed(_endpoint);
+				_modem_tcp_close();
+				break;
+			}
+		}
+
 		_modem_send_incomplete = !_modem_buffer_send();
-		
-		// Wait for data to be acknowleged
-		uint sent = 0;
-		uint unack = 0;
-		while (sim7080g_tcp_is_open(_gateway)) {
-			sim7080g_tcp_ack(_gateway, &sent, &unack);
-			if (sent == 0 || unack == 0) break;
-			sleep_ms(500);
+
+		// Window is full or all sent, give the server time to ack
+		_wake_in_ms(MODEM_ACK_POLL_MS);
+		break;
+
+	case MODEM_IDLE:
+		// Session is parked, sleep until a push wakes us
+		if (_modem_buffer_empty()) {
+			_wake_time = at_the_end_of_time;
+			break;
+		}
+
+		if (!_cycle_active)
+			_modem_cycle_start(false);
+
+		if (sim7080g_is_ready(_gateway)) {
+			// Registration survives PSM. If the PDP context did too
+			// we can go straight to opening TCP.
+			if (sim7080g_cn_is_active(_gateway)) {
+				_session_stats.pdp_reuses++;
+				_modem_state_set(MODEM_CN_ACTIVE);
+			} else {
+				_modem_state_set(MODEM_STARTED);
+			}
+			break;
+		}
+
+		// Still asleep in PSM, nudge it once
+		if (!_modem_wake_pulsed) {
+			_modem_wake_pulsed = true;
+			_modem_power_key_press(MODEM_PSM_WAKE_MS);
+			break;
+		}
+
+		// Session is gone, start over from power up. STOPPED gives the
+		// power key a full press straight away.
+		if (time_reached(_modem_boot_deadline)) {
+			_session_stats.fallbacks++;
+			_modem_state_set(MODEM_STOPPED);
+			break;
 		}
 
+		_wake_in_ms(MODEM_POLL_MS);
 		break;
 	}
 
+	if (MODEM_CORE_STATE == state)
+		_metrics.states[state].retries++;
+
+	// Keep coming back for queued commands, between radio work
+	if (sim7080g_at_busy(_gateway)
+			&& absolute_time_diff_us(make_timeout_time_ms(MODEM_AT_POLL_MS), _wake_time) > 0)
+		_wake_in_ms(MODEM_AT_POLL_MS);
+
 	return MODEM_CORE_STATE;
 }
 
+absolute_time_t gateway_next_service(void) {
+	return _wake_time;
+}
+
 int gateway_state_get(void) {
 	return MODEM_CORE_STATE;
 }
 
 int gateway_queue_push (void *data, uint32_t size) {
-	return cbuffer_push(_modem_buffer_out, (uint8_t *)data, size);
+	if (data == NULL || size == 0 || size > GATEWAY_RECORD_MAX) return -1;
+
+#ifdef GATEWAY_DUAL_CORE
+	uint8_t *block = gw_queue_acquire();
+	if (block == NULL) {
+		_handoff_dropped++;
+		return 0;
+	}
+
+	memcpy(block, data, size);
+	gw_queue_submit(block, size);
+
+	// Wake core1 if it is sleeping in gw_core_entry
+	__sev();
+
+	return size;
+#else
+	return _modem_buffer_push(data, size) ? size : 0;
+#endif
+}
+
+uint32_t gateway_queue_span(void **span) {
+#ifdef GATEWAY_DUAL_CORE
+	// Build straight into a pool block, which core1 gets on commit
+	if (_span_block == NULL)
+		_span_block = gw_queue_acquire();
+
+	if (_span_block == NULL) return 0;
+
+	*span = _span_block;
+	return GW_POOL_BLOCK_SIZE;
+#else
+	// In place writes would jump ahead of spilled records
+	if (_spill_active) return 0;
+
+	uint32_t span_len = rbuffer_write_span(_modem_buffer_out, (uint8_t **)span);
+
+	return span_len < GATEWAY_RECORD_MAX ? span_len : GATEWAY_RECORD_MAX;
+#endif
+}
+
+int gateway_queue_commit(uint32_t size) {
+	if (size > GATEWAY_RECORD_MAX) return -1;
+
+#ifdef GATEWAY_DUAL_CORE
+	if (_span_block == NULL || !gw_queue_submit(_span_block, size))
+		return -1;
+
+	_span_block = NULL;
+	__sev();
+	return size;
+#else
+	return rbuffer_write_commit(_modem_buffer_out, size);
+#endif
+}
+
+bool gateway_overflow_policy_set(GATEWAY_OVERFLOW_POLICY_T policy) {
+	if (policy < 0 || policy >= GATEWAY_OVERFLOW_POLICY_MAX) return false;
+
+	_overflow_policy = policy;
+	return true;
+}
+
+GATEWAY_OVERFLOW_POLICY_T gateway_overflow_policy_get(void) {
+	return _overflow_policy;
+}
+
+bool gateway_transport_set(GATEWAY_TRANSPORT_T transport) {
+	if (transport < 0 || transport >= GATEWAY_TRANSPORT_MAX) return false;
+
+	_transport = transport;
+	return true;
+}
+
+GATEWAY_TRANSPORT_T gateway_transport_get(void) {
+	return _transport;
+}
+
+void gateway_spill_set(const struct gateway_spill_s *spill) {
+	_spill = spill;
+	_spill_read_failures = 0;
+	_spill_failed = false;
+}
+
+void gateway_drop_stats_get(struct gateway_drop_stats_s *dst) {
+	*dst = _drop_stats;
+	dst->handoff_dropped = _handoff_dropped;
+}
+
+void gateway_drop_stats_reset(void) {
+	_drop_stats = (struct gateway_drop_stats_s) {0};
+	_handoff_dropped = 0;
+}
+
+void gateway_upload_stats_get(struct gateway_upload_stats_s *dst) {
+	*dst = _upload_stats;
+
+	// Include the connection that is still open
+	if (MODEM_CORE_STATE == MODEM_SERVER_CONNECTED)
+		dst->connected_us += absolute_time_diff_us(_connected_at, get_absolute_time());
+
+	dst->goodput_bps = 0;
+	if (dst->connected_us)
+		dst->goodput_bps = (uint64_t)dst->payload_bytes * 1000000 / dst->connected_us;
+}
+
+void gateway_session_keep_set(bool keep) {
+	_session_keep = keep;
+}
+
+bool gateway_session_keep_get(void) {
+	return _session_keep;
+}
+
+void gateway_session_stats_get(struct gateway_session_stats_s *dst) {
+	*dst = _session_stats;
+}
+
+void gateway_session_stats_reset(void) {
+	_session_stats = (struct gateway_session_stats_s) {0};
 }
 
-bool gateway_recv(void *data, uint size) {
+void gateway_metrics_get(struct gateway_metrics_s *dst) {
+	absolute_time_t now = get_absolute_time();
+
+	*dst = _metrics;
+	dst->uptime_us = absolute_time_diff_us(_metrics_since, now);
+
+	// Include the stay so far in the current state
+	dst->states[MODEM_CORE_STATE].dwell_us += absolute_time_diff_us(_metrics_state_entered, now);
+
+	struct sim7080g_at_stats_s at;
+	sim7080g_at_stats_get(_gateway, &at);
+	dst->at_commands = at.commands;
+	dst->at_timeouts = at.timeouts;
+	dst->at_mean_us = at.commands ? at.total_us / at.commands : 0;
+	dst->at_max_us = at.max_us;
+}
+
+void gateway_metrics_reset(void) {
+	_metrics = (struct gateway_metrics_s) {0};
+	_metrics_since = _metrics_state_entered = get_absolute_time();
+	sim7080g_at_stats_reset(_gateway);
+}
+
+void gateway_metrics_interval_set(uint32_t interval_ms) {
+	_metrics_interval_ms = interval_ms;
+}
+
+void gateway_upload_stats_reset(void) {
+	_upload_stats = (struct gateway_upload_stats_s) {0};
+	_connected_at = get_absolute_time();
+}
+
+void gateway_recv_sink_set(gateway_recv_sink_t sink, void *arg) {
+	_recv_sink_arg = arg;
+	_recv_sink = sink;
+}
+
+int gateway_recv(void *data, uint size) {
+	if (_recv_ready) {
+		__dmb();
+		int len = _recv_len;
+		_recv_buffer = NULL;
+		_recv_ready = false;
+		return len;
+	}
+
+	_recv_size = size;
+	__dmb();
+	_recv_buffer = data;
 
 	return 0;
 }
 
-static bool _modem_cn_available(void) {
-	if (MODEM_CORE_STATE <= MODEM_STOPPED)
-		return false;
+bool gw_modem_buffer_push(void *buffer, uint size) {
+	return _modem_buffer_push(buffer, size);
+}
 
-	return sim7080g_cn_available(_gateway);
+static bool _modem_buffer_push(void *buffer, uint size) {
+	switch (_overflow_policy) {
+	case GATEWAY_OVERFLOW_SPILL:
+		if (_spill != NULL && !_spill_failed
+				&& (_spill_active || rbuffer_remaining(_modem_buffer_out) < size)) {
+			if (_spill->write(buffer, size)) {
+				_spill_active = true;
+				_drop_stats.records_spilled++;
+				_drop_stats.bytes_spilled += size;
+				return true;
+			}
+
+			// Storage is full or broken. Keeping fresh data wins over
+			// keeping order.
+			_drop_stats.spill_failures++;
+		}
+		// fall through
+	case GATEWAY_OVERFLOW_DROP_OLDEST:
+		while (rbuffer_remaining(_modem_buffer_out) < size)
+			if (!_modem_buffer_drop_oldest()) break;
+		break;
+
+	case GATEWAY_OVERFLOW_DROP_NEWEST:
+	default:
+		break;
+	}
+
+	if (rbuffer_push(_modem_buffer_out, buffer, size) == size) {
+		// A powered down or parked modem has nothing scheduled, so new data
+		// has to make the pump due again
+		if (MODEM_CORE_STATE == MODEM_POWERED_DOWN || MODEM_CORE_STATE == MODEM_IDLE)
+			_wake_time = get_absolute_time();
+
+		return true;
+	}
+
+	_drop_stats.records_dropped++;
+	_drop_stats.bytes_dropped += size;
+	return false;
 }
 
-static bool _modem_buffer_send(void) {
-	static uint8_t data[100];
-	static int popped;
-	static bool data_buffered = false;
+static bool _modem_buffer_empty(void) {
+	return rbuffer_empty(_modem_buffer_out) && !_spill_active;
+}
+
+static void _modem_buffer_refill(void) {
+	static uint8_t record[GATEWAY_RECORD_MAX];
+
+	if (!_spill_active) return;
 
-	while (!cbuffer_empty(_modem_buffer_out) || data_buffered) {
-		if (!data_buffered) {
-			popped = cbuffer_pop(_modem_buffer_out, data, sizeof data);
-			//printf("popped: %u\n", popped);
-			//printf("cblen: %u\n", cbuffer_length(_modem_buffer_out));
-			data_buffered = true;
+	// Only read when any record is guaranteed to fit, so nothing read
+	// back from storage ever has to be held aside
+	while (rbuffer_remaining(_modem_buffer_out) >= GATEWAY_RECORD_MAX
+			&& _spill_unreleased_bytes < MODEM_SPILL_RELEASE_BYTES) {
+		int size = _spill->read(record, sizeof record);
+		if (size < 0) {
+			if (++_spill_read_failures < MODEM_SPILL_READ_RETRIES) break;
+
+			_spill_read_failures = 0;
+			_drop_stats.spill_failures++;
+
+			int skipped = _spill->skip();
+			if (skipped >= 0) {
+				_drop_stats.records_dropped += skipped;
+			} else {
+				_spill_active = false;
+				_spill_failed = true;
+			}
+			break;
 		}
 
-		if (!sim7080g_tcp_send(_gateway, popped, data))
+		_spill_read_failures = 0;
+
+		if (size == 0) {
+			_spill_active = false;
 			break;
+		}
+
+		rbuffer_push(_modem_buffer_out, record, size);
+		_spill_unreleased = true;
+		_spill_unreleased_bytes += size;
+	}
+}
+
+static bool _modem_buffer_send(void) {
+	uint32_t offset = 0;
+	for (uint i = 0; i < _batch_sent; i++)
+		offset += _batches[i].length;
+
+	// Batches not yet sent on this connection go first, same seq and
+	// same records as last time. Then new ones while there is room.
+	// Nothing is committed here, only _modem_ack does that.
+	while (_batch_sent < MODEM_BATCH_MAX) {
+		if (_batch_sent == _batch_count) {
+			struct _batch_s *batch = &_batches[_batch_count];
+			*batch = (struct _batch_s) { .seq = _uplink_seq + 1 };
+			if (!_modem_batch_make(batch)) break;
+
+			_uplink_seq++;
+			_batch_count++;
+			_batch_bytes += batch->length;
+		}
+
+		if (!_modem_batch_send(_batch_sent, offset))
+			return false;
+
+		offset += _batches[_batch_sent].length;
+		_batch_sent++;
+	}
+
+	return true;
+}
+
+static void _modem_tcp_close(void) {
+	sim7080g_tcp_close(_gateway);
+
+	// Unacked batches go out again on the next connection
+	_batch_sent = 0;
+
+	_upload_stats.connected_us += absolute_time_diff_us(_connected_at, get_absolute_time());
+	_modem_state_set(MODEM_CN_ACTIVE);
+}
+
+static bool _modem_uplink_hello(void) {
+	uint8_t header[UPLINK_HEADER_SIZE];
+	uplink_header_pack(header, &(struct uplink_header_s) {
+		.type = UPLINK_HELLO,
+		.seq = _uplink_epoch,
+	});
+
+	return sim7080g_tcp_sendv(_gateway, &(struct sim7080g_chunk_s) {header, sizeof header}, 1);
+}
+
+// Fills in the next batch from the output buffer past the batches
+// already made
+//
+// return: false if there is nothing left to batch
+static bool _modem_batch_make(struct _batch_s *batch) {
+	uint count;
+	size_t length = rbuffer_batch_length_at(
+			_modem_buffer_out, _batch_bytes, MODEM_BATCH_PAYLOAD_MAX, &count);
+	if (length == 0) return false;
+
+	batch->length = length;
+	batch->count = count;
+
+#ifdef GATEWAY_UPLINK_PACK
+	size_t staged = rbuffer_batch_length_at(
+			_modem_buffer_out, _batch_bytes, MODEM_PACK_STAGE_SIZE, &count);
+
+	size_t used;
+	int packed = _modem_batch_pack(_batch_bytes, staged, &used, &count);
+	if (packed > 0 && (size_t)packed < used) {
+		batch->length = used;
+		batch->count = count;
+		batch->packed = packed;
+		_pack_frame_seq = batch->seq;
+	}
+#endif
+
+	return true;
+}
+
+#ifdef GATEWAY_UPLINK_PACK
+// Packs records starting [offset] bytes into the output buffer into
+// _pack_frame, as many of the first [length] bytes as fit
+static int _modem_batch_pack(uint32_t offset, size_t length, size_t *used, uint *count) {
+	if (cbuffer_peek(_modem_buffer_out->bytes, offset, _pack_stage, length) != (int)length)
+		return -1;
+
+	return uplink_pack_encode(_pack_stage, length, _pack_frame, sizeof _pack_frame, used, count);
+}
+#endif
+
+// Sends _batches[index] as a DATA (or DATA_PACKED) frame. The records
+// start [offset] bytes into the output buffer. Header and payload go
+// out together in one CASEND, the payload straight from the (at most
+// two) ring spans unless packed.
+static bool _modem_batch_send(uint index, uint32_t offset) {
+	struct _batch_s *batch = &_batches[index];
+	cbuffer_t *bytes = _modem_buffer_out->bytes;
+
+	uint8_t header[UPLINK_HEADER_SIZE];
+	struct sim7080g_chunk_s chunks[3] = { { header, sizeof header } };
+	uint chunk_count;
+	struct uplink_header_s frame = { .seq = batch->seq };
+
+#ifdef GATEWAY_UPLINK_PACK
+	if (batch->packed) {
+		if (_pack_frame_seq != batch->seq) {
+			size_t used;
+			uint count;
+			if (_modem_batch_pack(offset, batch->length, &used, &count) != batch->packed)
+				return false;
+			_pack_frame_seq = batch->seq;
+		}
+
+		frame.type = UPLINK_DATA_PACKED;
+		frame.length = batch->packed;
+		frame.crc = uplink_crc16(UPLINK_CRC_INIT, _pack_frame, batch->packed);
+
+		chunks[1] = (struct sim7080g_chunk_s) { _pack_frame, batch->packed };
+		chunk_count = 2;
+	} else
+#endif
+	{
+		uint8_t *span;
+		size_t span_len = cbuffer_peek_span_at(bytes, offset, &span);
+		if (span_len > batch->length) span_len = batch->length;
+
+		frame.type = UPLINK_DATA;
+		frame.length = batch->length;
+		frame.crc = uplink_crc16(UPLINK_CRC_INIT, span, span_len);
+		frame.crc = uplink_crc16(frame.crc, bytes->buff, batch->length - span_len);
+
+		chunks[1] = (struct sim7080g_chunk_s) { span, span_len };
+		chunks[2] = (struct sim7080g_chunk_s) { bytes->buff, batch->length - span_len };
+		chunk_count = 3;
+	}
 
-		data_buffered = false;
-		//printf("data: %X\n", data);
+	uplink_header_pack(header, &frame);
+
+	absolute_time_t start = get_absolute_time();
+	bool sent = sim7080g_tcp_sendv(_gateway, chunks, chunk_count);
+	_upload_stats.send_us += absolute_time_diff_us(start, get_absolute_time());
+
+	if (!sent) {
+		_upload_stats.send_failures++;
+		return false;
+	}
+
+	// First batch out on this connection starts the ack clock
+	if (index == 0)
+		_ack_deadline = make_timeout_time_ms(_modem_ack_timeout_ms());
+
+	if (batch->sends++)
+		_upload_stats.resends++;
+
+	if (_cycle_active && _session_stats.first_byte_us == 0)
+		_session_stats.first_byte_us = absolute_time_diff_us(_cycle_started, get_absolute_time());
+
+	_upload_stats.sends++;
+	_upload_stats.wire_bytes += UPLINK_HEADER_SIZE + frame.length;
+	_metrics.bytes_sent += UPLINK_HEADER_SIZE + frame.length;
+
+	return true;
+}
+
+static void _modem_downlink_read(void) {
+	// A failed read leaves data pending, it is tried again next pump
+	if (sim7080g_tcp_recv_to(_gateway, MODEM_DOWNLINK_READ_MAX, _modem_downlink_feed, NULL) > 0)
+		_downlink_deadline = make_timeout_time_ms(_modem_ack_timeout_ms());
+}
+
+// Takes the stream from the server in whatever pieces the modem hands
+// over, a frame can start in one read and end several later
+static void _modem_downlink_feed(const uint8_t *data, size_t len, void *arg) {
+	size_t offset = 0;
+	while (offset < len) {
+		if (!_downlink_in_payload) {
+			bool complete;
+			offset += uplink_reader_feed(&_uplink_reader, &data[offset],
+					len - offset, &_downlink_header, &complete);
+			if (!complete) continue;
+
+			_downlink_in_payload = true;
+			_downlink_len = 0;
+			_downlink_crc = UPLINK_CRC_INIT;
+			if (_downlink_header.type == UPLINK_PUSH) _modem_push_begin();
+		}
+
+		size_t take = _downlink_header.length - _downlink_len;
+		if (take > len - offset) take = len - offset;
+
+		_modem_downlink_take(&data[offset], take);
+		offset += take;
+
+		if (_downlink_len < _downlink_header.length) continue;
+
+		_downlink_in_payload = false;
+		_modem_downlink_handle();
+	}
+}
+
+// Next [len] payload bytes of the frame coming in
+static void _modem_downlink_take(const uint8_t *data, size_t len) {
+	bool last = _downlink_len + len == _downlink_header.length;
+	_downlink_crc = uplink_crc16(_downlink_crc, data, len);
+
+	if (_downlink_header.type == UPLINK_PUSH) {
+		if (len || last) _modem_push_piece(data, len, last);
+	} else if (_downlink_len < MODEM_DOWNLINK_MAX) {
+		size_t keep = MODEM_DOWNLINK_MAX - _downlink_len;
+		memcpy(&_downlink_payload[_downlink_len], data, len < keep ? len : keep);
 	}
-	
-	return !data_buffered;
+
+	_downlink_len += len;
+}
+
+static void _modem_downlink_handle(void) {
+	switch (_downlink_header.type) {
+	case UPLINK_ACK:
+		_modem_ack(_downlink_header.seq);
+		break;
+
+	case UPLINK_GAP:
+		_modem_gap(_downlink_header.seq);
+		break;
+
+	case UPLINK_ENDPOINTS:
+		if (_downlink_len > MODEM_DOWNLINK_MAX) break;
+		if (_downlink_crc != _downlink_header.crc) break;
+
+		// Takes effect from the next connection
+		_downlink_payload[_downlink_len] = '\0';
+		gateway_endpoints_set((char *)_downlink_payload);
+		break;
+	}
+}
+
+// Picks where the push just starting goes, the lent buffer only if it
+// is free and big enough
+static void _modem_push_begin(void) {
+	_recv_into = NULL;
+	if (_recv_sink || _recv_ready || _downlink_header.length == 0) return;
+
+	uint8_t *buffer = _recv_buffer;
+	__dmb();
+	if (buffer && _downlink_header.length <= _recv_size)
+		_recv_into = buffer;
+}
+
+static void _modem_push_piece(const uint8_t *data, size_t len, bool last) {
+	bool valid = last && _downlink_crc == _downlink_header.crc;
+
+	if (_recv_sink) {
+		_recv_sink(&(struct gateway_recv_piece_s) {
+			.seq = _downlink_header.seq,
+			.length = _downlink_header.length,
+			.offset = _downlink_len,
+			.data = data,
+			.len = len,
+			.last = last,
+			.valid = valid,
+		}, _recv_sink_arg);
+	} else if (_recv_into) {
+		memcpy(&_recv_into[_downlink_len], data, len);
+	}
+
+	if (!last) return;
+
+	if (!valid || (!_recv_sink && !_recv_into)) {
+		_upload_stats.push_drops++;
+		return;
+	}
+
+	_upload_stats.pushes++;
+	if (_recv_into) {
+		_recv_len = _downlink_header.length;
+		__dmb();
+		_recv_ready = true;
+	}
+}
+
+// Server has stored every batch up to and including [seq]
+static void _modem_ack(uint32_t seq) {
+	bool progress = false;
+
+	// An ack can cover batches waiting to be resent too, when it was
+	// in flight as the last connection dropped
+	while (_batch_count && !uplink_seq_after(_batches[0].seq, seq)) {
+		struct _batch_s *batch = &_batches[0];
+
+		rbuffer_commit(_modem_buffer_out, batch->length, batch->count);
+
+		_upload_stats.records_acked += batch->count;
+		_upload_stats.payload_bytes += batch->length - batch->count * RBUFFER_HEADER_SIZE;
+		_metrics.bytes_acked += batch->length - batch->count * RBUFFER_HEADER_SIZE;
+
+		_batch_bytes -= batch->length;
+		_batch_count--;
+		if (_batch_sent) _batch_sent--;
+		memmove(&_batches[0], &_batches[1], _batch_count * sizeof (struct _batch_s));
+
+		progress = true;
+	}
+
+	if (progress) {
+		_ack_deadline = make_timeout_time_ms(_modem_ack_timeout_ms());
+		_udp_retries = 0;
+		_udp_gap_resent = false;
+	}
+}
+
+// Server got a datagram past batch [seq] without it, and kept nothing
+// from there on
+static void _modem_gap(uint32_t seq) {
+	if (_link_transport != GATEWAY_TRANSPORT_UDP || _udp_gap_resent) return;
+
+	// Acks crossed it, or it is about batches already going again
+	if (!_batch_sent || _batches[0].seq != seq) return;
+
+	_udp_gap_resent = true;
+	_batch_sent = 0;
+	_ack_deadline = make_timeout_time_ms(_modem_ack_timeout_ms());
+}
+
+static uint32_t _modem_ack_timeout_ms(void) {
+	return _link_transport == GATEWAY_TRANSPORT_UDP
+		? GATEWAY_UDP_ACK_TIMEOUT_MS
+		: MODEM_ACK_TIMEOUT_MS;
+}
+
+// Drops the oldest data in the output buffer. If that is batched the
+// whole batch goes, so batches always line up with the front of the
+// buffer. The batch itself stays behind empty and goes out under its
+// seq as before, so the server never sees a gap.
+static bool _modem_buffer_drop_oldest(void) {
+	// Batches already emptied are at the front
+	uint i = 0;
+	while (i < _batch_count && _batches[i].count == 0) i++;
+
+	if (i == _batch_count) {
+		int dropped = rbuffer_drop(_modem_buffer_out);
+		if (dropped < 0) return false;
+
+		_drop_stats.records_dropped++;
+		_drop_stats.bytes_dropped += dropped;
+		return true;
+	}
+
+	struct _batch_s *batch = &_batches[i];
+	rbuffer_commit(_modem_buffer_out, batch->length, batch->count);
+
+	_drop_stats.records_dropped += batch->count;
+	_drop_stats.bytes_dropped += batch->length - batch->count * RBUFFER_HEADER_SIZE;
+	if (batch->sends) _drop_stats.records_dropped_sent += batch->count;
+
+	_batch_bytes -= batch->length;
+	batch->length = 0;
+	batch->count = 0;
+	batch->packed = 0;
+
+	return true;
+}
+
+// Every state change goes through here so time spent in each state can
+// be charged to the phase of the upload cycle it belongs to
+static void _modem_state_set(int state) {
+	absolute_time_t now = get_absolute_time();
+	uint64_t dwell = absolute_time_diff_us(_modem_state_entered, now);
+
+	if (_cycle_active) switch (MODEM_CORE_STATE) {
+	case MODEM_STOPPED:
+	case MODEM_IDLE:
+		_session_stats.boot_us += dwell;
+		break;
+	case MODEM_STARTED:
+		_session_stats.attach_us += dwell;
+		break;
+	case MODEM_CN_ACTIVE:
+		_session_stats.connect_us += dwell;
+		break;
+	case MODEM_SERVER_CONNECTED:
+		_session_stats.upload_us += dwell;
+		break;
+	}
+
+	if (state == MODEM_POWERED_DOWN || state == MODEM_IDLE)
+		_cycle_active = false;
+
+	_metrics_dwell_add(MODEM_CORE_STATE, absolute_time_diff_us(_metrics_state_entered, now));
+	_metrics.transitions[MODEM_CORE_STATE][state]++;
+	_metrics.states[state].entries++;
+
+	if (MODEM_CORE_STATE == MODEM_POWERED_DOWN && state == MODEM_STOPPED)
+		_metrics.power_ups++;
+	if (state == MODEM_POWERED_DOWN)
+		_metrics.power_downs++;
+	if (MODEM_CORE_STATE == MODEM_IDLE)
+		_metrics.psm_wakes++;
+
+	MODEM_CORE_STATE = state;
+	_modem_state_entered = now;
+	_metrics_state_entered = now;
+
+	_modem_step = MODEM_STEP_NONE;
+}
+
+static void _metrics_dwell_add(int state, uint64_t dwell_us) {
+	struct gateway_state_metrics_s *metrics = &_metrics.states[state];
+
+	metrics->dwell_us += dwell_us;
+	if (dwell_us > metrics->dwell_max_us)
+		metrics->dwell_max_us = dwell_us < UINT32_MAX ? dwell_us : UINT32_MAX;
+
+	uint bucket = 0;
+	for (uint64_t limit = 1000000; dwell_us >= limit && bucket < GATEWAY_METRICS_BUCKETS - 1; limit *= 4)
+		bucket++;
+	metrics->dwell_hist[bucket]++;
+}
+
+static uint8_t *_put_u16(uint8_t *dst, uint16_t value) {
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+	return dst + 2;
+}
+
+static uint8_t *_put_u32(uint8_t *dst, uint32_t value) {
+	dst = _put_u16(dst, value & 0xFFFF);
+	return _put_u16(dst, value >> 16);
+}
+
+// Queues a metrics snapshot record (layout in gateway_interface.h)
+static void _metrics_queue(void) {
+	struct gateway_metrics_s metrics;
+	uint8_t record[MODEM_METRICS_RECORD_SIZE];
+	uint8_t *p = record;
+
+	gateway_metrics_get(&metrics);
+
+	p = _put_u16(p, GATEWAY_METRICS_NODE);
+	p = _put_u16(p, MODEM_METRICS_RECORD_SIZE - 4);
+	p = _put_u16(p, GATEWAY_METRICS_TYPE);
+	*p++ = 1;
+	p = _put_u32(p, metrics.uptime_us / 1000000);
+
+	for (uint i = 0; i < GATEWAY_METRICS_STATES; i++) {
+		struct gateway_state_metrics_s *state = &metrics.states[i];
+
+		p = _put_u32(p, state->entries);
+		p = _put_u32(p, state->retries);
+		p = _put_u32(p, state->dwell_us / 1000000);
+		p = _put_u32(p, state->dwell_max_us / 1000);
+		for (uint b = 0; b < GATEWAY_METRICS_BUCKETS; b++)
+			p = _put_u16(p, state->dwell_hist[b] < UINT16_MAX ? state->dwell_hist[b] : UINT16_MAX);
+	}
+
+	p = _put_u32(p, metrics.power_ups);
+	p = _put_u32(p, metrics.power_downs);
+	p = _put_u32(p, metrics.psm_wakes);
+	p = _put_u32(p, metrics.at_commands);
+	p = _put_u32(p, metrics.at_timeouts);
+	p = _put_u32(p, metrics.at_mean_us);
+	p = _put_u32(p, metrics.at_max_us);
+	p = _put_u32(p, metrics.bytes_sent);
+	p = _put_u32(p, metrics.bytes_acked);
+
+	if (_modem_buffer_push(record, p - record)) {
+		_metrics_queued = true;
+		_metrics_queued_at = get_absolute_time();
+	}
+}
+
+static void _modem_cycle_start(bool cold) {
+	_cycle_active = true;
+	_cycle_started = get_absolute_time();
+
+	// Time parked doesn't count towards waking up
+	_modem_state_entered = _cycle_started;
+
+	// Rides along with this upload
+	if (_metrics_interval_ms && (!_metrics_queued
+			|| absolute_time_diff_us(_metrics_queued_at, _cycle_started) >= (int64_t)_metrics_interval_ms * 1000))
+		_metrics_queue();
+
+	_session_stats.cycles++;
+	if (cold)
+		_session_stats.cold_starts++;
+	else
+		_session_stats.session_reuses++;
+
+	_session_stats.boot_us = 0;
+	_session_stats.attach_us = 0;
+	_session_stats.connect_us = 0;
+	_session_stats.first_byte_us = 0;
+	_session_stats.upload_us = 0;
+}
+
+static void _modem_session_park(void) {
+	// Settings are lost with a power cycle, so only sent once per boot.
+	// Queued, they go out chained as one command and the answer is
+	// picked up by later pumps instead of being waited on here.
+	if (!_modem_psm_configured) {
+		CommandBuffer cb;
+
+		sim7080g_psm_command(&cb, true, GATEWAY_PSM_TAU, GATEWAY_PSM_ACTIVE);
+		_modem_psm_configured =
+				sim7080g_at_enqueue(_gateway, &cb, AT_KEY_NONE, MODEM_AT_TIMEOUT_US, _modem_psm_done, NULL);
+
+		sim7080g_edrx_command(&cb, true, GATEWAY_EDRX_VALUE);
+		sim7080g_at_enqueue(_gateway, &cb, AT_KEY_NONE, MODEM_AT_TIMEOUT_US, NULL, NULL);
+	}
+
+	_modem_wake_pulsed = false;
+	_modem_state_set(MODEM_IDLE);
+	_wake_time = at_the_end_of_time;
+}
+
+// Tried again on the next park if the modem said no
+static void _modem_psm_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg) {
+	if (timed_out || !rp_contains_ok(rp))
+		_modem_psm_configured = false;
+}
+
+// Waits on the answer to the step's command, or tries queueing it again
+// on the next pump if the queue was full
+static void _modem_step_queued(bool queued) {
+	if (!queued) {
+		_wake_in_ms(MODEM_AT_POLL_MS);
+		return;
+	}
+
+	_modem_step = MODEM_STEP_WAITING;
+	_modem_step_started = get_absolute_time();
+}
+
+// Next try goes to the next best endpoint
+static void _modem_open_failed(void) {
+	endpoint_failed(_endpoint);
+	sim7080g_tcp_close(_gateway);
+	_modem_step = MODEM_STEP_NONE;
+	_wake_in_ms(MODEM_CN_POLL_MS);
+}
+
+// Answers that come in after a state change are let go of, the steps
+// have started over
+static void _modem_cn_available_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg) {
+	if (_modem_step != MODEM_STEP_WAITING) return;
+
+	if (!timed_out && sim7080g_cn_available_response(context, rp))
+		_modem_step = MODEM_STEP_REGISTERED;
+	else
+		_modem_step = MODEM_STEP_SEARCHING;
+}
+
+static void _modem_cn_activate_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg) {
+	if (_modem_step != MODEM_STEP_WAITING) return;
+
+	if (timed_out || !rp_contains_ok(rp)) {
+		_modem_step = MODEM_STEP_FAILED;
+		return;
+	}
+
+	_modem_step = MODEM_STEP_PDP_WAIT;
+	_modem_pdp_deadline = make_timeout_time_ms(MODEM_PDP_TIMEOUT_MS);
+}
+
+static void _modem_socket_open_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg) {
+	if (_modem_step != MODEM_STEP_WAITING) return;
+
+	// A timeout leaves the socket down, and closed again to be sure
+	bool opened = sim7080g_socket_open_response(context, rp);
+	_modem_step = opened ? MODEM_STEP_OPENED : MODEM_STEP_FAILED;
+}
+
+static void _modem_power_key_press(uint32_t ms) {
+	sim7080g_power_key_set(_gateway, true);
+	_modem_power_key_held = true;
+	_wake_in_ms(ms);
+}
+
+static void _wake_in_ms(uint32_t ms) {
+	_wake_time = make_timeout_time_ms(ms);
 }
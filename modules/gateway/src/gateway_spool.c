@@ -0,0 +1,364 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ff.h"
+
+#include "gateway_spool.h"
+
+#define SPOOL_DATA_NAME "spool.dat"
+#define SPOOL_CKPT_NAME "spool.ckp"
+#define SPOOL_PATH_MAX 64
+
+#define SPOOL_HEADER_SIZE 2
+
+// Appends are gathered and written (and synced) a buffer at a time. A
+// reset loses at most what is sitting here.
+#define SPOOL_WRITE_SIZE 2048
+// Reads back are done a whole buffer at a time
+#define SPOOL_READ_SIZE 4096
+
+#define SPOOL_CKPT_MAGIC 0x4C4F4F50 // "POOL"
+
+struct _checkpoint_s {
+	uint32_t magic;
+	uint32_t sequence; // Higher is newer
+	uint32_t acked;    // Offset of the first record not acked
+	uint32_t crc;      // Over everything above
+};
+
+static FIL _data;
+static FIL _ckpt;
+static bool _is_open = false;
+
+static uint32_t _sequence = 0; // Sequence of the last checkpoint written
+static uint32_t _acked = 0;    // Offsets into the data file
+static uint32_t _read = 0;
+static uint32_t _size = 0;     // Bytes written to the data file
+static uint32_t _unread = 0;   // Records past _read, pending writes included
+
+static uint8_t _write_buf[SPOOL_WRITE_SIZE];
+static uint32_t _write_len = 0;
+static uint32_t _write_records = 0;
+
+static uint8_t _read_buf[SPOOL_READ_SIZE];
+static uint32_t _read_buf_offset = 0; // File offset of _read_buf[0]
+static uint32_t _read_buf_len = 0;
+
+static struct gateway_spool_stats_s _stats = {0};
+
+static bool _spool_write(const void *record, uint32_t size);
+static int _spool_read(void *dst, uint32_t dst_len);
+static int _spool_skip(void);
+static void _spool_release(void);
+
+static const struct gateway_spill_s _hooks = {
+	.write = _spool_write,
+	.read = _spool_read,
+	.skip = _spool_skip,
+	.release = _spool_release,
+};
+
+static bool _flush(void);
+static bool _read_at(uint32_t offset, void *dst, uint32_t len);
+static bool _record_size(uint32_t offset, uint32_t *size);
+static bool _checkpoint_load(void);
+static bool _checkpoint_write(uint32_t acked);
+static void _trim_torn_tail(void);
+static uint32_t _crc32(const void *data, uint32_t len);
+
+const struct gateway_spill_s * gateway_spool_open(const char *dir) {
+	char path[SPOOL_PATH_MAX];
+
+	if (_is_open) return &_hooks;
+
+	FRESULT fr = f_mkdir(dir);
+	if (fr != FR_OK && fr != FR_EXIST) return NULL;
+
+	snprintf(path, sizeof path, "%s/%s", dir, SPOOL_DATA_NAME);
+	if (f_open(&_data, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE) != FR_OK)
+		return NULL;
+
+	snprintf(path, sizeof path, "%s/%s", dir, SPOOL_CKPT_NAME);
+	if (f_open(&_ckpt, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE) != FR_OK) {
+		f_close(&_data);
+		return NULL;
+	}
+
+	_size = f_size(&_data);
+	_write_len = 0;
+	_write_records = 0;
+	_read_buf_len = 0;
+
+	// No valid checkpoint means nothing was ever acked
+	if (!_checkpoint_load()) {
+		_sequence = 0;
+		_acked = 0;
+	}
+
+	// Checkpoint can be ahead of a file that was emptied just before
+	// a reset (see _spool_release)
+	if (_acked > _size) _acked = _size;
+	_read = _acked;
+
+	_trim_torn_tail();
+
+	_is_open = true;
+	return &_hooks;
+}
+
+void gateway_spool_close(void) {
+	if (!_is_open) return;
+
+	_flush();
+	f_close(&_data);
+	f_close(&_ckpt);
+	_is_open = false;
+}
+
+void gateway_spool_stats_get(struct gateway_spool_stats_s *dst) {
+	*dst = _stats;
+	dst->file_bytes = _size + _write_len;
+	dst->acked_offset = _acked;
+	dst->read_offset = _read;
+}
+
+static bool _spool_write(const void *record, uint32_t size) {
+	if (!_is_open || size == 0 || size > GATEWAY_RECORD_MAX) return false;
+
+	uint32_t framed = SPOOL_HEADER_SIZE + size;
+	if (_size + _write_len + framed - _acked > GATEWAY_SPOOL_MAX_BYTES)
+		return false;
+
+	if (_write_len + framed > SPOOL_WRITE_SIZE && !_flush())
+		return false;
+
+	_write_buf[_write_len++] = size & 0xFF;
+	_write_buf[_write_len++] = (size >> 8) & 0xFF;
+	memcpy(&_write_buf[_write_len], record, size);
+	_write_len += size;
+	_write_records++;
+	_unread++;
+
+	return true;
+}
+
+static int _spool_read(void *dst, uint32_t dst_len) {
+	if (!_is_open) return -1;
+
+	// Caught up with the file, pending writes have to go out first
+	if (_read >= _size) {
+		if (_write_len == 0) return 0;
+		if (!_flush()) return -1;
+	}
+
+	uint32_t size;
+	if (!_record_size(_read, &size) || size > dst_len) return -1;
+	if (!_read_at(_read + SPOOL_HEADER_SIZE, dst, size)) return -1;
+
+	_read += SPOOL_HEADER_SIZE + size;
+	if (_unread) _unread--;
+
+	return size;
+}
+
+// A record whose header reads back fine is stepped over. Without one
+// there is no telling where the next record starts, so the file is cut
+// at the read point. Pending writes that won't go out are let go of.
+static int _spool_skip(void) {
+	if (!_is_open) return -1;
+
+	uint32_t skipped;
+	if (_read >= _size) {
+		skipped = _write_records;
+		_write_len = 0;
+		_write_records = 0;
+	} else {
+		uint32_t size;
+		if (_record_size(_read, &size) && _read + SPOOL_HEADER_SIZE + size <= _size) {
+			_read += SPOOL_HEADER_SIZE + size;
+			skipped = 1;
+		} else {
+			if (f_lseek(&_data, _read) != FR_OK || f_truncate(&_data) != FR_OK) {
+				_stats.io_errors++;
+				return -1;
+			}
+
+			_size = _read;
+			_read_buf_len = 0;
+			skipped = _unread > _write_records ? _unread - _write_records : 0;
+		}
+	}
+
+	_unread = _unread > skipped ? _unread - skipped : 0;
+	_stats.records_skipped += skipped;
+
+	return skipped;
+}
+
+static void _spool_release(void) {
+	if (!_is_open) return;
+
+	// Everything written has been acked, start the file over. The
+	// checkpoint goes first: a reset in between resends the old file
+	// instead of skipping into whatever gets appended next.
+	if (_read >= _size && _write_len == 0) {
+		if (!_checkpoint_write(0)) return;
+
+		if (f_lseek(&_data, 0) != FR_OK || f_truncate(&_data) != FR_OK) {
+			_stats.io_errors++;
+			return;
+		}
+
+		_size = _read = _acked = 0;
+		_unread = 0;
+		_read_buf_len = 0;
+		return;
+	}
+
+	if (_checkpoint_write(_read))
+		_acked = _read;
+}
+
+static bool _flush(void) {
+	if (_write_len == 0) return true;
+
+	UINT written = 0;
+	if (f_lseek(&_data, _size) != FR_OK
+			|| f_write(&_data, _write_buf, _write_len, &written) != FR_OK
+			|| written != _write_len
+			|| f_sync(&_data) != FR_OK) {
+		_stats.io_errors++;
+		return false;
+	}
+
+	_size += _write_len;
+	_write_len = 0;
+	_write_records = 0;
+
+	return true;
+}
+
+// Reads [len] bytes at [offset] through the read buffer. Reads only
+// ever move forward, so a miss reloads the buffer starting at [offset].
+static bool _read_at(uint32_t offset, void *dst, uint32_t len) {
+	if (offset + len > _size) return false;
+
+	if (offset < _read_buf_offset || offset + len > _read_buf_offset + _read_buf_len) {
+		UINT received = 0;
+		if (f_lseek(&_data, offset) != FR_OK
+				|| f_read(&_data, _read_buf, SPOOL_READ_SIZE, &received) != FR_OK) {
+			_stats.io_errors++;
+			_read_buf_len = 0;
+			return false;
+		}
+
+		_read_buf_offset = offset;
+		_read_buf_len = received;
+		if (len > received) return false;
+	}
+
+	memcpy(dst, &_read_buf[offset - _read_buf_offset], len);
+	return true;
+}
+
+static bool _record_size(uint32_t offset, uint32_t *size) {
+	uint8_t header[SPOOL_HEADER_SIZE];
+	if (!_read_at(offset, header, SPOOL_HEADER_SIZE)) return false;
+
+	*size = header[0] | (header[1] << 8);
+	return *size != 0 && *size <= GATEWAY_RECORD_MAX;
+}
+
+// Walks the framing from the read point and cuts the file at the first
+// record that doesn't fit, which can only be one torn by a reset.
+// Counts the records on the way.
+static void _trim_torn_tail(void) {
+	uint32_t offset = _read;
+	uint32_t size;
+	uint32_t io_errors = _stats.io_errors;
+
+	_unread = 0;
+	while (offset < _size && _record_size(offset, &size)
+			&& offset + SPOOL_HEADER_SIZE + size <= _size) {
+		offset += SPOOL_HEADER_SIZE + size;
+		_unread++;
+	}
+
+	// Don't cut good data because the card hiccuped
+	if (offset == _size || _stats.io_errors != io_errors) return;
+
+	if (f_lseek(&_data, offset) != FR_OK || f_truncate(&_data) != FR_OK) {
+		_stats.io_errors++;
+		return;
+	}
+
+	_size = offset;
+	_read_buf_len = 0;
+}
+
+static bool _checkpoint_load(void) {
+	struct _checkpoint_s slots[2];
+	UINT received = 0;
+
+	if (f_lseek(&_ckpt, 0) != FR_OK
+			|| f_read(&_ckpt, slots, sizeof slots, &received) != FR_OK)
+		return false;
+
+	bool found = false;
+	for (int i = 0; i < 2; i++) {
+		if ((i + 1) * sizeof (struct _checkpoint_s) > received) break;
+
+		struct _checkpoint_s *slot = &slots[i];
+		if (slot->magic != SPOOL_CKPT_MAGIC) continue;
+		if (slot->crc != _crc32(slot, offsetof(struct _checkpoint_s, crc))) continue;
+
+		// Sequence comparison that survives wrap
+		if (found && (int32_t)(slot->sequence - _sequence) <= 0) continue;
+
+		_sequence = slot->sequence;
+		_acked = slot->acked;
+		found = true;
+	}
+
+	return found;
+}
+
+// Slots are written alternately so a reset mid-write always leaves the
+// previous checkpoint intact
+static bool _checkpoint_write(uint32_t acked) {
+	struct _checkpoint_s slot = {
+		.magic = SPOOL_CKPT_MAGIC,
+		.sequence = _sequence + 1,
+		.acked = acked,
+	};
+	slot.crc = _crc32(&slot, offsetof(struct _checkpoint_s, crc));
+
+	UINT written = 0;
+	if (f_lseek(&_ckpt, (slot.sequence & 1) * sizeof slot) != FR_OK
+			|| f_write(&_ckpt, &slot, sizeof slot, &written) != FR_OK
+			|| written != sizeof slot
+			|| f_sync(&_ckpt) != FR_OK) {
+		_stats.io_errors++;
+		return false;
+	}
+
+	_sequence = slot.sequence;
+	_stats.checkpoints++;
+
+	return true;
+}
+
+// Plain bitwise CRC-32 (IEEE). Only ever run over 12 bytes.
+static uint32_t _crc32(const void *data, uint32_t len) {
+	const uint8_t *p = data;
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
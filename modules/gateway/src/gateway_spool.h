@@ -0,0 +1,53 @@
+#ifndef WISDOM_GATEWAY_SPOOL_H
+#define WISDOM_GATEWAY_SPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gateway_interface.h"
+
+// SD card spool for GATEWAY_OVERFLOW_SPILL
+//
+// Records that don't fit in the upload buffer are appended to a binary
+// spool file (same 2 byte length framing as the upload buffer) and read
+// back in large sequential chunks once the link returns. The offset of
+// the first record the server hasn't acked yet is kept in a separate
+// checkpoint file with two CRC checked slots written alternately, so a
+// reset at any point costs at most a resend, never a gap.
+//
+// Not built by default. Add src/gateway_spool.c and FatFs_SPI to
+// gateway_config.cmake. The SD volume must be mounted (f_mount) before
+// gateway_spool_open, and nothing else may use it from the other core
+// while GATEWAY_DUAL_CORE is running the hooks on core1.
+//
+// Usage:
+//	gateway_spill_set(gateway_spool_open("0:/spool"));
+//	gateway_overflow_policy_set(GATEWAY_OVERFLOW_SPILL);
+
+// Spool refuses writes beyond this many unacked bytes
+#ifndef GATEWAY_SPOOL_MAX_BYTES
+#define GATEWAY_SPOOL_MAX_BYTES (64 * 1024 * 1024)
+#endif
+
+// Opens or creates the spool in directory [dir] and resumes from the
+// last checkpoint. A record torn by a reset mid-write is cut off.
+//
+// return: spill hooks for gateway_spill_set
+//         NULL if the files could not be opened
+const struct gateway_spill_s * gateway_spool_open(const char *dir);
+
+// Flushes pending writes and closes the spool files
+void gateway_spool_close(void);
+
+struct gateway_spool_stats_s {
+	uint32_t file_bytes;      // Spool file size, pending writes included
+	uint32_t acked_offset;    // Start of the oldest record not yet acked
+	uint32_t read_offset;     // Start of the next record to read back
+	uint32_t checkpoints;     // Checkpoints written
+	uint32_t io_errors;       // Failed reads, writes or syncs
+	uint32_t records_skipped; // Given up on after repeated read errors
+};
+
+void gateway_spool_stats_get(struct gateway_spool_stats_s *dst);
+
+#endif // WISDOM_GATEWAY_SPOOL_H
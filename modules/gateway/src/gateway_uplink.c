@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "gateway_uplink.h"
+
+static void _put_u16(uint8_t *dst, uint16_t value);
+static void _put_u32(uint8_t *dst, uint32_t value);
+static uint16_t _get_u16(const uint8_t *src);
+static uint32_t _get_u32(const uint8_t *src);
+
+void uplink_header_pack(uint8_t dst[UPLINK_HEADER_SIZE], const struct uplink_header_s *header) {
+	_put_u16(&dst[0], UPLINK_MAGIC);
+	dst[2] = header->type;
+	dst[3] = UPLINK_VERSION;
+	_put_u32(&dst[4], header->seq);
+	_put_u16(&dst[8], header->length);
+	_put_u16(&dst[10], header->crc);
+}
+
+bool uplink_header_unpack(const uint8_t src[UPLINK_HEADER_SIZE], struct uplink_header_s *header) {
+	if (_get_u16(&src[0]) != UPLINK_MAGIC || src[3] != UPLINK_VERSION)
+		return false;
+
+	header->type = src[2];
+	header->seq = _get_u32(&src[4]);
+	header->length = _get_u16(&src[8]);
+	header->crc = _get_u16(&src[10]);
+
+	return true;
+}
+
+uint16_t uplink_crc16(uint16_t crc, const void *data, size_t len) {
+	const uint8_t *p = data;
+
+	while (len--) {
+		crc ^= (uint16_t)*p++ << 8;
+		for (int i = 0; i < 8; i++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+void uplink_reader_reset(struct uplink_reader_s *reader) {
+	reader->length = 0;
+}
+
+size_t uplink_reader_feed(
+		struct uplink_reader_s *reader,
+		const uint8_t *data,
+		size_t len,
+		struct uplink_header_s *header,
+		bool *complete
+)
+{
+	size_t consumed = 0;
+	*complete = false;
+
+	while (consumed < len) {
+		reader->buffer[reader->length++] = data[consumed++];
+
+		// Check the magic as soon as it is in so garbage is dropped
+		// early, one byte at a time
+		if (reader->length == 2 && _get_u16(reader->buffer) != UPLINK_MAGIC) {
+			reader->buffer[0] = reader->buffer[1];
+			reader->length = 1;
+			continue;
+		}
+
+		if (reader->length < UPLINK_HEADER_SIZE) continue;
+
+		bool valid = uplink_header_unpack(reader->buffer, header);
+		if (!valid) {
+			// Right magic, wrong everything else. Look for the next
+			// magic inside what we already have.
+			memmove(reader->buffer, &reader->buffer[1], UPLINK_HEADER_SIZE - 1);
+			reader->length = UPLINK_HEADER_SIZE - 1;
+			continue;
+		}
+
+		reader->length = 0;
+		*complete = true;
+		break;
+	}
+
+	return consumed;
+}
+
+static void _put_u16(uint8_t *dst, uint16_t value) {
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+}
+
+static void _put_u32(uint8_t *dst, uint32_t value) {
+	_put_u16(&dst[0], value & 0xFFFF);
+	_put_u16(&dst[2], value >> 16);
+}
+
+static uint16_t _get_u16(const uint8_t *src) {
+	return src[0] | (src[1] << 8);
+}
+
+static uint32_t _get_u32(const uint8_t *src) {
+	return _get_u16(&src[0]) | ((uint32_t)_get_u16(&src[2]) << 16);
+}
@@ -0,0 +1,116 @@
+#ifndef WISDOM_GATEWAY_UPLINK_H
+#define WISDOM_GATEWAY_UPLINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Uplink framing between gateway and server
+//
+// No pico dependencies so the host side tools can build it too.
+//
+// Every frame starts with the same 12 byte little endian header:
+//	0  u16 magic    UPLINK_MAGIC
+//	2  u8  type     UPLINK_DATA, UPLINK_ACK, UPLINK_HELLO,
+//	                UPLINK_DATA_PACKED, UPLINK_ENDPOINTS, UPLINK_PUSH
+//	                or UPLINK_GAP
+//	3  u8  version  UPLINK_VERSION
+//	4  u32 seq
+//	8  u16 length   Payload bytes following the header
+//	10 u16 crc      CRC-16/CCITT-FALSE over the payload
+//
+// HELLO gateway -> server, first frame on every connection. seq holds
+//       the gateway's boot epoch, no payload. Batch numbers are only
+//       unique within an epoch.
+// DATA  gateway -> server. Payload is a batch of length framed records
+//       exactly as held in the upload buffer. seq starts at 1 and goes
+//       up by one per batch. A resent batch keeps its seq.
+// ACK   server -> gateway, no payload. seq is the highest batch of the
+//       current epoch the server has stored, along with every batch
+//       before it. A duplicate is acked again but never stored twice.
+// DATA_PACKED gateway -> server. Same as DATA but the records are packed
+//       (see gateway_uplink_pack.h). Decoded before storing.
+// ENDPOINTS server -> gateway. Payload is a new server list, text in
+//       the format gateway_endpoints_set takes. Used from the next
+//       connection on.
+// PUSH  server -> gateway. Payload is for the application behind
+//       gateway_recv: configuration, schedules, pieces of a firmware
+//       image. seq means whatever the server and application agree on,
+//       e.g. where the piece goes in the image. Not acked, so over UDP
+//       it has to fit in one datagram and can be lost.
+// GAP   server -> gateway, UDP only, no payload. A DATA frame came in
+//       past a lost one. seq is the first batch missing, nothing from
+//       there on was stored.
+//
+// The gateway only lets go of a batch once it has been acked, so a
+// connection lost at any point ends in a resend, not a gap. A batch
+// whose records had to be dropped to make room goes out empty under its
+// seq.
+//
+// Over UDP every frame is one datagram. An ack that doesn't come in time
+// has the gateway send HELLO again, in case that was what got lost, then
+// every unacked batch. The server keeps its per boot state by sender
+// address instead of by connection, and doesn't store a batch that
+// comes past a gap, since acking it would ack the lost one too. It
+// answers that batch with GAP instead, and the gateway resends from the
+// missing one on without waiting for the ack timeout.
+
+#define UPLINK_MAGIC 0x5557 // "WU"
+#define UPLINK_VERSION 1
+#define UPLINK_HEADER_SIZE 12
+
+#define UPLINK_CRC_INIT 0xFFFF
+
+enum uplink_type_e {
+	UPLINK_DATA = 1,
+	UPLINK_ACK,
+	UPLINK_HELLO,
+	UPLINK_DATA_PACKED,
+	UPLINK_ENDPOINTS,
+	UPLINK_PUSH,
+	UPLINK_GAP
+};
+
+struct uplink_header_s {
+	uint8_t type;
+	uint32_t seq;
+	uint16_t length;
+	uint16_t crc;
+};
+
+// Collects the bytes of one header at a time from a stream
+struct uplink_reader_s {
+	uint8_t buffer[UPLINK_HEADER_SIZE];
+	uint8_t length;
+};
+
+void uplink_header_pack(uint8_t dst[UPLINK_HEADER_SIZE], const struct uplink_header_s *header);
+
+// return: false if magic or version don't match
+bool uplink_header_unpack(const uint8_t src[UPLINK_HEADER_SIZE], struct uplink_header_s *header);
+
+// Continues a CRC over [data]. Start with UPLINK_CRC_INIT.
+uint16_t uplink_crc16(uint16_t crc, const void *data, size_t len);
+
+void uplink_reader_reset(struct uplink_reader_s *reader);
+
+// Feeds stream bytes to [reader] until a header is complete
+// Garbage in front of a valid header is skipped a byte at a time.
+//
+// return: number of bytes of [data] consumed, [header] is filled and
+//         [complete] set once a whole header has been read. Any payload
+//         that follows is not consumed.
+size_t uplink_reader_feed(
+		struct uplink_reader_s *reader,
+		const uint8_t *data,
+		size_t len,
+		struct uplink_header_s *header,
+		bool *complete
+);
+
+// True if batch [a] comes after batch [b], allowing for wrap
+static inline bool uplink_seq_after(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) > 0;
+}
+
+#endif // WISDOM_GATEWAY_UPLINK_H
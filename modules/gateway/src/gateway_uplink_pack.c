@@ -0,0 +1,410 @@
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "gateway_uplink_pack.h"
+
+#define FRAME_HEADER_SIZE 2
+
+// Record as pushed by the nodes: u16 node, u16 packed size, then the
+// sensor's packed reading (u16 type, f32 temperature, f32 humidity) and
+// the 5 byte packed date (minutes, hours, month, day, year)
+#define SHT30_TYPE 0
+#define SHT30_PACKED_SIZE 10
+#define SHT30_RECORD_SIZE (4 + SHT30_PACKED_SIZE + 5)
+
+#define MINUTES_PER_DAY (24 * 60)
+// First minute of 2100, packed dates only hold years 00 to 99
+#define MINUTES_END ((100 * 365 + 25) * MINUTES_PER_DAY)
+
+struct _record_s {
+	uint32_t offset; // Of the record (not its framing) in the input
+	uint8_t group;
+	uint16_t temperature;
+	uint16_t humidity;
+	uint32_t minutes;
+};
+
+struct _group_s {
+	uint8_t codec;
+	uint16_t node;
+	uint32_t count;
+	uint32_t bytes; // Encoded records, header not included
+
+	// Previous record, deltas are taken against these
+	uint32_t minutes;
+	uint16_t temperature;
+	uint16_t humidity;
+};
+
+static struct _record_s _records[UPLINK_PACK_RECORDS_MAX];
+static struct _group_s _groups[UPLINK_PACK_GROUPS_MAX];
+
+static const uint8_t _month_days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+static bool _sht30_classify(const uint8_t *record, size_t len, struct _record_s *dst);
+static bool _sht30_tick(float value, float (*convert)(uint16_t), uint16_t *tick);
+static float _temperature(uint16_t tick);
+static float _humidity(uint16_t tick);
+static bool _date_to_minutes(const uint8_t date[5], uint32_t *minutes);
+static void _minutes_to_date(uint32_t minutes, uint8_t date[5]);
+static unsigned _group_header_size(const struct _group_s *group, uint32_t count);
+static unsigned _group_find(uint8_t codec, uint16_t node, unsigned group_count);
+
+static unsigned _varint_size(uint32_t value);
+static unsigned _varint_put(uint8_t *dst, uint32_t value);
+static bool _varint_get(const uint8_t **src, const uint8_t *end, uint32_t *value);
+static uint32_t _zigzag(int32_t value);
+static int32_t _unzigzag(uint32_t value);
+static uint16_t _get_u16(const uint8_t *src);
+static void _put_u16(uint8_t *dst, uint16_t value);
+
+int uplink_pack_encode(
+		const uint8_t *framed,
+		size_t framed_len,
+		uint8_t *dst,
+		size_t dst_len,
+		size_t *used,
+		unsigned *count
+)
+{
+	unsigned group_count = 0;
+	unsigned record_count = 0;
+	size_t offset = 0;
+	size_t total = 1; // Version
+
+	// First pass sorts records into groups and works out how many fit
+	while (record_count < UPLINK_PACK_RECORDS_MAX && offset + FRAME_HEADER_SIZE <= framed_len) {
+		size_t len = _get_u16(&framed[offset]);
+		if (offset + FRAME_HEADER_SIZE + len > framed_len) break;
+
+		const uint8_t *record = &framed[offset + FRAME_HEADER_SIZE];
+		struct _record_s *rec = &_records[record_count];
+
+		uint8_t codec = _sht30_classify(record, len, rec) ? PACK_CODEC_SHT30 : PACK_CODEC_RAW;
+		uint16_t node = codec == PACK_CODEC_RAW ? 0 : _get_u16(record);
+
+		unsigned g = _group_find(codec, node, group_count);
+		if (g == group_count) {
+			if (group_count == UPLINK_PACK_GROUPS_MAX) break;
+			_groups[g] = (struct _group_s) { .codec = codec, .node = node };
+		}
+
+		struct _group_s *group = &_groups[g];
+		unsigned bytes;
+		if (codec == PACK_CODEC_RAW) {
+			bytes = _varint_size(len) + len;
+		} else {
+			bytes = _varint_size(_zigzag(rec->minutes - group->minutes))
+				+ _varint_size(_zigzag(rec->temperature - group->temperature))
+				+ _varint_size(_zigzag(rec->humidity - group->humidity));
+		}
+
+		// Count varint can grow by a byte as the group does
+		size_t grown = total + bytes
+			+ _group_header_size(group, group->count + 1)
+			- _group_header_size(group, group->count);
+		if (grown > dst_len) break;
+
+		total = grown;
+		if (g == group_count) group_count++;
+
+		group->count++;
+		group->bytes += bytes;
+		group->minutes = rec->minutes;
+		group->temperature = rec->temperature;
+		group->humidity = rec->humidity;
+
+		rec->offset = offset + FRAME_HEADER_SIZE;
+		rec->group = g;
+
+		offset += FRAME_HEADER_SIZE + len;
+		record_count++;
+	}
+
+	if (record_count == 0) return -1;
+
+	// Second pass writes each group out in turn
+	uint8_t *p = dst;
+	*p++ = UPLINK_PACK_VERSION;
+
+	for (unsigned g = 0; g < group_count; g++) {
+		struct _group_s *group = &_groups[g];
+
+		*p++ = group->codec;
+		if (group->codec == PACK_CODEC_SHT30)
+			p += _varint_put(p, group->node);
+		p += _varint_put(p, group->count);
+
+		uint32_t minutes = 0;
+		uint16_t temperature = 0;
+		uint16_t humidity = 0;
+
+		for (unsigned i = 0; i < record_count; i++) {
+			struct _record_s *rec = &_records[i];
+			if (rec->group != g) continue;
+
+			if (group->codec == PACK_CODEC_RAW) {
+				size_t len = _get_u16(&framed[rec->offset - FRAME_HEADER_SIZE]);
+				p += _varint_put(p, len);
+				memcpy(p, &framed[rec->offset], len);
+				p += len;
+				continue;
+			}
+
+			p += _varint_put(p, _zigzag(rec->minutes - minutes));
+			p += _varint_put(p, _zigzag(rec->temperature - temperature));
+			p += _varint_put(p, _zigzag(rec->humidity - humidity));
+
+			minutes = rec->minutes;
+			temperature = rec->temperature;
+			humidity = rec->humidity;
+		}
+	}
+
+	*used = offset;
+	*count = record_count;
+
+	return p - dst;
+}
+
+int uplink_pack_decode(
+		const uint8_t *src,
+		size_t src_len,
+		uint8_t *dst,
+		size_t dst_len,
+		unsigned *count
+)
+{
+	const uint8_t *end = src + src_len;
+	size_t written = 0;
+	unsigned records = 0;
+
+	if (src_len == 0 || *src++ != UPLINK_PACK_VERSION) return -1;
+
+	while (src < end) {
+		uint8_t codec = *src++;
+		uint32_t node = 0;
+		uint32_t group_count;
+
+		if (codec == PACK_CODEC_SHT30 && !_varint_get(&src, end, &node)) return -1;
+		if (!_varint_get(&src, end, &group_count)) return -1;
+
+		uint32_t minutes = 0;
+		uint16_t temperature = 0;
+		uint16_t humidity = 0;
+
+		for (uint32_t i = 0; i < group_count; i++) {
+			uint32_t value;
+
+			if (codec == PACK_CODEC_RAW) {
+				if (!_varint_get(&src, end, &value)) return -1;
+				if (value > UINT16_MAX || value > (size_t)(end - src)) return -1;
+				if (written + FRAME_HEADER_SIZE + value > dst_len) return -1;
+
+				_put_u16(&dst[written], value);
+				memcpy(&dst[written + FRAME_HEADER_SIZE], src, value);
+				src += value;
+				written += FRAME_HEADER_SIZE + value;
+				records++;
+				continue;
+			}
+
+			if (codec != PACK_CODEC_SHT30) return -1;
+
+			if (!_varint_get(&src, end, &value)) return -1;
+			minutes += _unzigzag(value);
+			if (!_varint_get(&src, end, &value)) return -1;
+			temperature += _unzigzag(value);
+			if (!_varint_get(&src, end, &value)) return -1;
+			humidity += _unzigzag(value);
+
+			if (minutes >= MINUTES_END) return -1;
+			if (written + FRAME_HEADER_SIZE + SHT30_RECORD_SIZE > dst_len) return -1;
+
+			uint8_t *record = &dst[written + FRAME_HEADER_SIZE];
+			float t = _temperature(temperature);
+			float h = _humidity(humidity);
+
+			_put_u16(&dst[written], SHT30_RECORD_SIZE);
+			_put_u16(&record[0], node);
+			_put_u16(&record[2], SHT30_PACKED_SIZE);
+			_put_u16(&record[4], SHT30_TYPE);
+			memcpy(&record[6], &t, sizeof t);
+			memcpy(&record[10], &h, sizeof h);
+			_minutes_to_date(minutes, &record[14]);
+
+			written += FRAME_HEADER_SIZE + SHT30_RECORD_SIZE;
+			records++;
+		}
+	}
+
+	*count = records;
+	return written;
+}
+
+static bool _sht30_classify(const uint8_t *record, size_t len, struct _record_s *dst) {
+	if (len != SHT30_RECORD_SIZE) return false;
+	if (_get_u16(&record[2]) != SHT30_PACKED_SIZE || _get_u16(&record[4]) != SHT30_TYPE)
+		return false;
+
+	float t, h;
+	memcpy(&t, &record[6], sizeof t);
+	memcpy(&h, &record[10], sizeof h);
+
+	return _sht30_tick(t, _temperature, &dst->temperature)
+		&& _sht30_tick(h, _humidity, &dst->humidity)
+		&& _date_to_minutes(&record[14], &dst->minutes);
+}
+
+// Finds the tick [convert] turns into exactly [value]. The inverse is
+// only a first guess, float rounding can put it one off.
+static bool _sht30_tick(float value, float (*convert)(uint16_t), uint16_t *tick) {
+	if (!isfinite(value)) return false;
+
+	float scale = convert(UINT16_MAX) - convert(0);
+	float guess = (value - convert(0)) / scale * UINT16_MAX;
+	if (guess < -1 || guess > UINT16_MAX + 1) return false;
+
+	long base = lroundf(guess);
+	for (long t = base - 1; t <= base + 1; t++) {
+		if (t < 0 || t > UINT16_MAX) continue;
+		if (convert(t) == value) {
+			*tick = t;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Same arithmetic as sht30_rp2040_read so the floats match bit for bit
+static float _temperature(uint16_t tick) {
+	return -45 + (175 * tick / 65535.0);
+}
+
+static float _humidity(uint16_t tick) {
+	return 100 * tick / 65535.0;
+}
+
+static bool _date_to_minutes(const uint8_t date[5], uint32_t *minutes) {
+	uint8_t mins = date[0], hours = date[1], month = date[2], day = date[3], year = date[4];
+
+	if (mins > 59 || hours > 23 || year > 99 || month < 1 || month > 12 || day < 1)
+		return false;
+
+	bool leap = year % 4 == 0;
+	unsigned month_days = _month_days[month - 1] + (month == 2 && leap);
+	if (day > month_days) return false;
+
+	// 2000 to 2099, every fourth year is a leap year
+	uint32_t days = year * 365 + (year + 3) / 4;
+	for (unsigned m = 1; m < month; m++)
+		days += _month_days[m - 1] + (m == 2 && leap);
+	days += day - 1;
+
+	*minutes = days * MINUTES_PER_DAY + hours * 60 + mins;
+	return true;
+}
+
+static void _minutes_to_date(uint32_t minutes, uint8_t date[5]) {
+	uint32_t days = minutes / MINUTES_PER_DAY;
+	minutes %= MINUTES_PER_DAY;
+
+	date[0] = minutes % 60;
+	date[1] = minutes / 60;
+
+	unsigned year = 0;
+	while (days >= 365u + (year % 4 == 0)) {
+		days -= 365 + (year % 4 == 0);
+		year++;
+	}
+
+	unsigned month = 1;
+	for (;;) {
+		unsigned month_days = _month_days[month - 1] + (month == 2 && year % 4 == 0);
+		if (days < month_days) break;
+		days -= month_days;
+		month++;
+	}
+
+	date[2] = month;
+	date[3] = days + 1;
+	date[4] = year;
+}
+
+static unsigned _group_header_size(const struct _group_s *group, uint32_t count) {
+	if (count == 0) return 0;
+
+	unsigned size = 1 + _varint_size(count);
+	if (group->codec == PACK_CODEC_SHT30)
+		size += _varint_size(group->node);
+
+	return size;
+}
+
+static unsigned _group_find(uint8_t codec, uint16_t node, unsigned group_count) {
+	unsigned g;
+	for (g = 0; g < group_count; g++)
+		if (_groups[g].codec == codec && _groups[g].node == node) break;
+
+	return g;
+}
+
+static unsigned _varint_size(uint32_t value) {
+	unsigned size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+static unsigned _varint_put(uint8_t *dst, uint32_t value) {
+	unsigned size = 0;
+	while (value >= 0x80) {
+		dst[size++] = value | 0x80;
+		value >>= 7;
+	}
+	dst[size++] = value;
+
+	return size;
+}
+
+static bool _varint_get(const uint8_t **src, const uint8_t *end, uint32_t *value) {
+	const uint8_t *p = *src;
+	uint32_t result = 0;
+
+	for (unsigned shift = 0; shift < 35; shift += 7) {
+		if (p == end) return false;
+
+		uint8_t byte = *p++;
+		result |= (uint32_t)(byte & 0x7F) << shift;
+
+		if ((byte & 0x80) == 0) {
+			*src = p;
+			*value = result;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static uint32_t _zigzag(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t _unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static uint16_t _get_u16(const uint8_t *src) {
+	return src[0] | (src[1] << 8);
+}
+
+static void _put_u16(uint8_t *dst, uint16_t value) {
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+}
@@ -0,0 +1,73 @@
+#ifndef WISDOM_GATEWAY_UPLINK_PACK_H
+#define WISDOM_GATEWAY_UPLINK_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed record batches for UPLINK_DATA_PACKED (see gateway_uplink.h)
+//
+// No pico dependencies so the host side tools can build it too.
+//
+// Records are grouped by node and sensor type. Within a group every field
+// is stored as the zigzag varint difference from the same field of the
+// previous record, starting from zero. Readings taken every few minutes
+// by the same node mostly end up as 3 to 5 bytes instead of 21.
+//
+// Frame:
+//	u8 version UPLINK_PACK_VERSION
+//	groups until the end of the payload, each:
+//	u8 codec
+//	PACK_CODEC_SHT30: varint node, varint count, then per record
+//	                  zz minutes since 2000-01-01, zz temperature tick,
+//	                  zz humidity tick
+//	PACK_CODEC_RAW:   varint count, then per record varint length, bytes
+//
+// Ticks are the SHT30's own 16 bit readings, which the driver turns into
+// floats with a fixed formula. A record only goes in an SHT30 group if
+// running its ticks back through that formula gives the exact same
+// floats, and its date back the exact same bytes, so decoding is
+// lossless. Anything else goes in the raw group as is.
+//
+// Decoding gives back the same length framed records that went in,
+// grouped by node. Order is only kept within each group.
+
+#define UPLINK_PACK_VERSION 1
+
+// Upper bounds on one encode call
+#define UPLINK_PACK_RECORDS_MAX 512
+#define UPLINK_PACK_GROUPS_MAX 32
+
+enum uplink_pack_codec_e {
+	PACK_CODEC_RAW,
+	PACK_CODEC_SHT30
+};
+
+// Encodes as many whole records from the front of [framed] as fit in
+// [dst_len] bytes. [framed] holds records with the upload buffer's 2 byte
+// length framing. Not reentrant.
+//
+// return: encoded bytes, [used] set to the framed bytes and [count] to
+//         the records they hold
+//         -1 if not even the first record fits
+int uplink_pack_encode(
+		const uint8_t *framed,
+		size_t framed_len,
+		uint8_t *dst,
+		size_t dst_len,
+		size_t *used,
+		unsigned *count
+);
+
+// Turns an encoded frame back into length framed records
+//
+// return: framed bytes written to [dst], [count] set to the records
+//         -1 if [src] is malformed or [dst] too small
+int uplink_pack_decode(
+		const uint8_t *src,
+		size_t src_len,
+		uint8_t *dst,
+		size_t dst_len,
+		unsigned *count
+);
+
+#endif // WISDOM_GATEWAY_UPLINK_PACK_H
@@ -1,8 +1,17 @@
 #ifndef WISDOM_GW_CORE_H
 #define WISDOM_GW_CORE_H
 
-// Core entry function
+#include <stdbool.h>
+
+#include "pico/types.h"
+
+// Core1 entry function for GATEWAY_DUAL_CORE builds
+// Owns the modem state machine and the upload buffer.
 void gw_core_entry(void);
-uint gw_core_buffer_out_remaining(void);
+
+// Modem side hooks, implemented in gateway_sim7080g.c
+// Only ever called from the core that owns the modem.
+int gw_modem_pump(void);
+bool gw_modem_buffer_push(void *buffer, uint size);
 
 #endif // WISDOM_GW_CORE_H
@@ -11,6 +11,7 @@ set(target "radio_module")
 list(APPEND sources
 	src/radio_rfm69.c
 	src/radio_error.c
+	src/radio_window.c
 )
 
 list(APPEND includes
@@ -32,4 +33,7 @@ list(APPEND definitions
 	RFM69_PIN_CS=17
 	RFM69_PIN_SCK=18
 	RFM69_PIN_RST=20
+
+	# Packets per burst for radio_send_window, 1 to 32
+	RADIO_WINDOW=16
 )
@@ -17,6 +17,12 @@ bool radio_address_set(uint8_t address);
 bool radio_send(void *payload, uint size, uint8_t address);
 bool radio_recv(void *buffer, uint size, uint *received);
 
+// Windowed selective-repeat transfers of up to RADIO_WINDOW_SIZE_MAX
+// bytes (see radio_window.h), for bulk transfers of buffered readings.
+// Only talks to the same calls on the other end.
+bool radio_send_window(void *payload, uint size, uint8_t address);
+bool radio_recv_window(void *buffer, uint size, uint *received);
+
 RADIO_ERROR_T radio_status(char dst[ERROR_STR_MAX]);
 
 #endif // WISDOM_RADIO_INTERFACE_H
@@ -1,11 +1,33 @@
 #include <string.h>
 
+#include "pico/stdlib.h"
+
 #include "radio_interface.h"
+#include "radio_window.h"
 #include "rfm69_rp2040.h"
 
+// Packets per burst for windowed transfers, 1 to RADIO_WINDOW_MAX
+#ifndef RADIO_WINDOW
+#define RADIO_WINDOW 16
+#endif
+
+// RegIrqFlags2 and its bits, per the RFM69HCW datasheet
+#define RADIO_REG_IRQ_FLAGS_2 0x28
+#define RADIO_IRQ_PACKET_SENT 0x08
+#define RADIO_IRQ_PAYLOAD_READY 0x04
+
+// A full packet at the slowest bit rate in use
+#define RADIO_PACKET_SENT_US (1000 * 1000)
+
 static rfm69_context_t _rfm = {0};
 static rudp_context_t _rudp = {0};
 static bool _radio_init = false;
+static uint8_t _address = 0;
+
+static radio_window_config_t _window_config(void);
+static bool _packet_send(const uint8_t *packet, uint len);
+static uint _packet_recv(uint8_t *packet, uint size, uint64_t until_us);
+static bool _irq_flag_wait(uint8_t flag, uint64_t until_us);
 
 bool radio_init(void) {
 	_radio_init  = false;
@@ -61,6 +83,8 @@ bool radio_address_set(uint8_t address) {
 		return false;
 	}
 
+	_address = address;
+
 	return true;
 }
 
@@ -135,3 +159,158 @@ bool radio_recv(void *buffer, uint size, uint *received) {
 
 	return true;
 }
+
+bool radio_send_window(void *payload, uint size, uint8_t address) {
+	if (_radio_init == false) {
+		radio_error_set(RADIO_UNINITIALIZED);
+		return false;
+	}
+
+	radio_window_config_t config = _window_config();
+	radio_window_tx_t tx;
+	if (!radio_window_tx_begin(&tx, &config, _address, address, payload, size, time_us_64())) {
+		radio_error_set(RADIO_TX_FAILURE);
+		return false;
+	}
+
+	uint8_t packet[RADIO_WINDOW_PACKET_MAX];
+	uint len;
+	while (radio_window_tx_status(&tx) == RADIO_WINDOW_BUSY) {
+		while ((len = radio_window_tx_poll(&tx, time_us_64(), packet))) {
+			if (!_packet_send(packet, len)) {
+				radio_error_set(RADIO_HW_FAILURE);
+				return false;
+			}
+		}
+
+		len = _packet_recv(packet, sizeof packet, radio_window_tx_deadline(&tx));
+		if (len) radio_window_tx_input(&tx, packet, len);
+	}
+
+	switch (radio_window_tx_status(&tx)) {
+	case RADIO_WINDOW_DONE:
+		return true;
+	case RADIO_WINDOW_TIMEOUT:
+		radio_error_set(RADIO_TX_TIMEOUT);
+		break;
+	default:
+		radio_error_set(RADIO_TX_FAILURE);
+	}
+
+	return false;
+}
+
+bool radio_recv_window(void *buffer, uint size, uint *received) {
+	if (_radio_init == false) {
+		radio_error_set(RADIO_UNINITIALIZED);
+		return false;
+	}
+
+	radio_window_config_t config = _window_config();
+	radio_window_rx_t rx;
+	if (!radio_window_rx_begin(&rx, &config, _address, buffer, size, time_us_64())) {
+		radio_error_set(RADIO_RX_FAILURE);
+		return false;
+	}
+
+	// Once done, keeps answering until the sender goes quiet in case it
+	// missed the final reverse ack
+	uint64_t quiet_until = 0;
+
+	uint8_t packet[RADIO_WINDOW_PACKET_MAX];
+	uint len;
+	for (;;) {
+		while ((len = radio_window_rx_poll(&rx, time_us_64(), packet))) {
+			if (!_packet_send(packet, len)) {
+				radio_error_set(RADIO_HW_FAILURE);
+				return false;
+			}
+		}
+
+		RADIO_WINDOW_STATUS_T status = radio_window_rx_status(&rx);
+		if (status == RADIO_WINDOW_DONE && quiet_until == 0)
+			quiet_until = time_us_64() + 2 * config.timeout_us;
+
+		if (status != RADIO_WINDOW_BUSY && (status != RADIO_WINDOW_DONE || time_us_64() >= quiet_until))
+			break;
+
+		uint64_t until = status == RADIO_WINDOW_DONE ? quiet_until : radio_window_rx_deadline(&rx);
+		len = _packet_recv(packet, sizeof packet, until);
+		if (len == 0) continue;
+
+		radio_window_rx_input(&rx, packet, len, time_us_64());
+		if (status == RADIO_WINDOW_DONE)
+			quiet_until = time_us_64() + 2 * config.timeout_us;
+	}
+
+	switch (radio_window_rx_status(&rx)) {
+	case RADIO_WINDOW_DONE:
+		*received = radio_window_rx_size(&rx);
+		return true;
+	case RADIO_WINDOW_TIMEOUT:
+		radio_error_set(RADIO_RX_TIMEOUT);
+		break;
+	default:
+		radio_error_set(RADIO_RX_FAILURE);
+	}
+
+	return false;
+}
+
+static radio_window_config_t _window_config(void) {
+	radio_window_config_t config = RADIO_WINDOW_CONFIG_DEFAULT;
+	config.window = RADIO_WINDOW;
+
+	return config;
+}
+
+// Windowed transfers drive the FIFO themselves, the rudp context is
+// only used for its setup
+static bool _packet_send(const uint8_t *packet, uint len) {
+	// Variable length packets, the length byte goes in the FIFO first
+	uint8_t length = len;
+
+	rfm69_mode_set(&_rfm, RFM69_OP_MODE_STDBY);
+	rfm69_write(&_rfm, RFM69_REG_FIFO, &length, 1);
+	rfm69_write(&_rfm, RFM69_REG_FIFO, (uint8_t *)packet, len);
+	rfm69_mode_set(&_rfm, RFM69_OP_MODE_TX);
+
+	bool sent = _irq_flag_wait(RADIO_IRQ_PACKET_SENT, time_us_64() + RADIO_PACKET_SENT_US);
+	rfm69_mode_set(&_rfm, RFM69_OP_MODE_STDBY);
+
+	return sent;
+}
+
+// return: bytes in [packet], 0 if none came before [until_us] or it
+//         didn't fit
+static uint _packet_recv(uint8_t *packet, uint size, uint64_t until_us) {
+	rfm69_mode_set(&_rfm, RFM69_OP_MODE_RX);
+	bool ready = _irq_flag_wait(RADIO_IRQ_PAYLOAD_READY, until_us);
+	rfm69_mode_set(&_rfm, RFM69_OP_MODE_STDBY);
+
+	if (!ready) return 0;
+
+	uint8_t length = 0;
+	rfm69_read(&_rfm, RFM69_REG_FIFO, &length, 1);
+
+	// Drained all the same, so the next packet starts clean
+	uint len = length;
+	while (len > size) {
+		rfm69_read(&_rfm, RFM69_REG_FIFO, packet, size);
+		len -= size;
+	}
+	rfm69_read(&_rfm, RFM69_REG_FIFO, packet, len);
+
+	return length <= size ? length : 0;
+}
+
+static bool _irq_flag_wait(uint8_t flag, uint64_t until_us) {
+	uint8_t flags = 0;
+
+	for (;;) {
+		rfm69_read(&_rfm, RADIO_REG_IRQ_FLAGS_2, &flags, 1);
+		if (flags & flag) return true;
+
+		if (time_us_64() >= until_us) return false;
+	}
+}
@@ -0,0 +1,355 @@
+#include <string.h>
+
+#include "radio_window.h"
+
+enum _tx_state_e {
+	_TX_REQUEST, // Request to go out
+	_TX_ASKED,   // Waiting for the ack
+	_TX_BURST,   // Data to go out
+	_TX_WAIT,    // Waiting for the reverse ack
+	_TX_END
+};
+
+enum _rx_state_e {
+	_RX_LISTEN,
+	_RX_RECEIVING,
+	_RX_END
+};
+
+static bool _config_valid(const radio_window_config_t *config);
+static uint32_t _packet_build(uint8_t *packet, uint8_t to, uint8_t from, uint8_t flags, uint8_t seq,
+		const uint8_t *data, uint32_t data_len);
+static bool _packet_check(const uint8_t *packet, uint32_t len, uint8_t self);
+static uint32_t _offsets_below(uint32_t n);
+static uint32_t _data_length(uint32_t size, uint16_t seq);
+
+static void _tx_burst(radio_window_tx_t *tx, uint32_t missing);
+static void _tx_end(radio_window_tx_t *tx, RADIO_WINDOW_STATUS_T status);
+
+static uint64_t _rx_idle_us(radio_window_rx_t *rx);
+static bool _rx_has(radio_window_rx_t *rx, uint16_t seq);
+static void _rx_reply(radio_window_rx_t *rx, uint8_t flags, uint8_t seq, const uint8_t *data, uint32_t data_len);
+static void _rx_reverse_ack(radio_window_rx_t *rx);
+
+bool radio_window_tx_begin(radio_window_tx_t *tx, const radio_window_config_t *config,
+		uint8_t self, uint8_t peer, const void *payload, uint32_t size, uint64_t now_us) {
+	if (!_config_valid(config)) return false;
+	if (size == 0 || size > RADIO_WINDOW_SIZE_MAX) return false;
+
+	*tx = (radio_window_tx_t) {
+		.config = *config,
+		.payload = payload,
+		.size = size,
+		.self = self,
+		.peer = peer,
+		.state = _TX_REQUEST,
+		.packets = (size + RADIO_WINDOW_DATA_MAX - 1) / RADIO_WINDOW_DATA_MAX,
+		.deadline = now_us,
+		.status = RADIO_WINDOW_BUSY,
+	};
+
+	return true;
+}
+
+uint32_t radio_window_tx_poll(radio_window_tx_t *tx, uint64_t now_us, uint8_t packet[RADIO_WINDOW_PACKET_MAX]) {
+	if (tx->status != RADIO_WINDOW_BUSY) return 0;
+
+	if ((tx->state == _TX_ASKED || tx->state == _TX_WAIT) && now_us >= tx->deadline) {
+		if (tx->tries++ >= tx->config.retries) {
+			_tx_end(tx, RADIO_WINDOW_TIMEOUT);
+			return 0;
+		}
+
+		// Either the ask or its answer was lost. Ask again, for a reverse
+		// ack with the newest packet sent, or the first one if none past
+		// the base went out.
+		if (tx->state == _TX_ASKED) {
+			tx->state = _TX_REQUEST;
+		} else {
+			tx->burst = tx->next > tx->base ? 1u << (tx->next - 1 - tx->base) : 1u;
+			tx->state = _TX_BURST;
+		}
+	}
+
+	if (tx->state == _TX_REQUEST) {
+		uint8_t request[4] = {
+			tx->packets,
+			tx->size >> 8,
+			tx->size & 0xFF,
+			tx->config.window
+		};
+
+		tx->state = _TX_ASKED;
+		tx->deadline = now_us + tx->config.timeout_us;
+		tx->stats.sent++;
+		return _packet_build(packet, tx->peer, tx->self, RADIO_WINDOW_FLAG_REQUEST, 0, request, sizeof request);
+	}
+
+	if (tx->state != _TX_BURST) return 0;
+
+	// Burst is out, the clock starts once the last packet has gone
+	if (tx->burst == 0) {
+		tx->state = _TX_WAIT;
+		tx->deadline = now_us + tx->config.timeout_us;
+		return 0;
+	}
+
+	uint32_t offset = __builtin_ctz(tx->burst);
+	tx->burst &= tx->burst - 1;
+
+	uint16_t seq = tx->base + offset;
+	if (seq < tx->next) tx->stats.resent++;
+	else tx->next = seq + 1;
+
+	uint8_t flags = RADIO_WINDOW_FLAG_DATA;
+	if (tx->burst == 0) flags |= RADIO_WINDOW_FLAG_REVERSE_ACK;
+
+	tx->stats.sent++;
+	return _packet_build(packet, tx->peer, tx->self, flags, seq,
+			tx->payload + seq * RADIO_WINDOW_DATA_MAX, _data_length(tx->size, seq));
+}
+
+void radio_window_tx_input(radio_window_tx_t *tx, const uint8_t *packet, uint32_t len) {
+	if (tx->status != RADIO_WINDOW_BUSY) return;
+	if (!_packet_check(packet, len, tx->self) || packet[2] != tx->peer) return;
+
+	tx->stats.received++;
+
+	uint8_t flags = packet[3];
+	const uint8_t *data = packet + RADIO_WINDOW_HEADER_SIZE;
+	uint32_t data_len = len - RADIO_WINDOW_HEADER_SIZE;
+
+	if ((flags & RADIO_WINDOW_FLAG_ACK) && tx->state == _TX_ASKED) {
+		// Receiver may only take a smaller window
+		tx->window = tx->config.window;
+		if (data_len >= 1 && data[0] >= 1 && data[0] < tx->window)
+			tx->window = data[0];
+
+		tx->tries = 0;
+		_tx_burst(tx, 0);
+		return;
+	}
+
+	// Answers to an earlier ask can turn up mid-burst, the burst's own
+	// reverse ack will be newer
+	if (!(flags & RADIO_WINDOW_FLAG_REVERSE_ACK) || tx->state != _TX_WAIT) return;
+
+	if (flags & RADIO_WINDOW_FLAG_SUCCESS) {
+		_tx_end(tx, RADIO_WINDOW_DONE);
+		return;
+	}
+
+	uint16_t base = packet[4];
+	if (base < tx->base || base > tx->next || data_len < 4) return;
+
+	uint32_t missing = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+
+	tx->base = base;
+	tx->tries = 0;
+	_tx_burst(tx, missing);
+}
+
+uint64_t radio_window_tx_deadline(radio_window_tx_t *tx) {
+	if (tx->status != RADIO_WINDOW_BUSY) return UINT64_MAX;
+
+	// Something to send now
+	if (tx->state == _TX_REQUEST || tx->state == _TX_BURST) return 0;
+
+	return tx->deadline;
+}
+
+RADIO_WINDOW_STATUS_T radio_window_tx_status(radio_window_tx_t *tx) {
+	return tx->status;
+}
+
+bool radio_window_rx_begin(radio_window_rx_t *rx, const radio_window_config_t *config,
+		uint8_t self, void *buffer, uint32_t size, uint64_t now_us) {
+	if (!_config_valid(config)) return false;
+
+	*rx = (radio_window_rx_t) {
+		.config = *config,
+		.buffer = buffer,
+		.buffer_size = size,
+		.self = self,
+		.state = _RX_LISTEN,
+		.status = RADIO_WINDOW_BUSY,
+	};
+	rx->deadline = now_us + _rx_idle_us(rx);
+
+	return true;
+}
+
+uint32_t radio_window_rx_poll(radio_window_rx_t *rx, uint64_t now_us, uint8_t packet[RADIO_WINDOW_PACKET_MAX]) {
+	if (rx->state != _RX_END && now_us >= rx->deadline) {
+		rx->state = _RX_END;
+		rx->status = RADIO_WINDOW_TIMEOUT;
+		rx->reply_len = 0;
+	}
+
+	if (rx->reply_len == 0) return 0;
+
+	uint32_t len = rx->reply_len;
+	memcpy(packet, rx->reply, len);
+	rx->reply_len = 0;
+	rx->stats.sent++;
+
+	return len;
+}
+
+void radio_window_rx_input(radio_window_rx_t *rx, const uint8_t *packet, uint32_t len, uint64_t now_us) {
+	if (rx->status != RADIO_WINDOW_BUSY && rx->status != RADIO_WINDOW_DONE) return;
+	if (!_packet_check(packet, len, rx->self)) return;
+
+	uint8_t from = packet[2];
+	uint8_t flags = packet[3];
+	uint8_t seq = packet[4];
+	const uint8_t *data = packet + RADIO_WINDOW_HEADER_SIZE;
+	uint32_t data_len = len - RADIO_WINDOW_HEADER_SIZE;
+
+	if (flags & RADIO_WINDOW_FLAG_REQUEST) {
+		// Asked again before any data, the ack was lost
+		bool again = rx->state == _RX_RECEIVING && from == rx->peer && rx->base == 0 && !rx->received[0];
+		if ((rx->state != _RX_LISTEN && !again) || data_len < 4) return;
+
+		uint16_t packets = data[0];
+		uint32_t size = data[1] << 8 | data[2];
+		if (size == 0 || packets != (size + RADIO_WINDOW_DATA_MAX - 1) / RADIO_WINDOW_DATA_MAX) return;
+
+		rx->stats.received++;
+
+		if (size > rx->buffer_size) {
+			rx->state = _RX_END;
+			rx->status = RADIO_WINDOW_OVERFLOW;
+			return;
+		}
+
+		rx->peer = from;
+		rx->packets = packets;
+		rx->size = size;
+		rx->window = rx->config.window;
+		if (data[3] >= 1 && data[3] < rx->window) rx->window = data[3];
+		rx->state = _RX_RECEIVING;
+		rx->deadline = now_us + _rx_idle_us(rx);
+
+		_rx_reply(rx, RADIO_WINDOW_FLAG_ACK, 0, &rx->window, 1);
+		return;
+	}
+
+	if (rx->state == _RX_LISTEN || from != rx->peer || !(flags & RADIO_WINDOW_FLAG_DATA)) return;
+	if (seq >= rx->packets || data_len != _data_length(rx->size, seq)) return;
+
+	rx->stats.received++;
+	rx->deadline = now_us + _rx_idle_us(rx);
+
+	if (!_rx_has(rx, seq)) {
+		memcpy(rx->buffer + seq * RADIO_WINDOW_DATA_MAX, data, data_len);
+		rx->received[seq / 32] |= 1u << (seq % 32);
+
+		while (rx->base < rx->packets && _rx_has(rx, rx->base)) rx->base++;
+	}
+
+	if (flags & RADIO_WINDOW_FLAG_REVERSE_ACK) _rx_reverse_ack(rx);
+}
+
+uint64_t radio_window_rx_deadline(radio_window_rx_t *rx) {
+	if (rx->reply_len) return 0;
+	if (rx->state == _RX_END) return UINT64_MAX;
+
+	return rx->deadline;
+}
+
+RADIO_WINDOW_STATUS_T radio_window_rx_status(radio_window_rx_t *rx) {
+	return rx->status;
+}
+
+uint32_t radio_window_rx_size(radio_window_rx_t *rx) {
+	return rx->status == RADIO_WINDOW_DONE ? rx->size : 0;
+}
+
+static bool _config_valid(const radio_window_config_t *config) {
+	return config->window >= 1 && config->window <= RADIO_WINDOW_MAX && config->timeout_us > 0;
+}
+
+static uint32_t _packet_build(uint8_t *packet, uint8_t to, uint8_t from, uint8_t flags, uint8_t seq,
+		const uint8_t *data, uint32_t data_len) {
+	packet[0] = to;
+	packet[1] = data_len + 3; // T F N P
+	packet[2] = from;
+	packet[3] = flags | RADIO_WINDOW_FLAG_WINDOW;
+	packet[4] = seq;
+	if (data_len) memcpy(packet + RADIO_WINDOW_HEADER_SIZE, data, data_len);
+
+	return data_len + RADIO_WINDOW_HEADER_SIZE;
+}
+
+static bool _packet_check(const uint8_t *packet, uint32_t len, uint8_t self) {
+	if (len < RADIO_WINDOW_HEADER_SIZE || len > RADIO_WINDOW_PACKET_MAX) return false;
+
+	return packet[0] == self
+		&& packet[1] == len - 2
+		&& (packet[3] & RADIO_WINDOW_FLAG_WINDOW);
+}
+
+// Bits 0 to [n] - 1
+static uint32_t _offsets_below(uint32_t n) {
+	return n >= 32 ? UINT32_MAX : (1u << n) - 1;
+}
+
+static uint32_t _data_length(uint32_t size, uint16_t seq) {
+	uint32_t left = size - seq * RADIO_WINDOW_DATA_MAX;
+	return left < RADIO_WINDOW_DATA_MAX ? left : RADIO_WINDOW_DATA_MAX;
+}
+
+// Resends whatever of [missing] was sent before, fills the rest of the
+// window with new packets
+static void _tx_burst(radio_window_tx_t *tx, uint32_t missing) {
+	uint32_t sent = _offsets_below(tx->next - tx->base);
+	uint32_t window = tx->packets - tx->base;
+	if (window > tx->window) window = tx->window;
+
+	tx->burst = (missing & sent) | (_offsets_below(window) & ~sent);
+
+	// Nothing new fits and nothing was reported missing, which a sane
+	// receiver can't send. Ask again with the newest packet.
+	if (tx->burst == 0 && tx->next > tx->base) tx->burst = 1u << (tx->next - 1 - tx->base);
+
+	tx->state = _TX_BURST;
+	tx->stats.bursts++;
+}
+
+static void _tx_end(radio_window_tx_t *tx, RADIO_WINDOW_STATUS_T status) {
+	tx->state = _TX_END;
+	tx->status = status;
+	tx->burst = 0;
+}
+
+// Quiet this long and the sender has given up
+static uint64_t _rx_idle_us(radio_window_rx_t *rx) {
+	return (uint64_t)rx->config.timeout_us * (rx->config.retries + 2);
+}
+
+static bool _rx_has(radio_window_rx_t *rx, uint16_t seq) {
+	return rx->received[seq / 32] & (1u << (seq % 32));
+}
+
+static void _rx_reply(radio_window_rx_t *rx, uint8_t flags, uint8_t seq, const uint8_t *data, uint32_t data_len) {
+	rx->reply_len = _packet_build(rx->reply, rx->peer, rx->self, flags, seq, data, data_len);
+}
+
+// Bit i set if packet base + i is still missing. All there is success,
+// sent again for as long as the sender keeps asking.
+static void _rx_reverse_ack(radio_window_rx_t *rx) {
+	if (rx->base == rx->packets) {
+		rx->state = _RX_END;
+		rx->status = RADIO_WINDOW_DONE;
+		_rx_reply(rx, RADIO_WINDOW_FLAG_REVERSE_ACK | RADIO_WINDOW_FLAG_SUCCESS, rx->packets, NULL, 0);
+		return;
+	}
+
+	uint32_t missing = 0;
+	for (uint32_t i = 0; i < 32 && rx->base + i < rx->packets; i++)
+		if (!_rx_has(rx, rx->base + i)) missing |= 1u << i;
+
+	uint8_t bitmap[4] = { missing, missing >> 8, missing >> 16, missing >> 24 };
+	_rx_reply(rx, RADIO_WINDOW_FLAG_REVERSE_ACK, rx->base, bitmap, sizeof bitmap);
+}
@@ -0,0 +1,145 @@
+#ifndef WISDOM_RADIO_WINDOW_H
+#define WISDOM_RADIO_WINDOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Windowed selective-repeat transfers (see docs/rudp_protocol.txt)
+//
+// No pico dependencies so the host side tools can build it too.
+//
+// The sender asks once for the whole transfer, then streams up to
+// [window] sequence numbered data packets back to back. The last one of
+// every burst asks for a reverse ack, which carries a bitmap of the
+// packets still missing, and only those go again in the next burst.
+//
+// Only the packet exchange lives here, nothing touches a radio. Packets
+// come in through *_input, go out through *_poll and time is whatever
+// the caller says it is. radio_rfm69.c runs it on the RFM69,
+// tools/rudp_sim over a simulated lossy channel.
+
+// Whole packet, A through P. Fits the RFM69 FIFO with its length byte.
+#define RADIO_WINDOW_PACKET_MAX 65
+#define RADIO_WINDOW_HEADER_SIZE 5 // A S T F N
+#define RADIO_WINDOW_DATA_MAX (RADIO_WINDOW_PACKET_MAX - RADIO_WINDOW_HEADER_SIZE)
+
+// Packets per burst, one bit each in the reverse ack bitmap
+#define RADIO_WINDOW_MAX 32
+
+// Sequence numbers are one byte
+#define RADIO_WINDOW_PACKETS_MAX 255
+#define RADIO_WINDOW_SIZE_MAX (RADIO_WINDOW_PACKETS_MAX * RADIO_WINDOW_DATA_MAX)
+
+// Packet information flags
+#define RADIO_WINDOW_FLAG_REQUEST     0x80 // r
+#define RADIO_WINDOW_FLAG_DATA        0x40 // d
+#define RADIO_WINDOW_FLAG_ACK         0x20 // a
+#define RADIO_WINDOW_FLAG_REVERSE_ACK 0x10 // c
+#define RADIO_WINDOW_FLAG_SUCCESS     0x08 // s
+#define RADIO_WINDOW_FLAG_WINDOW      0x04 // w, set on every packet of a windowed transfer
+
+typedef enum _radio_window_status {
+	RADIO_WINDOW_BUSY,
+	RADIO_WINDOW_DONE,
+	RADIO_WINDOW_TIMEOUT,  // Other side stopped answering
+	RADIO_WINDOW_OVERFLOW, // Transfer is larger than the receive buffer
+} RADIO_WINDOW_STATUS_T;
+
+typedef struct radio_window_config_s {
+	uint8_t window;      // Packets per burst, 1 to RADIO_WINDOW_MAX
+	uint32_t timeout_us; // Wait for an answer before asking again
+	uint8_t retries;     // Times to ask again before giving up
+} radio_window_config_t;
+
+#define RADIO_WINDOW_CONFIG_DEFAULT \
+	((radio_window_config_t) { .window = 16, .timeout_us = 300 * 1000, .retries = 8 })
+
+struct radio_window_stats_s {
+	uint32_t sent;     // Packets handed out by *_poll
+	uint32_t resent;   // Data packets sent more than once
+	uint32_t received; // Packets taken by *_input
+	uint32_t bursts;
+};
+
+typedef struct radio_window_tx_s {
+	radio_window_config_t config;
+	const uint8_t *payload;
+	uint32_t size;
+	uint8_t self;
+	uint8_t peer;
+	uint8_t state;
+	uint8_t window;    // As agreed with the receiver
+	uint8_t tries;
+	uint16_t packets;
+	uint16_t base;     // First packet not known to be received
+	uint16_t next;     // First packet never sent
+	uint32_t burst;    // Left to send this burst, bit i is packet base + i
+	uint64_t deadline;
+	RADIO_WINDOW_STATUS_T status;
+	struct radio_window_stats_s stats;
+} radio_window_tx_t;
+
+typedef struct radio_window_rx_s {
+	radio_window_config_t config;
+	uint8_t *buffer;
+	uint32_t buffer_size;
+	uint32_t size;
+	uint8_t self;
+	uint8_t peer;
+	uint8_t state;
+	uint8_t window;
+	uint16_t packets;
+	uint16_t base;     // First packet not received
+	uint32_t received[(RADIO_WINDOW_PACKETS_MAX + 31) / 32];
+	uint8_t reply[RADIO_WINDOW_HEADER_SIZE + 4];
+	uint8_t reply_len; // 0 if nothing to send
+	uint64_t deadline;
+	RADIO_WINDOW_STATUS_T status;
+	struct radio_window_stats_s stats;
+} radio_window_rx_t;
+
+// Starts sending [size] bytes of [payload] from address [self] to [peer]
+// [payload] must stay put until the transfer ends.
+//
+// return: false if [size] is 0 or above RADIO_WINDOW_SIZE_MAX, or the
+//         config is out of range
+bool radio_window_tx_begin(radio_window_tx_t *tx, const radio_window_config_t *config,
+		uint8_t self, uint8_t peer, const void *payload, uint32_t size, uint64_t now_us);
+
+// Next packet to send, if any, into [packet]
+// Call until it returns 0 every time something came in or the deadline
+// passed, sending each packet before asking for the next.
+//
+// return: bytes in [packet], 0 for nothing to send now
+uint32_t radio_window_tx_poll(radio_window_tx_t *tx, uint64_t now_us, uint8_t packet[RADIO_WINDOW_PACKET_MAX]);
+
+// Takes [len] bytes of received [packet], anything not for [tx] is ignored
+void radio_window_tx_input(radio_window_tx_t *tx, const uint8_t *packet, uint32_t len);
+
+// return: when to poll again if nothing comes in, UINT64_MAX for never
+uint64_t radio_window_tx_deadline(radio_window_tx_t *tx);
+
+RADIO_WINDOW_STATUS_T radio_window_tx_status(radio_window_tx_t *tx);
+
+// Starts listening at address [self] for a transfer of up to [size]
+// bytes into [buffer]
+//
+// return: false if the config is out of range
+bool radio_window_rx_begin(radio_window_rx_t *rx, const radio_window_config_t *config,
+		uint8_t self, void *buffer, uint32_t size, uint64_t now_us);
+
+// Same as radio_window_tx_poll. Keeps answering a sender that missed the
+// final reverse ack after the status turns RADIO_WINDOW_DONE.
+uint32_t radio_window_rx_poll(radio_window_rx_t *rx, uint64_t now_us, uint8_t packet[RADIO_WINDOW_PACKET_MAX]);
+
+// Same as radio_window_tx_input, [now_us] restarts the idle timeout
+void radio_window_rx_input(radio_window_rx_t *rx, const uint8_t *packet, uint32_t len, uint64_t now_us);
+
+uint64_t radio_window_rx_deadline(radio_window_rx_t *rx);
+
+RADIO_WINDOW_STATUS_T radio_window_rx_status(radio_window_rx_t *rx);
+
+// return: bytes in the transfer, once RADIO_WINDOW_DONE
+uint32_t radio_window_rx_size(radio_window_rx_t *rx);
+
+#endif // WISDOM_RADIO_WINDOW_H
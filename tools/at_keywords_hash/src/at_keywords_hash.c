@@ -0,0 +1,184 @@
+// at_keywords_hash.c
+// Searches for the associated values behind at_keywords.c's perfect
+// hash, and prints the _asso and _slots tables to paste over the old
+// ones. Run it after adding a keyword to at_keywords.h and _keywords.
+//
+// The keywords come from the driver itself through at_key_string, so
+// the search always covers the table as it is built. The table in use
+// is checked first, the exit status says whether it still holds.
+//
+// Usage: at_keywords_hash [seed]
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "at_keywords.h"
+
+// As in at_keywords.c
+#define AT_KEY_SLOTS 32
+
+#define SEARCH_TRIES 100000000
+
+// Enum names to print _slots with, in AT_KEY order
+static const char *_names[] = {
+	"AT_KEY_NONE",
+	"AT_KEY_OK",
+	"AT_KEY_ERROR",
+	"AT_KEY_PROMPT",
+	"AT_KEY_CME_ERROR",
+	"AT_KEY_POWER_DOWN",
+	"AT_KEY_RDY",
+	"AT_KEY_SMS_READY",
+	"AT_KEY_APP_PDP",
+	"AT_KEY_CAACK",
+	"AT_KEY_CADATAIND",
+	"AT_KEY_CAOPEN",
+	"AT_KEY_CARECV",
+	"AT_KEY_CASTATE",
+	"AT_KEY_CAURC",
+	"AT_KEY_CEDRXS",
+	"AT_KEY_CFUN",
+	"AT_KEY_CNACT",
+	"AT_KEY_COPS",
+	"AT_KEY_CPIN",
+	"AT_KEY_CPSMS",
+	"AT_KEY_IPR",
+};
+
+_Static_assert(sizeof _names / sizeof _names[0] == AT_KEYS_NUM,
+		"a keyword was added to at_keywords.h, name it here too");
+
+static uint8_t _asso[128];
+static uint8_t _slots[AT_KEY_SLOTS];
+static uint32_t _state;
+
+static bool _table_check(void);
+static bool _search(void);
+static bool _slots_fill(void);
+static uint8_t _third(AT_KEY key);
+static uint8_t _last(AT_KEY key);
+static uint32_t _rand(void);
+static void _print(void);
+
+int main(int argc, char **argv) {
+	_state = argc > 1 ? strtoul(argv[1], NULL, 0) : 8086;
+	if (_state == 0) _state = 1;
+
+	bool holds = _table_check();
+	printf("table in at_keywords.c %s\n\n", holds ? "holds" : "is broken");
+
+	if (!_search()) {
+		printf("nothing found in %u tries, try another seed\n", SEARCH_TRIES);
+		return 1;
+	}
+
+	_print();
+	return holds ? 0 : 1;
+}
+
+// Every keyword looks up to itself
+static bool _table_check(void) {
+	bool holds = true;
+	for (AT_KEY key = AT_KEY_NONE + 1; key < AT_KEYS_NUM; key++) {
+		const uint8_t *string = (const uint8_t *)at_key_string(key);
+		AT_KEY found = at_key_lookup(string, at_key_length(key));
+		if (found != key) {
+			printf("\"%s\" looks up as %s\n", at_key_string(key), _names[found]);
+			holds = false;
+		}
+	}
+
+	return holds;
+}
+
+// Random values for the bytes the hash looks at until no two keywords
+// share a slot. The 3rd byte of a two byte keyword stays 0.
+static bool _search(void) {
+	bool used[128] = {false};
+	for (AT_KEY key = AT_KEY_NONE + 1; key < AT_KEYS_NUM; key++) {
+		used[_third(key)] = true;
+		used[_last(key)] = true;
+	}
+	used[0] = false;
+
+	for (uint32_t i = 0; i < SEARCH_TRIES; i++) {
+		for (int c = 0; c < 128; c++)
+			_asso[c] = used[c] ? _rand() % AT_KEY_SLOTS : 0;
+
+		if (_slots_fill()) return true;
+	}
+
+	return false;
+}
+
+static bool _slots_fill(void) {
+	for (int slot = 0; slot < AT_KEY_SLOTS; slot++)
+		_slots[slot] = AT_KEY_NONE;
+
+	for (AT_KEY key = AT_KEY_NONE + 1; key < AT_KEYS_NUM; key++) {
+		uint32_t slot = (at_key_length(key) + _asso[_third(key)] + _asso[_last(key)]) % AT_KEY_SLOTS;
+		if (_slots[slot] != AT_KEY_NONE) return false;
+		_slots[slot] = key;
+	}
+
+	return true;
+}
+
+static uint8_t _third(AT_KEY key) {
+	return at_key_length(key) > 2 ? at_key_string(key)[2] : 0;
+}
+
+static uint8_t _last(AT_KEY key) {
+	return at_key_string(key)[at_key_length(key) - 1];
+}
+
+// xorshift32
+static uint32_t _rand(void) {
+	_state ^= _state << 13;
+	_state ^= _state >> 17;
+	_state ^= _state << 5;
+	return _state;
+}
+
+static void _print(void) {
+	printf("static const uint8_t _asso[128] = {");
+	unsigned printed = 0;
+	for (int c = 1; c < 128; c++) {
+		if (_asso[c] == 0) continue;
+
+		printf(printed % 5 ? " " : "\n\t");
+		printf("['%c'] = %u,", c, _asso[c]);
+		if (_asso[c] < 10 && printed % 5 != 4) printf(" ");
+		printed++;
+	}
+	printf("\n};\n\n");
+
+	printf("static const uint8_t _slots[AT_KEY_SLOTS] = {\n");
+	for (int slot = 0; slot < AT_KEY_SLOTS; slot++)
+		if (_slots[slot] != AT_KEY_NONE)
+			printf("\t[%d]%*s = %s,\n", slot, slot < 10 ? 1 : 0, "", _names[_slots[slot]]);
+	printf("};\n");
+}
@@ -0,0 +1,300 @@
+// cbuffer_bench.c
+// Host side benchmark comparing bulk cbuffer push/pop with the old
+// byte-at-a-time loop
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cbuffer.h"
+#include "record_buffer.h"
+
+// Same size as _modem_buffer_out in the gateway module
+#define BENCH_BUFFER_SIZE (1024 * 10)
+#define BENCH_TOTAL_BYTES (64 * 1024 * 1024)
+
+// Chunk sizes worth looking at:
+// 19   - one sht30 node record
+// 100  - old gateway send chunk
+// 1459 - MODEM_TCP_SEND_MAX
+static const size_t _chunk_sizes[] = { 1, 19, 100, 1459, 4096 };
+#define CHUNK_SIZES_NUM (sizeof _chunk_sizes / sizeof _chunk_sizes[0])
+
+typedef int (*push_func_t)(cbuffer_t *, void *, size_t);
+typedef int (*pop_func_t)(cbuffer_t *, void *, size_t);
+
+// The original per byte implementation, kept here as the baseline
+static int legacy_push(cbuffer_t *buffer, void *src, size_t size) {
+	if (buffer == NULL || src == NULL) return -1;
+
+	uint8_t *src_bytes = (uint8_t *)src;
+	uint pushed = 0;
+	for (int i = 0; i < size && cbuffer_remaining(buffer) > 0; i++) {
+		*buffer->write_p = src_bytes[i];
+
+		buffer->write_p++;
+		buffer->write_index++;
+		pushed++;
+
+		if (buffer->write_p == buffer->end_p)
+			buffer->write_p = buffer->buff;
+	}
+
+	return pushed;
+}
+
+static int legacy_pop(cbuffer_t *buffer, void *dest, size_t num) {
+	if (buffer == NULL || dest == NULL) return -1;
+
+	uint8_t *dest_bytes = (uint8_t *)dest;
+	int popped = 0;
+	for (int i = 0; i < num && !cbuffer_empty(buffer); i++) {
+		dest_bytes[i] = *buffer->base_p;
+
+		buffer->base_p++;
+		popped++;
+		buffer->write_index--;
+
+		if (buffer->base_p == buffer->end_p)
+			buffer->base_p = buffer->buff;
+	}
+
+	return popped;
+}
+
+static double _now_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Pushes then pops [chunk] sized pieces until BENCH_TOTAL_BYTES have gone
+// through the buffer. Push and pop are offset by a few bytes so that
+// transfers regularly straddle the wrap point.
+// Returns a checksum of everything popped.
+static uint32_t _run(
+		push_func_t push,
+		pop_func_t pop,
+		size_t chunk,
+		uint8_t *src,
+		uint8_t *dst,
+		double *elapsed
+)
+{
+	cbuffer_t *buffer = cbuffer_create(BENCH_BUFFER_SIZE);
+	if (buffer == NULL) {
+		fprintf(stderr, "cbuffer_create failed\n");
+		exit(1);
+	}
+
+	uint8_t skew[7];
+	push(buffer, src, sizeof skew);
+
+	uint32_t checksum = 0;
+	size_t moved = 0;
+
+	double start = _now_s();
+	while (moved < BENCH_TOTAL_BYTES) {
+		int pushed = push(buffer, src, chunk);
+		int popped = pop(buffer, dst, pushed);
+
+		// Sample the ends of each pop so the checksum doesn't
+		// dominate the timing
+		if (popped > 0)
+			checksum = (checksum * 31 + dst[0]) * 31 + dst[popped - 1];
+
+		moved += popped;
+	}
+	*elapsed = _now_s() - start;
+
+	cbuffer_destroy(buffer);
+	return checksum;
+}
+
+// Randomized push/pop against a flat reference copy
+static bool _verify(void) {
+	cbuffer_t *buffer = cbuffer_create(BENCH_BUFFER_SIZE);
+	uint8_t *ref = malloc(BENCH_TOTAL_BYTES / 16);
+	uint8_t *tmp = malloc(BENCH_BUFFER_SIZE * 2);
+	if (buffer == NULL || ref == NULL || tmp == NULL) return false;
+
+	for (size_t i = 0; i < BENCH_TOTAL_BYTES / 16; i++)
+		ref[i] = rand();
+
+	size_t in = 0;
+	size_t out = 0;
+	size_t total = BENCH_TOTAL_BYTES / 16;
+	srand(8086);
+	while (out < total) {
+		size_t n = rand() % (BENCH_BUFFER_SIZE + 100);
+		if (n > total - in) n = total - in;
+
+		int pushed = cbuffer_push(buffer, &ref[in], n);
+		size_t expected = n;
+		if (expected > BENCH_BUFFER_SIZE - (in - out))
+			expected = BENCH_BUFFER_SIZE - (in - out);
+		if (pushed != expected) return false;
+		in += pushed;
+
+		n = rand() % (BENCH_BUFFER_SIZE + 100);
+
+		// Alternate between copying out and reading spans in place
+		int popped = 0;
+		if (rand() & 1) {
+			popped = cbuffer_pop(buffer, tmp, n);
+		} else {
+			uint8_t *span;
+			size_t span_len;
+			while (popped < n && (span_len = cbuffer_peek_span(buffer, &span))) {
+				if (span_len > n - popped) span_len = n - popped;
+				memcpy(&tmp[popped], span, span_len);
+				popped += cbuffer_commit(buffer, span_len);
+			}
+		}
+
+		if (popped < 0 || popped > n || memcmp(tmp, &ref[out], popped))
+			return false;
+		out += popped;
+
+		if (cbuffer_length(buffer) != in - out) return false;
+	}
+
+	cbuffer_destroy(buffer);
+	free(ref);
+	free(tmp);
+	return true;
+}
+
+// Record n is (n % 300) + 1 bytes of (n + i)
+static size_t _record_fill(uint8_t *dst, uint32_t n) {
+	size_t size = (n % 300) + 1;
+	for (size_t i = 0; i < size; i++)
+		dst[i] = n + i;
+	return size;
+}
+
+// Checks framed records survive a buffer that is always near full
+static bool _verify_records(void) {
+	rbuffer_t *buffer = rbuffer_create(1024);
+	if (buffer == NULL) return false;
+
+	uint8_t record[512];
+	uint8_t expect[512];
+	uint8_t batch[1459];
+	uint32_t in = 0;
+	uint32_t out = 0;
+	srand(86);
+
+	while (out < 100000) {
+		// Fill until a push is refused
+		for (;;) {
+			size_t size = _record_fill(record, in);
+			size_t before = rbuffer_length(buffer);
+
+			int pushed;
+			uint8_t *span;
+			if (rand() & 1) {
+				pushed = rbuffer_push(buffer, record, size);
+			} else if (rbuffer_write_span(buffer, &span) >= size) {
+				memcpy(span, record, size);
+				pushed = rbuffer_write_commit(buffer, size);
+			} else {
+				pushed = rbuffer_remaining(buffer) >= size ?
+					rbuffer_push(buffer, record, size) : 0;
+			}
+
+			if (pushed == 0) {
+				// Refused pushes must not leave a partial record behind
+				if (rbuffer_length(buffer) != before) return false;
+				break;
+			}
+			if (pushed != size) return false;
+			in++;
+		}
+
+		// Drain some records one at a time or as a batch
+		if (rand() & 1) {
+			int n = rand() % 4;
+			while (n-- && !rbuffer_empty(buffer)) {
+				int size = rbuffer_pop(buffer, record, sizeof record);
+				if (size != _record_fill(expect, out) || memcmp(record, expect, size))
+					return false;
+				out++;
+			}
+		} else {
+			uint count;
+			int length = rbuffer_pop_batch(buffer, batch, sizeof batch, &count);
+			size_t offset = 0;
+			for (uint i = 0; i < count; i++) {
+				size_t size = batch[offset] | (batch[offset + 1] << 8);
+				if (size != _record_fill(expect, out)) return false;
+				if (memcmp(&batch[offset + RBUFFER_HEADER_SIZE], expect, size)) return false;
+				offset += RBUFFER_HEADER_SIZE + size;
+				out++;
+			}
+			if (offset != length) return false;
+		}
+	}
+
+	rbuffer_destroy(buffer);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	printf("cbuffer bench: %u byte buffer, %u MB per run\n",
+			BENCH_BUFFER_SIZE, BENCH_TOTAL_BYTES / (1024 * 1024));
+
+	if (!_verify() || !_verify_records()) {
+		printf("verify: FAILED\n");
+		return 1;
+	}
+	printf("verify: ok\n\n");
+
+	uint8_t *src = malloc(BENCH_BUFFER_SIZE);
+	uint8_t *dst = malloc(BENCH_BUFFER_SIZE);
+	for (int i = 0; i < BENCH_BUFFER_SIZE; i++)
+		src[i] = i * 7;
+
+	printf("%8s %14s %14s %9s\n", "chunk", "legacy MB/s", "bulk MB/s", "speedup");
+	for (int i = 0; i < CHUNK_SIZES_NUM; i++) {
+		double legacy_s, bulk_s;
+		uint32_t legacy_sum = _run(legacy_push, legacy_pop, _chunk_sizes[i], src, dst, &legacy_s);
+		uint32_t bulk_sum = _run(cbuffer_push, cbuffer_pop, _chunk_sizes[i], src, dst, &bulk_s);
+
+		if (legacy_sum != bulk_sum) {
+			printf("chunk %zu: checksum mismatch\n", _chunk_sizes[i]);
+			return 1;
+		}
+
+		double mb = BENCH_TOTAL_BYTES / (1024.0 * 1024.0);
+		printf("%8zu %14.1f %14.1f %8.1fx\n",
+				_chunk_sizes[i], mb / legacy_s, mb / bulk_s, legacy_s / bulk_s);
+	}
+
+	free(src);
+	free(dst);
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+// spsc_bench.c
+// Host side stress test and throughput check for the SPSC ring.
+// A producer and consumer thread stand in for core0/core1 (or an IRQ
+// handler and the main loop) and hammer the ring with odd sized
+// transfers while the consumer checks every byte arrives in order.
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spsc_buffer.h"
+
+#define BENCH_BUFFER_SIZE (1024 * 8)
+#define BENCH_TOTAL_BYTES ((size_t)64 * 1024 * 1024)
+
+static spsc_buffer_t _ring;
+static uint8_t _ring_array[BENCH_BUFFER_SIZE];
+
+// Cleared by the consumer on the first out of order byte
+static atomic_bool _ok = true;
+
+// The byte stream is a simple counter so the consumer can check order
+static inline uint8_t _stream_byte(size_t i) {
+	return (uint8_t)(i ^ (i >> 8));
+}
+
+static void *_producer(void *arg) {
+	uint8_t chunk[1500];
+	size_t sent = 0;
+	unsigned seed = 1;
+
+	while (sent < BENCH_TOTAL_BYTES && atomic_load(&_ok)) {
+		size_t n = 1 + rand_r(&seed) % sizeof chunk;
+		if (n > BENCH_TOTAL_BYTES - sent) n = BENCH_TOTAL_BYTES - sent;
+
+		// Alternate between copying and writing spans in place
+		if (n & 1) {
+			for (size_t i = 0; i < n; i++)
+				chunk[i] = _stream_byte(sent + i);
+			sent += spsc_buffer_push(&_ring, chunk, n);
+		} else {
+			uint8_t *span;
+			size_t span_len = spsc_buffer_write_span(&_ring, &span);
+			if (span_len > n) span_len = n;
+			for (size_t i = 0; i < span_len; i++)
+				span[i] = _stream_byte(sent + i);
+			sent += spsc_buffer_write_commit(&_ring, span_len);
+		}
+
+		// Be nice on machines with fewer cores than threads
+		if (spsc_buffer_remaining(&_ring) == 0) sched_yield();
+	}
+
+	return NULL;
+}
+
+static void *_consumer(void *arg) {
+	uint8_t chunk[1500];
+	size_t received = 0;
+	unsigned seed = 2;
+
+	while (received < BENCH_TOTAL_BYTES) {
+		size_t n = 1 + rand_r(&seed) % sizeof chunk;
+
+		if (n & 1) {
+			int popped = spsc_buffer_pop(&_ring, chunk, n);
+			for (int i = 0; i < popped; i++)
+				if (chunk[i] != _stream_byte(received + i)) atomic_store(&_ok, false);
+			received += popped;
+		} else {
+			uint8_t *span;
+			size_t span_len = spsc_buffer_peek_span(&_ring, &span);
+			if (span_len > n) span_len = n;
+			for (size_t i = 0; i < span_len; i++)
+				if (span[i] != _stream_byte(received + i)) atomic_store(&_ok, false);
+			received += spsc_buffer_commit(&_ring, span_len);
+		}
+
+		if (!atomic_load(&_ok)) break;
+		if (spsc_buffer_empty(&_ring)) sched_yield();
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	spsc_buffer_t not_pow2;
+	if (spsc_buffer_init(&not_pow2, _ring_array, 1000)) {
+		printf("spsc bench: accepted non power of two size\n");
+		return 1;
+	}
+
+	if (!spsc_buffer_init(&_ring, _ring_array, sizeof _ring_array)) {
+		printf("spsc bench: init failed\n");
+		return 1;
+	}
+
+	printf("spsc bench: %u byte ring, %zu MB across two threads\n",
+			BENCH_BUFFER_SIZE, BENCH_TOTAL_BYTES / (1024 * 1024));
+
+	pthread_t producer, consumer;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_create(&consumer, NULL, _consumer, NULL);
+	pthread_create(&producer, NULL, _producer, NULL);
+	pthread_join(producer, NULL);
+	pthread_join(consumer, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!atomic_load(&_ok) || !spsc_buffer_empty(&_ring)) {
+		printf("verify: FAILED\n");
+		return 1;
+	}
+
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("verify: ok\n");
+	printf("throughput: %.1f MB/s\n", BENCH_TOTAL_BYTES / (1024.0 * 1024.0) / elapsed);
+
+	return 0;
+}
@@ -0,0 +1,247 @@
+// command_bench.c
+// Cost of building the driver's AT commands (command_buffer.h): the
+// sprintf path the driver used to take against the typed appends it
+// takes now. Every command is built both ways for a spread of values
+// and checked byte for byte before anything is timed.
+//
+// Builds for the host (ns per command) and for a pico (cycles per
+// command, see pico/).
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PICO_ON_DEVICE
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#else
+#include <time.h>
+#endif
+
+#include "command_buffer.h"
+
+#ifdef PICO_ON_DEVICE
+#define BENCH_CALLS 20000
+#else
+#define BENCH_CALLS 2000000
+#endif
+
+#define BENCH_URL "wisdom.example.net"
+
+// Builds one command into [cb] from [value]
+typedef void (*build_fn_t)(CommandBuffer *cb, uint32_t value);
+
+struct command_s {
+	const char *name;
+	build_fn_t old;
+	build_fn_t new;
+	uint32_t modulo; // Values run 0 .. modulo - 1
+};
+
+static uint64_t _now_ns(void) {
+#ifdef PICO_ON_DEVICE
+	return time_us_64() * 1000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// The way the driver built them before, kept here to compare against
+
+static void _old_casend(CommandBuffer *cb, uint32_t value) {
+	uint8_t command[100];
+	uint8_t command_len = sprintf(command, "+CASEND=0,%u", value);
+
+	cb_reset(cb);
+	cb_at_prefix_set(cb);
+	cb_write(cb, command, command_len);
+}
+
+static void _old_carecv(CommandBuffer *cb, uint32_t value) {
+	uint8_t command[100] = {0};
+	size_t command_len = sprintf(command, "+CARECV=0,%u", value);
+
+	cb_reset(cb);
+	cb_at_prefix_set(cb);
+	cb_write(cb, command, command_len);
+}
+
+static void _old_caack(CommandBuffer *cb, uint32_t value) {
+	uint8_t buffer[100];
+	uint8_t buffer_len = sprintf(buffer, "+CAACK=0");
+
+	cb_reset(cb);
+	cb_at_prefix_set(cb);
+	cb_write(cb, buffer, buffer_len);
+}
+
+static void _old_ipr(CommandBuffer *cb, uint32_t value) {
+	char command[24];
+	sprintf(command, "+IPR=%u", value);
+
+	cb_reset(cb);
+	cb_at_prefix_set(cb);
+	cb_write(cb, (uint8_t *)command, strlen(command));
+}
+
+static void _old_caopen(CommandBuffer *cb, uint32_t value) {
+	cb_reset(cb);
+	cb_at_prefix_set(cb);
+	cb_write(cb, "+CAOPEN=0,0,\"", 13);
+	cb_write(cb, "TCP", 3);
+	cb_write(cb, "\",\"", 3);
+	cb_write(cb, BENCH_URL, strlen(BENCH_URL));
+	cb_write(cb, "\",", 2);
+
+	// Port is a uint16_t in the driver
+	uint8_t port_str[6];
+	size_t str_len = sprintf(port_str, "%u", (uint16_t)value);
+	cb_write(cb, port_str, str_len);
+}
+
+// And the way the driver builds them now
+
+static void _new_casend(CommandBuffer *cb, uint32_t value) {
+	cb_command(cb, "+CASEND=0,");
+	cb_write_uint(cb, value);
+}
+
+static void _new_carecv(CommandBuffer *cb, uint32_t value) {
+	cb_command(cb, "+CARECV=0,");
+	cb_write_uint(cb, value);
+}
+
+static void _new_caack(CommandBuffer *cb, uint32_t value) {
+	cb_command(cb, "+CAACK=0");
+}
+
+static void _new_ipr(CommandBuffer *cb, uint32_t value) {
+	cb_command(cb, "+IPR=");
+	cb_write_uint(cb, value);
+}
+
+static void _new_caopen(CommandBuffer *cb, uint32_t value) {
+	uint16_t port = value;
+
+
+	cb_command(cb, "+CAOPEN=0,0,");
+	cb_write_quoted(cb, "TCP", 3);
+	cb_write_literal(cb, ",");
+	cb_write_quoted(cb, BENCH_URL, sizeof BENCH_URL - 1);
+	cb_write_literal(cb, ",");
+	cb_write_uint(cb, port);
+}
+
+static const struct command_s _commands[] = {
+	{ "CASEND=0,<len>",   _old_casend, _new_casend, 1460 },
+	{ "CARECV=0,<len>",   _old_carecv, _new_carecv, 1460 },
+	{ "CAACK=0",          _old_caack,  _new_caack,  1 },
+	{ "IPR=<baud>",       _old_ipr,    _new_ipr,    3686400 },
+	{ "CAOPEN ...,<port>", _old_caopen, _new_caopen, 65536 },
+};
+#define COMMANDS_NUM (sizeof _commands / sizeof _commands[0])
+
+static CommandBuffer _old_cb;
+static CommandBuffer _new_cb;
+
+// Bytes sent, '\r' included, must be the same both ways
+static bool _same(const struct command_s *c, uint32_t value) {
+	c->old(&_old_cb, value);
+	c->new(&_new_cb, value);
+
+	uint32_t length = cb_length(&_old_cb);
+	return length == cb_length(&_new_cb)
+		&& !memcmp(_old_cb.buffer, _new_cb.buffer, length)
+		&& _new_cb.buffer[length - 1] == '\r';
+}
+
+static bool _check(const struct command_s *c) {
+	static const uint32_t edges[] = { 0, 1, 9, 10, 99, 100, 1459, 65535, 921600, UINT32_MAX };
+
+	for (size_t i = 0; i < sizeof edges / sizeof edges[0]; i++)
+		if (!_same(c, edges[i])) return false;
+
+	for (uint32_t value = 0; value < 10000; value++)
+		if (!_same(c, value % c->modulo)) return false;
+
+	return true;
+}
+
+// Total ns for BENCH_CALLS builds, each one read so none are dropped
+static uint64_t _time(build_fn_t build, CommandBuffer *cb, uint32_t modulo) {
+	volatile uint32_t sink = 0;
+	uint32_t value = 0;
+
+	uint64_t start = _now_ns();
+	for (uint32_t i = 0; i < BENCH_CALLS; i++) {
+		build(cb, value);
+		sink += cb_length(cb);
+		if (++value == modulo) value = 0;
+	}
+
+	return _now_ns() - start;
+}
+
+static bool _run(const struct command_s *c) {
+	if (!_check(c)) return false;
+
+	double old_ns = _time(c->old, &_old_cb, c->modulo) / (double)BENCH_CALLS;
+	double new_ns = _time(c->new, &_new_cb, c->modulo) / (double)BENCH_CALLS;
+
+#ifdef PICO_ON_DEVICE
+	double cycles_per_ns = clock_get_hz(clk_sys) / 1e9;
+	printf("%-18s %8.0f %8.0f cycles/command %6.1fx\n",
+			c->name, old_ns * cycles_per_ns, new_ns * cycles_per_ns, old_ns / new_ns);
+#else
+	printf("%-18s %8.1f %8.1f ns/command %6.1fx\n",
+			c->name, old_ns, new_ns, old_ns / new_ns);
+#endif
+
+	return true;
+}
+
+int main(void) {
+#ifdef PICO_ON_DEVICE
+	stdio_init_all();
+	// Give USB serial a chance to come up
+	sleep_ms(3000);
+#endif
+
+	printf("%u builds per command\n", BENCH_CALLS);
+	printf("%-18s %8s %8s\n", "command", "sprintf", "appends");
+
+	bool ok = true;
+	for (size_t i = 0; i < COMMANDS_NUM; i++) {
+		if (!_run(&_commands[i])) {
+			printf("%-18s output differs, FAILED\n", _commands[i].name);
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+// pack_bench.c
+// Compression ratio and speed of the uplink batch packer
+// (gateway_uplink_pack.h) on synthetic node traffic. Every batch is
+// decoded again and checked byte for byte against what went in.
+//
+// Builds for the host (ns per record) and for a pico (cycles per
+// record, see pico/). Sizes are kept small enough for the pico's RAM.
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PICO_ON_DEVICE
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#else
+#include <time.h>
+#endif
+
+#include "gateway_uplink_pack.h"
+
+#define BENCH_RECORDS 2048
+#define BENCH_ROUNDS 8
+
+// Same limits as the gateway: one CASEND less the uplink header, packed
+// from a staging copy of the front of the output buffer
+#define BENCH_PAYLOAD_MAX (1459 - 12)
+#define BENCH_STAGE_SIZE (8 * 1024)
+
+#define RECORD_SIZE 19
+#define FRAMED_SIZE (2 + RECORD_SIZE)
+
+struct scenario_s {
+	const char *name;
+	unsigned nodes;
+	unsigned interval;  // Minutes between readings
+	unsigned noise;     // Max tick change per reading
+	unsigned raw_every; // A "Ping!" record every n records, 0 for none
+};
+
+static const struct scenario_s _scenarios[] = {
+	{ "1 node, 1 min",         1, 1,  8,   0 },
+	{ "8 nodes, 5 min",        8, 5,  40,  0 },
+	{ "8 nodes, noisy",        8, 5,  400, 0 },
+	{ "8 nodes, pings",        8, 5,  40,  10 },
+	{ "32 nodes, 15 min",      32, 15, 40,  0 },
+};
+#define SCENARIOS_NUM (sizeof _scenarios / sizeof _scenarios[0])
+
+static uint8_t _input[BENCH_RECORDS * FRAMED_SIZE];
+static uint8_t _decoded[BENCH_STAGE_SIZE];
+static uint8_t _packed[BENCH_PAYLOAD_MAX];
+static bool _matched[UPLINK_PACK_RECORDS_MAX];
+
+static const uint8_t _month_days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+static uint64_t _now_ns(void) {
+#ifdef PICO_ON_DEVICE
+	return time_us_64() * 1000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void _put_u16(uint8_t *dst, uint16_t value) {
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+}
+
+// Small LCG so host and pico see the same data
+static uint32_t _seed;
+static uint32_t _rand(void) {
+	_seed = _seed * 1103515245 + 12345;
+	return _seed >> 8;
+}
+
+static int _walk(int tick, unsigned noise, int low, int high) {
+	tick += (int)(_rand() % (2 * noise + 1)) - (int)noise;
+	if (tick < low) tick = low;
+	if (tick > high) tick = high;
+	return tick;
+}
+
+// Fills _input the way nodes fill the upload buffer, floats made with
+// the sht30 driver's arithmetic. Returns the framed length.
+static size_t _generate(const struct scenario_s *s) {
+	int temperature[64], humidity[64];
+	size_t length = 0;
+
+	_seed = 8086;
+	for (unsigned n = 0; n < s->nodes; n++) {
+		temperature[n] = 24000 + _rand() % 4000; // About 20 C
+		humidity[n] = 26000 + _rand() % 8000;    // About 45 %
+	}
+
+	// 2024-10-17 06:00
+	unsigned minutes = 0, hours = 6, day = 17, month = 10, year = 24;
+
+	for (unsigned i = 0; i < BENCH_RECORDS; i++) {
+		uint8_t *framed = &_input[length];
+		unsigned n = i % s->nodes;
+
+		if (s->raw_every && i % s->raw_every == s->raw_every - 1) {
+			_put_u16(&framed[0], 9);
+			_put_u16(&framed[2], 0);
+			_put_u16(&framed[4], 5);
+			memcpy(&framed[6], "Ping!", 5);
+			length += 11;
+			continue;
+		}
+
+		// Whole network reports, then time moves on
+		if (n == 0 && i) {
+			minutes += s->interval;
+			hours += minutes / 60;
+			minutes %= 60;
+			if (hours == 24) {
+				hours = 0;
+				unsigned days = _month_days[month - 1] + (month == 2 && year % 4 == 0);
+				if (++day > days) {
+					day = 1;
+					if (++month > 12) { month = 1; year++; }
+				}
+			}
+		}
+
+		temperature[n] = _walk(temperature[n], s->noise, 0, 65535);
+		humidity[n] = _walk(humidity[n], s->noise, 0, 65535);
+
+		float t = -45 + (175 * temperature[n] / 65535.0);
+		float h = 100 * humidity[n] / 65535.0;
+
+		_put_u16(&framed[0], RECORD_SIZE);
+		uint8_t *record = &framed[2];
+		_put_u16(&record[0], n + 1);
+		_put_u16(&record[2], 10);
+		_put_u16(&record[4], 0);
+		memcpy(&record[6], &t, sizeof t);
+		memcpy(&record[10], &h, sizeof h);
+		record[14] = minutes;
+		record[15] = hours;
+		record[16] = month;
+		record[17] = day;
+		record[18] = year;
+
+		length += FRAMED_SIZE;
+	}
+
+	return length;
+}
+
+static size_t _framed_size(const uint8_t *framed) {
+	return 2 + (framed[0] | framed[1] << 8);
+}
+
+// Every decoded record has to match a distinct input record of the batch
+static bool _verify(const uint8_t *batch, size_t used, unsigned count, size_t decoded_len) {
+	memset(_matched, 0, count);
+
+	for (size_t d = 0; d < decoded_len; d += _framed_size(&_decoded[d])) {
+		size_t size = _framed_size(&_decoded[d]);
+		bool found = false;
+
+		unsigned i = 0;
+		for (size_t o = 0; o < used && !found; o += _framed_size(&batch[o]), i++) {
+			if (_matched[i] || _framed_size(&batch[o]) != size) continue;
+			if (memcmp(&batch[o], &_decoded[d], size)) continue;
+
+			_matched[i] = found = true;
+		}
+
+		if (!found) return false;
+	}
+
+	return true;
+}
+
+static bool _run(const struct scenario_s *s) {
+	size_t length = _generate(s);
+	size_t packed_total = 0;
+	unsigned batches = 0;
+
+	// Correctness pass, also gives the ratio
+	for (size_t offset = 0; offset < length; ) {
+		size_t stage = length - offset;
+		if (stage > BENCH_STAGE_SIZE) stage = BENCH_STAGE_SIZE;
+
+		size_t used;
+		unsigned count, decoded_count;
+		int packed = uplink_pack_encode(&_input[offset], stage, _packed, sizeof _packed, &used, &count);
+		if (packed < 0) return false;
+
+		int decoded = uplink_pack_decode(_packed, packed, _decoded, sizeof _decoded, &decoded_count);
+		if (decoded != (int)used || decoded_count != count) return false;
+		if (!_verify(&_input[offset], used, count, decoded)) return false;
+
+		packed_total += packed;
+		offset += used;
+		batches++;
+	}
+
+	uint64_t encode_ns = 0;
+	uint64_t decode_ns = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		for (size_t offset = 0; offset < length; ) {
+			size_t stage = length - offset;
+			if (stage > BENCH_STAGE_SIZE) stage = BENCH_STAGE_SIZE;
+
+			size_t used;
+			unsigned count;
+
+			uint64_t start = _now_ns();
+			int packed = uplink_pack_encode(&_input[offset], stage, _packed, sizeof _packed, &used, &count);
+			uint64_t middle = _now_ns();
+			uplink_pack_decode(_packed, packed, _decoded, sizeof _decoded, &count);
+			uint64_t end = _now_ns();
+
+			encode_ns += middle - start;
+			decode_ns += end - middle;
+			offset += used;
+		}
+	}
+
+	double records = (double)BENCH_RECORDS * BENCH_ROUNDS;
+	printf("%-18s %7zu %7zu %6.2fx %7.1f B/batch %5u batches",
+			s->name, length, packed_total, (double)length / packed_total,
+			(double)packed_total / batches, batches);
+
+#ifdef PICO_ON_DEVICE
+	double cycles_per_ns = clock_get_hz(clk_sys) / 1e9;
+	printf("  encode %6.0f  decode %6.0f cycles/record\n",
+			encode_ns * cycles_per_ns / records, decode_ns * cycles_per_ns / records);
+#else
+	printf("  encode %6.1f  decode %6.1f ns/record\n",
+			encode_ns / records, decode_ns / records);
+#endif
+
+	return true;
+}
+
+int main(void) {
+#ifdef PICO_ON_DEVICE
+	stdio_init_all();
+	// Give USB serial a chance to come up
+	sleep_ms(3000);
+#endif
+
+	printf("%u records per scenario, %u byte batches\n", BENCH_RECORDS, BENCH_PAYLOAD_MAX);
+	printf("%-18s %7s %7s %7s\n", "scenario", "framed", "packed", "ratio");
+
+	bool ok = true;
+	for (size_t i = 0; i < SCENARIOS_NUM; i++) {
+		if (!_run(&_scenarios[i])) {
+			printf("%-18s round trip FAILED\n", _scenarios[i].name);
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
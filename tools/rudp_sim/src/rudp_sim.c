@@ -0,0 +1,260 @@
+// rudp_sim.c
+// Bulk node to gateway transfers over a simulated lossy radio channel,
+// one RUDP handshake per packet against windowed selective repeat
+// (radio_window.h). Both ends run the real state machines, only the
+// RFM69s and the air between them are simulated, in virtual time.
+//
+// The channel is half duplex: a packet takes its airtime plus a mode
+// switch, is lost at random both ways, and a node that is sending hears
+// nothing. Every delivered transfer is checked byte for byte.
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "radio_window.h"
+
+// 200 buffered 19 byte sensor records
+#define SIM_TRANSFER_SIZE 3800
+#define SIM_RUNS 50
+
+#define SIM_NODE 0x01
+#define SIM_GATEWAY 0x02
+
+// Preamble, sync word, length byte and CRC around every packet, RFM69
+// reset defaults
+#define SIM_AIR_OVERHEAD 10
+#define SIM_SETUP_US 1000 // Mode switch and FIFO fill
+#define SIM_FLIGHTS_MAX 8
+
+struct channel_s {
+	const char *name;
+	uint32_t bitrate; // bits/s
+	uint32_t loss;    // Packets lost per 1000, each way
+};
+
+static const struct channel_s _channels[] = {
+	{ "4.8 kbps, clean",     4800,  0 },
+	{ "4.8 kbps, 5% loss",   4800,  50 },
+	{ "4.8 kbps, 10% loss",  4800,  100 },
+	{ "4.8 kbps, 20% loss",  4800,  200 },
+	{ "55.5 kbps, clean",    55555, 0 },
+	{ "55.5 kbps, 10% loss", 55555, 100 },
+};
+#define CHANNELS_NUM (sizeof _channels / sizeof _channels[0])
+
+struct mode_s {
+	const char *name;
+	uint8_t window;
+	bool per_packet; // A whole transfer per packet, as radio_send does now
+};
+
+static const struct mode_s _modes[] = {
+	{ "handshake/packet", 1,  true },
+	{ "window 1",         1,  false },
+	{ "window 4",         4,  false },
+	{ "window 8",         8,  false },
+	{ "window 16",        16, false },
+	{ "window 32",        32, false },
+};
+#define MODES_NUM (sizeof _modes / sizeof _modes[0])
+
+struct node_s {
+	uint64_t busy_from; // Last transmission, mode switch included
+	uint64_t busy_until;
+};
+
+struct flight_s {
+	uint64_t start;
+	uint64_t end;
+	int to;
+	bool lost;
+	uint32_t len;
+	uint8_t packet[RADIO_WINDOW_PACKET_MAX];
+};
+
+struct result_s {
+	uint64_t us;
+	uint32_t packets;
+	uint32_t resent;
+	bool ok;
+};
+
+static uint8_t _payload[SIM_TRANSFER_SIZE];
+static uint8_t _received[SIM_TRANSFER_SIZE];
+
+// xorshift, an LCG's low bits repeat often enough to lose the same
+// retry over and over
+static uint32_t _seed;
+static uint32_t _rand(void) {
+	_seed ^= _seed << 13;
+	_seed ^= _seed >> 17;
+	_seed ^= _seed << 5;
+	return _seed;
+}
+
+static uint64_t _airtime_us(const struct channel_s *c, uint32_t len) {
+	return ((uint64_t)(len + SIM_AIR_OVERHEAD) * 8 * 1000000 + c->bitrate - 1) / c->bitrate;
+}
+
+// One transfer of [size] bytes at [offset] starting at [now], node 0
+// sending to node 1. Returns false if either end gave up.
+static bool _transfer(const struct channel_s *c, const radio_window_config_t *config,
+		uint32_t offset, uint32_t size, uint64_t *now, struct result_s *r) {
+	radio_window_tx_t tx;
+	radio_window_rx_t rx;
+	radio_window_tx_begin(&tx, config, SIM_NODE, SIM_GATEWAY, &_payload[offset], size, *now);
+	radio_window_rx_begin(&rx, config, SIM_GATEWAY, &_received[offset], size, *now);
+
+	struct node_s nodes[2] = {0};
+	struct flight_s flights[SIM_FLIGHTS_MAX];
+	uint32_t flying = 0;
+
+	while (radio_window_tx_status(&tx) == RADIO_WINDOW_BUSY) {
+		// Whoever isn't sending sends whatever it has
+		for (int n = 0; n < 2; n++) {
+			if (nodes[n].busy_until > *now || flying == SIM_FLIGHTS_MAX) continue;
+
+			struct flight_s *f = &flights[flying];
+			f->len = n == 0
+				? radio_window_tx_poll(&tx, *now, f->packet)
+				: radio_window_rx_poll(&rx, *now, f->packet);
+			if (f->len == 0) continue;
+
+			f->start = *now;
+			f->end = *now + SIM_SETUP_US + _airtime_us(c, f->len);
+			f->to = !n;
+			f->lost = _rand() % 1000 < c->loss;
+			flying++;
+
+			nodes[n].busy_from = f->start;
+			nodes[n].busy_until = f->end;
+			r->packets++;
+		}
+
+		if (radio_window_tx_status(&tx) != RADIO_WINDOW_BUSY) break;
+
+		uint64_t next = UINT64_MAX;
+		for (int n = 0; n < 2; n++) {
+			uint64_t t = nodes[n].busy_until > *now ? nodes[n].busy_until
+				: n == 0 ? radio_window_tx_deadline(&tx) : radio_window_rx_deadline(&rx);
+			if (t > *now && t < next) next = t;
+		}
+		for (uint32_t i = 0; i < flying; i++)
+			if (flights[i].end < next) next = flights[i].end;
+
+		if (next == UINT64_MAX) break;
+		*now = next;
+
+		for (uint32_t i = 0; i < flying; ) {
+			struct flight_s *f = &flights[i];
+			if (f->end > *now) {
+				i++;
+				continue;
+			}
+
+			// Nothing is heard while sending
+			struct node_s *to = &nodes[f->to];
+			bool deaf = to->busy_from < f->end && to->busy_until > f->start;
+			if (!f->lost && !deaf) {
+				if (f->to == 0) radio_window_tx_input(&tx, f->packet, f->len);
+				else radio_window_rx_input(&rx, f->packet, f->len, *now);
+			}
+
+			*f = flights[--flying];
+		}
+	}
+
+	r->resent += tx.stats.resent;
+
+	return radio_window_tx_status(&tx) == RADIO_WINDOW_DONE
+		&& radio_window_rx_status(&rx) == RADIO_WINDOW_DONE
+		&& radio_window_rx_size(&rx) == size;
+}
+
+static struct result_s _run(const struct channel_s *c, const struct mode_s *m) {
+	radio_window_config_t config = RADIO_WINDOW_CONFIG_DEFAULT;
+	config.window = m->window;
+
+	struct result_s r = { .ok = true };
+	uint64_t now = 0;
+
+	memset(_received, 0, sizeof _received);
+
+	uint32_t step = m->per_packet ? RADIO_WINDOW_DATA_MAX : SIM_TRANSFER_SIZE;
+	for (uint32_t offset = 0; offset < SIM_TRANSFER_SIZE; offset += step) {
+		uint32_t size = SIM_TRANSFER_SIZE - offset;
+		if (size > step) size = step;
+
+		if (!_transfer(c, &config, offset, size, &now, &r)) r.ok = false;
+	}
+
+	r.us = now;
+	if (memcmp(_payload, _received, SIM_TRANSFER_SIZE)) r.ok = false;
+
+	return r;
+}
+
+int main(void) {
+	for (uint32_t i = 0; i < SIM_TRANSFER_SIZE; i++) _payload[i] = i * 7 + (i >> 8);
+
+	printf("%u byte transfer, %u runs each, %u byte packets, %u ms timeout\n",
+			SIM_TRANSFER_SIZE, SIM_RUNS, RADIO_WINDOW_PACKET_MAX,
+			RADIO_WINDOW_CONFIG_DEFAULT.timeout_us / 1000);
+
+	bool ok = true;
+	for (size_t ci = 0; ci < CHANNELS_NUM; ci++) {
+		const struct channel_s *c = &_channels[ci];
+
+		printf("\n%-20s %-18s %8s %7s %8s %7s %6s\n",
+				c->name, "mode", "time s", "B/s", "packets", "resent", "failed");
+
+		for (size_t mi = 0; mi < MODES_NUM; mi++) {
+			uint64_t us = 0;
+			uint32_t packets = 0, resent = 0, failed = 0;
+
+			_seed = 8086;
+			for (uint32_t run = 0; run < SIM_RUNS; run++) {
+				struct result_s r = _run(c, &_modes[mi]);
+				us += r.us;
+				packets += r.packets;
+				resent += r.resent;
+				if (!r.ok) failed++;
+			}
+
+			double s = us / 1e6 / SIM_RUNS;
+			printf("%-20s %-18s %8.2f %7.0f %8.1f %7.1f %6u\n",
+					"", _modes[mi].name, s, SIM_TRANSFER_SIZE / s,
+					(double)packets / SIM_RUNS, (double)resent / SIM_RUNS, failed);
+
+			// Giving up now and then is expected on a bad channel,
+			// delivering wrong data never is
+			if (failed && c->loss == 0) ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
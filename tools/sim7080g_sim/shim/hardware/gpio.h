@@ -0,0 +1,25 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_HARDWARE_GPIO_H
+#define WISDOM_SHIM_HARDWARE_GPIO_H
+
+#include "pico/types.h"
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+enum gpio_function {
+	GPIO_FUNC_SPI = 1,
+	GPIO_FUNC_UART = 2,
+	GPIO_FUNC_I2C = 3,
+	GPIO_FUNC_SIO = 5,
+	GPIO_FUNC_NULL = 0x1f
+};
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_pull_up(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+
+#endif // WISDOM_SHIM_HARDWARE_GPIO_H
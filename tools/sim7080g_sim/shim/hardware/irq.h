@@ -0,0 +1,15 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_HARDWARE_IRQ_H
+#define WISDOM_SHIM_HARDWARE_IRQ_H
+
+#include "pico/types.h"
+
+#define UART0_IRQ 20
+#define UART1_IRQ 21
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+
+#endif // WISDOM_SHIM_HARDWARE_IRQ_H
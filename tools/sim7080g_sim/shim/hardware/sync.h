@@ -0,0 +1,17 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_HARDWARE_SYNC_H
+#define WISDOM_SHIM_HARDWARE_SYNC_H
+
+#include "pico/types.h"
+
+static inline void __dmb(void) {
+}
+
+// Wakes a best_effort_wfe_or_timeout
+void __sev(void);
+void __wfe(void);
+
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+#endif // WISDOM_SHIM_HARDWARE_SYNC_H
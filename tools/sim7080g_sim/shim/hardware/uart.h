@@ -0,0 +1,30 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_HARDWARE_UART_H
+#define WISDOM_SHIM_HARDWARE_UART_H
+
+#include "pico/types.h"
+
+typedef struct uart_inst uart_inst_t;
+
+extern uart_inst_t *const pico_shim_uarts[2];
+#define uart0 (pico_shim_uarts[0])
+#define uart1 (pico_shim_uarts[1])
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+void uart_deinit(uart_inst_t *uart);
+bool uart_is_enabled(uart_inst_t *uart);
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate);
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data);
+uint uart_get_index(uart_inst_t *uart);
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len);
+void uart_read_blocking(uart_inst_t *uart, uint8_t *dst, size_t len);
+bool uart_is_readable(uart_inst_t *uart);
+bool uart_is_writable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
+void uart_putc_raw(uart_inst_t *uart, char c);
+void uart_tx_wait_blocking(uart_inst_t *uart);
+
+#endif // WISDOM_SHIM_HARDWARE_UART_H
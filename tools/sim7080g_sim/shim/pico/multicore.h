@@ -0,0 +1,14 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+// Only core0 is simulated, GATEWAY_DUAL_CORE builds don't link.
+#ifndef WISDOM_SHIM_PICO_MULTICORE_H
+#define WISDOM_SHIM_PICO_MULTICORE_H
+
+#include "pico/types.h"
+
+void multicore_launch_core1(void (*entry)(void));
+
+static inline uint get_core_num(void) {
+	return 0;
+}
+
+#endif // WISDOM_SHIM_PICO_MULTICORE_H
@@ -0,0 +1,10 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_PICO_RAND_H
+#define WISDOM_SHIM_PICO_RAND_H
+
+#include "pico/types.h"
+
+// Same sequence every run
+uint32_t get_rand_32(void);
+
+#endif // WISDOM_SHIM_PICO_RAND_H
@@ -0,0 +1,10 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_PICO_STDLIB_H
+#define WISDOM_SHIM_PICO_STDLIB_H
+
+#include "pico/types.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+
+#endif // WISDOM_SHIM_PICO_STDLIB_H
@@ -0,0 +1,25 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+// One core, nothing to lock against.
+#ifndef WISDOM_SHIM_PICO_SYNC_H
+#define WISDOM_SHIM_PICO_SYNC_H
+
+#include "pico/types.h"
+#include "hardware/sync.h"
+
+typedef struct critical_section {
+	uint32_t save;
+} critical_section_t;
+
+static inline void critical_section_init(critical_section_t *crit_sec) {
+	crit_sec->save = 0;
+}
+
+static inline void critical_section_enter_blocking(critical_section_t *crit_sec) {
+	crit_sec->save = save_and_disable_interrupts();
+}
+
+static inline void critical_section_exit(critical_section_t *crit_sec) {
+	restore_interrupts(crit_sec->save);
+}
+
+#endif // WISDOM_SHIM_PICO_SYNC_H
@@ -0,0 +1,61 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_PICO_TIME_H
+#define WISDOM_SHIM_PICO_TIME_H
+
+#include "pico/types.h"
+
+#define at_the_end_of_time ((absolute_time_t)UINT64_MAX)
+#define nil_time ((absolute_time_t)0)
+
+static inline bool is_nil_time(absolute_time_t t) {
+	return t == nil_time;
+}
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) {
+	return t;
+}
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t) {
+	return t / 1000;
+}
+
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+	return (int64_t)(to - from);
+}
+
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) {
+	return t + us < t ? at_the_end_of_time : t + us;
+}
+
+static inline absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms) {
+	return delayed_by_us(t, ms * 1000ull);
+}
+
+uint64_t time_us_64(void);
+
+static inline uint32_t time_us_32(void) {
+	return (uint32_t)time_us_64();
+}
+
+static inline absolute_time_t get_absolute_time(void) {
+	return time_us_64();
+}
+
+static inline absolute_time_t make_timeout_time_us(uint64_t us) {
+	return delayed_by_us(get_absolute_time(), us);
+}
+
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) {
+	return delayed_by_ms(get_absolute_time(), ms);
+}
+
+static inline bool time_reached(absolute_time_t t) {
+	return get_absolute_time() >= t;
+}
+
+void sleep_until(absolute_time_t t);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+
+#endif // WISDOM_SHIM_PICO_TIME_H
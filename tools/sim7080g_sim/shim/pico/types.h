@@ -0,0 +1,12 @@
+// Host stand-in for the pico-sdk header of the same name (see pico_shim.c)
+#ifndef WISDOM_SHIM_PICO_TYPES_H
+#define WISDOM_SHIM_PICO_TYPES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+#endif // WISDOM_SHIM_PICO_TYPES_H
@@ -0,0 +1,996 @@
+// modem_sim.c
+// Simulated SIM7080G for running the modem driver and gateway on a host
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gateway_uplink.h"
+#include "gateway_uplink_pack.h"
+
+#include "modem_sim.h"
+
+#define SIM_LINE_MAX (559 + 3)  // COMMAND_BUFFER_MAX, AT and \r
+#define SIM_SEND_MAX 1459       // MODEM_TCP_SEND_MAX
+#define SIM_RECV_MAX 1460       // MODEM_TCP_RECV_MAX
+#define SIM_OUT_SIZE (1024 * 8) // Power of 2
+#define SIM_SOCKET_RX_SIZE (1024 * 8)
+#define SIM_EVENTS_MAX 64
+#define SIM_EVENT_DATA SIM_RECV_MAX
+#define SIM_RESPONSE_MAX (SIM_RECV_MAX + 64)
+#define SIM_SERVER_OUT_SIZE (1024 * 64) // Power of 2
+#define SIM_PUSH_FRAME_MAX (1024 * 16)
+#define SIM_PUSH_DATAGRAM_MAX (SIM_RECV_MAX - UPLINK_HEADER_SIZE)
+
+#define SIM_PRESS_BOOT_MS 1000
+#define SIM_PRESS_OFF_MS 1200
+#define SIM_PSM_WAKE_MS 100
+
+enum _power_e {
+	POWER_OFF,
+	POWER_BOOTING,
+	POWER_ON,
+	POWER_PSM
+};
+
+enum _event_e {
+	EVENT_COMMAND,    // Line came in at_delay_us ago, runs now
+	EVENT_BOOTED,
+	EVENT_WOKEN,      // Out of PSM
+	EVENT_REGISTERED,
+	EVENT_PDP,        // data[0] is 1 for up
+	EVENT_OPENED,
+	EVENT_SERVER,     // Sent bytes reach the server
+	EVENT_DOWNLINK,   // Server bytes reach the modem
+	EVENT_ACKED       // Server TCP acks [length] bytes
+};
+
+// Events only count for the power cycle or socket they were made in.
+// [generation] is the power generation for modem events and the socket
+// generation for socket ones, see _event_stale.
+struct _event_s {
+	uint64_t at;
+	uint32_t order; // Same time events run in the order they were made
+	uint32_t generation;
+	uint8_t type;
+	uint16_t length;
+	uint8_t data[SIM_EVENT_DATA];
+};
+
+static struct modem_sim_config_s _config;
+static struct modem_sim_stats_s _stats;
+static uint64_t _now = 0;
+static uint32_t _seed = 0;
+
+static struct _event_s _events[SIM_EVENTS_MAX];
+static bool _event_used[SIM_EVENTS_MAX];
+static uint32_t _event_order = 0;
+
+// Bytes out, with the time each has fully arrived
+static uint8_t _out[SIM_OUT_SIZE];
+static uint64_t _out_ready[SIM_OUT_SIZE];
+static uint32_t _out_baud[SIM_OUT_SIZE];
+static uint32_t _out_head = 0;
+static uint32_t _out_tail = 0;
+static uint64_t _out_free_ns = 0; // Line is busy until
+static uint32_t _baud = 0;
+static uint32_t _baud_next = 0;   // Set by AT+IPR, taken up after its OK
+
+static enum _power_e _power = POWER_OFF;
+static uint32_t _power_generation = 0;
+static uint64_t _press_at = 0;
+static bool _pressed = false;
+static bool _echo = true;
+static bool _registered = false;
+static bool _pdp = false;
+static bool _psm_enabled = false;
+static uint64_t _last_activity = 0;
+
+static uint8_t _line[SIM_LINE_MAX];
+static size_t _line_len = 0;
+static bool _line_overflow = false;
+
+// Socket 0
+static bool _socket_open = false;
+static bool _socket_udp = false;
+static uint32_t _socket_generation = 0;
+static uint8_t _socket_rx[SIM_SOCKET_RX_SIZE];
+static uint32_t _socket_rx_head = 0;
+static uint32_t _socket_rx_tail = 0;
+static bool _socket_indicated = false; // +CADATAIND sent for what is waiting
+static uint32_t _socket_sent = 0;
+static uint32_t _socket_acked = 0;
+
+// CASEND payload being received
+static uint8_t _send[SIM_SEND_MAX];
+static size_t _send_len = 0;
+static size_t _send_left = 0;
+
+// Radio, busy until
+static uint64_t _uplink_free = 0;
+static uint64_t _downlink_free = 0;
+static uint64_t _server_in_order = 0; // TCP delivers in order
+
+// Uplink server, one gateway
+static uint32_t _server_generation = UINT32_MAX; // Connection its reader is on
+static struct uplink_reader_s _server_reader;
+static struct uplink_header_s _server_header;
+static bool _server_in_payload = false;
+static uint8_t _server_payload[SIM_SEND_MAX];
+static uint16_t _server_payload_len = 0;
+static uint32_t _server_epoch = 0;
+static uint32_t _server_stored = 0;
+static uint8_t _server_unpacked[1024 * 8];
+
+// Server to gateway stream, acks and pushes in the order they were
+// written. Only as much is sent on as the modem's socket buffer has room
+// for, the way TCP's window would let it.
+static uint8_t _server_out[SIM_SERVER_OUT_SIZE];
+static uint32_t _server_out_head = 0;
+static uint32_t _server_out_tail = 0;
+static uint32_t _downlink_inflight = 0; // Sent on, not in the socket buffer yet
+static uint32_t _push_offset = 0;       // Where the next push frame starts
+static uint32_t _push_end = 0;
+static uint32_t _push_frame_max = 0;
+static uint8_t _push_payload[SIM_PUSH_FRAME_MAX];
+
+static struct _event_s *_event_add(uint64_t at, uint8_t type, const uint8_t *data, uint16_t length);
+static void _event_run(struct _event_s *event);
+static bool _event_stale(struct _event_s *event);
+static uint64_t _psm_at(void);
+static void _out_write(uint64_t at, const void *data, size_t len);
+static void _out_str(uint64_t at, const char *s);
+static void _command_run(const uint8_t *line, size_t len);
+static int _command_one(const char *command, char *response, size_t *response_len);
+static bool _command_is(const char *command, const char *name, const char **args);
+static void _send_done(void);
+static void _power_off(void);
+static void _socket_close(void);
+static void _server_feed(uint64_t at, uint32_t generation, bool udp, const uint8_t *data, size_t len);
+static void _server_frame(uint64_t at, uint32_t generation, bool udp);
+static void _server_reply(uint64_t at, uint8_t type, uint32_t seq);
+static void _server_write(const uint8_t *data, size_t len);
+static void _server_send(uint64_t at);
+static void _push_fill(void);
+static uint64_t _link_us(size_t bytes);
+static uint32_t _rand(void);
+static bool _line_holds(uint32_t sent, uint32_t received);
+
+void modem_sim_config_default(struct modem_sim_config_s *config) {
+	*config = (struct modem_sim_config_s) {
+		.baud = 115200,
+		.at_delay_us = 2000,
+		.boot_ms = 4000,
+		.attach_ms = 2000,
+		.pdp_ms = 600,
+		.rtt_ms = 150,
+		.link_bps = 300000,
+		.psm_idle_ms = 10000,
+		.error_permille = 0,
+		.loss_permille = 0,
+		.seed = 8086,
+	};
+}
+
+void modem_sim_init(const struct modem_sim_config_s *config, uint64_t now) {
+	_config = *config;
+	_stats = (struct modem_sim_stats_s) {0};
+	_now = now;
+	_seed = config->seed;
+
+	memset(_event_used, 0, sizeof _event_used);
+	_out_head = _out_tail = 0;
+	_out_free_ns = now * 1000;
+	_baud = config->baud;
+	_baud_next = 0;
+
+	_power = POWER_OFF;
+	_pressed = false;
+	_power_off();
+
+	_uplink_free = _downlink_free = _server_in_order = now;
+	_server_generation = UINT32_MAX;
+	_server_epoch = 0;
+	_server_stored = 0;
+	_server_out_head = _server_out_tail = 0;
+	_downlink_inflight = 0;
+	_push_offset = _push_end = 0;
+}
+
+void modem_sim_rx(uint64_t at, uint32_t baud, uint8_t c) {
+	modem_sim_advance(at);
+	_stats.bytes_in++;
+
+	// Framing error, dropped like the real one does
+	if (!_line_holds(_baud, baud)) return;
+
+	// Asleep or off, the byte goes nowhere
+	if (_power != POWER_ON) return;
+	_last_activity = at;
+
+	if (_send_left) {
+		_send[_send_len++] = c;
+		if (--_send_left == 0) _send_done();
+		return;
+	}
+
+	if (_echo) _out_write(at, &c, 1);
+
+	if (c == '\n') return;
+	if (c != '\r') {
+		if (_line_len < SIM_LINE_MAX) _line[_line_len++] = c;
+		else _line_overflow = true;
+		return;
+	}
+
+	if (_line_len && !_line_overflow)
+		_event_add(at + _config.at_delay_us, EVENT_COMMAND, _line, _line_len);
+	else if (_line_overflow)
+		_out_str(at, "\r\nERROR\r\n");
+
+	_line_len = 0;
+	_line_overflow = false;
+}
+
+void modem_sim_power_key(uint64_t at, bool pressed) {
+	modem_sim_advance(at);
+	if (pressed == _pressed) return;
+	_pressed = pressed;
+
+	if (pressed) {
+		_press_at = at;
+		return;
+	}
+
+	uint64_t held_ms = (at - _press_at) / 1000;
+	switch (_power) {
+	case POWER_OFF:
+		if (held_ms < SIM_PRESS_BOOT_MS) break;
+		_power = POWER_BOOTING;
+		_event_add(at + _config.boot_ms * 1000ull, EVENT_BOOTED, NULL, 0);
+		break;
+
+	case POWER_PSM:
+		_event_add(at + SIM_PSM_WAKE_MS * 1000ull, EVENT_WOKEN, NULL, 0);
+		break;
+
+	case POWER_ON:
+		if (held_ms < SIM_PRESS_OFF_MS) break;
+		_out_str(at, "\r\nNORMAL POWER DOWN\r\n");
+		_power_off();
+		break;
+
+	case POWER_BOOTING:
+		break;
+	}
+}
+
+bool modem_sim_tx(uint64_t now, uint32_t baud, uint8_t *c) {
+	modem_sim_advance(now);
+
+	if (_out_head == _out_tail) return false;
+
+	uint32_t index = _out_tail & (SIM_OUT_SIZE - 1);
+	if (_out_ready[index] > now) return false;
+
+	*c = _line_holds(_out_baud[index], baud) ? _out[index] : 0xFF;
+	_out_tail++;
+
+	return true;
+}
+
+uint64_t modem_sim_next_event(void) {
+	uint64_t next = _psm_at();
+
+	if (_out_head != _out_tail) {
+		uint64_t ready = _out_ready[_out_tail & (SIM_OUT_SIZE - 1)];
+		if (ready < next) next = ready;
+	}
+
+	for (int i = 0; i < SIM_EVENTS_MAX; i++)
+		if (_event_used[i] && _events[i].at < next)
+			next = _events[i].at;
+
+	return next;
+}
+
+void modem_sim_advance(uint64_t now) {
+	for (;;) {
+		// Earliest due event, oldest first among equals
+		int first = -1;
+		for (int i = 0; i < SIM_EVENTS_MAX; i++) {
+			if (!_event_used[i] || _events[i].at > now) continue;
+
+			if (first < 0 || _events[i].at < _events[first].at
+					|| (_events[i].at == _events[first].at
+						&& (int32_t)(_events[i].order - _events[first].order) < 0))
+				first = i;
+		}
+
+		uint64_t psm_at = _psm_at();
+		if (psm_at <= now && (first < 0 || psm_at <= _events[first].at)) {
+			if (psm_at > _now) _now = psm_at;
+			_power = POWER_PSM;
+			_stats.psm_entries++;
+			_socket_close();
+			continue;
+		}
+
+		if (first < 0) break;
+
+		if (_events[first].at > _now) _now = _events[first].at;
+		_event_used[first] = false;
+		if (!_event_stale(&_events[first]))
+			_event_run(&_events[first]);
+	}
+
+	if (now > _now) _now = now;
+}
+
+bool modem_sim_powered(void) {
+	return _power != POWER_OFF;
+}
+
+void modem_sim_stats_get(struct modem_sim_stats_s *dst) {
+	*dst = _stats;
+}
+
+static struct _event_s *_event_add(uint64_t at, uint8_t type, const uint8_t *data, uint16_t length) {
+	for (int i = 0; i < SIM_EVENTS_MAX; i++) {
+		if (_event_used[i]) continue;
+
+		struct _event_s *event = &_events[i];
+		event->at = at;
+		event->order = _event_order++;
+		event->type = type;
+		event->length = length;
+		if (length) memcpy(event->data, data, length);
+
+		switch (type) {
+		case EVENT_OPENED:
+		case EVENT_SERVER:
+		case EVENT_DOWNLINK:
+		case EVENT_ACKED:
+			event->generation = _socket_generation;
+			break;
+		default:
+			event->generation = _power_generation;
+		}
+
+		_event_used[i] = true;
+		return event;
+	}
+
+	// Nothing should ever queue this much
+	fprintf(stderr, "modem_sim: event queue full\n");
+	abort();
+}
+
+static bool _event_stale(struct _event_s *event) {
+	switch (event->type) {
+	case EVENT_SERVER:
+		// Already on its way, the server gets it regardless
+		return false;
+	case EVENT_OPENED:
+	case EVENT_DOWNLINK:
+	case EVENT_ACKED:
+		return event->generation != _socket_generation;
+	default:
+		return event->generation != _power_generation;
+	}
+}
+
+static void _event_run(struct _event_s *event) {
+	switch (event->type) {
+	case EVENT_COMMAND:
+		if (_power == POWER_ON)
+			_command_run(event->data, event->length);
+		break;
+
+	case EVENT_BOOTED:
+		_power = POWER_ON;
+		_echo = true;
+		_last_activity = _now;
+		_stats.boots++;
+		_out_str(_now, "\r\nRDY\r\n");
+		_event_add(_now + _config.attach_ms * 1000ull, EVENT_REGISTERED, NULL, 0);
+		break;
+
+	case EVENT_WOKEN:
+		if (_power == POWER_PSM) _power = POWER_ON;
+		_last_activity = _now;
+		break;
+
+	case EVENT_REGISTERED:
+		_registered = true;
+		break;
+
+	case EVENT_PDP:
+		_pdp = event->data[0];
+		if (!_pdp) _socket_close();
+		_out_str(_now, _pdp ? "\r\n+APP PDP: 0,ACTIVE\r\n" : "\r\n+APP PDP: 0,DEACTIVE\r\n");
+		break;
+
+	case EVENT_OPENED:
+		_socket_open = true;
+		_out_str(_now, "\r\n+CAOPEN: 0,0\r\n\r\nOK\r\n");
+		break;
+
+	case EVENT_SERVER:
+		_server_feed(_now, event->generation, event->data[0], &event->data[1], event->length - 1);
+		break;
+
+	case EVENT_DOWNLINK:
+		_downlink_inflight -= event->length;
+		if (!_socket_open) break;
+
+		for (uint16_t i = 0; i < event->length; i++) {
+			if (_socket_rx_head - _socket_rx_tail == SIM_SOCKET_RX_SIZE) break;
+			_socket_rx[_socket_rx_head++ & (SIM_SOCKET_RX_SIZE - 1)] = event->data[i];
+		}
+
+		// Once per batch of data, until it has all been read
+		if (!_socket_indicated && _power == POWER_ON) {
+			_socket_indicated = true;
+			_out_str(_now, "\r\n+CADATAIND: 0\r\n");
+		}
+		break;
+
+	case EVENT_ACKED:
+		_socket_acked += event->length;
+		break;
+	}
+}
+
+// When the modem goes into PSM if nothing happens first
+static uint64_t _psm_at(void) {
+	if (_power != POWER_ON || !_psm_enabled || _socket_open || _send_left)
+		return UINT64_MAX;
+
+	// Not with anything still to come out of the UART
+	if (_out_head != _out_tail) return UINT64_MAX;
+
+	return _last_activity + _config.psm_idle_ms * 1000ull;
+}
+
+static void _out_write(uint64_t at, const void *data, size_t len) {
+	const uint8_t *bytes = data;
+	uint64_t byte_ns = 10ull * 1000 * 1000 * 1000 / _baud;
+
+	if (_out_free_ns < at * 1000) _out_free_ns = at * 1000;
+
+	for (size_t i = 0; i < len; i++) {
+		if (_out_head - _out_tail == SIM_OUT_SIZE) return;
+
+		_out_free_ns += byte_ns;
+
+		uint32_t index = _out_head & (SIM_OUT_SIZE - 1);
+		_out[index] = bytes[i];
+		_out_ready[index] = (_out_free_ns + 999) / 1000;
+		_out_baud[index] = _baud;
+		_out_head++;
+	}
+
+	_stats.bytes_out += len;
+	_last_activity = at;
+}
+
+static void _out_str(uint64_t at, const char *s) {
+	_out_write(at, s, strlen(s));
+}
+
+enum _result_e {
+	RESULT_OK,
+	RESULT_ERROR,
+	RESULT_PENDING, // Command finishes its own response later
+	RESULT_NONE     // No final line
+};
+
+// AT<command>[;<command>...]
+static void _command_run(const uint8_t *line, size_t len) {
+	static char response[SIM_RESPONSE_MAX];
+	size_t response_len = 0;
+	char command[SIM_LINE_MAX + 1];
+
+	_stats.commands++;
+
+	if (len < 2 || line[0] != 'A' || line[1] != 'T') {
+		_out_str(_now, "\r\nERROR\r\n");
+		return;
+	}
+
+	if (_config.error_permille && _rand() % 1000 < _config.error_permille) {
+		_stats.errors_injected++;
+		_out_str(_now, "\r\nERROR\r\n");
+		return;
+	}
+
+	int result = RESULT_OK;
+	size_t start = 2;
+	bool quoted = false;
+	for (size_t i = 2; i <= len && result == RESULT_OK; i++) {
+		if (i < len && line[i] == '"') quoted = !quoted;
+		if (i < len && (line[i] != ';' || quoted)) continue;
+
+		memcpy(command, &line[start], i - start);
+		command[i - start] = '\0';
+		start = i + 1;
+
+		result = _command_one(command, response, &response_len);
+	}
+
+	if (result == RESULT_ERROR) {
+		_out_str(_now, "\r\nERROR\r\n");
+		_baud_next = 0;
+		return;
+	}
+
+	_out_write(_now, response, response_len);
+	if (result == RESULT_OK) _out_str(_now, "\r\nOK\r\n");
+
+	// Answered at the old rate
+	if (_baud_next) {
+		_baud = _baud_next;
+		_baud_next = 0;
+	}
+}
+
+#define RESPONSE_LINE(...) \
+	(*response_len += snprintf(&response[*response_len], SIM_RESPONSE_MAX - *response_len, __VA_ARGS__))
+
+// One command of a line, without AT or ';'
+// Info lines are added to [response].
+static int _command_one(const char *command, char *response, size_t *response_len) {
+	const char *args;
+
+	if (command[0] == '\0') return RESULT_OK;
+
+	if (strcmp(command, "E0") == 0 || strcmp(command, "E1") == 0) {
+		_echo = command[1] == '1';
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CPIN?", &args)) {
+		RESPONSE_LINE("\r\n+CPIN: READY\r\n");
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+COPS?", &args)) {
+		if (_registered) RESPONSE_LINE("\r\n+COPS: 0,0,\"SIM\",9\r\n");
+		else RESPONSE_LINE("\r\n+COPS: 0\r\n");
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CNACT?", &args)) {
+		RESPONSE_LINE("\r\n+CNACT: 0,%d,\"%s\"\r\n", _pdp, _pdp ? "10.64.0.2" : "0.0.0.0");
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CNACT=", &args)) {
+		if (!_registered || strncmp(args, "0,", 2)) return RESULT_ERROR;
+
+		uint8_t up = args[2] == '1';
+		if (up == _pdp) return up ? RESULT_ERROR : RESULT_OK;
+
+		_event_add(_now + (up ? _config.pdp_ms * 1000ull : _config.at_delay_us), EVENT_PDP, &up, 1);
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CAOPEN=", &args)) {
+		// 0,0,"TCP"|"UDP","host",port
+		if (strncmp(args, "0,0,\"", 5) || *response_len) return RESULT_ERROR;
+
+		if (!_pdp || _socket_open) {
+			RESPONSE_LINE("\r\n+CAOPEN: 0,1\r\n");
+			return RESULT_OK;
+		}
+
+		_socket_udp = strncmp(&args[5], "UDP", 3) == 0;
+		_socket_generation++;
+		_socket_rx_head = _socket_rx_tail = 0;
+		_socket_indicated = false;
+		_socket_sent = _socket_acked = 0;
+
+		// A datagram socket is ready straight away
+		uint64_t open_us = _socket_udp ? _config.at_delay_us : _config.rtt_ms * 1000ull;
+		_event_add(_now + open_us, EVENT_OPENED, NULL, 0);
+		return RESULT_PENDING;
+	}
+
+	if (_command_is(command, "+CACLOSE=", &args)) {
+		if (!_socket_open) return RESULT_ERROR;
+		_socket_close();
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CASEND=", &args)) {
+		unsigned length = 0;
+		if (sscanf(args, "0,%u", &length) != 1 || *response_len) return RESULT_ERROR;
+		if (!_socket_open || length == 0 || length > SIM_SEND_MAX) return RESULT_ERROR;
+
+		_send_len = 0;
+		_send_left = length;
+		RESPONSE_LINE("\r\n> ");
+		return RESULT_NONE;
+	}
+
+	if (_command_is(command, "+CAACK=", &args)) {
+		if (!_socket_open) return RESULT_ERROR;
+		RESPONSE_LINE("\r\n+CAACK: %u,%u\r\n", _socket_sent, _socket_sent - _socket_acked);
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CARECV=", &args)) {
+		unsigned length = 0;
+		if (sscanf(args, "0,%u", &length) != 1 || !_socket_open) return RESULT_ERROR;
+
+		uint32_t available = _socket_rx_head - _socket_rx_tail;
+		if (length > available) length = available;
+		if (length > SIM_RECV_MAX) length = SIM_RECV_MAX;
+
+		if (length == 0) {
+			RESPONSE_LINE("\r\n+CARECV: 0\r\n");
+		} else {
+			RESPONSE_LINE("\r\n+CARECV: %u,", length);
+			for (unsigned i = 0; i < length; i++)
+				response[(*response_len)++] = _socket_rx[_socket_rx_tail++ & (SIM_SOCKET_RX_SIZE - 1)];
+			RESPONSE_LINE("\r\n");
+		}
+
+		// Next data in gets its own +CADATAIND
+		if (_socket_rx_head == _socket_rx_tail) _socket_indicated = false;
+
+		// Room made, the server hears of it half a round trip on
+		if (length) _server_send(_now + _config.rtt_ms * 500ull);
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CASTATE?", &args)) {
+		if (_socket_open) RESPONSE_LINE("\r\n+CASTATE: 0,1\r\n");
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+CPOWD=", &args)) {
+		RESPONSE_LINE("\r\nNORMAL POWER DOWN\r\n");
+		_power_off();
+		return RESULT_NONE;
+	}
+
+	if (_command_is(command, "+IPR?", &args)) {
+		RESPONSE_LINE("\r\n+IPR: %u\r\n", _baud);
+		return RESULT_OK;
+	}
+
+	if (_command_is(command, "+IPR=", &args)) {
+		static const uint32_t rates[] = {
+			9600, 19200, 38400, 57600, 115200, 230400, 921600,
+			2000000, 2900000, 3000000, 3200000, 3686400, 4000000,
+		};
+
+		unsigned long baud = strtoul(args, NULL, 10);
+		for (size_t i = 0; i < sizeof rates / sizeof rates[0]; i++) {
+			if (rates[i] != baud) continue;
+			_baud_next = baud;
+			return RESULT_OK;
+		}
+
+		return RESULT_ERROR;
+	}
+
+	if (_command_is(command, "+CPSMS=", &args)) {
+		_psm_enabled = args[0] == '1';
+		return RESULT_OK;
+	}
+
+	// Any other set, CMEE, CGDCONT, CEDRXS and the like, is taken as is
+	if (command[0] == '+' && strchr(command, '=') && !strchr(command, '?'))
+		return RESULT_OK;
+
+	return RESULT_ERROR;
+}
+
+// [command] is [name] followed by its arguments, pointed to by [args]
+static bool _command_is(const char *command, const char *name, const char **args) {
+	size_t n = strlen(name);
+	if (strncmp(command, name, n)) return false;
+
+	*args = &command[n];
+	return true;
+}
+
+// Whole CASEND payload is in, off it goes
+static void _send_done(void) {
+	_stats.sends++;
+	_socket_sent += _send_len;
+	_out_str(_now, "\r\nOK\r\n");
+
+	uint64_t arrive = (_uplink_free > _now ? _uplink_free : _now) + _link_us(_send_len);
+	_uplink_free = arrive;
+	arrive += _config.rtt_ms * 500ull;
+
+	bool lost = _config.loss_permille && _rand() % 1000 < _config.loss_permille;
+	if (lost) {
+		_stats.sends_lost++;
+
+		// Gone for good over UDP. TCP gets it there a retransmit later,
+		// holding up everything behind it.
+		if (_socket_udp) return;
+		arrive += _config.rtt_ms * 2000ull;
+	}
+
+	if (!_socket_udp) {
+		if (arrive < _server_in_order) arrive = _server_in_order;
+		_server_in_order = arrive;
+	}
+
+	// First byte says how the server should take it
+	struct _event_s *event = _event_add(arrive, EVENT_SERVER, NULL, 0);
+	event->data[0] = _socket_udp;
+	memcpy(&event->data[1], _send, _send_len);
+	event->length = _send_len + 1;
+
+	if (!_socket_udp) {
+		struct _event_s *acked = _event_add(arrive + _config.rtt_ms * 500ull, EVENT_ACKED, NULL, 0);
+		acked->length = _send_len;
+	}
+}
+
+static void _power_off(void) {
+	_power = POWER_OFF;
+	_power_generation++;
+	_registered = false;
+	_pdp = false;
+	_psm_enabled = false;
+	_echo = true;
+	_line_len = 0;
+	_line_overflow = false;
+	_send_left = 0;
+	_socket_close();
+}
+
+static void _socket_close(void) {
+	_socket_open = false;
+	_socket_generation++;
+	_socket_rx_head = _socket_rx_tail = 0;
+	_socket_indicated = false;
+	_send_left = 0;
+}
+
+// Uplink server end of socket 0
+static void _server_feed(uint64_t at, uint32_t generation, bool udp, const uint8_t *data, size_t len) {
+	// Every datagram and every new connection starts from scratch
+	if (udp || generation != _server_generation) {
+		uplink_reader_reset(&_server_reader);
+		_server_in_payload = false;
+	}
+
+	// What was on its way to the last connection goes with it
+	if (generation != _server_generation) {
+		_server_generation = generation;
+		_server_out_head = _server_out_tail = 0;
+		_downlink_inflight = 0;
+		_push_offset = _push_end = 0;
+	}
+
+	while (len) {
+		if (!_server_in_payload) {
+			bool complete = false;
+			size_t used = uplink_reader_feed(&_server_reader, data, len, &_server_header, &complete);
+			data += used;
+			len -= used;
+
+			if (!complete) continue;
+
+			_server_in_payload = true;
+			_server_payload_len = 0;
+			if (_server_header.length > SIM_SEND_MAX) {
+				_stats.bad_frames++;
+				_server_in_payload = false;
+				continue;
+			}
+		}
+
+		size_t take = _server_header.length - _server_payload_len;
+		if (take > len) take = len;
+		memcpy(&_server_payload[_server_payload_len], data, take);
+		_server_payload_len += take;
+		data += take;
+		len -= take;
+
+		if (_server_payload_len == _server_header.length) {
+			_server_in_payload = false;
+			_server_frame(at, generation, udp);
+		}
+	}
+
+	// A datagram is one frame, what is missing isn't coming
+	if (udp && _server_in_payload) _stats.bad_frames++;
+}
+
+// Same rules as tools/uplink_server
+static void _server_frame(uint64_t at, uint32_t generation, bool udp) {
+	struct uplink_header_s *header = &_server_header;
+
+	switch (header->type) {
+	case UPLINK_HELLO:
+		_stats.hellos++;
+		if (header->seq != _server_epoch) {
+			_server_epoch = header->seq;
+			_server_stored = 0;
+
+			// Goes out behind the ack, once per boot
+			_push_offset = 0;
+			_push_end = _config.push_bytes;
+			_push_frame_max = udp ? SIM_PUSH_DATAGRAM_MAX : SIM_PUSH_FRAME_MAX;
+		}
+		break;
+
+	case UPLINK_DATA:
+	case UPLINK_DATA_PACKED:
+		if (uplink_crc16(UPLINK_CRC_INIT, _server_payload, header->length) != header->crc) {
+			_stats.bad_frames++;
+			return;
+		}
+
+		if (!uplink_seq_after(header->seq, _server_stored)) {
+			_stats.duplicates++;
+			break;
+		}
+
+		// A datagram past a lost one waits for the resend
+		if (udp && header->seq != _server_stored + 1) {
+			_server_reply(at, UPLINK_GAP, _server_stored + 1);
+			return;
+		}
+
+		const uint8_t *records = _server_payload;
+		size_t records_len = header->length;
+		if (header->type == UPLINK_DATA_PACKED) {
+			unsigned count;
+			int unpacked = uplink_pack_decode(_server_payload, header->length,
+					_server_unpacked, sizeof _server_unpacked, &count);
+			if (unpacked < 0) {
+				_stats.bad_frames++;
+				return;
+			}
+
+			records = _server_unpacked;
+			records_len = unpacked;
+		}
+
+		for (size_t offset = 0; offset + 2 <= records_len; ) {
+			size_t size = records[offset] | records[offset + 1] << 8;
+			_stats.records++;
+			_stats.record_bytes += size;
+			offset += 2 + size;
+		}
+
+		_stats.batches++;
+		_server_stored = header->seq;
+		break;
+
+	default:
+		return;
+	}
+
+	_server_reply(at, UPLINK_ACK, _server_stored);
+}
+
+static void _server_reply(uint64_t at, uint8_t type, uint32_t seq) {
+	uint8_t frame[UPLINK_HEADER_SIZE];
+	uplink_header_pack(frame, &(struct uplink_header_s) {
+		.type = type,
+		.seq = seq,
+		.length = 0,
+		.crc = UPLINK_CRC_INIT,
+	});
+
+	_server_write(frame, sizeof frame);
+	_server_send(at);
+}
+
+static void _server_write(const uint8_t *data, size_t len) {
+	if (SIM_SERVER_OUT_SIZE - (_server_out_head - _server_out_tail) < len) {
+		fprintf(stderr, "modem_sim: server stream full\n");
+		abort();
+	}
+
+	for (size_t i = 0; i < len; i++)
+		_server_out[_server_out_head++ & (SIM_SERVER_OUT_SIZE - 1)] = data[i];
+}
+
+// Sends on as much of the server stream as the modem has room for,
+// starting at server time [at]
+static void _server_send(uint64_t at) {
+	_push_fill();
+
+	for (;;) {
+		uint32_t waiting = _server_out_head - _server_out_tail;
+		uint32_t buffered = _socket_rx_head - _socket_rx_tail + _downlink_inflight;
+		if (waiting == 0 || buffered >= SIM_SOCKET_RX_SIZE) break;
+
+		uint32_t index = _server_out_tail & (SIM_SERVER_OUT_SIZE - 1);
+		uint32_t len = waiting;
+		if (len > SIM_SOCKET_RX_SIZE - buffered) len = SIM_SOCKET_RX_SIZE - buffered;
+		if (len > SIM_EVENT_DATA) len = SIM_EVENT_DATA;
+		if (len > SIM_SERVER_OUT_SIZE - index) len = SIM_SERVER_OUT_SIZE - index;
+
+		uint64_t arrive = at + _config.rtt_ms * 500ull;
+		if (arrive < _downlink_free) arrive = _downlink_free;
+		arrive += _link_us(len);
+		_downlink_free = arrive;
+
+		struct _event_s *event = _event_add(arrive, EVENT_DOWNLINK, &_server_out[index], len);
+		event->generation = _server_generation;
+		_downlink_inflight += len;
+		_server_out_tail += len;
+
+		_push_fill();
+	}
+}
+
+// Writes push frames to the server stream while it is less than half
+// full, leaving room for the acks behind them
+static void _push_fill(void) {
+	while (_push_offset < _push_end) {
+		uint32_t len = _push_end - _push_offset;
+		if (len > _push_frame_max) len = _push_frame_max;
+
+		uint32_t queued = _server_out_head - _server_out_tail;
+		if (queued + UPLINK_HEADER_SIZE + len > SIM_SERVER_OUT_SIZE / 2) break;
+
+		for (uint32_t i = 0; i < len; i++)
+			_push_payload[i] = modem_sim_push_byte(_push_offset + i);
+
+		uint8_t header[UPLINK_HEADER_SIZE];
+		uplink_header_pack(header, &(struct uplink_header_s) {
+			.type = UPLINK_PUSH,
+			.seq = _push_offset,
+			.length = len,
+			.crc = uplink_crc16(UPLINK_CRC_INIT, _push_payload, len),
+		});
+
+		_server_write(header, sizeof header);
+		_server_write(_push_payload, len);
+		_stats.pushes++;
+		_push_offset += len;
+	}
+}
+
+// Time on air for [bytes]
+static uint64_t _link_us(size_t bytes) {
+	return (uint64_t)bytes * 8 * 1000 * 1000 / _config.link_bps;
+}
+
+// Small LCG so runs repeat
+static uint32_t _rand(void) {
+	_seed = _seed * 1103515245 + 12345;
+	return _seed >> 8;
+}
+
+// A byte sent at one rate arrives intact at the other end, only if both
+// agree and the wiring holds the rate
+static bool _line_holds(uint32_t sent, uint32_t received) {
+	return sent == received && (_config.baud_max == 0 || sent <= _config.baud_max);
+}
@@ -0,0 +1,129 @@
+// modem_sim.h
+// Simulated SIM7080G for running the modem driver and gateway on a host
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef WISDOM_MODEM_SIM_H
+#define WISDOM_MODEM_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Speaks the AT subset sim7080g_pico uses: E0, CPIN, COPS, CNACT,
+// CAOPEN, CACLOSE, CASEND, CAACK, CARECV, CASTATE, CPOWD, IPR, IFC and
+// the plain set commands of config/PSM/eDRX, chained with ';' or not. Sends RDY,
+// +APP PDP and +CADATAIND on its own. Behind socket 0 sits an uplink
+// server (gateway_uplink.h) that stores batches in order and acks them.
+// On the first HELLO of each boot it can also push push_bytes down,
+// made of modem_sim_push_byte, in PUSH frames with seq as their offset.
+// The server only sends as much as fits in the modem's socket buffer.
+//
+// Nothing runs on its own. All times are microseconds on the caller's
+// clock, and the caller moves the modem along by handing it bytes,
+// power key changes and the current time. Bytes out come with the time
+// they finish arriving at the UART, paced by the baud rate.
+//
+// The power key works like the real one: a press of a second or more
+// boots a switched off modem, 1.2 s or more switches a running one off
+// and any press wakes it from PSM. PSM is entered once AT+CPSMS=1 has
+// been set and the UART has been quiet for psm_idle_ms with no socket
+// open. Registration and the PDP context survive it.
+//
+// AT+IPR changes the UART rate once its OK is out, and like the real
+// one's it is kept over a power cycle. A byte only gets through when
+// both ends are at the same rate and the wiring holds it (baud_max).
+
+struct modem_sim_config_s {
+	uint32_t baud;           // UART, both ways, until AT+IPR
+	uint32_t baud_max;       // Fastest rate the wiring holds, 0 for any
+	uint32_t at_delay_us;    // Command line in to response out
+	uint32_t boot_ms;        // Power key release to RDY
+	uint32_t attach_ms;      // RDY to registered
+	uint32_t pdp_ms;         // AT+CNACT to +APP PDP
+	uint32_t rtt_ms;         // Network round trip, also what CAOPEN takes
+	uint32_t link_bps;       // Radio throughput, each way
+	uint32_t psm_idle_ms;    // Quiet time before PSM once set
+	uint16_t error_permille; // Commands answered ERROR instead
+	uint16_t loss_permille;  // Sends lost on the way to the server
+	uint32_t push_bytes;     // Pushed to each boot, 0 for none
+	uint32_t seed;
+};
+
+struct modem_sim_stats_s {
+	uint32_t commands;       // AT command lines, chained ones count once
+	uint32_t errors_injected;
+	uint32_t sends;          // CASENDs taken
+	uint32_t sends_lost;     // ... of which lost (UDP) or retransmitted (TCP)
+	uint32_t bytes_in;       // UART bytes into the modem
+	uint32_t bytes_out;      // UART bytes out of the modem
+	uint32_t boots;
+	uint32_t psm_entries;
+
+	// Uplink server
+	uint32_t hellos;
+	uint32_t batches;        // Stored, duplicates not included
+	uint32_t duplicates;
+	uint32_t records;        // Stored
+	uint32_t record_bytes;
+	uint32_t bad_frames;     // CRC or header failures
+	uint32_t pushes;         // PUSH frames sent
+};
+
+// Byte [offset] into a push
+static inline uint8_t modem_sim_push_byte(uint32_t offset) {
+	return offset * 31 + (offset >> 9);
+}
+
+// Defaults are a CAT-M modem on a decent cell at 115200 baud
+void modem_sim_config_default(struct modem_sim_config_s *config);
+
+// Switched off, at time [now]
+void modem_sim_init(const struct modem_sim_config_s *config, uint64_t now);
+
+// Byte [c], sent at [baud], has finished arriving at the modem at time
+// [at]
+void modem_sim_rx(uint64_t at, uint32_t baud, uint8_t c);
+
+// Power key state at time [at]
+void modem_sim_power_key(uint64_t at, bool pressed);
+
+// Next byte out of the modem, if it has fully arrived by [now] at a UART
+// set to [baud]
+//
+// return: false if there is none yet
+bool modem_sim_tx(uint64_t now, uint32_t baud, uint8_t *c);
+
+// When the modem next does anything on its own, a byte coming out
+// included
+//
+// return: UINT64_MAX if it never will without being poked
+uint64_t modem_sim_next_event(void);
+
+// Runs everything due by [now]
+void modem_sim_advance(uint64_t now);
+
+bool modem_sim_powered(void);
+
+void modem_sim_stats_get(struct modem_sim_stats_s *dst);
+
+#endif // WISDOM_MODEM_SIM_H
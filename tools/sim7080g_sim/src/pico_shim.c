@@ -0,0 +1,296 @@
+// pico_shim.c
+// Just enough pico-sdk on a host to run the modem driver against modem_sim
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/rand.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "modem_sim.h"
+#include "pico_shim.h"
+
+#define SHIM_START_US (1000 * 1000)
+#define SHIM_FIFO_SIZE 32
+#define SHIM_IRQS_MAX 32
+
+struct uart_inst {
+	uint index;
+	bool enabled;
+	uint baud;
+	bool rx_irq;
+};
+
+static struct uart_inst _uarts[2] = { { .index = 0 }, { .index = 1 } };
+uart_inst_t *const pico_shim_uarts[2] = { &_uarts[0], &_uarts[1] };
+static uart_inst_t *_modem_uart = &_uarts[0]; // Last one set up
+
+static uint64_t _now = SHIM_START_US;
+static uint64_t _tx_free_ns = 0; // UART TX is busy until
+static uint _pin_power = 0;
+static bool _event = false;      // Set by __sev, cleared by a wait
+static uint32_t _interrupts_off = 0;
+static uint32_t _rand_seed = 8086;
+
+static irq_handler_t _irq_handlers[SHIM_IRQS_MAX];
+static bool _irq_enabled[SHIM_IRQS_MAX];
+
+// RX FIFO, shared by both UARTs since there is one modem
+static uint8_t _fifo[SHIM_FIFO_SIZE];
+static uint _fifo_head = 0;
+static uint _fifo_tail = 0;
+
+static void _advance_to(uint64_t t);
+static void _interrupts_run(void);
+static void _fifo_fill(void);
+static void _forever(const char *what);
+
+void pico_shim_init(uint pin_power) {
+	_pin_power = pin_power;
+	_now = SHIM_START_US;
+	_tx_free_ns = _now * 1000;
+}
+
+uint64_t time_us_64(void) {
+	return _now;
+}
+
+void sleep_until(absolute_time_t t) {
+	if (t == at_the_end_of_time) _forever("sleep_until(at_the_end_of_time)");
+	_advance_to(t);
+}
+
+void sleep_us(uint64_t us) {
+	sleep_until(delayed_by_us(_now, us));
+}
+
+void sleep_ms(uint32_t ms) {
+	sleep_until(delayed_by_ms(_now, ms));
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp) {
+	// An SEV that came before the WFE isn't lost
+	if (_event) {
+		_event = false;
+		return time_reached(timeout_timestamp);
+	}
+
+	uint64_t next = modem_sim_next_event();
+	if (next >= timeout_timestamp) {
+		if (timeout_timestamp == at_the_end_of_time) _forever("best_effort_wfe_or_timeout");
+
+		_advance_to(timeout_timestamp);
+		_event = false;
+		return true;
+	}
+
+	_advance_to(next);
+	_event = false;
+	return time_reached(timeout_timestamp);
+}
+
+void __sev(void) {
+	_event = true;
+}
+
+void __wfe(void) {
+	if (!_event) best_effort_wfe_or_timeout(at_the_end_of_time);
+	_event = false;
+}
+
+uint32_t save_and_disable_interrupts(void) {
+	return _interrupts_off++;
+}
+
+void restore_interrupts(uint32_t status) {
+	_interrupts_off = status;
+}
+
+uint32_t get_rand_32(void) {
+	_rand_seed = _rand_seed * 1103515245 + 12345;
+	return _rand_seed;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+	fprintf(stderr, "pico_shim: core1 isn't simulated, build without GATEWAY_DUAL_CORE\n");
+	exit(2);
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+	if (num < SHIM_IRQS_MAX) _irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+	if (num < SHIM_IRQS_MAX) _irq_enabled[num] = enabled;
+}
+
+void gpio_init(uint gpio) {
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+}
+
+void gpio_pull_up(uint gpio) {
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn) {
+}
+
+void gpio_put(uint gpio, bool value) {
+	// PWRKEY is active low
+	if (gpio == _pin_power) modem_sim_power_key(_now, !value);
+}
+
+bool gpio_get(uint gpio) {
+	return false;
+}
+
+uint uart_init(uart_inst_t *uart, uint baudrate) {
+	uart->enabled = true;
+	uart->baud = baudrate;
+	_modem_uart = uart;
+	return baudrate;
+}
+
+void uart_deinit(uart_inst_t *uart) {
+	uart->enabled = false;
+}
+
+bool uart_is_enabled(uart_inst_t *uart) {
+	return uart->enabled;
+}
+
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate) {
+	uart->baud = baudrate;
+	return baudrate;
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts) {
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled) {
+}
+
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data) {
+	uart->rx_irq = rx_has_data;
+}
+
+uint uart_get_index(uart_inst_t *uart) {
+	return uart->index;
+}
+
+// Takes as long as the bytes take on the wire, anything received in the
+// meantime comes in through the IRQ as it would on the chip
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len) {
+	uint64_t byte_ns = 10ull * 1000 * 1000 * 1000 / uart->baud;
+	if (_tx_free_ns < _now * 1000) _tx_free_ns = _now * 1000;
+
+	for (size_t i = 0; i < len; i++) {
+		_tx_free_ns += byte_ns;
+		_advance_to((_tx_free_ns + 999) / 1000);
+		modem_sim_rx(_now, uart->baud, src[i]);
+	}
+}
+
+void uart_read_blocking(uart_inst_t *uart, uint8_t *dst, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		while (!uart_is_readable(uart)) {
+			uint64_t next = modem_sim_next_event();
+			if (next == UINT64_MAX) _forever("uart_read_blocking");
+			_advance_to(next);
+		}
+
+		dst[i] = uart_getc(uart);
+	}
+}
+
+bool uart_is_readable(uart_inst_t *uart) {
+	_fifo_fill();
+	return _fifo_head != _fifo_tail;
+}
+
+bool uart_is_writable(uart_inst_t *uart) {
+	return true;
+}
+
+char uart_getc(uart_inst_t *uart) {
+	_fifo_fill();
+	if (_fifo_head == _fifo_tail) return 0;
+
+	return _fifo[_fifo_tail++ % SHIM_FIFO_SIZE];
+}
+
+void uart_putc_raw(uart_inst_t *uart, char c) {
+	uart_write_blocking(uart, (const uint8_t *)&c, 1);
+}
+
+void uart_tx_wait_blocking(uart_inst_t *uart) {
+}
+
+// Moves the clock to [t], running the modem and the RX IRQ at every
+// point something happens on the way
+static void _advance_to(uint64_t t) {
+	for (;;) {
+		uint64_t next = modem_sim_next_event();
+		if (next > t) break;
+
+		if (next > _now) _now = next;
+		modem_sim_advance(_now);
+		_interrupts_run();
+
+		// Only bytes nobody is reading can still be due, the FIFO is
+		// full with the IRQ off
+		if (modem_sim_next_event() <= _now) break;
+	}
+
+	if (t > _now) _now = t;
+	modem_sim_advance(_now);
+	_interrupts_run();
+}
+
+static void _interrupts_run(void) {
+	if (_interrupts_off) return;
+
+	for (uint i = 0; i < 2; i++) {
+		uint irq = i ? UART1_IRQ : UART0_IRQ;
+		if (!_uarts[i].rx_irq || !_irq_enabled[irq] || !_irq_handlers[irq]) continue;
+
+		if (uart_is_readable(&_uarts[i])) _irq_handlers[irq]();
+	}
+}
+
+static void _fifo_fill(void) {
+	uint8_t c;
+	while (_fifo_head - _fifo_tail < SHIM_FIFO_SIZE && modem_sim_tx(_now, _modem_uart->baud, &c))
+		_fifo[_fifo_head++ % SHIM_FIFO_SIZE] = c;
+}
+
+static void _forever(const char *what) {
+	fprintf(stderr, "pico_shim: %s waits forever, the modem has nothing more to say (t=%llu us)\n",
+			what, (unsigned long long)_now);
+	exit(2);
+}
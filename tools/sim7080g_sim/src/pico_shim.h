@@ -0,0 +1,49 @@
+// pico_shim.h
+// Just enough pico-sdk on a host to run the modem driver against modem_sim
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef WISDOM_PICO_SHIM_H
+#define WISDOM_PICO_SHIM_H
+
+#include <stdint.h>
+
+#include "pico/types.h"
+
+// Time is virtual. It only moves when the code under test sleeps or
+// waits, or writes to the UART (at the baud rate). Code runs in no time
+// at all, so runs are repeatable to the microsecond and an hour of
+// modem time takes milliseconds.
+//
+// Both UARTs lead to the one simulated modem, whose power key is GPIO
+// [pin_power]. Received bytes go through a 32 byte FIFO and the RX IRQ
+// handler the driver installed, as on the chip, and wake
+// best_effort_wfe_or_timeout.
+//
+// A wait with no timeout on a modem that has nothing more to say would
+// never end. The shim reports it and exits instead.
+
+// Modem has to be set up first (see modem_sim_init)
+// Clock starts at one second so no time is nil_time.
+void pico_shim_init(uint pin_power);
+
+#endif // WISDOM_PICO_SHIM_H
@@ -0,0 +1,632 @@
+// sim_bench.c
+// Latency and throughput of the sim7080g_pico driver and the gateway
+// pump, run against the simulated modem (modem_sim.h) on virtual time
+// (pico_shim.h). Same numbers every run, so a before and after of a
+// driver change can be compared directly.
+//
+// Times marked "modem" are virtual: what the exchange would take on the
+// wire. "host" is what the code under test, simulator included, costs
+// on this machine.
+//
+// Every scenario runs in its own process so the gateway's statics start
+// from scratch each time.
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "pico/stdlib.h"
+
+#include "at_keywords.h"
+#include "sim7080g_pico.h"
+#include "gateway.h"
+#include "gateway_uplink.h"
+
+#include "modem_sim.h"
+#include "pico_shim.h"
+
+#define BENCH_PORT 8086
+#define BENCH_HOST "10.64.0.1"
+
+#define OP_ROUNDS 50
+#define RECORD_SIZE 19
+#define FRAME_RECORDS 68 // Largest whole number of records in one send
+
+// Gateway scenarios give up after this much modem time
+#define SCENARIO_LIMIT_US (6ull * 60 * 60 * 1000 * 1000)
+
+struct scenario_s {
+	const char *name;
+	unsigned records;
+	unsigned interval_ms;   // Between pushes, 0 for all at once
+	bool udp;
+	bool session_keep;
+	uint32_t link_bps;      // 0 keeps the default
+	uint32_t rtt_ms;        // 0 keeps the default
+	uint16_t error_permille;
+	uint16_t loss_permille;
+};
+
+// A backlog is as much as fits in the gateway's output buffer. A stream
+// keeps one connection busy for a few minutes.
+static const struct scenario_s _scenarios[] = {
+	{ "backlog TCP",          480,  0,         false, false },
+	{ "backlog UDP",          480,  0,         true,  false },
+	{ "stream TCP",           3000, 25,        false, false },
+	{ "stream UDP",           3000, 25,        true,  false },
+	{ "stream, 20 kbps",      3000, 25,        false, false, 20000 },
+	{ "stream, 600 ms rtt",   3000, 25,        false, false, 0, 600 },
+	{ "stream, 5% AT errors", 3000, 25,        false, false, 0, 0, 50 },
+	{ "stream, 10% loss TCP", 3000, 25,        false, false, 0, 0, 0, 100 },
+	{ "stream, 10% loss UDP", 3000, 25,        true,  false, 0, 0, 0, 100 },
+	{ "12 x 5 min, cold",     12,   5 * 60000, false, false },
+	{ "12 x 5 min, PSM",      12,   5 * 60000, false, true },
+};
+#define SCENARIOS_NUM (sizeof _scenarios / sizeof _scenarios[0])
+
+// Server pushes to the gateway, behind one record's upload
+struct push_s {
+	const char *name;
+	uint32_t bytes;
+	bool udp;
+	bool buffer; // Through gateway_recv instead of a sink
+};
+
+static const struct push_s _pushes[] = {
+	{ "push 64 KiB TCP",    64 * 1024,  false, false },
+	{ "push 64 KiB UDP",    64 * 1024,  true,  false },
+	{ "push 256 KiB TCP",   256 * 1024, false, false },
+	{ "push 1 KiB, buffer", 1024,       false, true },
+};
+#define PUSHES_NUM (sizeof _pushes / sizeof _pushes[0])
+
+// Overrides from the command line, for every run
+static struct modem_sim_config_s _base;
+static uint _baud_fast = 921600; // Driver run negotiates this, 0 not to
+
+static sim7080g_context_t *_modem = NULL;
+static uint32_t _epoch = 0x5EED;
+static uint32_t _seq = 0;
+static uint8_t _frame[UPLINK_HEADER_SIZE + FRAME_RECORDS * (2 + RECORD_SIZE)];
+
+static uint64_t _host_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _put_u16(uint8_t *dst, uint16_t value) {
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+}
+
+// Node record as the gateway would queue it
+static void _record_make(uint8_t record[RECORD_SIZE], unsigned i) {
+	memset(record, 0, RECORD_SIZE);
+	_put_u16(&record[0], 1 + i % 8);
+	_put_u16(&record[2], 10);
+	record[6] = i;
+	record[7] = i >> 8;
+}
+
+static size_t _frame_make(uint8_t type, uint32_t seq, unsigned records) {
+	uint8_t *payload = &_frame[UPLINK_HEADER_SIZE];
+	size_t length = 0;
+
+	for (unsigned i = 0; i < records; i++) {
+		_put_u16(&payload[length], RECORD_SIZE);
+		_record_make(&payload[length + 2], i);
+		length += 2 + RECORD_SIZE;
+	}
+
+	uplink_header_pack(_frame, &(struct uplink_header_s) {
+		.type = type,
+		.seq = seq,
+		.length = length,
+		.crc = uplink_crc16(UPLINK_CRC_INIT, payload, length),
+	});
+
+	return UPLINK_HEADER_SIZE + length;
+}
+
+static void _sim_start(const struct modem_sim_config_s *config) {
+	pico_shim_init(GATEWAY_PIN_PWR);
+	modem_sim_init(config, time_us_64());
+}
+
+// Driver on its own
+
+// The perfect hash in at_keywords.c still takes every keyword back to
+// itself, see tools/at_keywords_hash
+static bool _keywords_check(void) {
+	bool holds = true;
+	for (AT_KEY key = AT_KEY_NONE + 1; key < AT_KEYS_NUM; key++) {
+		AT_KEY found = at_key_lookup((const uint8_t *)at_key_string(key), at_key_length(key));
+		if (found != key) {
+			printf("keyword \"%s\" looks up as %d\n", at_key_string(key), found);
+			holds = false;
+		}
+	}
+
+	return holds;
+}
+
+static bool _op_cops(unsigned i) {
+	return sim7080g_cn_available(_modem);
+}
+
+static bool _op_send(unsigned i) {
+	size_t length = _frame_make(UPLINK_DATA, ++_seq, FRAME_RECORDS);
+	struct sim7080g_chunk_s chunk = { _frame, length };
+	return sim7080g_tcp_sendv(_modem, &chunk, 1);
+}
+
+static bool _op_ack(unsigned i) {
+	uint sent, unack;
+	return sim7080g_tcp_ack(_modem, &sent, &unack);
+}
+
+static uint32_t _push_bytes;  // Received and as sent
+static uint32_t _push_bad;    // Bytes not as sent, pushes failing their CRC
+static uint32_t _push_frames; // Whole ones that checked out
+static uint64_t _push_first_us;
+static uint64_t _push_done_us;
+
+static void _push_check(uint32_t offset, const uint8_t *data, uint32_t len) {
+	if (!_push_first_us) _push_first_us = time_us_64();
+
+	for (uint32_t i = 0; i < len; i++) {
+		if (data[i] == modem_sim_push_byte(offset + i))
+			_push_bytes++;
+		else
+			_push_bad++;
+	}
+}
+
+static void _push_sink(const struct gateway_recv_piece_s *piece, void *arg) {
+	_push_check(piece->seq + piece->offset, piece->data, piece->len);
+
+	if (piece->last && !piece->valid) _push_bad++;
+	if (piece->last && piece->valid) _push_frames++;
+}
+
+static bool _op_recv(unsigned i) {
+	uint8_t ack[UPLINK_HEADER_SIZE];
+	return sim7080g_tcp_recv(_modem, sizeof ack, ack) == sizeof ack;
+}
+
+static void _urc_count(sim7080g_context_t *context, const uint8_t *line, size_t line_len, void *arg) {
+	(*(unsigned *)arg)++;
+}
+
+static void _urc_none(sim7080g_context_t *context, const uint8_t *line, size_t line_len, void *arg) {
+}
+
+// One ack back per send, each announced by its own +CADATAIND. A
+// handler left over from the last round would count it twice.
+static bool _op_urc(unsigned i) {
+	unsigned fired = 0;
+	if (!sim7080g_urc_subscribe(_modem, "+CADATAIND", _urc_count, &fired))
+		return false;
+
+	_op_send(i);
+
+	absolute_time_t until = make_timeout_time_ms(2000);
+	while (!fired && !time_reached(until)) {
+		sleep_ms(10);
+		sim7080g_urc_poll(_modem);
+	}
+
+	uint8_t ack[UPLINK_HEADER_SIZE];
+	sim7080g_tcp_recv(_modem, sizeof ack, ack);
+	sim7080g_urc_unsubscribe(_modem, _urc_count);
+
+	return fired == 1;
+}
+
+// Subscriber table limit, and that unsubscribing takes every entry of a
+// handler out
+static bool _urc_table_check(void) {
+	unsigned taken = 0;
+	while (sim7080g_urc_subscribe(_modem, "+CADATAIND", _urc_none, NULL))
+		taken++;
+
+	sim7080g_urc_unsubscribe(_modem, _urc_none);
+	bool room = sim7080g_urc_subscribe(_modem, "+CADATAIND", _urc_none, NULL);
+	sim7080g_urc_unsubscribe(_modem, _urc_none);
+
+	return taken == MODEM_URC_HANDLERS_MAX && room;
+}
+
+static bool _op_psm_blocking(unsigned i) {
+	return sim7080g_psm_set(_modem, true, "00100010", "00000101")
+		&& sim7080g_edrx_set(_modem, true, "0101");
+}
+
+static bool _psm_queued_ok;
+static void _psm_queued_done(sim7080g_context_t *context, ResponseParser *rp, bool timed_out, void *arg) {
+	_psm_queued_ok = !timed_out && rp_contains_ok(rp);
+}
+
+static bool _op_psm_queued(unsigned i) {
+	CommandBuffer cb;
+
+	sim7080g_psm_command(&cb, true, "00100010", "00000101");
+	sim7080g_at_enqueue(_modem, &cb, AT_KEY_NONE, 1000 * 1000, NULL, NULL);
+	sim7080g_edrx_command(&cb, true, "0101");
+	sim7080g_at_enqueue(_modem, &cb, AT_KEY_NONE, 1000 * 1000, _psm_queued_done, NULL);
+
+	sim7080g_at_flush(_modem);
+	return _psm_queued_ok;
+}
+
+static void _op_run(const char *name, bool (*op)(unsigned i)) {
+	struct sim7080g_at_stats_s at;
+	unsigned failures = 0;
+
+	sim7080g_at_stats_reset(_modem);
+	uint64_t modem_start = time_us_64();
+	uint64_t host_start = _host_ns();
+
+	for (unsigned i = 0; i < OP_ROUNDS; i++)
+		if (!op(i)) failures++;
+
+	uint64_t host = _host_ns() - host_start;
+	uint64_t modem = time_us_64() - modem_start;
+	sim7080g_at_stats_get(_modem, &at);
+
+	printf("%-22s %9.0f %9.0f %8.2f %7.0f %8u\n",
+			name, (double)modem / OP_ROUNDS,
+			at.commands ? (double)at.total_us / at.commands : 0.0,
+			(double)at.commands / OP_ROUNDS, (double)host / OP_ROUNDS, failures);
+}
+
+static int _driver_run(void) {
+	if (!_keywords_check()) return 1;
+
+	_sim_start(&_base);
+
+	_modem = sim7080g_create();
+	sim7080g_init(_modem, GATEWAY_APN, GATEWAY_UART, GATEWAY_PIN_TX, GATEWAY_PIN_RX, GATEWAY_PIN_PWR);
+
+	uint64_t start = time_us_64();
+	sim7080g_toggle_power(_modem);
+	if (!sim7080g_start(_modem)) {
+		printf("modem never came up\n");
+		return 1;
+	}
+
+	uint64_t booted = time_us_64();
+	while (!sim7080g_cn_available(_modem))
+		sleep_ms(500);
+
+	if (!sim7080g_cn_activate(_modem, true)
+			|| !sim7080g_tcp_open(_modem, strlen(BENCH_HOST), BENCH_HOST, BENCH_PORT)) {
+		printf("no connection to the simulated server\n");
+		return 1;
+	}
+
+	printf("power key to AT %.1f ms, to TCP open %.1f ms\n",
+			(booted - start) / 1000.0, (time_us_64() - start) / 1000.0);
+
+	size_t length = _frame_make(UPLINK_HELLO, _epoch, 0);
+	struct sim7080g_chunk_s hello = { _frame, length };
+	sim7080g_tcp_sendv(_modem, &hello, 1);
+	sleep_ms(1000);
+	sim7080g_tcp_recv(_modem, UPLINK_HEADER_SIZE, _frame);
+
+	printf("%-22s %9s %9s %8s %7s %8s\n",
+			"operation", "modem us", "AT us", "AT/op", "host ns", "failures");
+
+	_op_run("COPS? round trip", _op_cops);
+	_op_run("CASEND 1440 B", _op_send);
+	_op_run("CAACK", _op_ack);
+
+	// Every ack is in by now, one CARECV each
+	sleep_ms(2000);
+	_op_run("CARECV 12 B", _op_recv);
+	_op_run("URC +CADATAIND", _op_urc);
+
+	if (!_urc_table_check()) {
+		printf("URC subscriber table not as MODEM_URC_HANDLERS_MAX says\n");
+		return 1;
+	}
+
+	_op_run("PSM+eDRX blocking", _op_psm_blocking);
+	_op_run("PSM+eDRX queued", _op_psm_queued);
+
+	if (_baud_fast) {
+		sim7080g_link_set(_modem, _baud_fast, MODEM_PIN_NONE, MODEM_PIN_NONE);
+
+		uint64_t negotiate_start = time_us_64();
+		uint baud = sim7080g_link_negotiate(_modem);
+		printf("negotiated %u baud in %.1f ms\n", baud, (time_us_64() - negotiate_start) / 1000.0);
+
+		_op_run("COPS? round trip", _op_cops);
+		_op_run("CASEND 1440 B", _op_send);
+	}
+
+	struct modem_sim_stats_s sim;
+	modem_sim_stats_get(&sim);
+	printf("server stored %u batches, %u records, %u bad frames\n\n",
+			sim.batches, sim.records, sim.bad_frames);
+
+	return 0;
+}
+
+// Gateway pump
+
+static int _scenario_run(const struct scenario_s *s) {
+	struct modem_sim_config_s config = _base;
+	if (s->link_bps) config.link_bps = s->link_bps;
+	if (s->rtt_ms) config.rtt_ms = s->rtt_ms;
+	if (s->error_permille) config.error_permille = s->error_permille;
+	if (s->loss_permille) config.loss_permille = s->loss_permille;
+
+	_sim_start(&config);
+	if (!gateway_init()) {
+		printf("%-22s gateway_init failed\n", s->name);
+		return 1;
+	}
+
+	gateway_endpoints_set(BENCH_HOST ":8086");
+	gateway_transport_set(s->udp ? GATEWAY_TRANSPORT_UDP : GATEWAY_TRANSPORT_TCP);
+	gateway_session_keep_set(s->session_keep);
+
+	uint64_t start = time_us_64();
+	uint64_t host_start = _host_ns();
+	uint64_t stored_at = 0;
+	absolute_time_t next_push = start;
+	unsigned pushed = 0;
+	struct modem_sim_stats_s sim;
+	struct gateway_drop_stats_s drops;
+
+	for (;;) {
+		while (pushed < s->records && time_reached(next_push)) {
+			uint8_t record[RECORD_SIZE];
+			_record_make(record, pushed++);
+			gateway_queue_push(record, sizeof record);
+			next_push = delayed_by_ms(next_push, s->interval_ms);
+		}
+
+		int state = gateway_pump();
+
+		// Whatever the overflow policy let through
+		modem_sim_stats_get(&sim);
+		gateway_drop_stats_get(&drops);
+		if (!stored_at && pushed == s->records && sim.records >= pushed - drops.records_dropped)
+			stored_at = time_us_64();
+
+		// Stored and the modem switched off or parked
+		bool settled = state == MODEM_POWERED_DOWN || state == MODEM_IDLE;
+		if (stored_at && settled && pushed == s->records) break;
+
+		absolute_time_t wake = gateway_next_service();
+		if (pushed < s->records && next_push < wake) wake = next_push;
+
+		if (wake > start + SCENARIO_LIMIT_US) break;
+		sleep_until(wake);
+	}
+
+	uint64_t host = _host_ns() - host_start;
+	uint64_t total = time_us_64() - start;
+
+	struct gateway_upload_stats_s upload;
+	struct gateway_metrics_s metrics;
+	gateway_upload_stats_get(&upload);
+	gateway_metrics_get(&metrics);
+
+	// Radio on time, everything but switched off and parked
+	uint64_t on_us = metrics.uptime_us
+		- metrics.states[MODEM_POWERED_DOWN].dwell_us
+		- metrics.states[MODEM_IDLE].dwell_us;
+
+	printf("%-22s %4u/%-4u %5u %8.1f %8.1f %8.1f %6u %6u %6u %5u %5u %8.1f\n",
+			s->name, sim.records, s->records, drops.records_dropped,
+			stored_at ? (stored_at - start) / 1e6 : -1.0, total / 1e6, on_us / 1e6,
+			upload.goodput_bps, metrics.at_commands, metrics.at_mean_us,
+			upload.resends, sim.errors_injected, host / 1e6);
+
+	// Otherwise the scenario is the clean one under another name
+	if (config.error_permille && !sim.errors_injected) return 1;
+
+	// Everything not dropped is stored once. Only a batch dropped after
+	// it went out may have been stored as well, its ack lost.
+	unsigned expected = s->records - drops.records_dropped;
+	if (sim.records < expected || sim.records - expected > drops.records_dropped_sent) return 1;
+
+	return 0;
+}
+
+static int _push_run(const struct push_s *p) {
+	struct modem_sim_config_s config = _base;
+	config.push_bytes = p->bytes;
+
+	_sim_start(&config);
+	if (!gateway_init()) {
+		printf("%-22s gateway_init failed\n", p->name);
+		return 1;
+	}
+
+	gateway_endpoints_set(BENCH_HOST ":8086");
+	gateway_transport_set(p->udp ? GATEWAY_TRANSPORT_UDP : GATEWAY_TRANSPORT_TCP);
+	if (!p->buffer) gateway_recv_sink_set(_push_sink, NULL);
+
+	uint8_t record[RECORD_SIZE];
+	_record_make(record, 0);
+	gateway_queue_push(record, sizeof record);
+
+	static uint8_t buffer[1024 * 4];
+	uint64_t start = time_us_64();
+	uint64_t host_start = _host_ns();
+
+	for (;;) {
+		if (p->buffer) {
+			int len = gateway_recv(buffer, sizeof buffer);
+			if (len > 0) {
+				_push_check(0, buffer, len);
+				_push_frames++;
+			}
+		}
+
+		if (!_push_done_us && _push_bytes + _push_bad >= p->bytes)
+			_push_done_us = time_us_64();
+
+		int state = gateway_pump();
+		bool settled = state == MODEM_POWERED_DOWN || state == MODEM_IDLE;
+		if (_push_done_us && settled) break;
+
+		absolute_time_t wake = gateway_next_service();
+		if (p->buffer && wake > delayed_by_ms(time_us_64(), 100))
+			wake = delayed_by_ms(time_us_64(), 100);
+
+		if (wake > start + SCENARIO_LIMIT_US) break;
+		sleep_until(wake);
+	}
+
+	uint64_t host = _host_ns() - host_start;
+
+	struct gateway_upload_stats_s upload;
+	struct gateway_metrics_s metrics;
+	struct modem_sim_stats_s sim;
+	gateway_upload_stats_get(&upload);
+	gateway_metrics_get(&metrics);
+	modem_sim_stats_get(&sim);
+
+	double push_s = _push_done_us ? (_push_done_us - _push_first_us) / 1e6 : -1.0;
+	printf("%-22s %6u/%-6u %3u/%-3u %8.1f %8.1f %6.0f %6u %5u %8.1f\n",
+			p->name, _push_bytes, p->bytes, _push_frames, sim.pushes,
+			_push_done_us ? (_push_done_us - start) / 1e6 : -1.0, push_s,
+			push_s > 0 ? _push_bytes / push_s : 0.0, metrics.at_commands,
+			upload.push_drops, host / 1e6);
+
+	return _push_bytes == p->bytes && _push_bad == 0 && _push_frames == sim.pushes ? 0 : 1;
+}
+
+// Runs [run] on its own copy of everything
+static int _isolated(int (*run)(const void *arg), const void *arg) {
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid < 0) return 1;
+	if (pid == 0) exit(run(arg));
+
+	int status;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static int _driver_entry(const void *arg) {
+	return _driver_run();
+}
+
+static int _scenario_entry(const void *arg) {
+	return _scenario_run(arg);
+}
+
+static int _push_entry(const void *arg) {
+	return _push_run(arg);
+}
+
+static bool _picked(int argc, char **argv, size_t number) {
+	if (optind == argc) return true;
+
+	for (int a = optind; a < argc; a++)
+		if (strtoul(argv[a], NULL, 0) == number) return true;
+
+	return false;
+}
+
+static void _usage(const char *name) {
+	fprintf(stderr,
+			"usage: %s [-d at_delay_us] [-r rtt_ms] [-b link_bps] [-u baud]\n"
+			"          [-e error_permille] [-l loss_permille] [-s seed]\n"
+			"          [-f fast_baud] [-m max_baud] [scenario...]\n"
+			"Applies to every run. Scenarios are picked by number, all by default.\n"
+			"The driver run negotiates fast_baud (921600, 0 not to), the wiring\n"
+			"holds up to max_baud (0 for any).\n",
+			name);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	modem_sim_config_default(&_base);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:r:b:u:e:l:s:f:m:h")) != -1) {
+		unsigned long value = strtoul(optarg ? optarg : "0", NULL, 0);
+		switch (opt) {
+		case 'd': _base.at_delay_us = value; break;
+		case 'r': _base.rtt_ms = value; break;
+		case 'b': _base.link_bps = value; break;
+		case 'u': _base.baud = value; break;
+		case 'e': _base.error_permille = value; break;
+		case 'l': _base.loss_permille = value; break;
+		case 's': _base.seed = value; break;
+		case 'f': _baud_fast = value; break;
+		case 'm': _base.baud_max = value; break;
+		default: _usage(argv[0]);
+		}
+	}
+
+	if (_base.baud == 0 || _base.link_bps == 0) _usage(argv[0]);
+
+	printf("modem: %u baud, %u us per command, %u ms rtt, %u bps, %u/1000 errors, %u/1000 lost\n\n",
+			_base.baud, _base.at_delay_us, _base.rtt_ms, _base.link_bps,
+			_base.error_permille, _base.loss_permille);
+
+	bool ok = true;
+	if (optind == argc)
+		ok &= _isolated(_driver_entry, NULL) == 0;
+
+	printf("%-22s %9s %5s %8s %8s %8s %6s %6s %6s %5s %5s %8s\n",
+			"gateway scenario", "stored", "drop", "drain s", "total s", "radio s",
+			"B/s", "AT", "AT us", "resnd", "errs", "host ms");
+
+	for (size_t i = 0; i < SCENARIOS_NUM; i++) {
+		if (_picked(argc, argv, i) && _isolated(_scenario_entry, &_scenarios[i]) != 0) {
+			printf("%-22s FAILED\n", _scenarios[i].name);
+			ok = false;
+		}
+	}
+
+	printf("\n%-22s %13s %7s %8s %8s %6s %6s %5s %8s\n",
+			"push scenario", "received", "frames", "done s", "push s",
+			"B/s", "AT", "drops", "host ms");
+
+	// Numbered on from the gateway scenarios
+	for (size_t i = 0; i < PUSHES_NUM; i++) {
+		if (_picked(argc, argv, SCENARIOS_NUM + i) && _isolated(_push_entry, &_pushes[i]) != 0) {
+			printf("%-22s FAILED\n", _pushes[i].name);
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,500 @@
+// uplink_server.c
+// Reference server for the gateway uplink protocol (gateway_uplink.h).
+// Accepts gateway connections, stores every DATA batch exactly once and
+// acks it only after it is on disk. Batches are appended to the output
+// file as the length framed records they carry, packed batches
+// (gateway_uplink_pack.h) decoded first.
+//
+// -k N drops each connection after N DATA frames without acking the
+// last one, to exercise resend and dedupe on the gateway side.
+//
+// -e LIST sends every gateway a new server list after its HELLO (see
+// gateway_endpoints_set for the format).
+//
+// -f FILE pushes the file to every gateway after its HELLO, in PUSH
+// frames whose seq is where their piece starts in the file. Each is at
+// most PUSH_FRAME_MAX bytes, one modem read's worth over UDP.
+//
+// Gateways using GATEWAY_TRANSPORT_UDP are served on the same port over
+// UDP, one frame per datagram, tracked by sender address. -k drops
+// the sender's state instead of a connection.
+
+//	Copyright (C) 2024
+//	Evan Morse
+//	Amelia Vlahogiannis
+//	Noelle Steil
+//	Jordan Allen
+//	Sam Cowan
+//	Rachel Cleminson
+
+//	This program is free software: you can redistribute it and/or modify
+//	it under the terms of the GNU General Public License as published by
+//	the Free Software Foundation, either version 3 of the License, or
+//	(at your option) any later version.
+
+//	This program is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//	GNU General Public License for more details.
+
+//	You should have received a copy of the GNU General Public License
+//	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gateway_uplink.h"
+#include "gateway_uplink_pack.h"
+
+#define SERVER_PORT_DEFAULT 8086
+#define CLIENTS_MAX 16
+#define EPOCHS_MAX 64
+#define UNPACKED_MAX (1024 * 1024)
+#define PUSH_FRAME_MAX (1024 * 16)
+#define PUSH_DATAGRAM_MAX (1460 - UPLINK_HEADER_SIZE) // MODEM_TCP_RECV_MAX
+
+struct client_s {
+	int fd;
+	bool udp; // Replies go to [addr] through fd
+	struct sockaddr_in addr;
+	bool has_epoch;
+	uint32_t epoch;
+	uint32_t frames; // DATA frames seen on this connection
+
+	// Current frame, header first then payload
+	struct uplink_reader_s reader;
+	struct uplink_header_s header;
+	bool in_payload;
+	uint8_t payload[UINT16_MAX];
+	uint32_t payload_len;
+};
+
+// Highest stored batch per gateway boot. Lives as long as the server.
+struct epoch_s {
+	uint32_t epoch;
+	uint32_t stored;
+};
+
+static struct client_s _clients[CLIENTS_MAX];
+static struct client_s _peers[CLIENTS_MAX]; // UDP senders
+static int _peer_next = 0; // Next to make way when all are taken
+static struct epoch_s _epochs[EPOCHS_MAX];
+static int _epoch_count = 0;
+
+static uint8_t _unpacked[UNPACKED_MAX];
+
+static int _out_fd = -1;
+static uint32_t _kill_after = 0;
+static const char *_endpoints = NULL;
+static uint8_t *_push = NULL;
+static size_t _push_len = 0;
+
+static struct epoch_s *_epoch_get(uint32_t epoch);
+static bool _client_read(struct client_s *client);
+static void _udp_read(int fd);
+static bool _client_send(struct client_s *client, const struct uplink_header_s *header, const void *payload);
+static bool _frame_handle(struct client_s *client);
+static bool _ack_send(struct client_s *client, uint32_t seq);
+static bool _gap_send(struct client_s *client, uint32_t seq);
+static bool _endpoints_send(struct client_s *client);
+static bool _push_send(struct client_s *client);
+static bool _push_load(const char *path);
+static void _client_close(struct client_s *client);
+
+static void _usage(const char *name) {
+	printf("usage: %s [-p port] [-o file] [-k frames] [-e endpoints] [-f push_file]\n", name);
+}
+
+int main(int argc, char **argv) {
+	int port = SERVER_PORT_DEFAULT;
+	const char *out_path = "uplink.dat";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:o:k:e:f:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'k':
+			_kill_after = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			_endpoints = optarg;
+			break;
+		case 'f':
+			if (!_push_load(optarg)) return 1;
+			break;
+		default:
+			_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	_out_fd = open(out_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (_out_fd == -1) {
+		perror("open");
+		return 1;
+	}
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+
+	if (bind(listener, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(listener, 4) == -1) {
+		perror("listen");
+		return 1;
+	}
+
+	int udp = socket(AF_INET, SOCK_DGRAM, 0);
+	if (bind(udp, (struct sockaddr *)&addr, sizeof addr) == -1) {
+		perror("bind udp");
+		return 1;
+	}
+
+	for (int i = 0; i < CLIENTS_MAX; i++) {
+		_clients[i].fd = -1;
+		_peers[i].fd = -1;
+	}
+
+	printf("uplink server: tcp/udp port %d, storing to %s\n", port, out_path);
+	fflush(stdout);
+
+	for (;;) {
+		struct pollfd fds[CLIENTS_MAX + 2];
+		fds[0] = (struct pollfd) { .fd = listener, .events = POLLIN };
+		for (int i = 0; i < CLIENTS_MAX; i++)
+			fds[i + 1] = (struct pollfd) { .fd = _clients[i].fd, .events = POLLIN };
+		fds[CLIENTS_MAX + 1] = (struct pollfd) { .fd = udp, .events = POLLIN };
+
+		if (poll(fds, CLIENTS_MAX + 2, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			return 1;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listener, NULL, NULL);
+
+			struct client_s *client = NULL;
+			for (int i = 0; i < CLIENTS_MAX && client == NULL; i++)
+				if (_clients[i].fd == -1) client = &_clients[i];
+
+			if (client == NULL) {
+				close(fd);
+			} else {
+				memset(client, 0, sizeof *client);
+				client->fd = fd;
+				printf("connect: fd %d\n", fd);
+			}
+		}
+
+		for (int i = 0; i < CLIENTS_MAX; i++) {
+			if (_clients[i].fd == -1 || !(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			if (!_client_read(&_clients[i]))
+				_client_close(&_clients[i]);
+		}
+
+		if (fds[CLIENTS_MAX + 1].revents & POLLIN)
+			_udp_read(udp);
+
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+static struct epoch_s *_epoch_get(uint32_t epoch) {
+	for (int i = 0; i < _epoch_count; i++)
+		if (_epochs[i].epoch == epoch) return &_epochs[i];
+
+	// Oldest boot makes way
+	if (_epoch_count == EPOCHS_MAX) {
+		memmove(&_epochs[0], &_epochs[1], (EPOCHS_MAX - 1) * sizeof (struct epoch_s));
+		_epoch_count--;
+	}
+
+	_epochs[_epoch_count] = (struct epoch_s) { .epoch = epoch, .stored = 0 };
+	return &_epochs[_epoch_count++];
+}
+
+static bool _client_read(struct client_s *client) {
+	uint8_t buffer[4096];
+
+	ssize_t received = read(client->fd, buffer, sizeof buffer);
+	if (received <= 0) return false;
+
+	size_t offset = 0;
+	while (offset < (size_t)received) {
+		if (!client->in_payload) {
+			bool complete;
+			offset += uplink_reader_feed(&client->reader, &buffer[offset],
+					received - offset, &client->header, &complete);
+
+			if (!complete) continue;
+
+			client->in_payload = true;
+			client->payload_len = 0;
+		}
+
+		size_t want = client->header.length - client->payload_len;
+		size_t have = received - offset;
+		size_t take = want < have ? want : have;
+
+		memcpy(&client->payload[client->payload_len], &buffer[offset], take);
+		client->payload_len += take;
+		offset += take;
+
+		if (client->payload_len < client->header.length) continue;
+
+		client->in_payload = false;
+		if (!_frame_handle(client)) return false;
+	}
+
+	return true;
+}
+
+// One datagram, one frame
+static void _udp_read(int fd) {
+	uint8_t buffer[UPLINK_HEADER_SIZE + UINT16_MAX];
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof addr;
+
+	ssize_t received = recvfrom(fd, buffer, sizeof buffer, 0, (struct sockaddr *)&addr, &addr_len);
+	if (received < UPLINK_HEADER_SIZE) return;
+
+	struct client_s *peer = NULL;
+	for (int i = 0; i < CLIENTS_MAX && peer == NULL; i++) {
+		if (_peers[i].fd != -1 && _peers[i].addr.sin_addr.s_addr == addr.sin_addr.s_addr
+				&& _peers[i].addr.sin_port == addr.sin_port)
+			peer = &_peers[i];
+	}
+
+	if (peer == NULL) {
+		peer = &_peers[_peer_next];
+		_peer_next = (_peer_next + 1) % CLIENTS_MAX;
+
+		memset(peer, 0, sizeof *peer);
+		peer->fd = fd;
+		peer->udp = true;
+		peer->addr = addr;
+		printf("udp peer: %s:%u\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	}
+
+	if (!uplink_header_unpack(buffer, &peer->header)
+			|| peer->header.length != received - UPLINK_HEADER_SIZE) {
+		printf("udp: bad datagram of %zd bytes\n", received);
+		return;
+	}
+
+	memcpy(peer->payload, &buffer[UPLINK_HEADER_SIZE], peer->header.length);
+	peer->payload_len = peer->header.length;
+
+	// Nothing to close, forget the sender so it has to say hello again
+	if (!_frame_handle(peer))
+		peer->has_epoch = false;
+}
+
+static bool _frame_handle(struct client_s *client) {
+	struct uplink_header_s *header = &client->header;
+	struct epoch_s *epoch;
+	uint16_t crc;
+	const uint8_t *records;
+	size_t records_len;
+	unsigned count;
+	int unpacked;
+
+	switch (header->type) {
+	case UPLINK_HELLO:
+		client->has_epoch = true;
+		client->epoch = header->seq;
+
+		epoch = _epoch_get(client->epoch);
+		printf("hello: epoch %08x, stored up to %u\n", epoch->epoch, epoch->stored);
+
+		// Lets the gateway skip resending what we already have
+		if (!_ack_send(client, epoch->stored)) return false;
+
+		if (_endpoints && !_endpoints_send(client)) return false;
+
+		return _push == NULL || _push_send(client);
+
+	case UPLINK_DATA:
+	case UPLINK_DATA_PACKED:
+		if (!client->has_epoch) {
+			printf("data before hello, dropping connection\n");
+			return false;
+		}
+
+		crc = uplink_crc16(UPLINK_CRC_INIT, client->payload, client->payload_len);
+		if (crc != header->crc) {
+			// Gateway will resend it on the next connection
+			printf("crc mismatch on seq %u, dropping connection\n", header->seq);
+			return false;
+		}
+
+		client->frames++;
+		if (_kill_after && client->frames % _kill_after == 0) {
+			printf("seq %u: dropping connection without ack (-k)\n", header->seq);
+			return false;
+		}
+
+		epoch = _epoch_get(client->epoch);
+
+		if (!uplink_seq_after(header->seq, epoch->stored)) {
+			printf("seq %u: duplicate\n", header->seq);
+			return _ack_send(client, epoch->stored);
+		}
+
+		// A datagram past a lost one waits for the resend, storing it
+		// would ack the lost one too
+		if (client->udp && header->seq != epoch->stored + 1) {
+			printf("seq %u: waiting for %u\n", header->seq, epoch->stored + 1);
+			return _gap_send(client, epoch->stored + 1);
+		}
+
+		if (header->seq != epoch->stored + 1)
+			printf("seq %u: gap after %u, gateway dropped data\n", header->seq, epoch->stored);
+
+		records = client->payload;
+		records_len = client->payload_len;
+
+		if (header->type == UPLINK_DATA_PACKED) {
+			unpacked = uplink_pack_decode(client->payload, client->payload_len,
+					_unpacked, sizeof _unpacked, &count);
+			if (unpacked < 0) {
+				// Passed the crc, so resending won't help either
+				printf("seq %u: can't unpack, dropping connection\n", header->seq);
+				return false;
+			}
+
+			records = _unpacked;
+			records_len = unpacked;
+			printf("seq %u: unpacked %u records, %u -> %zu bytes\n",
+					header->seq, count, client->payload_len, records_len);
+		}
+
+		// Only ack what is on disk
+		if (write(_out_fd, records, records_len) != (ssize_t)records_len
+				|| fsync(_out_fd) == -1) {
+			perror("store");
+			return false;
+		}
+
+		epoch->stored = header->seq;
+		printf("seq %u: stored %zu bytes\n", header->seq, records_len);
+
+		return _ack_send(client, epoch->stored);
+
+	default:
+		printf("unknown frame type %u\n", header->type);
+		return true;
+	}
+}
+
+static bool _ack_send(struct client_s *client, uint32_t seq) {
+	return _client_send(client, &(struct uplink_header_s) {
+		.type = UPLINK_ACK,
+		.seq = seq,
+	}, NULL);
+}
+
+static bool _gap_send(struct client_s *client, uint32_t seq) {
+	return _client_send(client, &(struct uplink_header_s) {
+		.type = UPLINK_GAP,
+		.seq = seq,
+	}, NULL);
+}
+
+static bool _endpoints_send(struct client_s *client) {
+	size_t len = strlen(_endpoints);
+
+	printf("endpoints: %s\n", _endpoints);
+
+	return _client_send(client, &(struct uplink_header_s) {
+		.type = UPLINK_ENDPOINTS,
+		.length = len,
+		.crc = uplink_crc16(UPLINK_CRC_INIT, _endpoints, len),
+	}, _endpoints);
+}
+
+static bool _push_send(struct client_s *client) {
+	size_t frame_max = client->udp ? PUSH_DATAGRAM_MAX : PUSH_FRAME_MAX;
+
+	printf("push: %zu bytes\n", _push_len);
+
+	for (size_t offset = 0; offset < _push_len; offset += frame_max) {
+		size_t len = _push_len - offset;
+		if (len > frame_max) len = frame_max;
+
+		bool sent = _client_send(client, &(struct uplink_header_s) {
+			.type = UPLINK_PUSH,
+			.seq = offset,
+			.length = len,
+			.crc = uplink_crc16(UPLINK_CRC_INIT, &_push[offset], len),
+		}, &_push[offset]);
+		if (!sent) return false;
+	}
+
+	return true;
+}
+
+static bool _push_load(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		perror("push file");
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	rewind(file);
+
+	_push = malloc(len > 0 ? len : 1);
+	_push_len = len > 0 ? fread(_push, 1, len, file) : 0;
+	fclose(file);
+
+	return true;
+}
+
+// Sends a frame in one write, or one datagram
+static bool _client_send(struct client_s *client, const struct uplink_header_s *header, const void *payload) {
+	uint8_t frame[UPLINK_HEADER_SIZE + UINT16_MAX];
+	size_t len = UPLINK_HEADER_SIZE + header->length;
+
+	uplink_header_pack(frame, header);
+	if (header->length)
+		memcpy(&frame[UPLINK_HEADER_SIZE], payload, header->length);
+
+	if (client->udp)
+		return sendto(client->fd, frame, len, 0,
+				(struct sockaddr *)&client->addr, sizeof client->addr) == (ssize_t)len;
+
+	return write(client->fd, frame, len) == (ssize_t)len;
+}
+
+static void _client_close(struct client_s *client) {
+	printf("disconnect: fd %d\n", client->fd);
+	close(client->fd);
+	client->fd = -1;
+}